@@ -0,0 +1,243 @@
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <filesystem>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "../src/archive/archive.hpp"
+
+// total size of each generated corpus in megabytes, if not set by the first argument
+#define CORPUS_SIZE_MB_DEFAULT 64
+// average size of files in the corpus of small files
+#define SMALL_FILE_SIZE (16 * 1024)
+#define HUGE_FILES_COUNT 2
+// read buffers are offset by these amounts from a page aligned address
+#define PAGE_SIZE 4096
+
+static const std::vector<size_t> block_sizes { 4 * 1024, 10240, 64 * 1024, 256 * 1024, 1024 * 1024 };
+static const std::vector<size_t> buffer_offsets { 0, 16, 512 };
+
+struct corpus_t {
+    std::string name;
+    std::filesystem::path directory;
+    std::vector<std::string> files;
+    unsigned long long size;
+};
+
+// text-like data with a compression ratio close to logs and documents
+static void generate_file(const std::filesystem::path &path, unsigned long long size, std::mt19937 &rng) {
+    std::uniform_int_distribution<int> word_dist(0, 999);
+    std::ofstream file(path, std::ios::binary);
+    unsigned long long written = 0;
+    std::string line;
+    while (written < size) {
+        line = "entry " + std::to_string(written) + " value " + std::to_string(word_dist(rng)) + " status " + std::to_string(word_dist(rng) % 7) + "\n";
+        file << line;
+        written += line.size();
+    }
+}
+
+static corpus_t generate_corpus(const std::string &name, const std::filesystem::path &directory, unsigned long long size, unsigned long long files_count) {
+    std::mt19937 rng(42);
+    corpus_t corpus { name, directory, {}, 0 };
+    std::filesystem::create_directories(directory);
+    for (unsigned long long i = 0; i < files_count; i++) {
+        const auto file_name = "file_" + std::to_string(i) + ".txt";
+        generate_file(directory / file_name, size / files_count, rng);
+        corpus.files.push_back(file_name);
+        corpus.size += std::filesystem::file_size(directory / file_name);
+    }
+    return corpus;
+}
+
+// format - libarchive format code, i.e. ARCHIVE_FORMAT_ZIP or ARCHIVE_FORMAT_7ZIP which is solid by default
+static bool write_archive(const corpus_t &corpus, const std::filesystem::path &dest_path, int format) {
+    auto *arch = archive_write_new();
+    archive_write_set_format(arch, format);
+    if (archive_write_open_filename(arch, dest_path.string().c_str()) != ARCHIVE_OK) {
+        fprintf(stderr, "Could not create \"%s\": %s\n", dest_path.string().c_str(), archive_error_string(arch));
+        archive_write_free(arch);
+        return false;
+    }
+    std::vector<char> buff(1024 * 1024);
+    for (const auto &file_name : corpus.files) {
+        const auto source_path = corpus.directory / file_name;
+        auto *entry = archive_entry_new();
+        archive_entry_set_pathname(entry, file_name.c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, std::filesystem::file_size(source_path));
+        archive_write_header(arch, entry);
+        archive_entry_free(entry);
+        std::ifstream file(source_path, std::ios::binary);
+        while (file) {
+            file.read(buff.data(), buff.size());
+            if (file.gcount() > 0) {
+                archive_write_data(arch, buff.data(), (size_t) file.gcount());
+            }
+        }
+    }
+    archive_write_close(arch);
+    archive_write_free(arch);
+    return true;
+}
+
+static double measure(std::function<bool()> operation) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!operation()) {
+        return -1;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void print_result(const std::string &name, size_t block_size, double seconds, unsigned long long size) {
+    if (seconds < 0) {
+        fprintf(stdout, "%-32s %8zu  failed\n", name.c_str(), block_size);
+        return;
+    }
+    fprintf(stdout, "%-32s %8zu  %8.3f s  %9.1f MB/s\n", name.c_str(), block_size, seconds, size / 1024.0 / 1024.0 / seconds);
+}
+
+static unsigned long long extracted_size(const std::vector<file_unpack_info_t> &files) {
+    unsigned long long size = 0;
+    for (const auto &f : files) {
+        std::error_code ec;
+        const auto file_size = std::filesystem::file_size(f.name, ec);
+        size += ec ? 0 : file_size;
+    }
+    return size;
+}
+
+static void bench_extract(const std::filesystem::path &archive_path, const std::filesystem::path &output_directory) {
+    for (const auto block_size : block_sizes) {
+        set_archive_block_size(block_size);
+        std::filesystem::remove_all(output_directory);
+        unsigned long long size = 0;
+        const auto seconds = measure([&]() {
+            const auto ret = unpack_file(archive_path, output_directory);
+            if (std::holds_alternative<std::string>(ret)) {
+                return false;
+            }
+            size = extracted_size(std::get<std::vector<file_unpack_info_t>>(ret));
+            return true;
+        });
+        print_result("extract " + archive_path.filename().string(), block_size, seconds, size);
+    }
+    std::filesystem::remove_all(output_directory);
+}
+
+// reads archive files without writing them to disk, as with --extract-streaming
+static void bench_stream(const std::filesystem::path &archive_path) {
+    std::vector<char> buff(1024 * 1024);
+    for (const auto block_size : block_sizes) {
+        set_archive_block_size(block_size);
+        unsigned long long size = 0;
+        const auto seconds = measure([&]() {
+            ArchiveEntryStreamBuf entry_buffer(archive_path);
+            std::istream entry_stream(&entry_buffer);
+            while (true) {
+                const auto next = entry_buffer.next_entry();
+                if (std::holds_alternative<std::string>(next)) {
+                    return false;
+                }
+                if (!std::get<std::optional<archive_entry_info_t>>(next).has_value()) {
+                    return true;
+                }
+                while (entry_stream.read(buff.data(), buff.size()) || entry_stream.gcount() > 0) {
+                    size += entry_stream.gcount();
+                }
+                entry_stream.clear();
+            }
+        });
+        print_result("stream " + archive_path.filename().string(), block_size, seconds, size);
+    }
+}
+
+static void bench_zip(const corpus_t &corpus, const std::filesystem::path &output_directory) {
+    std::filesystem::create_directories(output_directory);
+    for (const auto block_size : block_sizes) {
+        set_archive_block_size(block_size);
+        const auto seconds = measure([&]() {
+            for (const auto &file_name : corpus.files) {
+                if (zip_file(corpus.directory / file_name, output_directory / (file_name + ".zip")).has_value()) {
+                    return false;
+                }
+            }
+            return true;
+        });
+        print_result("zip " + corpus.name, block_size, seconds, corpus.size);
+    }
+    std::filesystem::remove_all(output_directory);
+}
+
+// plain sequential reads, so that storage throughput could be compared with archive processing
+static void bench_read(const corpus_t &corpus) {
+    for (const auto block_size : block_sizes) {
+        for (const auto offset : buffer_offsets) {
+            std::vector<char> storage(block_size + 2 * PAGE_SIZE);
+            const auto aligned = (reinterpret_cast<uintptr_t>(storage.data()) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+            auto *buff = reinterpret_cast<char *>(aligned) + offset;
+            const auto seconds = measure([&]() {
+                for (const auto &file_name : corpus.files) {
+                    // unbuffered stream reads directly to the buffer
+                    std::ifstream file;
+                    file.rdbuf()->pubsetbuf(nullptr, 0);
+                    file.open(corpus.directory / file_name, std::ios::binary);
+                    while (file.read(buff, block_size) || file.gcount() > 0) {
+                    }
+                }
+                return true;
+            });
+            print_result("read " + corpus.name + " offset " + std::to_string(offset), block_size, seconds, corpus.size);
+        }
+    }
+}
+
+// measures extraction, streaming and zipping of generated corpora with different block sizes
+// usage: torrent-s3-bench-archive-io [corpus size in MB] [directory] [archive...]
+// directory - where corpora are generated, system temporary directory if not set. Use the storage to be measured
+// archive - additional archives to extract, i.e. rar5 archives which could not be generated
+int main(int argc, char **argv) {
+    const auto size_mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : CORPUS_SIZE_MB_DEFAULT;
+    const auto root = argc > 2 ? std::filesystem::path(argv[2]) : std::filesystem::temp_directory_path();
+    const auto directory = root / "torrent-s3-bench-archive-io";
+    const auto size = size_mb * 1024 * 1024;
+    std::filesystem::remove_all(directory);
+
+    fprintf(stdout, "Generating %llu MB corpora in %s\n", size_mb, directory.string().c_str());
+    const auto small_corpus = generate_corpus("small files", directory / "small", size, std::max(size / SMALL_FILE_SIZE, 1ULL));
+    const auto huge_corpus = generate_corpus("huge files", directory / "huge", size, HUGE_FILES_COUNT);
+    std::vector<std::filesystem::path> archives;
+    const std::vector<std::pair<std::filesystem::path, std::pair<const corpus_t *, int>>> generated {
+        { directory / "small.zip", { &small_corpus, ARCHIVE_FORMAT_ZIP } },
+        { directory / "huge.zip", { &huge_corpus, ARCHIVE_FORMAT_ZIP } },
+        { directory / "small_solid.7z", { &small_corpus, ARCHIVE_FORMAT_7ZIP } },
+    };
+    for (const auto &[path, source] : generated) {
+        if (write_archive(*source.first, path, source.second)) {
+            archives.push_back(path);
+        }
+    }
+    for (int i = 3; i < argc; i++) {
+        archives.push_back(argv[i]);
+    }
+
+    fprintf(stdout, "%-32s %8s  %10s  %14s\n", "operation", "block", "time", "throughput");
+    bench_read(small_corpus);
+    bench_read(huge_corpus);
+    for (const auto &archive_path : archives) {
+        bench_extract(archive_path, directory / "extracted");
+        bench_stream(archive_path);
+    }
+    bench_zip(small_corpus, directory / "zipped");
+    bench_zip(huge_corpus, directory / "zipped");
+    std::filesystem::remove_all(directory);
+    return EXIT_SUCCESS;
+}
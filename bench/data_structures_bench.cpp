@@ -0,0 +1,298 @@
+#include <map>
+#include <mutex>
+#include <thread>
+#include <filesystem>
+
+#include <benchmark/benchmark.h>
+
+#include "../src/hashlist/hashlist.hpp"
+#include "../src/downloading_files/downloading_files.hpp"
+#include "../src/linked_files/linked_files.hpp"
+#include "../src/app_state/state.hpp"
+#include "../src/db/sqlite.hpp"
+#include "../src/deque/deque.hpp"
+#include "../src/synthetic_torrent/synthetic_torrent.hpp"
+#include "../src/torrent_metadata/torrent_metadata.hpp"
+
+#define STRING(x) #x
+#define XSTRING(x) STRING(x)
+#define SOURCE_DIR XSTRING(CMAKE_SOURCE_DIR)
+
+// number of files in synthetic torrents, the range shows how the hot paths scale
+#define SCALED_FILES_MIN 256
+#define SCALED_FILES_MAX 4096
+#define SCALED_FILES_PER_DIRECTORY 64
+#define SCALED_FILE_SIZE_MAX (4 * 1024 * 1024)
+#define SCALED_PIECE_SIZE (256 * 1024)
+// DownloadingFiles is given a fraction of the torrent size, so that it is downloaded in several chunks
+#define DOWNLOAD_CHUNKS 16
+// LinkedFiles parents are archives with this number of extracted files
+#define LINKED_FILES_PER_PARENT 16
+#define DEQUE_ITEMS 100000
+
+// runs a benchmark on the starwars.torrent asset and on synthetic torrents of growing size
+#define TORRENT_BENCHMARK(func) \
+    BENCHMARK_CAPTURE(func, starwars, true); \
+    BENCHMARK_CAPTURE(func, scaled, false)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX)->Complexity()
+
+// torrents are cached, so that generation is not measured and repetitions use the same torrent
+static std::shared_ptr<const TorrentMetadata> get_torrent(const benchmark::State &state, bool is_asset) {
+    static std::mutex mutex;
+    static std::map<int, std::shared_ptr<const TorrentMetadata>> torrents;
+    const auto file_count = is_asset ? 0 : (int) state.range(0);
+    std::unique_lock<std::mutex> lock{ mutex };
+    auto &torrent = torrents[file_count];
+    if (torrent == nullptr) {
+        if (is_asset) {
+            const auto path = std::filesystem::path(SOURCE_DIR) / "test" / "assets" / "starwars.torrent";
+            torrent = std::make_shared<const TorrentMetadata>(std::make_shared<const lt::torrent_info>(path.string()));
+        } else {
+            synthetic_torrent_options_t options;
+            options.file_count = file_count;
+            options.depth = 1;
+            options.fanout = SCALED_FILES_PER_DIRECTORY;
+            options.size_distribution = FILE_SIZE_UNIFORM;
+            options.min_file_size = 1;
+            options.max_file_size = SCALED_FILE_SIZE_MAX;
+            options.piece_size = SCALED_PIECE_SIZE;
+            options.seed = file_count;
+            torrent = std::make_shared<const TorrentMetadata>(std::get<std::shared_ptr<lt::torrent_info>>(create_synthetic_torrent(options)));
+        }
+    }
+    return torrent;
+}
+
+static std::vector<std::string> get_file_names(const TorrentMetadata &torrent) {
+    std::vector<std::string> file_names;
+    for (unsigned int file_index = 0; file_index < torrent.num_files(); file_index++) {
+        file_names.push_back(torrent.file_path(file_index));
+    }
+    return file_names;
+}
+
+// file table is built once per run, when the torrent is loaded
+static void bm_torrent_metadata(benchmark::State &state, bool is_asset) {
+    const auto torrent = get_torrent(state, is_asset);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(TorrentMetadata(torrent->get_torrent_info()));
+    }
+    state.SetComplexityN(torrent->num_files());
+    state.SetItemsProcessed(state.iterations() * torrent->num_files());
+}
+TORRENT_BENCHMARK(bm_torrent_metadata);
+
+static void bm_create_hashlist(benchmark::State &state, bool is_asset) {
+    const auto torrent = get_torrent(state, is_asset);
+    const std::unordered_map<std::string, std::vector<std::string>> linked_files;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(create_hashlist(*torrent, linked_files));
+    }
+    state.SetComplexityN(torrent->num_files());
+    state.SetItemsProcessed(state.iterations() * torrent->num_files());
+}
+TORRENT_BENCHMARK(bm_create_hashlist);
+
+// a sync of the unchanged torrent, which is the most common case
+static void bm_get_updated_files(benchmark::State &state, bool is_asset) {
+    const auto torrent = get_torrent(state, is_asset);
+    const auto hashlist = create_hashlist(*torrent, {});
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(get_updated_files(*torrent, hashlist));
+    }
+    state.SetComplexityN(torrent->num_files());
+    state.SetItemsProcessed(state.iterations() * torrent->num_files());
+}
+TORRENT_BENCHMARK(bm_get_updated_files);
+
+// downloads the whole torrent chunk by chunk, as AppSync does
+static void bm_download_next_chunk(benchmark::State &state, bool is_asset) {
+    const auto torrent = get_torrent(state, is_asset);
+    const auto file_names = get_file_names(*torrent);
+    const auto size_limit = std::max((unsigned long long) torrent->total_size() / DOWNLOAD_CHUNKS, 1ULL);
+    for (auto _ : state) {
+        state.PauseTiming();
+        DownloadingFiles downloading_files(torrent, file_names, size_limit);
+        state.ResumeTiming();
+        while (!downloading_files.is_completed()) {
+            for (const auto &file_name : downloading_files.download_next_chunk()) {
+                downloading_files.complete_file(file_name);
+            }
+        }
+    }
+    state.SetComplexityN(torrent->num_files());
+    state.SetItemsProcessed(state.iterations() * torrent->num_files());
+}
+TORRENT_BENCHMARK(bm_download_next_chunk);
+
+static std::vector<std::string> get_children(const std::string &parent) {
+    std::vector<std::string> children;
+    for (int i = 0; i < LINKED_FILES_PER_PARENT; i++) {
+        children.push_back(parent + "/file_" + std::to_string(i) + ".txt");
+    }
+    return children;
+}
+
+static std::vector<std::string> get_parents(int count) {
+    std::vector<std::string> parents;
+    for (int i = 0; i < count; i++) {
+        parents.push_back("dir_" + std::to_string(i / SCALED_FILES_PER_DIRECTORY) + "/archive_" + std::to_string(i) + ".zip");
+    }
+    return parents;
+}
+
+static void bm_linked_files_add(benchmark::State &state) {
+    const auto parents = get_parents((int) state.range(0));
+    for (auto _ : state) {
+        LinkedFiles linked_files;
+        for (const auto &parent : parents) {
+            linked_files.add_files(parent, get_children(parent));
+        }
+        benchmark::DoNotOptimize(linked_files);
+    }
+    state.SetComplexityN(state.range(0));
+    state.SetItemsProcessed(state.iterations() * state.range(0) * LINKED_FILES_PER_PARENT);
+}
+BENCHMARK(bm_linked_files_add)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX)->Complexity();
+
+static void bm_linked_files_get(benchmark::State &state) {
+    const auto parents = get_parents((int) state.range(0));
+    LinkedFiles linked_files;
+    std::vector<std::string> children;
+    for (const auto &parent : parents) {
+        const auto parent_children = get_children(parent);
+        linked_files.add_files(parent, parent_children);
+        children.insert(children.end(), parent_children.begin(), parent_children.end());
+    }
+    for (auto _ : state) {
+        for (const auto &child : children) {
+            benchmark::DoNotOptimize(linked_files.get_parent(child));
+        }
+        // called on each sync to build the hashlist
+        benchmark::DoNotOptimize(linked_files.get_files());
+    }
+    state.SetComplexityN(state.range(0));
+    state.SetItemsProcessed(state.iterations() * children.size());
+}
+BENCHMARK(bm_linked_files_get)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX)->Complexity();
+
+// half of the parents lose a child, then all parents are removed
+static void bm_linked_files_remove(benchmark::State &state) {
+    const auto parents = get_parents((int) state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        LinkedFiles linked_files;
+        for (const auto &parent : parents) {
+            linked_files.add_files(parent, get_children(parent));
+        }
+        state.ResumeTiming();
+        for (size_t i = 0; i < parents.size(); i += 2) {
+            linked_files.remove_child(parents[i] + "/file_0.txt");
+        }
+        for (const auto &parent : parents) {
+            linked_files.remove_parent(parent);
+        }
+    }
+    state.SetComplexityN(state.range(0));
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(bm_linked_files_remove)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX)->Complexity();
+
+static std::shared_ptr<sqlite3> open_db(benchmark::State &state, bool is_on_disk) {
+    std::string path = ":memory:";
+    if (is_on_disk) {
+        const auto directory = std::filesystem::temp_directory_path() / "torrent-s3-bench";
+        std::filesystem::create_directories(directory);
+        path = (directory / "bench.db").string();
+    }
+    auto maybe_db = db_open(path);
+    if (std::holds_alternative<std::string>(maybe_db)) {
+        state.SkipWithError(std::get<std::string>(maybe_db).c_str());
+        return nullptr;
+    }
+    return std::get<std::shared_ptr<sqlite3>>(maybe_db);
+}
+
+// state changes of a sync: archive children are registered, files are completed and the hashlist is saved
+static void bm_app_state_write(benchmark::State &state, bool is_on_disk) {
+    const auto torrent = get_torrent(state, false);
+    const auto file_names = get_file_names(*torrent);
+    const auto hashlist = create_hashlist(*torrent, {});
+    const auto db = open_db(state, is_on_disk);
+    if (db == nullptr) {
+        return;
+    }
+    for (auto _ : state) {
+        state.PauseTiming();
+        AppState app_state(db, true);
+        state.ResumeTiming();
+        for (size_t i = 0; i < file_names.size(); i++) {
+            if (i % LINKED_FILES_PER_PARENT == 0) {
+                app_state.add_uploading_files(file_names[i], get_children(file_names[i]));
+            }
+            app_state.file_complete(file_names[i]);
+        }
+        app_state.save_hashlist(hashlist);
+    }
+    state.SetComplexityN(torrent->num_files());
+    state.SetItemsProcessed(state.iterations() * torrent->num_files());
+}
+BENCHMARK_CAPTURE(bm_app_state_write, memory, false)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX)->Complexity();
+// each completed file is a commit, which is synced to the disk
+BENCHMARK_CAPTURE(bm_app_state_write, disk, true)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX / 4)->Complexity()->Unit(benchmark::kMillisecond);
+
+// state loaded on start and on each sync
+static void bm_app_state_read(benchmark::State &state, bool is_on_disk) {
+    const auto torrent = get_torrent(state, false);
+    const auto file_names = get_file_names(*torrent);
+    const auto db = open_db(state, is_on_disk);
+    if (db == nullptr) {
+        return;
+    }
+    AppState app_state(db, true);
+    for (size_t i = 0; i < file_names.size(); i++) {
+        if (i % LINKED_FILES_PER_PARENT == 0) {
+            app_state.add_uploading_files(file_names[i], get_children(file_names[i]));
+        }
+        app_state.file_complete(file_names[i]);
+    }
+    app_state.save_hashlist(create_hashlist(*torrent, {}));
+    for (auto _ : state) {
+        for (const auto &file_name : file_names) {
+            benchmark::DoNotOptimize(app_state.get_file_status(file_name));
+        }
+        benchmark::DoNotOptimize(app_state.get_uploading_files());
+        benchmark::DoNotOptimize(app_state.get_completed_files());
+        benchmark::DoNotOptimize(app_state.get_hashlist());
+    }
+    state.SetComplexityN(torrent->num_files());
+    state.SetItemsProcessed(state.iterations() * torrent->num_files());
+}
+BENCHMARK_CAPTURE(bm_app_state_read, memory, false)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX)->Complexity();
+BENCHMARK_CAPTURE(bm_app_state_read, disk, true)->RangeMultiplier(4)->Range(SCALED_FILES_MIN, SCALED_FILES_MAX)->Complexity();
+
+// producers push file names while a consumer pops them, as the upload queues do
+static void bm_deque_throughput(benchmark::State &state) {
+    const auto producer_count = (int) state.range(0);
+    const auto items_per_producer = DEQUE_ITEMS / producer_count;
+    for (auto _ : state) {
+        ThreadSafeDeque<std::string> deque;
+        std::vector<std::thread> producers;
+        for (int p = 0; p < producer_count; p++) {
+            producers.push_back(std::thread([&deque, items_per_producer]() {
+                for (int i = 0; i < items_per_producer; i++) {
+                    deque.push_back("dir/file_" + std::to_string(i) + ".txt");
+                }
+            }));
+        }
+        for (int i = 0; i < items_per_producer * producer_count; i++) {
+            benchmark::DoNotOptimize(deque.pop_front_waiting());
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * items_per_producer * producer_count);
+}
+BENCHMARK(bm_deque_throughput)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,61 @@
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+
+#include "../src/archive/archive.hpp"
+
+// generated file size in megabytes, if not set by the first argument
+#define SOURCE_SIZE_MB_DEFAULT 256
+
+// text-like data with a compression ratio close to logs and documents
+static void generate_file(const std::filesystem::path &path, unsigned long long size) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> word_dist(0, 999);
+    std::ofstream file(path, std::ios::binary);
+    unsigned long long written = 0;
+    std::string line;
+    while (written < size) {
+        line = "entry " + std::to_string(written) + " value " + std::to_string(word_dist(rng)) + " status " + std::to_string(word_dist(rng) % 7) + "\n";
+        file << line;
+        written += line.size();
+    }
+}
+
+static void run(const std::filesystem::path &source_path, const std::filesystem::path &dest_path, unsigned int thread_count) {
+    std::shared_ptr<DeflatePool> deflate_pool;
+    if (thread_count > 1) {
+        deflate_pool = std::make_shared<DeflatePool>(thread_count);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const auto ret = zip_file(source_path, dest_path, deflate_pool);
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (ret.has_value()) {
+        fprintf(stderr, "%u threads: %s\n", thread_count, ret.value().c_str());
+        return;
+    }
+    const auto source_size = (double) std::filesystem::file_size(source_path);
+    const auto dest_size = (double) std::filesystem::file_size(dest_path);
+    fprintf(stdout, "%2u threads: %7.3f s, %8.1f MB/s, ratio %.3f\n", thread_count, seconds, source_size / 1024 / 1024 / seconds, dest_size / source_size);
+}
+
+// compares single threaded libarchive compression with the deflate pool
+// usage: torrent-s3-bench-deflate [size in MB]
+int main(int argc, char **argv) {
+    const auto size_mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : SOURCE_SIZE_MB_DEFAULT;
+    const auto directory = std::filesystem::temp_directory_path() / "torrent-s3-bench-deflate";
+    std::filesystem::create_directories(directory);
+    const auto source_path = directory / "source.txt";
+    const auto dest_path = directory / "source.txt.zip";
+    generate_file(source_path, size_mb * 1024 * 1024);
+
+    const auto hardware_threads = std::max(std::thread::hardware_concurrency(), 1U);
+    fprintf(stdout, "Compressing %llu MB, %u hardware threads\n", size_mb, hardware_threads);
+    for (unsigned int thread_count = 1; thread_count <= std::max(hardware_threads, 2U); thread_count *= 2) {
+        run(source_path, dest_path, thread_count);
+    }
+    std::filesystem::remove_all(directory);
+    return EXIT_SUCCESS;
+}
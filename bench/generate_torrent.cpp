@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "../src/command_line/cxxopts.hpp"
+#include "../src/synthetic_torrent/synthetic_torrent.hpp"
+
+// writes a synthetic .torrent file without payload data, i.e. to run torrent-s3 or benchmarks on huge torrents
+// usage: torrent-s3-generate-torrent -o synthetic.torrent --files 1000000
+int main(int argc, char **argv) {
+    synthetic_torrent_options_t defaults;
+    cxxopts::Options options("torrent-s3-generate-torrent");
+    options.add_options()
+           ("o,output", "Path to the .torrent file", cxxopts::value<std::string>())
+           ("name", "Torrent name", cxxopts::value<std::string>()->default_value(defaults.name))
+           ("files", "Number of files", cxxopts::value<unsigned long long>()->default_value(std::to_string(defaults.file_count)))
+           ("depth", "Number of folder levels above files", cxxopts::value<unsigned int>()->default_value(std::to_string(defaults.depth)))
+           ("fanout", "Number of files or subfolders in a folder", cxxopts::value<unsigned int>()->default_value(std::to_string(defaults.fanout)))
+           ("distribution", "File size distribution: fixed, uniform or log-uniform", cxxopts::value<std::string>()->default_value("log-uniform"))
+           ("min-file-size", "Minimum file size in bytes", cxxopts::value<unsigned long long>()->default_value(std::to_string(defaults.min_file_size)))
+           ("max-file-size", "Maximum file size in bytes, size of all files for the fixed distribution", cxxopts::value<unsigned long long>()->default_value(std::to_string(defaults.max_file_size)))
+           ("piece-size", "Piece size in bytes. Chosen by libtorrent if not set", cxxopts::value<int>()->default_value("0"))
+           ("seed", "Seed of file sizes and piece hashes", cxxopts::value<unsigned int>()->default_value("0"))
+           ("h,help", "Show help");
+
+    cxxopts::ParseResult args;
+    try {
+        args = options.parse(argc, argv);
+    } catch (const cxxopts::exceptions::exception &x) {
+        fprintf(stderr, "%s\n%s", x.what(), options.help().c_str());
+        return EXIT_FAILURE;
+    }
+    if (args.count("help") || !args.count("output")) {
+        fprintf(stderr, "%s", options.help().c_str());
+        return args.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    synthetic_torrent_options_t torrent_options;
+    torrent_options.name = args["name"].as<std::string>();
+    torrent_options.file_count = args["files"].as<unsigned long long>();
+    torrent_options.depth = args["depth"].as<unsigned int>();
+    torrent_options.fanout = args["fanout"].as<unsigned int>();
+    torrent_options.min_file_size = args["min-file-size"].as<unsigned long long>();
+    torrent_options.max_file_size = args["max-file-size"].as<unsigned long long>();
+    torrent_options.piece_size = args["piece-size"].as<int>();
+    torrent_options.seed = args["seed"].as<unsigned int>();
+    const auto distribution = args["distribution"].as<std::string>();
+    if (distribution == "fixed") {
+        torrent_options.size_distribution = FILE_SIZE_FIXED;
+    } else if (distribution == "uniform") {
+        torrent_options.size_distribution = FILE_SIZE_UNIFORM;
+    } else if (distribution == "log-uniform") {
+        torrent_options.size_distribution = FILE_SIZE_LOG_UNIFORM;
+    } else {
+        fprintf(stderr, "Unknown distribution \"%s\"\n", distribution.c_str());
+        return EXIT_FAILURE;
+    }
+
+    const auto generate_ret = generate_synthetic_torrent(torrent_options);
+    if (std::holds_alternative<std::string>(generate_ret)) {
+        fprintf(stderr, "%s\n", std::get<std::string>(generate_ret).c_str());
+        return EXIT_FAILURE;
+    }
+    const auto &buffer = std::get<std::vector<char>>(generate_ret);
+    const auto output_path = args["output"].as<std::string>();
+    std::ofstream file(output_path, std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), buffer.size());
+    file.close();
+    if (!file) {
+        fprintf(stderr, "Could not write \"%s\"\n", output_path.c_str());
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "%llu files, %zu bytes written to %s\n", torrent_options.file_count, buffer.size(), output_path.c_str());
+    return EXIT_SUCCESS;
+}
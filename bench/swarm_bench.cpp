@@ -0,0 +1,258 @@
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <fstream>
+#include <filesystem>
+#include <sys/resource.h>
+
+#include <libtorrent/session.hpp>
+#include <libtorrent/session_params.hpp>
+#include <libtorrent/settings_pack.hpp>
+#include <libtorrent/posix_disk_io.hpp>
+#include <libtorrent/add_torrent_params.hpp>
+#include <libtorrent/create_torrent.hpp>
+#include <libtorrent/torrent_flags.hpp>
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/address.hpp>
+#include <libtorrent/socket.hpp>
+
+#include "../src/db/sqlite.hpp"
+#include "../src/app_sync/sync.hpp"
+#include "../src/s3/local_backend.hpp"
+#include "../src/trace/trace.hpp"
+
+// torrent size in megabytes, if not set by the first argument
+#define TORRENT_SIZE_MB_DEFAULT 512
+// file sizes are distributed log-uniformly between min and max, in kilobytes
+#define FILE_SIZE_MIN_KB_DEFAULT 16
+#define FILE_SIZE_MAX_KB_DEFAULT (64 * 1024)
+#define SEEDERS_DEFAULT 2
+// each seeder listens on its own loopback address, since the downloader accepts one connection per IP
+#define SEEDERS_MAX 254
+#define WRITE_BLOCK_SIZE (1024 * 1024)
+#define LISTEN_WAIT_MS 5000
+#define SAMPLE_INTERVAL_MS 100
+
+struct swarm_file_t {
+    std::string name;
+    unsigned long long size;
+};
+
+// random content is generated once and written with a different offset to each file, so that pieces differ
+static std::vector<swarm_file_t> generate_files(
+    const std::filesystem::path &directory,
+    unsigned long long total_size,
+    unsigned long long min_file_size,
+    unsigned long long max_file_size
+) {
+    std::mt19937 rng(42);
+    std::vector<char> block(WRITE_BLOCK_SIZE * 2);
+    std::uniform_int_distribution<int> byte_dist(0, 255);
+    for (auto &c : block) {
+        c = (char) byte_dist(rng);
+    }
+    std::uniform_real_distribution<double> size_dist(std::log((double) min_file_size), std::log((double) max_file_size));
+    std::uniform_int_distribution<size_t> offset_dist(0, WRITE_BLOCK_SIZE - 1);
+
+    std::vector<swarm_file_t> files;
+    unsigned long long generated = 0;
+    while (generated < total_size) {
+        const auto size = std::min((unsigned long long) std::exp(size_dist(rng)), total_size - generated);
+        const auto index = files.size();
+        const auto name = "dir_" + std::to_string(index / 100) + "/file_" + std::to_string(index) + ".bin";
+        std::filesystem::create_directories((directory / name).parent_path());
+        std::ofstream file(directory / name, std::ios::binary);
+        unsigned long long written = 0;
+        while (written < size) {
+            const auto chunk = std::min(size - written, (unsigned long long) WRITE_BLOCK_SIZE);
+            file.write(block.data() + offset_dist(rng), chunk);
+            written += chunk;
+        }
+        files.push_back(swarm_file_t { name, size });
+        generated += size;
+    }
+    return files;
+}
+
+static std::variant<std::shared_ptr<lt::torrent_info>, std::string> create_torrent(const std::filesystem::path &directory) {
+    lt::file_storage fs;
+    lt::add_files(fs, directory.string());
+    lt::create_torrent torrent(fs, 0, lt::create_torrent::v1_only);
+    lt::error_code ec;
+    lt::set_piece_hashes(torrent, directory.parent_path().string(), ec);
+    if (ec) {
+        return ec.message();
+    }
+    std::vector<char> buffer;
+    lt::bencode(std::back_inserter(buffer), torrent.generate());
+    return std::make_shared<lt::torrent_info>(buffer, lt::from_span);
+}
+
+// seeders read with pread instead of mmap, so that their page cache is not counted in the peak RSS
+static std::variant<std::vector<std::shared_ptr<lt::session>>, std::string> start_seeders(
+    unsigned int count,
+    std::shared_ptr<lt::torrent_info> torrent,
+    const std::filesystem::path &save_path,
+    std::vector<lt::tcp::endpoint> &peers
+) {
+    std::vector<std::shared_ptr<lt::session>> seeders;
+    for (unsigned int i = 0; i < count; i++) {
+        const auto address = "127.0.0." + std::to_string(i + 1);
+        lt::settings_pack p;
+        p.set_str(lt::settings_pack::listen_interfaces, address + ":0");
+        p.set_bool(lt::settings_pack::enable_dht, false);
+        p.set_bool(lt::settings_pack::enable_lsd, false);
+        p.set_bool(lt::settings_pack::enable_upnp, false);
+        p.set_bool(lt::settings_pack::enable_natpmp, false);
+        lt::session_params session_params(p);
+        session_params.disk_io_constructor = lt::posix_disk_io_constructor;
+        auto seeder = std::make_shared<lt::session>(std::move(session_params));
+
+        lt::add_torrent_params params;
+        params.ti = torrent;
+        params.save_path = save_path.string();
+        params.flags |= lt::torrent_flags::seed_mode;
+        seeder->add_torrent(params);
+
+        const auto wait_start = std::chrono::steady_clock::now();
+        while (seeder->listen_port() == 0) {
+            if (std::chrono::steady_clock::now() - wait_start > std::chrono::milliseconds(LISTEN_WAIT_MS)) {
+                return "Seeder could not listen on " + address;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        peers.push_back(lt::tcp::endpoint(lt::make_address(address), seeder->listen_port()));
+        seeders.push_back(seeder);
+    }
+    return seeders;
+}
+
+static unsigned long long get_directory_size(const std::filesystem::path &path) {
+    unsigned long long size = 0;
+    std::error_code ec;
+    for (std::filesystem::recursive_directory_iterator it(path, ec), end; it != end; it.increment(ec)) {
+        if (ec) {
+            break;
+        }
+        if (it->is_regular_file(ec)) {
+            size += it->file_size(ec);
+        }
+    }
+    return size;
+}
+
+// peak resident set size of the process in megabytes
+static double get_peak_rss_mb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (double) usage.ru_maxrss / 1024 / 1024;
+#else
+    return (double) usage.ru_maxrss / 1024;
+#endif
+}
+
+// downloads a generated torrent from local seeders and uploads it to a LocalBackend bucket with AppSync::full_sync
+// usage: torrent-s3-bench-swarm [size in MB] [min file size in KB] [max file size in KB] [seeders] [limit in MB]
+int main(int argc, char **argv) {
+    const auto size_mb = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : TORRENT_SIZE_MB_DEFAULT;
+    const auto min_file_size_kb = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : FILE_SIZE_MIN_KB_DEFAULT;
+    const auto max_file_size_kb = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : FILE_SIZE_MAX_KB_DEFAULT;
+    const auto seeder_count = argc > 4 ? (unsigned int) std::strtoul(argv[4], nullptr, 10) : SEEDERS_DEFAULT;
+    const auto limit_mb = argc > 5 ? std::strtoull(argv[5], nullptr, 10) : 0;
+    if (size_mb == 0 || min_file_size_kb == 0 || max_file_size_kb < min_file_size_kb || seeder_count == 0 || seeder_count > SEEDERS_MAX) {
+        fprintf(stderr, "Invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+
+    const auto directory = std::filesystem::temp_directory_path() / "torrent-s3-bench-swarm";
+    std::filesystem::remove_all(directory);
+    const auto seed_path = directory / "seed";
+    const auto download_path = directory / "download";
+    const auto bucket_path = directory / "bucket";
+    std::filesystem::create_directories(download_path);
+    std::filesystem::create_directories(bucket_path);
+
+    fprintf(stdout, "Generating %llu MB of files from %llu KB to %llu KB\n", size_mb, min_file_size_kb, max_file_size_kb);
+    const auto files = generate_files(seed_path / "swarm", size_mb * 1024 * 1024, min_file_size_kb * 1024, max_file_size_kb * 1024);
+    const auto maybe_torrent = create_torrent(seed_path / "swarm");
+    if (std::holds_alternative<std::string>(maybe_torrent)) {
+        fprintf(stderr, "Could not create torrent: %s\n", std::get<std::string>(maybe_torrent).c_str());
+        return EXIT_FAILURE;
+    }
+    const auto torrent = std::get<std::shared_ptr<lt::torrent_info>>(maybe_torrent);
+
+    std::vector<lt::tcp::endpoint> peers;
+    const auto maybe_seeders = start_seeders(seeder_count, torrent, seed_path, peers);
+    if (std::holds_alternative<std::string>(maybe_seeders)) {
+        fprintf(stderr, "%s\n", std::get<std::string>(maybe_seeders).c_str());
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "Seeding %zu files, %d pieces of %d KB from %u seeders\n", files.size(), torrent->num_pieces(), torrent->piece_length() / 1024, seeder_count);
+
+    const auto maybe_db = db_open(":memory:");
+    if (std::holds_alternative<std::string>(maybe_db)) {
+        fprintf(stderr, "Could not open database: %s\n", std::get<std::string>(maybe_db).c_str());
+        return EXIT_FAILURE;
+    }
+    auto app_state = std::make_shared<AppState>(std::get<std::shared_ptr<sqlite3>>(maybe_db), true);
+    auto s3_uploader = std::make_shared<S3Uploader>(0, std::make_shared<LocalBackend>(bucket_path), download_path, "upload");
+    lt::add_torrent_params torrent_params;
+    torrent_params.save_path = download_path.string();
+    torrent_params.ti = std::make_shared<lt::torrent_info>(*torrent);
+    torrent_params.peers = peers;
+    auto torrent_downloader = std::make_shared<TorrentDownloader>(torrent_params);
+    AppSync app_sync(
+        app_state,
+        s3_uploader,
+        torrent_downloader,
+        limit_mb > 0 ? limit_mb * 1024 * 1024 : LLONG_MAX,
+        download_path.string(),
+        false,
+        false
+    );
+
+    std::atomic<bool> is_syncing {true};
+    unsigned long long peak_disk_size = 0;
+    std::thread sampler([&]() {
+        while (is_syncing) {
+            peak_disk_size = std::max(peak_disk_size, get_directory_size(download_path));
+            std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_INTERVAL_MS));
+        }
+    });
+
+    trace_start(directory / "trace.json");
+    const auto start = std::chrono::steady_clock::now();
+    const auto sync_ret = app_sync.full_sync();
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    trace_stop();
+    is_syncing = false;
+    sampler.join();
+
+    if (std::holds_alternative<std::string>(sync_ret)) {
+        fprintf(stderr, "Sync failed: %s\n", std::get<std::string>(sync_ret).c_str());
+        return EXIT_FAILURE;
+    }
+    const auto file_errors = std::get<std::vector<file_upload_error_t>>(sync_ret);
+    const auto uploaded_size = get_directory_size(bucket_path);
+    fprintf(stdout, "\nSynced %llu MB in %.3f s: %.1f MB/s, %zu errors\n", uploaded_size / 1024 / 1024, seconds, (double) uploaded_size / 1024 / 1024 / seconds, file_errors.size());
+    fprintf(stdout, "Peak temporary disk: %.1f MB\n", (double) peak_disk_size / 1024 / 1024);
+    fprintf(stdout, "Peak RSS: %.1f MB\n", get_peak_rss_mb());
+    // stages run in parallel, so their total time exceeds the sync time
+    fprintf(stdout, "%-24s %8s %12s %12s\n", "Stage", "Count", "Total s", "Average ms");
+    for (const auto &[name, total] : get_trace_totals()) {
+        fprintf(stdout, "%-24s %8llu %12.3f %12.3f\n", name.c_str(), total.count, total.seconds, total.seconds * 1000 / total.count);
+    }
+    fprintf(stdout, "Trace is written to %s\n", (directory / "trace.json").string().c_str());
+
+    std::filesystem::remove_all(seed_path);
+    std::filesystem::remove_all(download_path);
+    std::filesystem::remove_all(bucket_path);
+    return file_errors.empty() && uploaded_size == size_mb * 1024 * 1024 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -4,6 +4,9 @@
 #include <iterator>
 
 #include "./state.hpp"
+#include "../trace/trace.hpp"
+
+#define METRIC_DB_COMMIT_DURATION "torrent_s3_db_commit_duration_seconds"
 
 struct file_with_status_t {
     std::string name;
@@ -71,7 +74,16 @@ static std::unordered_map<std::string, std::vector<std::string>> get_linked_file
     return ret;
 }
 
-AppState::AppState(std::shared_ptr<sqlite3> db_, bool reset) : db {db_} {
+// reports time of the statement which commits changes, i.e. COMMIT or a single statement in autocommit mode
+static void observe_commit(Metrics *metrics, std::chrono::steady_clock::time_point start, const std::string &file_name = "") {
+    const auto end = std::chrono::steady_clock::now();
+    trace_event("commit", "state", start, end, file_name);
+    if (metrics != nullptr) {
+        metrics->observe(METRIC_DB_COMMIT_DURATION, std::chrono::duration<double>(end - start).count());
+    }
+}
+
+AppState::AppState(std::shared_ptr<sqlite3> db_, bool reset, std::shared_ptr<Metrics> metrics_) : db {db_}, metrics {metrics_} {
     if (reset) {
         char *err_msg = nullptr;
         auto drop_table_query = std::string("DROP TABLE IF EXISTS ") + LINKED_FILES_TABLE_NAME + ";";
@@ -97,6 +109,14 @@ AppState::AppState(std::shared_ptr<sqlite3> db_, bool reset) : db {db_} {
             sqlite3_free(err_msg);
             throw std::runtime_error("Failed to drop table: " + err_msg_str);
         }
+
+        drop_table_query = std::string("DROP TABLE IF EXISTS ") + BUNDLE_FILES_TABLE_NAME + ";";
+        rc = sqlite3_exec(db.get(), drop_table_query.c_str(), nullptr, nullptr, &err_msg);
+        if (rc != SQLITE_OK) {
+            const auto err_msg_str = std::string(err_msg);
+            sqlite3_free(err_msg);
+            throw std::runtime_error("Failed to drop table: " + err_msg_str);
+        }
     }
     char *err_msg = nullptr;
     auto create_table_query = std::string("CREATE TABLE IF NOT EXISTS ") + LINKED_FILES_TABLE_NAME + " (file TEXT PRIMARY KEY, parent TEXT, status INT NOT NULL);";
@@ -107,6 +127,23 @@ AppState::AppState(std::shared_ptr<sqlite3> db_, bool reset) : db {db_} {
         throw std::runtime_error("Failed to create table: " + err_msg_str);
     }
 
+    // children are replaced by parent, uploading files are selected by status on each upload
+    auto create_index_query = std::string("CREATE INDEX IF NOT EXISTS ") + LINKED_FILES_TABLE_NAME + "_parent_idx ON " + LINKED_FILES_TABLE_NAME + " (parent);";
+    rc = sqlite3_exec(db.get(), create_index_query.c_str(), nullptr, nullptr, &err_msg);
+    if (rc != SQLITE_OK) {
+        const auto err_msg_str = std::string(err_msg);
+        sqlite3_free(err_msg);
+        throw std::runtime_error("Failed to create index: " + err_msg_str);
+    }
+
+    create_index_query = std::string("CREATE INDEX IF NOT EXISTS ") + LINKED_FILES_TABLE_NAME + "_status_idx ON " + LINKED_FILES_TABLE_NAME + " (status);";
+    rc = sqlite3_exec(db.get(), create_index_query.c_str(), nullptr, nullptr, &err_msg);
+    if (rc != SQLITE_OK) {
+        const auto err_msg_str = std::string(err_msg);
+        sqlite3_free(err_msg);
+        throw std::runtime_error("Failed to create index: " + err_msg_str);
+    }
+
     create_table_query = std::string("CREATE TABLE IF NOT EXISTS ") + HASHLIST_TABLE_NAME + " (id INTEGER PRIMARY KEY, file TEXT NOT NULL, piece_hash BLOB NOT NULL);";
     rc = sqlite3_exec(db.get(), create_table_query.c_str(), nullptr, nullptr, &err_msg);
     if (rc != SQLITE_OK) {
@@ -115,7 +152,7 @@ AppState::AppState(std::shared_ptr<sqlite3> db_, bool reset) : db {db_} {
         throw std::runtime_error("Failed to create table: " + err_msg_str);
     }
 
-    const auto create_index_query = std::string("CREATE INDEX IF NOT EXISTS ") + HASHLIST_TABLE_NAME + "_file_idx ON " + HASHLIST_TABLE_NAME + " (file);";
+    create_index_query = std::string("CREATE INDEX IF NOT EXISTS ") + HASHLIST_TABLE_NAME + "_file_idx ON " + HASHLIST_TABLE_NAME + " (file);";
     rc = sqlite3_exec(db.get(), create_index_query.c_str(), nullptr, nullptr, &err_msg);
     if (rc != SQLITE_OK) {
         const auto err_msg_str = std::string(err_msg);
@@ -130,6 +167,14 @@ AppState::AppState(std::shared_ptr<sqlite3> db_, bool reset) : db {db_} {
         sqlite3_free(err_msg);
         throw std::runtime_error("Failed to create table: " + err_msg_str);
     }
+
+    create_table_query = std::string("CREATE TABLE IF NOT EXISTS ") + BUNDLE_FILES_TABLE_NAME + " (file TEXT PRIMARY KEY, bundle TEXT NOT NULL, offset INTEGER NOT NULL, size INTEGER NOT NULL);";
+    rc = sqlite3_exec(db.get(), create_table_query.c_str(), nullptr, nullptr, &err_msg);
+    if (rc != SQLITE_OK) {
+        const auto err_msg_str = std::string(err_msg);
+        sqlite3_free(err_msg);
+        throw std::runtime_error("Failed to create table: " + err_msg_str);
+    }
 }
 
 std::unordered_map<std::string, std::vector<std::string>> AppState::get_uploading_files() const {
@@ -219,7 +264,9 @@ void AppState::add_uploading_files(std::string name, std::vector<std::string> ch
     }
     sqlite3_finalize(stmt3);
 
+    const auto commit_start = std::chrono::steady_clock::now();
     rc = sqlite3_exec(db.get(), "COMMIT TRANSACTION", NULL, NULL, &err_msg);
+    observe_commit(metrics.get(), commit_start, name);
     if (rc != SQLITE_OK) {
         const auto err_msg_str = std::string(err_msg);
         sqlite3_free(err_msg);
@@ -227,6 +274,24 @@ void AppState::add_uploading_files(std::string name, std::vector<std::string> ch
     }
 }
 
+void AppState::add_uploading_file(std::string name, std::string child) {
+    const auto insert_query = std::string("INSERT OR REPLACE INTO ") + LINKED_FILES_TABLE_NAME + " (file, parent, status) VALUES (?, ?, 0);";
+    sqlite3_stmt *stmt = nullptr;
+    auto rc = sqlite3_prepare_v2(db.get(), insert_query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare insert statement: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    sqlite3_bind_text(stmt, 1, child.c_str(), child.size(), 0);
+    sqlite3_bind_text(stmt, 2, name.c_str(), name.size(), 0);
+    const auto commit_start = std::chrono::steady_clock::now();
+    rc = sqlite3_step(stmt);
+    observe_commit(metrics.get(), commit_start, child);
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Failed to step: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    sqlite3_finalize(stmt);
+}
+
 std::optional<file_status_t> AppState::get_file_status(std::string name) const {
     const auto select_query = std::string("SELECT status FROM ") + LINKED_FILES_TABLE_NAME + " WHERE file=?;";
     sqlite3_stmt *stmt = nullptr;
@@ -237,6 +302,7 @@ std::optional<file_status_t> AppState::get_file_status(std::string name) const {
     sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), 0);
     rc = sqlite3_step(stmt);
     if (rc == SQLITE_DONE) {
+        sqlite3_finalize(stmt);
         return std::nullopt;
     }
     if (rc != SQLITE_ROW) {
@@ -274,6 +340,7 @@ std::optional<std::string> AppState::get_uploading_parent(std::string name) cons
     sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), 0);
     rc = sqlite3_step(stmt);
     if (rc == SQLITE_DONE) {
+        sqlite3_finalize(stmt);
         return std::nullopt;
     }
     if (rc != SQLITE_ROW) {
@@ -290,7 +357,9 @@ std::optional<std::string> AppState::get_uploading_parent(std::string name) cons
 }
 
 void AppState::file_complete(std::string name) {
+    const auto commit_start = std::chrono::steady_clock::now();
     set_file_status(db, name, file_status_t::FILE_STATUS_READY);
+    observe_commit(metrics.get(), commit_start, name);
 }
 
 void AppState::save_hashlist(file_hashlist_t hashlist) {
@@ -378,7 +447,9 @@ void AppState::save_hashlist(file_hashlist_t hashlist) {
         sqlite3_finalize(stmt4);
     }
 
+    const auto commit_start = std::chrono::steady_clock::now();
     rc = sqlite3_exec(db.get(), "COMMIT TRANSACTION", NULL, NULL, &err_msg);
+    observe_commit(metrics.get(), commit_start);
     if (rc != SQLITE_OK) {
         const auto err_msg_str = std::string(err_msg);
         sqlite3_free(err_msg);
@@ -411,28 +482,89 @@ file_hashlist_t AppState::get_hashlist() const {
     }
     sqlite3_finalize(stmt);
 
-    for (const auto &f : hashlist) {
-        const auto &name = f.first;
-        const auto select_linked_files_query = std::string("SELECT file FROM ") + HASHLIST_LINKED_FILES_TABLE_NAME + " WHERE parent=?;";
-        sqlite3_stmt *stmt2 = nullptr;
-        rc = sqlite3_prepare_v2(db.get(), select_linked_files_query.c_str(), -1, &stmt2, nullptr);
-        if (rc != SQLITE_OK) {
-            throw std::runtime_error("Failed to prepare select statement: " + std::string(sqlite3_errmsg(db.get())));
+    // linked files of all parents are read at once, a query per parent is quadratic without an index
+    const auto select_linked_files_query = std::string("SELECT file, parent FROM ") + HASHLIST_LINKED_FILES_TABLE_NAME + ";";
+    sqlite3_stmt *stmt2 = nullptr;
+    rc = sqlite3_prepare_v2(db.get(), select_linked_files_query.c_str(), -1, &stmt2, nullptr);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare select statement: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    while (true) {
+        rc = sqlite3_step(stmt2);
+        if (rc == SQLITE_DONE) {
+            break;
         }
-        sqlite3_bind_text(stmt2, 1, name.c_str(), name.size(), 0);
-        while (true) {
-            rc = sqlite3_step(stmt2);
-            if (rc == SQLITE_DONE) {
-                break;
-            }
-            if (rc != SQLITE_ROW) {
-                throw std::runtime_error("Failed to step: " + std::string(sqlite3_errmsg(db.get())));
-            }
-            const auto file_name = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt2, 0)));
-            auto &linked_files = hashlist[name].linked_files;
-            linked_files.push_back(file_name);
+        if (rc != SQLITE_ROW) {
+            throw std::runtime_error("Failed to step: " + std::string(sqlite3_errmsg(db.get())));
         }
-        sqlite3_finalize(stmt2);
+        const auto parent = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt2, 1)));
+        const auto parent_iter = hashlist.find(parent);
+        if (parent_iter == hashlist.end()) {
+            continue;
+        }
+        const auto file_name = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt2, 0)));
+        parent_iter->second.linked_files.push_back(file_name);
     }
+    sqlite3_finalize(stmt2);
     return hashlist;
 }
+
+void AppState::add_bundle_file(const bundle_entry_t &entry) {
+    const auto insert_query = std::string("INSERT OR REPLACE INTO ") + BUNDLE_FILES_TABLE_NAME + " (file, bundle, offset, size) VALUES (?, ?, ?, ?);";
+    sqlite3_stmt *stmt = nullptr;
+    auto rc = sqlite3_prepare_v2(db.get(), insert_query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare insert statement: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    sqlite3_bind_text(stmt, 1, entry.file_name.c_str(), entry.file_name.size(), 0);
+    sqlite3_bind_text(stmt, 2, entry.bundle_name.c_str(), entry.bundle_name.size(), 0);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64) entry.offset);
+    sqlite3_bind_int64(stmt, 4, (sqlite3_int64) entry.size);
+    const auto commit_start = std::chrono::steady_clock::now();
+    rc = sqlite3_step(stmt);
+    observe_commit(metrics.get(), commit_start, entry.file_name);
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Failed to step: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    sqlite3_finalize(stmt);
+}
+
+void AppState::remove_bundle_file(std::string name) {
+    const auto delete_query = std::string("DELETE FROM ") + BUNDLE_FILES_TABLE_NAME + " WHERE file=?;";
+    sqlite3_stmt *stmt = nullptr;
+    auto rc = sqlite3_prepare_v2(db.get(), delete_query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare delete statement: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), 0);
+    const auto commit_start = std::chrono::steady_clock::now();
+    rc = sqlite3_step(stmt);
+    observe_commit(metrics.get(), commit_start, name);
+    if (rc != SQLITE_DONE) {
+        throw std::runtime_error("Failed to step: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    sqlite3_finalize(stmt);
+}
+
+std::optional<bundle_entry_t> AppState::get_bundle_file(std::string name) const {
+    const auto select_query = std::string("SELECT bundle, offset, size FROM ") + BUNDLE_FILES_TABLE_NAME + " WHERE file=?;";
+    sqlite3_stmt *stmt = nullptr;
+    auto rc = sqlite3_prepare_v2(db.get(), select_query.c_str(), -1, &stmt, nullptr);
+    if (rc != SQLITE_OK) {
+        throw std::runtime_error("Failed to prepare select statement: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    sqlite3_bind_text(stmt, 1, name.c_str(), name.size(), 0);
+    rc = sqlite3_step(stmt);
+    if (rc == SQLITE_DONE) {
+        sqlite3_finalize(stmt);
+        return std::nullopt;
+    }
+    if (rc != SQLITE_ROW) {
+        throw std::runtime_error("Failed to step: " + std::string(sqlite3_errmsg(db.get())));
+    }
+    const auto bundle = std::string(reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+    const auto offset = (unsigned long long) sqlite3_column_int64(stmt, 1);
+    const auto size = (unsigned long long) sqlite3_column_int64(stmt, 2);
+    sqlite3_finalize(stmt);
+    return bundle_entry_t { name, bundle, offset, size };
+}
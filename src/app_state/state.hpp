@@ -7,10 +7,13 @@
 
 #include <sqlite3.h>
 #include "../hashlist/hashlist.hpp"
+#include "../archive/bundle_entry.hpp"
+#include "../metrics/metrics.hpp"
 
 #define LINKED_FILES_TABLE_NAME "linked_files"
 #define HASHLIST_TABLE_NAME "hashlist"
 #define HASHLIST_LINKED_FILES_TABLE_NAME "hashlist_linked_files"
+#define BUNDLE_FILES_TABLE_NAME "bundle_files"
 
 enum file_status_t {
     FILE_STATUS_UPLOADING = 0,
@@ -21,10 +24,13 @@ enum file_status_t {
 
 class AppState {
 public:
-    AppState(std::shared_ptr<sqlite3> db_, bool reset = false);
+    // metrics_ - latency of commits is reported if set
+    AppState(std::shared_ptr<sqlite3> db_, bool reset = false, std::shared_ptr<Metrics> metrics_ = nullptr);
 
     // removes all previous children of the file and adds new ones
     void add_uploading_files(std::string name, std::vector<std::string> children);
+    // adds a child of the file, previous children are kept
+    void add_uploading_file(std::string name, std::string child);
     std::optional<std::string> get_uploading_parent(std::string name) const;
     std::optional<file_status_t> get_file_status(std::string name) const;
     // mark file as 'ready'
@@ -35,6 +41,13 @@ public:
     std::unordered_map<std::string, std::vector<std::string>> get_completed_files() const;
     file_hashlist_t get_hashlist() const;
 
+    // replaces previous location of the file
+    void add_bundle_file(const bundle_entry_t &entry);
+    // file is not bundled anymore, i.e. uploaded as a separate object
+    void remove_bundle_file(std::string name);
+    std::optional<bundle_entry_t> get_bundle_file(std::string name) const;
+
 private:
     std::shared_ptr<sqlite3> db;
+    std::shared_ptr<Metrics> metrics;
 };
@@ -1,11 +1,36 @@
 #include <filesystem>
 #include <vector>
+#include <algorithm>
+#include <climits>
+#include <chrono>
 
 #include "../archive/archive.hpp"
 #include "../path/path_utils.hpp"
+#include "../trace/trace.hpp"
 
 #include "./sync.hpp"
 
+// bundle is uploaded when its size reaches this limit
+#define BUNDLE_SIZE_DEFAULT (64ULL * 1024 * 1024)
+// bundles are stored in this folder of the upload path
+#define BUNDLE_FOLDER "_bundles"
+// how often queue sizes and temporary storage usage are sampled to metrics
+#define METRICS_UPDATE_MS 5000
+
+#define METRIC_DOWNLOAD_PROGRESS_QUEUE_SIZE "torrent_s3_download_progress_queue_size"
+#define METRIC_UPLOAD_PROGRESS_QUEUE_SIZE "torrent_s3_upload_progress_queue_size"
+#define METRIC_UPLOAD_QUEUE_SIZE "torrent_s3_upload_queue_size"
+#define METRIC_UPLOAD_RETRY_QUEUE_SIZE "torrent_s3_upload_retry_queue_size"
+#define METRIC_UPLOADING_FILES "torrent_s3_uploading_files"
+#define METRIC_UPLOAD_CONCURRENCY "torrent_s3_upload_concurrency"
+#define METRIC_DOWNLOADING_FILES "torrent_s3_downloading_files"
+#define METRIC_EXTRACT_PROGRESS_QUEUE_SIZE "torrent_s3_extract_progress_queue_size"
+#define METRIC_EXTRACTING_ARCHIVES "torrent_s3_extracting_archives"
+#define METRIC_TEMP_STORAGE_BYTES "torrent_s3_temp_storage_bytes"
+#define METRIC_TEMP_STORAGE_LIMIT_BYTES "torrent_s3_temp_storage_limit_bytes"
+#define METRIC_UPLOADED_FILES "torrent_s3_uploaded_files_total"
+#define METRIC_UPLOAD_ERRORS "torrent_s3_upload_errors_total"
+
 static std::unordered_set<std::string> filter_complete_files(const std::unordered_set<std::string>& files, const AppState &state) {
     std::unordered_set<std::string> ret;
     for (const auto &f : files) {
@@ -17,43 +42,102 @@ static std::unordered_set<std::string> filter_complete_files(const std::unordere
     return ret;
 }
 
-static void populate_folders(LinkedFiles &folders, std::vector<std::string> files) {
+// links each file to its folder and each folder to its parent folder, stops at the first folder linked already
+static void populate_folders(LinkedFiles &folders, const std::vector<std::string> &files) {
     for (const auto &f : files) {
         auto child = std::filesystem::path(f);
         while (true) {
-            const auto parent = child.parent_path();
+            auto parent = child.parent_path();
             if (parent.empty()) {
                 break;
             }
-            if (folders.get_parent(child.string()).has_value()) {
+            if (!folders.add_child(parent.string(), child.string())) {
                 break;
             }
-            folders.add_files(parent.string(), {child.string()});
-            child = parent;
+            child = std::move(parent);
+        }
+    }
+}
+
+// total size of files in the directory and its subdirectories, files which disappear meanwhile are skipped
+static unsigned long long get_directory_size(const std::filesystem::path &path) {
+    unsigned long long size = 0;
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(path, std::filesystem::directory_options::skip_permission_denied, ec);
+            !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        std::error_code size_ec;
+        if (it->is_regular_file(size_ec)) {
+            const auto file_size = it->file_size(size_ec);
+            size += size_ec ? 0 : file_size;
         }
     }
+    return size;
 }
 
 static std::string strip_prefix(const std::string &from, const std::string &prefix) {
     return from.find(prefix) == 0 ? from.substr(prefix.size()) : from;
 }
 
+// name of the file relative to the download path, as it is stored in the state
+static std::string to_relative_name(const std::filesystem::path &file_name, const std::string &download_path) {
+    const auto relative_name = strip_prefix(path_to_relative(file_name, download_path).string(), "./");
+    return strip_prefix(relative_name, ".\\");
+}
+
+// deletes the file and its folders which become empty
+// kept_folders - folders which are not deleted even if they are empty
+static void delete_child(LinkedFiles &folders, std::string file_name, const std::filesystem::path path_from, const std::unordered_set<std::string> &kept_folders) {
+    while (true) {
+        if (file_name.empty()) {
+            break;
+        }
+        if (file_name == ".") {
+            break;
+        }
+        const auto full_name = path_from / file_name;
+        fprintf(stdout, "Deleting %s\n", full_name.string().c_str());
+        std::filesystem::remove(std::filesystem::u8path(full_name.string()));
+
+        const auto parent = folders.get_parent(file_name);
+        if (!parent.has_value()) {
+            break;
+        }
+        const auto parent_name = parent.value();
+        folders.remove_child(file_name);
+        if (kept_folders.count(parent_name) > 0) {
+            break;
+        }
+
+        if (folders.has_children(parent_name)) {
+            break;
+        }
+        folders.remove_parent(parent_name);
+        file_name = parent_name;
+    }
+}
+
 void AppSync::init_downloading() {
-    const auto ti = torrent_downloader->get_torrent_info();
-    const auto new_files_set = get_updated_files(ti, app_state->get_hashlist());
+    const auto metadata = torrent_downloader->get_metadata();
+    const auto new_files_set = get_updated_files(*metadata, app_state->get_hashlist());
     const auto new_files_set_filtered = filter_complete_files(new_files_set, *app_state);
     // TODO: check if files have been deleted from S3
     // TODO: erase updated files from the state
 
     std::vector new_files(new_files_set_filtered.begin(), new_files_set_filtered.end());
 
-    downloading_files = std::make_shared<DownloadingFiles>(ti, new_files, limit_size);
+    downloading_files = std::make_shared<DownloadingFiles>(metadata, new_files, limit_size);
     folders = std::make_shared<LinkedFiles>();
     populate_folders(*folders, new_files);
 
     download_error = false;
     has_uploading_files = false;
     file_errors.clear();
+    pending_bundle_files.clear();
+    pending_bundle_size = 0;
+    outstanding_downloads = 0;
+    download_request_times.clear();
+    extracting_archives.clear();
+    extracting_folders.clear();
 }
 
 AppSync::AppSync(
@@ -63,22 +147,49 @@ AppSync::AppSync(
     unsigned long long limit_size_bytes,
     std::string download_path_,
     bool extract_files_,
-    bool archive_files_) :
+    bool archive_files_,
+    double prefetch_headroom_,
+    bool reconcile_uploaded_,
+    unsigned long long bundle_threshold_,
+    unsigned long long bundle_size_,
+    bool extract_streaming_,
+    std::shared_ptr<ExtractPool> extract_pool_,
+    std::shared_ptr<Metrics> metrics_) :
     app_state {app_state_},
     s3_uploader {s3_uploader_},
     torrent_downloader {torrent_downloader_},
+    extract_pool {extract_pool_},
+    metrics {metrics_},
     download_path {download_path_},
     extract_files {extract_files_},
     archive_files {archive_files_},
+    extract_streaming {extract_streaming_},
+    reconcile_uploaded {reconcile_uploaded_},
     limit_size {limit_size_bytes},
+    prefetch_size {(unsigned long long) std::min(limit_size_bytes * prefetch_headroom_, (double) LLONG_MAX)},
+    bundle_threshold {bundle_threshold_},
+    bundle_size {bundle_size_ ? bundle_size_ : BUNDLE_SIZE_DEFAULT},
+    pending_bundle_size {0},
+    bundle_name_prefix {std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count())},
+    bundle_count {0},
+    outstanding_downloads {0},
     download_error {false},
     has_uploading_files {false},
     file_errors {}
 {
     init_downloading();
+    if (metrics != nullptr) {
+        // the download directory is walked on the metrics thread, it takes long with many files
+        metrics->add_sampler([path = download_path](Metrics &m) {
+            m.set(METRIC_TEMP_STORAGE_BYTES, get_directory_size(path));
+        });
+    }
 }
 
 std::optional<std::string> AppSync::start() {
+    if (reconcile_uploaded) {
+        reconcile_uploaded_files();
+    }
     init_downloading();
 
     torrent_downloader->start();
@@ -87,10 +198,107 @@ std::optional<std::string> AppSync::start() {
         return s3_start_ret.value();
     }
     const auto chunk = downloading_files->download_next_chunk();
-    torrent_downloader->download_files(chunk);
+    download_files(chunk);
+    prefetch_next_chunk();
     return std::nullopt;
 }
 
+void AppSync::download_files(const std::vector<std::string> &files) {
+    outstanding_downloads += files.size();
+    if (is_tracing()) {
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto &f : files) {
+            download_request_times.emplace(f, now);
+        }
+    }
+    torrent_downloader->download_files(files);
+}
+
+void AppSync::upload_file(const std::string &file_name, const std::string &parent) {
+    has_uploading_files = true;
+    if (bundle_threshold > 0) {
+        std::error_code ec;
+        const auto file_size = std::filesystem::file_size(std::filesystem::u8path((std::filesystem::path(download_path) / file_name).string()), ec);
+        if (!ec && file_size < bundle_threshold) {
+            pending_bundle_files.push_back(file_name);
+            pending_bundle_size += file_size;
+            if (pending_bundle_size >= bundle_size) {
+                flush_bundle();
+            }
+            return;
+        }
+    }
+    // archives are not archived again, they are detected by the upload task
+    s3_uploader->new_file(file_name, archive_files, parent);
+}
+
+void AppSync::flush_bundle() {
+    if (pending_bundle_files.empty()) {
+        return;
+    }
+    bundle_count++;
+    const auto bundle_name = (std::filesystem::path(BUNDLE_FOLDER) / (bundle_name_prefix + "_" + std::to_string(bundle_count) + ".tar")).string();
+    s3_uploader->new_bundle(bundle_name, pending_bundle_files);
+    pending_bundle_files.clear();
+    pending_bundle_size = 0;
+}
+
+static std::string to_object_name(const std::string &file_name) {
+    auto object_name = std::filesystem::path(file_name).lexically_normal().string();
+    std::replace(object_name.begin(), object_name.end(), '\\', '/');
+    return object_name;
+}
+
+void AppSync::reconcile_uploaded_files() {
+    fprintf(stdout, "Listing uploaded files\n");
+    const auto list_ret = s3_uploader->list_files();
+    if (std::holds_alternative<std::string>(list_ret)) {
+        fprintf(stderr, "Could not list uploaded files: %s\n", std::get<std::string>(list_ret).c_str());
+        return;
+    }
+    const auto &uploaded_files = std::get<std::unordered_map<std::string, unsigned long long>>(list_ret);
+    if (uploaded_files.empty()) {
+        return;
+    }
+
+    const auto metadata = torrent_downloader->get_metadata();
+    const auto hashlist = app_state->get_hashlist();
+    unsigned long long reconciled_count = 0;
+    for (unsigned int file_index = 0; file_index < metadata->num_files(); file_index++) {
+        const auto &file_name = metadata->file_path(file_index);
+        // only files that state does not know about, modified files should be uploaded again
+        if (hashlist.count(file_name) > 0 || app_state->get_file_status(file_name).has_value()) {
+            continue;
+        }
+        const auto object_name = to_object_name(file_name);
+        const auto uploaded_iter = uploaded_files.find(object_name);
+        auto is_uploaded = uploaded_iter != uploaded_files.end() && uploaded_iter->second == metadata->file_size(file_index);
+        // archived file size is not known before archiving, so only check that it exists
+        if (!is_uploaded && archive_files) {
+            const auto archived_iter = uploaded_files.find(object_name + ".zip");
+            is_uploaded = archived_iter != uploaded_files.end() && archived_iter->second > 0;
+        }
+        if (!is_uploaded) {
+            continue;
+        }
+        app_state->add_uploading_files(file_name, {});
+        app_state->file_complete(file_name);
+        reconciled_count++;
+    }
+    fprintf(stdout, "Found %llu already uploaded files\n", reconciled_count);
+}
+
+void AppSync::prefetch_next_chunk() {
+    if (prefetch_size == 0) {
+        return;
+    }
+    const auto prefetch_chunk = downloading_files->prefetch_next_chunk(prefetch_size);
+    if (prefetch_chunk.empty()) {
+        return;
+    }
+    torrent_downloader->prefetch_files(prefetch_chunk);
+}
+
 std::vector<file_upload_error_t> AppSync::stop() {
     torrent_downloader->stop();
     s3_uploader->stop();
@@ -98,6 +306,7 @@ std::vector<file_upload_error_t> AppSync::stop() {
 }
 
 std::variant<std::string, std::vector<file_upload_error_t>> AppSync::full_sync() {
+    trace_thread_name("Sync");
     const auto sync_start_ret = start();
     if (sync_start_ret.has_value()) {
         return sync_start_ret.value();
@@ -105,8 +314,13 @@ std::variant<std::string, std::vector<file_upload_error_t>> AppSync::full_sync()
 
     auto &download_progress = torrent_downloader->get_progress_queue();
     auto &upload_progress = s3_uploader->get_progress_queue();
+    auto metrics_update_time = std::chrono::steady_clock::now();
     while(true) {
         if (is_completed()) break;
+        if (metrics != nullptr && std::chrono::steady_clock::now() - metrics_update_time >= std::chrono::milliseconds(METRICS_UPDATE_MS)) {
+            metrics_update_time = std::chrono::steady_clock::now();
+            update_metrics();
+        }
         while (!download_progress.empty()) {
             const auto torrent_event = download_progress.pop_front_waiting();
             if (std::holds_alternative<TorrentProgressDownloadError>(torrent_event)) {
@@ -128,109 +342,250 @@ std::variant<std::string, std::vector<file_upload_error_t>> AppSync::full_sync()
                 continue;
             }
             const auto s3_file_uploaded = std::get<S3ProgressUploadOk>(s3_event);
+            if (s3_file_uploaded.bundle_entry.has_value()) {
+                app_state->add_bundle_file(s3_file_uploaded.bundle_entry.value());
+            } else if (bundle_threshold > 0) {
+                app_state->remove_bundle_file(s3_file_uploaded.file_name);
+            }
             process_s3_file(s3_file_uploaded.file_name);
             continue;
         }
+        while (extract_pool != nullptr && !extract_pool->get_progress_queue().empty()) {
+            const auto extract_event = extract_pool->get_progress_queue().pop_front_waiting();
+            if (std::holds_alternative<ExtractProgressFile>(extract_event)) {
+                const auto &extracted_file = std::get<ExtractProgressFile>(extract_event);
+                process_extracted_file(extracted_file.file_name, extracted_file.file);
+                continue;
+            }
+            const auto &extract_done = std::get<ExtractProgressDone>(extract_event);
+            process_extraction_done(extract_done.file_name, extract_done.result);
+        }
     }
 
     fprintf(stdout, "Downloading torrent completed\n");
     update_hashlist();
-    return stop();
+    const auto errors = stop();
+    if (metrics != nullptr) {
+        update_metrics();
+    }
+    return errors;
+}
+
+void AppSync::update_metrics() {
+    metrics->set(METRIC_DOWNLOAD_PROGRESS_QUEUE_SIZE, torrent_downloader->get_progress_queue().size());
+    metrics->set(METRIC_UPLOAD_PROGRESS_QUEUE_SIZE, s3_uploader->get_progress_queue().size());
+    metrics->set(METRIC_UPLOAD_QUEUE_SIZE, s3_uploader->get_queue_size());
+    metrics->set(METRIC_UPLOAD_RETRY_QUEUE_SIZE, s3_uploader->get_retry_count());
+    metrics->set(METRIC_UPLOADING_FILES, s3_uploader->get_uploading_count());
+    metrics->set(METRIC_UPLOAD_CONCURRENCY, s3_uploader->get_concurrency());
+    metrics->set(METRIC_DOWNLOADING_FILES, outstanding_downloads);
+    if (extract_pool != nullptr) {
+        metrics->set(METRIC_EXTRACT_PROGRESS_QUEUE_SIZE, extract_pool->get_progress_queue().size());
+    }
+    metrics->set(METRIC_EXTRACTING_ARCHIVES, extracting_archives.size());
+    if (limit_size < LLONG_MAX) {
+        metrics->set(METRIC_TEMP_STORAGE_LIMIT_BYTES, limit_size);
+    }
 }
 
 void AppSync::process_torrent_file(std::string file_name) {
+    const auto request_time = download_request_times.find(file_name);
+    if (request_time != download_request_times.end()) {
+        trace_event("download", "torrent", request_time->second, std::chrono::steady_clock::now(), file_name);
+        download_request_times.erase(request_time);
+    }
     const auto file_name_full = std::filesystem::path(download_path) / file_name;
     const auto file_name_str = file_name_full.string();
-    std::vector<std::string> linked_file_names;
 
-    if (extract_files && is_packed(file_name_str)) {
+    const auto is_archive = extract_files && is_packed(file_name_str);
+    // extracted files are archived on disk, so streaming is not used with archiving
+    auto is_streamed = false;
+    if (is_archive && extract_streaming && !archive_files) {
+        const auto upload_ret = upload_archive_files(file_name);
+        is_streamed = std::holds_alternative<std::vector<std::string>>(upload_ret);
+        // extract to disk if files could not be streamed
+        if (!is_streamed) {
+            fprintf(stderr, "Could not stream files from \"%s\": %s\n", file_name_str.c_str(), std::get<std::string>(upload_ret).c_str());
+        }
+    }
+    if (!is_streamed && is_archive) {
         // automatically create folder for extracted files
         const auto extract_folder = folder_for_unpacked_file(file_name_str);
-        const auto extract_ret = unpack_file(file_name_str, extract_folder);
-        // upload without unpacking if extraction failed
-        if (std::holds_alternative<std::string>(extract_ret)) {
-            fprintf(stderr, "Could not extract file \"%s\": %s\n", file_name_str.c_str(), std::get<std::string>(extract_ret).c_str());
+        if (extract_pool != nullptr) {
+            extracting_archives[file_name] = 0;
+            extracting_folders.insert(to_relative_name(extract_folder, download_path));
+            extract_pool->extract(file_name, file_name_full, extract_folder);
         } else {
-            const auto files = std::get<std::vector<file_unpack_info_t>>(extract_ret);
-            std::vector<file_unpack_info_t> filtered_files;
-            std::copy_if(files.begin(), files.end(), std::back_inserter(filtered_files), [](const auto &f) {
-                return !f.error_message.has_value();
+            upload_extracted_files(file_name, unpack_file(file_name_str, extract_folder));
+        }
+    } else if (!is_streamed) {
+        upload_linked_files(file_name, {});
+    }
+    if (outstanding_downloads > 0) {
+        outstanding_downloads--;
+    }
+    // no more files are expected until some uploads complete, so upload small files collected so far
+    if (outstanding_downloads == 0 && extracting_archives.empty()) {
+        flush_bundle();
+    }
+}
+
+void AppSync::process_extracted_file(std::string file_name, file_unpack_info_t file) {
+    const auto linked_file_name = to_relative_name(file.name, download_path);
+    auto &extracted_count = extracting_archives[file_name];
+    // previous children of the archive are replaced when the first file is extracted
+    if (extracted_count == 0) {
+        app_state->add_uploading_files(file_name, {linked_file_name});
+    } else {
+        app_state->add_uploading_file(file_name, linked_file_name);
+    }
+    extracted_count++;
+    populate_folders(*folders, {linked_file_name});
+    upload_file(linked_file_name, file_name);
+}
+
+void AppSync::process_extraction_done(std::string file_name, std::variant<std::vector<file_unpack_info_t>, std::string> extract_ret) {
+    const auto archive_iter = extracting_archives.find(file_name);
+    const auto extracted_count = archive_iter != extracting_archives.end() ? archive_iter->second : 0;
+    extracting_archives.erase(file_name);
+    const auto file_name_full = std::filesystem::path(download_path) / file_name;
+    const auto extract_folder = to_relative_name(folder_for_unpacked_file(file_name_full), download_path);
+    extracting_folders.erase(extract_folder);
+
+    if (extracted_count == 0) {
+        // nothing is uploaded yet, so the archive is processed as if it was extracted at once
+        upload_extracted_files(file_name, extract_ret);
+    } else {
+        auto is_extracted = std::holds_alternative<std::vector<file_unpack_info_t>>(extract_ret);
+        if (is_extracted) {
+            const auto &files = std::get<std::vector<file_unpack_info_t>>(extract_ret);
+            is_extracted = std::none_of(files.begin(), files.end(), [](const auto &f) {
+                return f.error_message.has_value();
             });
-            // upload without unpacking if some files have not been extracted properly
-            if (filtered_files.size() != files.size()) {
-                fprintf(stderr, "Some files were not extracted from \"%s\"\n", file_name_str.c_str());
-            } else {
-                std::transform(filtered_files.begin(), filtered_files.end(), std::back_inserter(linked_file_names), [this](const file_unpack_info_t &f) {
-                    auto linked_file_stripped = strip_prefix(path_to_relative(f.name, download_path).string(), "./");
-                    linked_file_stripped = strip_prefix(linked_file_stripped, ".\\");
-                    return linked_file_stripped;
-                });
-                // erase archive after extraction
-                std::filesystem::remove(std::filesystem::u8path(file_name_str));
-                folders->remove_child(file_name);
+        }
+        if (is_extracted) {
+            // erase archive after extraction
+            std::filesystem::remove(std::filesystem::u8path(file_name_full.string()));
+            folders->remove_child(file_name);
+        } else {
+            // extracted files are uploaded already, so the archive is uploaded in addition to them
+            fprintf(stderr, "Some files were not extracted from \"%s\"\n", file_name_full.string().c_str());
+            app_state->add_uploading_file(file_name, file_name);
+            upload_file(file_name, file_name);
+        }
+        // folder was kept while extracting, delete it if all its files are uploaded already.
+        // Its last child is removed by then, so the folder is no longer a parent, but it is still linked to its own parent
+        if (!folders->has_children(extract_folder) && folders->get_parent(extract_folder).has_value()) {
+            delete_child(*folders, extract_folder, download_path, extracting_folders);
+        }
+        // parent completion is postponed until extraction is done
+        const auto linked_files = app_state->get_uploading_files();
+        const auto parent_iter = linked_files.find(file_name);
+        if (parent_iter == linked_files.end() || parent_iter->second.empty()) {
+            downloading_files->complete_file(file_name);
+            app_state->file_complete(file_name);
+            if (linked_files.empty()) {
+                has_uploading_files = false;
+            }
+            if (!download_error) {
+                download_next_chunk();
             }
-            populate_folders(*folders, linked_file_names);
         }
     }
+    if (outstanding_downloads == 0 && extracting_archives.empty()) {
+        flush_bundle();
+    }
+}
+
+void AppSync::upload_extracted_files(const std::string &file_name, const std::variant<std::vector<file_unpack_info_t>, std::string> &extract_ret) {
+    const auto file_name_str = (std::filesystem::path(download_path) / file_name).string();
+    std::vector<std::string> linked_file_names;
+    // upload without unpacking if extraction failed
+    if (std::holds_alternative<std::string>(extract_ret)) {
+        fprintf(stderr, "Could not extract file \"%s\": %s\n", file_name_str.c_str(), std::get<std::string>(extract_ret).c_str());
+    } else {
+        const auto files = std::get<std::vector<file_unpack_info_t>>(extract_ret);
+        std::vector<file_unpack_info_t> filtered_files;
+        std::copy_if(files.begin(), files.end(), std::back_inserter(filtered_files), [](const auto &f) {
+            return !f.error_message.has_value();
+        });
+        // upload without unpacking if some files have not been extracted properly
+        if (filtered_files.size() != files.size()) {
+            fprintf(stderr, "Some files were not extracted from \"%s\"\n", file_name_str.c_str());
+        } else {
+            std::transform(filtered_files.begin(), filtered_files.end(), std::back_inserter(linked_file_names), [this](const file_unpack_info_t &f) {
+                return to_relative_name(f.name, download_path);
+            });
+            // erase archive after extraction
+            std::filesystem::remove(std::filesystem::u8path(file_name_str));
+            folders->remove_child(file_name);
+        }
+        populate_folders(*folders, linked_file_names);
+    }
+    upload_linked_files(file_name, linked_file_names);
+}
+
+void AppSync::upload_linked_files(const std::string &file_name, const std::vector<std::string> &linked_file_names) {
     app_state->add_uploading_files(file_name, linked_file_names);
     // upload parent file if linked files are empty
     if (linked_file_names.empty()) {
-        has_uploading_files = true;
-        auto should_archive = false;
-        if (!is_packed(file_name) && archive_files) {
-            should_archive = true;
-        }
-        s3_uploader->new_file(file_name, should_archive);
+        upload_file(file_name, file_name);
     }
     // upload linked files
     for (const auto &f: linked_file_names) {
-        has_uploading_files = true;
-        auto should_archive = false;
-        if (!is_packed(f) && archive_files) {
-            should_archive = true;
+        upload_file(f, file_name);
+    }
+}
+
+std::variant<std::vector<std::string>, std::string> AppSync::upload_archive_files(const std::string &file_name) {
+    const auto file_name_full = std::filesystem::path(download_path) / file_name;
+    const auto list_ret = list_archive_entries(file_name_full);
+    if (std::holds_alternative<std::string>(list_ret)) {
+        return std::get<std::string>(list_ret);
+    }
+    const auto entries = std::get<std::vector<archive_entry_info_t>>(list_ret);
+    if (entries.empty()) {
+        return std::string("Archive has no files");
+    }
+    // same folder as the archive would be extracted to
+    const auto output_folder = to_relative_name(folder_for_unpacked_file(file_name_full), download_path);
+    std::vector<std::string> entry_names;
+    std::vector<std::string> linked_file_names;
+    std::unordered_set<std::string> unique_names;
+    for (const auto &e : entries) {
+        // files with the same name would be uploaded to the same object, so only the first one is uploaded
+        if (!unique_names.insert(e.name).second) {
+            continue;
         }
-        s3_uploader->new_file(f, should_archive);
+        entry_names.push_back(e.name);
+        linked_file_names.push_back((std::filesystem::path(output_folder) / std::filesystem::u8path(e.name)).string());
     }
+    app_state->add_uploading_files(file_name, linked_file_names);
+    has_uploading_files = true;
+    s3_uploader->new_archive(file_name, output_folder, entry_names);
+    return linked_file_names;
 }
 
 void AppSync::process_torrent_error(std::string error_message) {
     download_error = true;
     torrent_downloader->stop();
+    flush_bundle();
 }
 
-static void delete_child(LinkedFiles &folders, std::string file_name, const std::filesystem::path path_from) {
-    while (true) {
-        if (file_name.empty()) {
-            break;
-        }
-        if (file_name == ".") {
-            break;
-        }
-        const auto full_name = path_from / file_name;
-        fprintf(stdout, "Deleting %s\n", full_name.string().c_str());
-        std::filesystem::remove(std::filesystem::u8path(full_name.string()));
-
-        const auto parent = folders.get_parent(file_name);
-        if (!parent.has_value()) {
-            break;
-        }
-        const auto parent_name = parent.value();
-        folders.remove_child(file_name);
-
-        const auto children = folders.get_files();
-        const auto parent_iter = children.find(parent_name);
-        if (parent_iter != children.end() && parent_iter->second.size() > 0) {
-            break;
-        }
-        folders.remove_parent(parent_name);
-        file_name = parent_name;
-    }
-}
-
-static void s3_file_upload_complete(const std::filesystem::path path_from, LinkedFiles &folders, const std::string relative_filename, DownloadingFiles &downloading_files, AppState &state) {
+// extracting_archives - archives which are not completed until extraction is done
+// extracting_folders - folders of extracting archives, they are not deleted while extraction is running
+static void s3_file_upload_complete(
+    const std::filesystem::path path_from,
+    LinkedFiles &folders,
+    const std::string relative_filename,
+    DownloadingFiles &downloading_files,
+    AppState &state,
+    const std::unordered_map<std::string, unsigned long long> &extracting_archives,
+    const std::unordered_set<std::string> &extracting_folders
+) {
     const auto parent = state.get_uploading_parent(relative_filename);
 
-    delete_child(folders, relative_filename, path_from);
+    delete_child(folders, relative_filename, path_from, extracting_folders);
     state.file_complete(relative_filename);
     if (!parent.has_value()) {
         downloading_files.complete_file(relative_filename);
@@ -245,13 +600,24 @@ static void s3_file_upload_complete(const std::filesystem::path path_from, Linke
     if (parent_iter != linked_files.end() && parent_iter->second.size() > 0) {
         return;
     }
+    // more files of the archive are expected
+    if (extracting_archives.count(parent_file_name) > 0) {
+        return;
+    }
+    // streamed archive is kept on disk until all its files are uploaded
+    if (std::filesystem::exists(std::filesystem::u8path((path_from / parent_file_name).string()))) {
+        delete_child(folders, parent_file_name, path_from, extracting_folders);
+    }
     downloading_files.complete_file(parent_file_name);
     state.file_complete(parent_file_name);
 }
 
 // update state after uploading file to s3
 void AppSync::process_s3_file(std::string file_name) {
-    s3_file_upload_complete(download_path, *folders, file_name, *downloading_files, *app_state);
+    if (metrics != nullptr) {
+        metrics->add(METRIC_UPLOADED_FILES);
+    }
+    s3_file_upload_complete(download_path, *folders, file_name, *downloading_files, *app_state, extracting_archives, extracting_folders);
     if (app_state->get_uploading_files().empty()) {
         has_uploading_files = false;
     }
@@ -266,29 +632,37 @@ void AppSync::process_s3_file(std::string file_name) {
         return;
     }
     // check for completed downloads only on S3 events for optimization purpose
+    download_next_chunk();
+}
+
+void AppSync::download_next_chunk() {
     const auto next_chunk = downloading_files->download_next_chunk();
     if (next_chunk.empty()) {
         return;
     }
-    torrent_downloader->download_files(next_chunk);
+    // prefetched files among next_chunk are promoted to the normal priority
+    download_files(next_chunk);
+    prefetch_next_chunk();
 }
 
 void AppSync::process_s3_file_error(std::string file_name, std::string error_message) {
     file_errors.push_back(file_upload_error_t { file_name, error_message });
+    if (metrics != nullptr) {
+        metrics->add(METRIC_UPLOAD_ERRORS);
+    }
     // process as completed to avoid infinite loop
-    s3_file_upload_complete(download_path, *folders, file_name, *downloading_files, *app_state);
+    s3_file_upload_complete(download_path, *folders, file_name, *downloading_files, *app_state, extracting_archives, extracting_folders);
     if (app_state->get_uploading_files().empty()) {
         has_uploading_files = false;
     }
 }
 
 bool AppSync::is_completed() const {
-    return (downloading_files->is_completed() || download_error) && !has_uploading_files;
+    return (downloading_files->is_completed() || download_error) && !has_uploading_files && extracting_archives.empty();
 }
 
 void AppSync::update_hashlist() {
-    const auto ti = torrent_downloader->get_torrent_info();
-    auto new_hashlist = create_hashlist(ti, app_state->get_completed_files());
+    auto new_hashlist = create_hashlist(*torrent_downloader->get_metadata(), app_state->get_completed_files());
     // remove files with errors from hashlist
     for (const auto &f : file_errors) {
         new_hashlist.erase(f.file_name);
@@ -9,7 +9,9 @@
 #include "../s3/s3.hpp"
 #include "../downloading_files/downloading_files.hpp"
 #include "../torrent/torrent_download.hpp"
+#include "../extract/extract_pool.hpp"
 #include "../linked_files/linked_files.hpp"
+#include "../metrics/metrics.hpp"
 
 struct file_upload_error_t {
     std::string file_name;
@@ -27,7 +29,14 @@ public:
         unsigned long long limit_size_bytes,
         std::string download_path_,
         bool extract_files_,
-        bool archive_files_);
+        bool archive_files_,
+        double prefetch_headroom_ = 0.0,
+        bool reconcile_uploaded_ = false,
+        unsigned long long bundle_threshold_ = 0,
+        unsigned long long bundle_size_ = 0,
+        bool extract_streaming_ = false,
+        std::shared_ptr<ExtractPool> extract_pool_ = nullptr,
+        std::shared_ptr<Metrics> metrics_ = nullptr);
 
     // start sync by selecting next chunk and downloading it
     // optionally returns an error
@@ -44,6 +53,12 @@ public:
     // update state after downloading file from a torrent
     void process_torrent_file(std::string file_name);
 
+    // upload file which is extracted by the extract pool while the rest of the archive is extracted
+    void process_extracted_file(std::string file_name, file_unpack_info_t file);
+
+    // update state after the extract pool finished extraction of the archive
+    void process_extraction_done(std::string file_name, std::variant<std::vector<file_unpack_info_t>, std::string> extract_ret);
+
     // update state after torrent error
     void process_torrent_error(std::string error_message);
 
@@ -60,6 +75,27 @@ public:
 
 protected:
     void init_downloading();
+    // request pieces of the next planned files with low priority while the current chunk is uploading
+    void prefetch_next_chunk();
+    // mark files unknown to the state as ready if they are already uploaded to S3 with the same size
+    void reconcile_uploaded_files();
+    // upload file separately or add it to the pending bundle
+    // parent - file which becomes ready after this file is uploaded
+    void upload_file(const std::string &file_name, const std::string &parent);
+    // upload extracted files, or the archive itself if extraction failed
+    void upload_extracted_files(const std::string &file_name, const std::variant<std::vector<file_unpack_info_t>, std::string> &extract_ret);
+    // upload linked files of file_name, or the file itself if there are no linked files
+    void upload_linked_files(const std::string &file_name, const std::vector<std::string> &linked_file_names);
+    // upload pending bundle
+    void flush_bundle();
+    void download_files(const std::vector<std::string> &files);
+    // start downloading of the next chunk if there is space for it
+    void download_next_chunk();
+    // upload files of the archive without extraction to disk
+    // returns names of the uploading files or an error message
+    std::variant<std::vector<std::string>, std::string> upload_archive_files(const std::string &file_name);
+    // sample queue sizes and files in progress, temporary storage usage is sampled on the metrics thread
+    void update_metrics();
 
 private:
     std::shared_ptr<AppState> app_state;
@@ -67,10 +103,37 @@ private:
     std::shared_ptr<LinkedFiles> folders;
     std::shared_ptr<S3Uploader> s3_uploader;
     std::shared_ptr<TorrentDownloader> torrent_downloader;
+    // extracts archives on worker threads. Archives are extracted synchronously if set to nullptr
+    std::shared_ptr<ExtractPool> extract_pool;
+    // queue sizes and temporary storage usage are reported during full_sync if set
+    std::shared_ptr<Metrics> metrics;
     std::string download_path;
     bool extract_files;
     bool archive_files;
+    // archive files are uploaded directly from the archive, which is deleted after all of them are uploaded
+    bool extract_streaming;
+    bool reconcile_uploaded;
     unsigned long long limit_size;
+    // extra temporary storage for prefetched files. Prefetch is disabled if set to 0
+    unsigned long long prefetch_size;
+    // files smaller than bundle_threshold are packed into bundles. Bundling is disabled if set to 0
+    unsigned long long bundle_threshold;
+    // bundle is uploaded when it reaches bundle_size
+    unsigned long long bundle_size;
+    std::vector<std::string> pending_bundle_files;
+    unsigned long long pending_bundle_size;
+    // unique prefix of bundle names created during this run
+    std::string bundle_name_prefix;
+    unsigned long long bundle_count;
+    // requested files which are not downloaded yet
+    unsigned long long outstanding_downloads;
+    // time when files were requested from the torrent, only kept while tracing
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> download_request_times;
+    // archives which are being extracted by the extract pool
+    // key - archive name, value - number of files extracted so far
+    std::unordered_map<std::string, unsigned long long> extracting_archives;
+    // folders of extracting archives, they are not deleted when all files extracted so far are uploaded
+    std::unordered_set<std::string> extracting_folders;
     bool download_error;
     bool has_uploading_files;
     std::vector<file_upload_error_t> file_errors;
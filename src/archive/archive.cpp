@@ -7,12 +7,58 @@
 #include <unistd.h>
 #endif // _WIN32
 
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+
 #include <archive.h>
 #include <archive_entry.h>
+#include <zlib.h>
 
 #include "./archive.hpp"
+#include "../trace/trace.hpp"
+
+// archives and source files are read by this amount, unless changed with set_archive_block_size
+#define ARCHIVE_BLOCK_SIZE_DEFAULT (64 * 1024)
+#define ARCHIVE_BLOCK_SIZE_MIN 512
+// files are split into blocks of this size when compressed with multiple threads
+#define DEFLATE_BLOCK_SIZE (256 * 1024)
+#define DEFLATE_DICTIONARY_SIZE (32 * 1024)
+// smaller files are compressed with a single thread
+#define PARALLEL_DEFLATE_SIZE_MIN (4 * DEFLATE_BLOCK_SIZE)
+
+#define ZIP64_LIMIT 0xFFFFFFFFULL
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034b50
+#define ZIP_DATA_DESCRIPTOR_SIGNATURE 0x08074b50
+#define ZIP_CENTRAL_HEADER_SIGNATURE 0x02014b50
+#define ZIP64_END_SIGNATURE 0x06064b50
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP_END_SIGNATURE 0x06054b50
+#define ZIP_VERSION_DEFLATE 20
+#define ZIP_VERSION_ZIP64 45
+// sizes are in the data descriptor, file name is UTF-8
+#define ZIP_FLAGS ((1 << 3) | (1 << 11))
+#define ZIP_METHOD_DEFLATE 8
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP64_EXTRA_SIZE 16
+
+// detection results of this many files are cached, the cache is cleared when it is full
+#define PACKED_CACHE_SIZE_MAX 65536
+// longest signature of supported archive formats
+#define ARCHIVE_SIGNATURE_SIZE 8
+
+static std::atomic<size_t> archive_block_size {ARCHIVE_BLOCK_SIZE_DEFAULT};
+
+void set_archive_block_size(size_t block_size) {
+    archive_block_size = std::max(block_size, (size_t) ARCHIVE_BLOCK_SIZE_MIN);
+}
 
-#define READ_BLOCK_SIZE 10240
+size_t get_archive_block_size() {
+    return archive_block_size;
+}
 
 static inline bool ends_with(std::string const &value, std::string const &ending) {
     if (ending.size() > value.size()) return false;
@@ -38,32 +84,109 @@ static std::string copy_data(std::string file_name, archive *ar, archive *aw) {
     }
 }
 
-bool is_packed(std::filesystem::path file_name) {
-    if (!ends_with(file_name.string(), ".zip") && !ends_with(file_name.string(), ".rar") && !ends_with(file_name.string(), ".7z")) {
-        return false;
-    }
+// reader of supported archive formats
+static archive *new_archive_reader() {
     archive *arch = archive_read_new();
     archive_read_support_format_7zip(arch);
     archive_read_support_format_zip(arch);
     archive_read_support_format_rar(arch);
     archive_read_support_format_rar5(arch);
     archive_read_support_filter_all(arch);
-    const auto ret = archive_read_open_filename(arch, std::filesystem::u8path(file_name.string()).string().c_str(), READ_BLOCK_SIZE);
+    return arch;
+}
+
+// true if the name could not be used as a path relative to the extraction folder
+static bool is_unsafe_entry_name(const std::string &name) {
+    const auto path = std::filesystem::u8path(name);
+    if (path.has_root_path()) {
+        return true;
+    }
+    for (const auto &part : path) {
+        if (part == "..") {
+            return true;
+        }
+    }
+    return false;
+}
+
+// signatures at the beginning of zip, rar, rar5 and 7zip files
+static bool has_archive_signature(const std::filesystem::path &file_name) {
+    static const std::vector<std::string> signatures {
+        std::string("PK\x03\x04", 4),
+        // empty zip archive
+        std::string("PK\x05\x06", 4),
+        // spanned zip archive
+        std::string("PK\x07\x08", 4),
+        std::string("Rar!\x1a\x07\x00", 7),
+        std::string("Rar!\x1a\x07\x01\x00", 8),
+        std::string("7z\xbc\xaf\x27\x1c", 6),
+    };
+    std::ifstream file(std::filesystem::u8path(file_name.string()), std::ios::binary);
+    char header[ARCHIVE_SIGNATURE_SIZE];
+    file.read(header, ARCHIVE_SIGNATURE_SIZE);
+    const auto header_size = (size_t) file.gcount();
+    return std::any_of(signatures.begin(), signatures.end(), [&](const std::string &signature) {
+        return header_size >= signature.size() && memcmp(header, signature.data(), signature.size()) == 0;
+    });
+}
+
+static bool can_open_archive(const std::filesystem::path &file_name) {
+    archive *arch = new_archive_reader();
+    const auto ret = archive_read_open_filename(arch, std::filesystem::u8path(file_name.string()).string().c_str(), get_archive_block_size());
     archive_read_close(arch);
     archive_read_free(arch);
     return ret == ARCHIVE_OK;
 }
 
-std::variant<std::vector<file_unpack_info_t>, std::string> unpack_file(std::filesystem::path file_name, std::filesystem::path output_directory) {
+// detection result is valid while the file size and modification time are the same
+struct packed_cache_entry_t {
+    unsigned long long size;
+    std::filesystem::file_time_type modified;
+    bool is_packed;
+};
+
+static std::mutex packed_cache_mutex;
+// key - normalized file path
+static std::unordered_map<std::string, packed_cache_entry_t> packed_cache;
+
+bool is_packed(std::filesystem::path file_name) {
+    if (!ends_with(file_name.string(), ".zip") && !ends_with(file_name.string(), ".rar") && !ends_with(file_name.string(), ".7z")) {
+        return false;
+    }
+    const auto path = std::filesystem::u8path(file_name.string());
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    const auto modified = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return false;
+    }
+    const auto key = file_name.lexically_normal().string();
+    {
+        std::lock_guard<std::mutex> lock(packed_cache_mutex);
+        const auto cached = packed_cache.find(key);
+        if (cached != packed_cache.end() && cached->second.size == size && cached->second.modified == modified) {
+            return cached->second.is_packed;
+        }
+    }
+    // signature check is cheaper than opening the archive, which could read its end for some formats
+    const auto ret = has_archive_signature(file_name) && can_open_archive(file_name);
+    std::lock_guard<std::mutex> lock(packed_cache_mutex);
+    if (packed_cache.size() >= PACKED_CACHE_SIZE_MAX) {
+        packed_cache.clear();
+    }
+    packed_cache[key] = packed_cache_entry_t { size, modified, ret };
+    return ret;
+}
+
+std::variant<std::vector<file_unpack_info_t>, std::string> unpack_file(std::filesystem::path file_name, std::filesystem::path output_directory, std::function<void(const file_unpack_info_t &)> on_file_extracted) {
+    TraceSpan span("extract", "archive", file_name.string());
     std::vector<file_unpack_info_t> unpacked_files;
-    archive *arch = archive_read_new();
-    archive_read_support_format_7zip(arch);
-    archive_read_support_format_zip(arch);
-    archive_read_support_format_rar(arch);
-    archive_read_support_format_rar5(arch);
-    archive_read_support_filter_all(arch);
+    archive *arch = new_archive_reader();
 
-    const auto ret = archive_read_open_filename(arch, std::filesystem::u8path(file_name.string()).string().c_str(), READ_BLOCK_SIZE);
+    const auto ret = archive_read_open_filename(arch, std::filesystem::u8path(file_name.string()).string().c_str(), get_archive_block_size());
     if (ret != ARCHIVE_OK) {
         archive_read_close(arch);
         archive_read_free(arch);
@@ -109,6 +232,9 @@ std::variant<std::vector<file_unpack_info_t>, std::string> unpack_file(std::file
             continue;
         }
         unpacked_files.push_back(file_unpack_info_t { new_extracted_file_name.string(), std::nullopt });
+        if (on_file_extracted) {
+            on_file_extracted(unpacked_files.back());
+        }
     }
     archive_read_close(arch);
     archive_read_free(arch);
@@ -117,71 +243,643 @@ std::variant<std::vector<file_unpack_info_t>, std::string> unpack_file(std::file
     return unpacked_files;
 }
 
-std::optional<std::string> zip_file(std::filesystem::path source_path, std::filesystem::path dest_path) {
+std::variant<std::vector<archive_entry_info_t>, std::string> list_archive_entries(std::filesystem::path file_name) {
+    ArchiveEntryStreamBuf reader(file_name);
+    std::vector<archive_entry_info_t> entries;
+    while (true) {
+        const auto ret = reader.next_entry();
+        if (std::holds_alternative<std::string>(ret)) {
+            return std::get<std::string>(ret);
+        }
+        const auto entry = std::get<std::optional<archive_entry_info_t>>(ret);
+        if (!entry.has_value()) {
+            break;
+        }
+        if (is_unsafe_entry_name(entry->name)) {
+            return std::string("File name \"") + entry->name + "\" in archive \"" + file_name.string() + "\" points outside of the archive";
+        }
+        entries.push_back(entry.value());
+    }
+    return entries;
+}
+
+ArchiveEntryStreamBuf::ArchiveEntryStreamBuf(std::filesystem::path file_name_) :
+    file_name {file_name_},
+    arch {nullptr},
+    block {nullptr},
+    block_size {0},
+    block_offset {0},
+    zeros(get_archive_block_size(), 0),
+    position {0},
+    is_entry_finished {true} {
+    setg(nullptr, nullptr, nullptr);
+    arch = new_archive_reader();
+    if (archive_read_open_filename(arch, std::filesystem::u8path(file_name.string()).string().c_str(), get_archive_block_size()) != ARCHIVE_OK) {
+        archive_read_free(arch);
+        arch = nullptr;
+        fail("could not open archive");
+    }
+}
+
+ArchiveEntryStreamBuf::~ArchiveEntryStreamBuf() {
+    if (arch != nullptr) {
+        archive_read_close(arch);
+        archive_read_free(arch);
+    }
+}
+
+std::optional<std::string> ArchiveEntryStreamBuf::error() const {
+    return error_message;
+}
+
+void ArchiveEntryStreamBuf::fail(const std::string &message) {
+    error_message = std::string("Failed to read archive \"") + file_name.string() + "\": " + message;
+    is_entry_finished = true;
+}
+
+std::variant<std::optional<archive_entry_info_t>, std::string> ArchiveEntryStreamBuf::next_entry() {
+    if (arch == nullptr) {
+        return error_message.value();
+    }
+    setg(nullptr, nullptr, nullptr);
+    block = nullptr;
+    block_size = 0;
+    block_offset = 0;
+    position = 0;
+    error_message = std::nullopt;
+    while (true) {
+        archive_entry *entry = nullptr;
+        const auto ret = archive_read_next_header(arch, &entry);
+        if (ret == ARCHIVE_EOF) {
+            is_entry_finished = true;
+            return std::nullopt;
+        }
+        if (ret != ARCHIVE_OK) {
+            fail(archive_error_string(arch) != nullptr ? archive_error_string(arch) : "could not read file header");
+            return error_message.value();
+        }
+        // directories are created implicitly by object names, links are not supported by S3
+        if (archive_entry_filetype(entry) != AE_IFREG) {
+            continue;
+        }
+        const auto *entry_file_name = archive_entry_pathname_utf8(entry);
+        if (entry_file_name == nullptr) {
+            fail("could not get name of file in archive");
+            return error_message.value();
+        }
+        if (!archive_entry_size_is_set(entry)) {
+            fail(std::string("size of \"") + entry_file_name + "\" is unknown");
+            return error_message.value();
+        }
+        is_entry_finished = false;
+        return archive_entry_info_t { entry_file_name, (unsigned long long) archive_entry_size(entry) };
+    }
+}
+
+ArchiveEntryStreamBuf::int_type ArchiveEntryStreamBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    position += egptr() - eback();
+    setg(nullptr, nullptr, nullptr);
+    while (!is_entry_finished) {
+        if (block == nullptr) {
+            const void *buff = nullptr;
+            size_t size = 0;
+            la_int64_t offset = 0;
+            const auto ret = archive_read_data_block(arch, &buff, &size, &offset);
+            if (ret == ARCHIVE_EOF) {
+                is_entry_finished = true;
+                break;
+            }
+            if (ret != ARCHIVE_OK) {
+                fail(archive_error_string(arch) != nullptr ? archive_error_string(arch) : "could not read file data");
+                break;
+            }
+            block = static_cast<const char *>(buff);
+            block_size = size;
+            block_offset = (off_type) offset;
+        }
+        // data block of a sparse file starts after a hole
+        if (block_offset > position) {
+            const auto hole_size = (size_t) std::min(block_offset - position, (off_type) zeros.size());
+            setg(zeros.data(), zeros.data(), zeros.data() + hole_size);
+            break;
+        }
+        auto *data = const_cast<char *>(block);
+        const auto size = block_size;
+        block = nullptr;
+        if (size > 0) {
+            setg(data, data, data + size);
+            break;
+        }
+    }
+    if (gptr() == egptr()) {
+        return traits_type::eof();
+    }
+    return traits_type::to_int_type(*gptr());
+}
+
+ArchiveEntryStreamBuf::pos_type ArchiveEntryStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in)) {
+        return pos_type(off_type(-1));
+    }
+    // report current position
+    if (dir == std::ios_base::cur && off == 0) {
+        return pos_type(position + (gptr() - eback()));
+    }
+    if (dir == std::ios_base::beg) {
+        return seekpos(pos_type(off), which);
+    }
+    return pos_type(off_type(-1));
+}
+
+ArchiveEntryStreamBuf::pos_type ArchiveEntryStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    // archive data could not be read again, so only the current position at the beginning is accepted
+    if (!(which & std::ios_base::in) || off_type(pos) != 0 || position + (gptr() - eback()) != 0) {
+        return pos_type(off_type(-1));
+    }
+    return pos;
+}
+
+std::optional<std::string> zip_file(std::filesystem::path source_path, std::filesystem::path dest_path, std::shared_ptr<DeflatePool> deflate_pool, compression_choice_t compression) {
+    TraceSpan span("zip", "zip", source_path.string());
+    ZipStreamBuf zip_buffer(source_path, deflate_pool, compression);
+    if (zip_buffer.error().has_value()) {
+        return zip_buffer.error();
+    }
+    std::filesystem::create_directories(std::filesystem::u8path(dest_path.parent_path().string()));
+    std::ofstream file(std::filesystem::u8path(dest_path.string()), std::ios::binary);
+    if (!file) {
+        return std::string("Failed to write file \"") + dest_path.string() + "\"";
+    }
+    file << &zip_buffer;
+    if (zip_buffer.error().has_value()) {
+        return zip_buffer.error();
+    }
+    if (!file) {
+        return std::string("Failed to write file \"") + dest_path.string() + "\"";
+    }
+    return std::nullopt;
+}
+
+std::variant<std::vector<bundle_entry_t>, std::string> bundle_files(const std::vector<std::string> &files, std::filesystem::path source_directory, std::filesystem::path dest_path) {
+    TraceSpan span("bundle", "archive", dest_path.filename().string());
     const auto dest_file = std::filesystem::u8path(dest_path.string()).string();
     auto *arch = archive_write_new();
     archive_write_set_options(arch, "hdrcharset=UTF-8");
-    auto ret = archive_write_set_format_zip(arch);
-    if (ret != ARCHIVE_OK) {
-        const auto err_string = archive_error_string(arch);
-        archive_write_close(arch);
-        archive_write_free(arch);
-        return std::string("Failed to create archive from \"") + source_path.string() + "\": " + err_string;
-    }
-    ret = archive_write_zip_set_compression_deflate(arch);
+    // pax headers keep long and unicode file names
+    auto ret = archive_write_set_format_pax_restricted(arch);
     if (ret != ARCHIVE_OK) {
         const auto err_string = archive_error_string(arch);
-        archive_write_close(arch);
         archive_write_free(arch);
-        return std::string("Failed to create archive from \"") + source_path.string() + "\": " + err_string;
+        return std::string("Failed to create bundle \"") + dest_path.string() + "\": " + err_string;
     }
     std::filesystem::create_directories(std::filesystem::u8path(dest_path.parent_path().string()));
 
-    auto fd = open(dest_file.c_str(), O_RDWR | O_CREAT | O_TRUNC);
+#ifdef _WIN32
+    auto fd = open(dest_file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0644);
+#else
+    auto fd = open(dest_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif // _WIN32
     if (fd < 0) {
+        archive_write_free(arch);
         return std::string("Failed to write file \"") + dest_file + "\"";
     }
 
     ret = archive_write_open_fd(arch, fd);
     if (ret != ARCHIVE_OK) {
         const auto err_string = archive_error_string(arch);
-        archive_write_close(arch);
         archive_write_free(arch);
         close(fd);
-        return std::string("Failed to create archive from \"") + source_path.string() + "\": " + err_string;
+        return std::string("Failed to create bundle \"") + dest_path.string() + "\": " + err_string;
+    }
+
+    std::vector<bundle_entry_t> entries;
+    std::vector<char> buff(get_archive_block_size());
+    for (const auto &file_name : files) {
+        const auto source_path = std::filesystem::u8path((source_directory / file_name).string());
+        std::error_code ec;
+        const auto file_size = std::filesystem::file_size(source_path, ec);
+        std::ifstream file(source_path, std::ios::binary);
+        if (ec || !file) {
+            archive_write_close(arch);
+            archive_write_free(arch);
+            close(fd);
+            return std::string("Failed to add \"") + file_name + "\" to bundle";
+        }
+
+        auto *entry = archive_entry_new();
+        archive_entry_set_pathname_utf8(entry, std::filesystem::path(file_name).generic_string().c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, file_size);
+        ret = archive_write_header(arch, entry);
+        archive_entry_free(entry);
+        if (ret != ARCHIVE_OK) {
+            const auto err_string = archive_error_string(arch);
+            archive_write_close(arch);
+            archive_write_free(arch);
+            close(fd);
+            return std::string("Failed to add \"") + file_name + "\" to bundle: " + err_string;
+        }
+        // the output is not compressed, so bytes written so far is the offset of the file content
+        entries.push_back(bundle_entry_t { file_name, "", (unsigned long long) archive_filter_bytes(arch, -1), file_size });
+
+        unsigned long long written = 0;
+        while (written < file_size && file) {
+            file.read(buff.data(), buff.size());
+            const auto bytes_read = file.gcount();
+            if (bytes_read <= 0) {
+                break;
+            }
+            archive_write_data(arch, buff.data(), static_cast<size_t>(bytes_read));
+            written += bytes_read;
+        }
+        archive_write_finish_entry(arch);
+        if (written != file_size) {
+            archive_write_close(arch);
+            archive_write_free(arch);
+            close(fd);
+            return std::string("File \"") + file_name + "\" changed while adding to bundle";
+        }
+    }
+    ret = archive_write_close(arch);
+    archive_write_free(arch);
+    close(fd);
+    if (ret != ARCHIVE_OK) {
+        return std::string("Failed to write bundle \"") + dest_path.string() + "\"";
+    }
+    return entries;
+}
+
+// appends compressed data to the output buffer of ZipStreamBuf
+static la_ssize_t zip_stream_write(struct archive *arch, void *client_data, const void *buffer, size_t length) {
+    auto *output = static_cast<std::vector<char> *>(client_data);
+    const auto *data = static_cast<const char *>(buffer);
+    output->insert(output->end(), data, data + length);
+    return (la_ssize_t) length;
+}
+
+// little endian values of zip headers
+static void put_u16(std::vector<char> &output, uint16_t value) {
+    output.push_back((char) (value & 0xFF));
+    output.push_back((char) (value >> 8));
+}
+
+static void put_u32(std::vector<char> &output, uint32_t value) {
+    put_u16(output, (uint16_t) (value & 0xFFFF));
+    put_u16(output, (uint16_t) (value >> 16));
+}
+
+static void put_u64(std::vector<char> &output, uint64_t value) {
+    put_u32(output, (uint32_t) (value & 0xFFFFFFFF));
+    put_u32(output, (uint32_t) (value >> 32));
+}
+
+ZipStreamBuf::ZipStreamBuf(std::filesystem::path source_path_, std::shared_ptr<DeflatePool> deflate_pool_, compression_choice_t compression_) :
+    source_path {source_path_},
+    deflate_pool {deflate_pool_},
+    compression {compression_},
+    arch {nullptr},
+    position {0},
+    finished {false},
+    is_input_finished {false},
+    is_zip64 {false},
+    crc {0},
+    uncompressed_size {0},
+    compressed_size {0},
+    input_size {0},
+    compression_time {0},
+    dos_time {0},
+    dos_date {0} {
+    open();
+}
+
+ZipStreamBuf::~ZipStreamBuf() {
+    close();
+}
+
+std::optional<std::string> ZipStreamBuf::error() const {
+    return error_message;
+}
+
+compression_stats_t ZipStreamBuf::get_stats() const {
+    compression_stats_t stats;
+    if (compression.method == COMPRESSION_STORE) {
+        stats.stored_files = 1;
+    } else {
+        stats.deflated_files = 1;
+    }
+    stats.input_size = input_size;
+    stats.output_size = (unsigned long long) (position + (egptr() - eback()));
+    stats.compression_time = compression_time;
+    return stats;
+}
+
+void ZipStreamBuf::fail(const std::string &message) {
+    error_message = std::string("Failed to create archive from \"") + source_path.string() + "\": " + message;
+    finished = true;
+}
+
+void ZipStreamBuf::open() {
+    output.clear();
+    position = 0;
+    finished = false;
+    error_message = std::nullopt;
+    input_size = 0;
+    compression_time = std::chrono::nanoseconds(0);
+    setg(output.data(), output.data(), output.data());
+
+    file.clear();
+    file.open(std::filesystem::u8path(source_path.string()), std::ios::binary);
+    if (!file) {
+        fail("could not open file");
+        return;
+    }
+    std::error_code ec;
+    const auto file_size = std::filesystem::file_size(std::filesystem::u8path(source_path.string()), ec);
+    // small files are compressed faster than blocks are distributed between threads
+    if (compression.method == COMPRESSION_DEFLATE && deflate_pool != nullptr && deflate_pool->get_thread_count() > 1 && !ec && file_size >= PARALLEL_DEFLATE_SIZE_MIN) {
+        input.resize(DEFLATE_BLOCK_SIZE);
+        pending_blocks.clear();
+        dictionary.clear();
+        is_input_finished = false;
+        // compressed size is not known in advance, so use zip64 if it could exceed 4 GB
+        is_zip64 = file_size + file_size / 100 + DEFLATE_BLOCK_SIZE >= ZIP64_LIMIT;
+        crc = (uint32_t) crc32(0L, Z_NULL, 0);
+        uncompressed_size = 0;
+        compressed_size = 0;
+        write_local_header();
+        setg(output.data(), output.data(), output.data() + output.size());
+        return;
+    }
+
+    input.resize(get_archive_block_size());
+    arch = archive_write_new();
+    // pass data to the callback as soon as it is compressed, without padding of the last block
+    archive_write_set_bytes_per_block(arch, 0);
+    archive_write_set_bytes_in_last_block(arch, 1);
+    if (archive_write_set_format_zip(arch) != ARCHIVE_OK) {
+        fail(archive_error_string(arch));
+        return;
+    }
+    const auto ret_compression = compression.method == COMPRESSION_STORE ? archive_write_zip_set_compression_store(arch) : archive_write_zip_set_compression_deflate(arch);
+    if (ret_compression != ARCHIVE_OK) {
+        fail(archive_error_string(arch));
+        return;
+    }
+    if (compression.method == COMPRESSION_DEFLATE && compression.level >= 0) {
+        archive_write_set_format_option(arch, "zip", "compression-level", std::to_string(compression.level).c_str());
+    }
+    // format options are applied to the selected format only
+    archive_write_set_options(arch, "hdrcharset=UTF-8");
+    if (archive_write_open(arch, &output, nullptr, zip_stream_write, nullptr) != ARCHIVE_OK) {
+        fail(archive_error_string(arch));
+        return;
     }
     auto *entry = archive_entry_new();
-    archive_entry_set_pathname(entry, source_path.filename().string().c_str());
+    archive_entry_set_pathname_utf8(entry, source_path.filename().string().c_str());
     archive_entry_set_filetype(entry, AE_IFREG);
-    ret = archive_write_header(arch, entry);
+    archive_entry_set_perm(entry, 0644);
+    const auto ret = archive_write_header(arch, entry);
+    archive_entry_free(entry);
     if (ret != ARCHIVE_OK) {
-        const auto err_string = archive_error_string(arch);
-        archive_write_close(arch);
-        archive_write_free(arch);
-        close(fd);
-        return std::string("Failed to create archive from \"") + source_path.string() + "\": " + err_string;
+        fail(archive_error_string(arch));
+        return;
     }
-    std::ifstream file(std::filesystem::u8path(source_path.string()), std::ios::binary);
-    if (!file) {
-        archive_entry_free(entry);
-        archive_write_close(arch);
+    // local file header is already written
+    setg(output.data(), output.data(), output.data() + output.size());
+}
+
+void ZipStreamBuf::close() {
+    if (arch != nullptr) {
         archive_write_free(arch);
-        close(fd);
-        return std::string("Failed to create archive from \"") + source_path.string() + "\"";
+        arch = nullptr;
     }
+    // wait for blocks which are still compressed by the pool
+    for (auto &block : pending_blocks) {
+        block.wait();
+    }
+    pending_blocks.clear();
+    file.close();
+}
 
-    char buff[READ_BLOCK_SIZE];
-    while (!file.eof()) {
-        file.read(buff, READ_BLOCK_SIZE);
-        std::streamsize bytes_read = file.gcount();
-        if (bytes_read > 0) {
-            archive_write_data(arch, buff, static_cast<size_t>(bytes_read));
+void ZipStreamBuf::write_local_header() {
+    const auto now = std::time(nullptr);
+    // archives are created by several upload tasks at once, localtime() is not thread-safe
+    std::tm local_time {};
+#ifdef _WIN32
+    localtime_s(&local_time, &now);
+#else
+    localtime_r(&now, &local_time);
+#endif // _WIN32
+    dos_time = (uint16_t) ((local_time.tm_hour << 11) | (local_time.tm_min << 5) | (local_time.tm_sec / 2));
+    dos_date = (uint16_t) (((std::max(local_time.tm_year, 80) - 80) << 9) | ((local_time.tm_mon + 1) << 5) | local_time.tm_mday);
+    const auto file_name = source_path.filename().string();
+
+    put_u32(output, ZIP_LOCAL_HEADER_SIGNATURE);
+    put_u16(output, is_zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION_DEFLATE);
+    put_u16(output, ZIP_FLAGS);
+    put_u16(output, ZIP_METHOD_DEFLATE);
+    put_u16(output, dos_time);
+    put_u16(output, dos_date);
+    // CRC and sizes follow the data in the data descriptor
+    put_u32(output, 0);
+    put_u32(output, is_zip64 ? 0xFFFFFFFF : 0);
+    put_u32(output, is_zip64 ? 0xFFFFFFFF : 0);
+    put_u16(output, (uint16_t) file_name.size());
+    put_u16(output, is_zip64 ? ZIP64_EXTRA_SIZE + 4 : 0);
+    output.insert(output.end(), file_name.begin(), file_name.end());
+    if (is_zip64) {
+        put_u16(output, ZIP64_EXTRA_ID);
+        put_u16(output, ZIP64_EXTRA_SIZE);
+        put_u64(output, 0);
+        put_u64(output, 0);
+    }
+}
+
+void ZipStreamBuf::write_trailer() {
+    const auto file_name = source_path.filename().string();
+    const uint16_t local_header_size = 30 + (uint16_t) file_name.size() + (is_zip64 ? ZIP64_EXTRA_SIZE + 4 : 0);
+
+    put_u32(output, ZIP_DATA_DESCRIPTOR_SIGNATURE);
+    put_u32(output, crc);
+    if (is_zip64) {
+        put_u64(output, compressed_size);
+        put_u64(output, uncompressed_size);
+    } else {
+        put_u32(output, (uint32_t) compressed_size);
+        put_u32(output, (uint32_t) uncompressed_size);
+    }
+    const auto central_directory_offset = local_header_size + compressed_size + (is_zip64 ? 24 : 16);
+
+    const auto central_directory_start = output.size();
+    put_u32(output, ZIP_CENTRAL_HEADER_SIGNATURE);
+    // made by Unix, so that external attributes are Unix permissions
+    put_u16(output, (3 << 8) | (is_zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION_DEFLATE));
+    put_u16(output, is_zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION_DEFLATE);
+    put_u16(output, ZIP_FLAGS);
+    put_u16(output, ZIP_METHOD_DEFLATE);
+    put_u16(output, dos_time);
+    put_u16(output, dos_date);
+    put_u32(output, crc);
+    put_u32(output, is_zip64 ? 0xFFFFFFFF : (uint32_t) compressed_size);
+    put_u32(output, is_zip64 ? 0xFFFFFFFF : (uint32_t) uncompressed_size);
+    put_u16(output, (uint16_t) file_name.size());
+    put_u16(output, is_zip64 ? ZIP64_EXTRA_SIZE + 4 : 0);
+    // comment length, disk number, internal attributes
+    put_u16(output, 0);
+    put_u16(output, 0);
+    put_u16(output, 0);
+    // regular file with 0644 permissions
+    put_u32(output, 0100644U << 16);
+    // local header offset
+    put_u32(output, 0);
+    output.insert(output.end(), file_name.begin(), file_name.end());
+    if (is_zip64) {
+        put_u16(output, ZIP64_EXTRA_ID);
+        put_u16(output, ZIP64_EXTRA_SIZE);
+        put_u64(output, uncompressed_size);
+        put_u64(output, compressed_size);
+    }
+    const auto central_directory_size = (unsigned long long) (output.size() - central_directory_start);
+
+    if (is_zip64) {
+        const auto zip64_end_offset = central_directory_offset + central_directory_size;
+        put_u32(output, ZIP64_END_SIGNATURE);
+        // size of the remaining record
+        put_u64(output, 44);
+        put_u16(output, ZIP_VERSION_ZIP64);
+        put_u16(output, ZIP_VERSION_ZIP64);
+        put_u32(output, 0);
+        put_u32(output, 0);
+        put_u64(output, 1);
+        put_u64(output, 1);
+        put_u64(output, central_directory_size);
+        put_u64(output, central_directory_offset);
+
+        put_u32(output, ZIP64_LOCATOR_SIGNATURE);
+        put_u32(output, 0);
+        put_u64(output, zip64_end_offset);
+        put_u32(output, 1);
+    }
+    put_u32(output, ZIP_END_SIGNATURE);
+    put_u16(output, 0);
+    put_u16(output, 0);
+    put_u16(output, 1);
+    put_u16(output, 1);
+    put_u32(output, is_zip64 ? 0xFFFFFFFF : (uint32_t) central_directory_size);
+    put_u32(output, is_zip64 ? 0xFFFFFFFF : (uint32_t) central_directory_offset);
+    put_u16(output, 0);
+}
+
+void ZipStreamBuf::write_archive() {
+    // compressor may buffer data, so feed it until it produces some output
+    while (output.empty() && !finished) {
+        file.read(input.data(), input.size());
+        const auto read_count = file.gcount();
+        input_size += read_count;
+        const auto start = std::chrono::steady_clock::now();
+        if (read_count > 0 && archive_write_data(arch, input.data(), (size_t) read_count) < 0) {
+            fail(archive_error_string(arch));
+            break;
+        }
+        compression_time += std::chrono::steady_clock::now() - start;
+        if (file.bad()) {
+            fail("could not read file");
+            break;
+        }
+        if (file.eof()) {
+            // writes the rest of compressed data and the central directory
+            const auto close_start = std::chrono::steady_clock::now();
+            if (archive_write_close(arch) != ARCHIVE_OK) {
+                fail(archive_error_string(arch));
+                break;
+            }
+            compression_time += std::chrono::steady_clock::now() - close_start;
+            finished = true;
         }
     }
-    archive_write_finish_entry(arch);
-    archive_entry_free(entry);
-    archive_write_close(arch);
-    archive_write_free(arch);
-    close(fd);
-    return std::nullopt;
+}
+
+void ZipStreamBuf::write_parallel() {
+    while (output.empty() && !finished) {
+        // keep all threads busy, blocks of other streams could be in the pool queue too
+        while (!is_input_finished && pending_blocks.size() < 2 * deflate_pool->get_thread_count()) {
+            file.read(input.data(), input.size());
+            const auto read_count = file.gcount();
+            if (file.bad()) {
+                fail("could not read file");
+                return;
+            }
+            std::vector<char> block(input.begin(), input.begin() + read_count);
+            is_input_finished = file.eof() || file.peek() == std::char_traits<char>::eof();
+            auto block_dictionary = std::move(dictionary);
+            dictionary.assign(block.end() - std::min(block.size(), (size_t) DEFLATE_DICTIONARY_SIZE), block.end());
+            pending_blocks.push_back(deflate_pool->compress(std::move(block), std::move(block_dictionary), is_input_finished, compression.level));
+        }
+        if (pending_blocks.empty()) {
+            write_trailer();
+            finished = true;
+            return;
+        }
+        const auto block = pending_blocks.front().get();
+        pending_blocks.pop_front();
+        if (block.error.has_value()) {
+            fail(block.error.value());
+            return;
+        }
+        crc = (uint32_t) crc32_combine(crc, block.crc, (z_off_t) block.size);
+        uncompressed_size += block.size;
+        input_size += block.size;
+        compression_time += block.duration;
+        compressed_size += block.data.size();
+        output.insert(output.end(), block.data.begin(), block.data.end());
+    }
+}
+
+ZipStreamBuf::int_type ZipStreamBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    position += egptr() - eback();
+    output.clear();
+    if (arch != nullptr) {
+        write_archive();
+    } else if (!finished) {
+        write_parallel();
+    }
+    setg(output.data(), output.data(), output.data() + output.size());
+    if (output.empty()) {
+        return traits_type::eof();
+    }
+    return traits_type::to_int_type(*gptr());
+}
+
+ZipStreamBuf::pos_type ZipStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in)) {
+        return pos_type(off_type(-1));
+    }
+    // report current position
+    if (dir == std::ios_base::cur && off == 0) {
+        return pos_type(position + (gptr() - eback()));
+    }
+    if (dir == std::ios_base::beg) {
+        return seekpos(pos_type(off), which);
+    }
+    return pos_type(off_type(-1));
+}
+
+ZipStreamBuf::pos_type ZipStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in) || off_type(pos) != 0) {
+        return pos_type(off_type(-1));
+    }
+    // nothing is read yet
+    if (position == 0 && gptr() == eback() && !finished) {
+        return pos;
+    }
+    close();
+    open();
+    return pos;
 }
@@ -1,18 +1,154 @@
 #pragma once
 
+#include <deque>
+#include <future>
+#include <memory>
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <variant>
 #include <optional>
+#include <fstream>
+#include <functional>
+#include <streambuf>
 #include <filesystem>
 
+#include "./bundle_entry.hpp"
+#include "../deflate/parallel_deflate.hpp"
+#include "../compression/compression_policy.hpp"
+
+struct archive;
+
 struct file_unpack_info_t {
     std::string name;
     std::optional<std::string> error_message;
 };
 
+// regular file stored in an archive
+struct archive_entry_info_t {
+    // path inside of the archive
+    std::string name;
+    unsigned long long size;
+};
+
+// size of reads from archives and from files which are archived or bundled. Default is 64 KB.
+// Affects archives and files opened after the call
+void set_archive_block_size(size_t block_size);
+size_t get_archive_block_size();
+
+// true for zip, rar and 7zip archives which could be extracted.
+// Result is cached until the file size or modification time is changed
 bool is_packed(std::filesystem::path file_name);
 
-std::variant<std::vector<file_unpack_info_t>, std::string> unpack_file(std::filesystem::path file_name, std::filesystem::path output_directory);
+// on_file_extracted - called for each file as soon as it is written to disk, so it could be processed while the rest is extracted
+std::variant<std::vector<file_unpack_info_t>, std::string> unpack_file(std::filesystem::path file_name, std::filesystem::path output_directory, std::function<void(const file_unpack_info_t &)> on_file_extracted = nullptr);
+
+// lists regular files of an archive without extracting them.
+// Fails if size of a file is not stored in the archive headers or its name points outside of the archive
+std::variant<std::vector<archive_entry_info_t>, std::string> list_archive_entries(std::filesystem::path file_name);
+
+// deflate_pool - compress large files with multiple threads. Single threaded if set to nullptr
+std::optional<std::string> zip_file(std::filesystem::path source_path, std::filesystem::path dest_path, std::shared_ptr<DeflatePool> deflate_pool = nullptr, compression_choice_t compression = {});
+
+// zip archive of a single file which is compressed while it is read, so that the archive is not stored on disk.
+// Only seeking to the beginning is supported, it restarts compression
+class ZipStreamBuf : public std::streambuf {
+public:
+    // deflate_pool_ - compress large files with multiple threads. Single threaded if set to nullptr
+    // compression_ - store or deflate with the given level
+    explicit ZipStreamBuf(std::filesystem::path source_path_, std::shared_ptr<DeflatePool> deflate_pool_ = nullptr, compression_choice_t compression_ = {});
+    ~ZipStreamBuf();
+    ZipStreamBuf(const ZipStreamBuf &) = delete;
+    ZipStreamBuf &operator=(const ZipStreamBuf &) = delete;
+
+    // set if the archive could not be created. Archive data is incomplete in this case
+    std::optional<std::string> error() const;
+    // sizes and compression time of the data produced so far
+    compression_stats_t get_stats() const;
+
+protected:
+    int_type underflow() override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+    void open();
+    void close();
+    void fail(const std::string &message);
+    // produce next output with libarchive
+    void write_archive();
+    // produce next output with deflate pool, zip headers are written without libarchive
+    void write_parallel();
+    void write_local_header();
+    void write_trailer();
+
+    std::filesystem::path source_path;
+    std::shared_ptr<DeflatePool> deflate_pool;
+    compression_choice_t compression;
+    std::ifstream file;
+    struct archive *arch;
+    std::vector<char> input;
+    // compressed data produced by libarchive and not read yet
+    std::vector<char> output;
+    // number of bytes produced before the current output
+    off_type position;
+    bool finished;
+    std::optional<std::string> error_message;
+
+    // compressed blocks in order of the source data
+    std::deque<std::future<deflate_block_t>> pending_blocks;
+    // end of the previous block, used as deflate dictionary
+    std::vector<char> dictionary;
+    bool is_input_finished;
+    bool is_zip64;
+    uint32_t crc;
+    unsigned long long uncompressed_size;
+    unsigned long long compressed_size;
+    // bytes read from the source file
+    unsigned long long input_size;
+    std::chrono::nanoseconds compression_time;
+    // modification time in MS-DOS format
+    uint16_t dos_time;
+    uint16_t dos_date;
+};
+
+// reads regular files of an archive one by one, so that they could be uploaded without extraction to disk.
+// Only seeking to the beginning of a file which is not read yet is supported
+class ArchiveEntryStreamBuf : public std::streambuf {
+public:
+    explicit ArchiveEntryStreamBuf(std::filesystem::path file_name_);
+    ~ArchiveEntryStreamBuf();
+    ArchiveEntryStreamBuf(const ArchiveEntryStreamBuf &) = delete;
+    ArchiveEntryStreamBuf &operator=(const ArchiveEntryStreamBuf &) = delete;
+
+    // moves to the next regular file, the rest of the current file is skipped.
+    // Returns either the file, std::nullopt at the end of the archive or an error message
+    std::variant<std::optional<archive_entry_info_t>, std::string> next_entry();
+    // set if the archive could not be opened or the current file could not be read completely
+    std::optional<std::string> error() const;
+
+protected:
+    int_type underflow() override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+    void fail(const std::string &message);
+
+    std::filesystem::path file_name;
+    struct archive *arch;
+    // data block returned by libarchive and not read yet
+    const char *block;
+    size_t block_size;
+    off_type block_offset;
+    // zeros for holes of sparse files
+    std::vector<char> zeros;
+    // number of bytes of the current file produced before the current get area
+    off_type position;
+    bool is_entry_finished;
+    std::optional<std::string> error_message;
+};
 
-std::optional<std::string> zip_file(std::filesystem::path source_path, std::filesystem::path dest_path);
+// packs files from source_directory into uncompressed tar, so that each file could be read from the bundle by byte range.
+// Returns bundle entries with empty bundle_name or an error message
+std::variant<std::vector<bundle_entry_t>, std::string> bundle_files(const std::vector<std::string> &files, std::filesystem::path source_directory, std::filesystem::path dest_path);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+// location of a file inside of a bundle
+struct bundle_entry_t {
+    std::string file_name;
+    std::string bundle_name;
+    // byte offset of the file content in the bundle
+    unsigned long long offset;
+    unsigned long long size;
+};
@@ -1,11 +0,0 @@
-// Copyright (c) 2021 Kingsley Chen <kingsamchen at gmail dot com>
-// This file is subject to the terms of license that can be found
-// in the LICENSE file.
-
-#ifndef BACKOFFXX_BACKOFFXX_H_
-#define BACKOFFXX_BACKOFFXX_H_
-
-#include "./attempt.h"
-#include "./backoff.h"
-
-#endif // BACKOFFXX_BACKOFFXX_H_
@@ -0,0 +1,280 @@
+#include <ctime>
+#include <thread>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+
+#include "./bandwidth_limiter.hpp"
+
+#define MINUTES_PER_DAY (24 * 60)
+#define SCHEDULE_CHECK_INTERVAL_MS 1000
+// waiting acquire wakes up at least this often, so that rate changes are applied
+#define MAX_WAIT_MS 100
+// uploads always get some bandwidth
+#define RESERVED_SHARE_MAX 0.9
+// reads are split into chunks so that single large read does not make a burst
+#define THROTTLE_CHUNK_SIZE (64 * 1024)
+
+// ctype functions are undefined for negative char values
+static bool is_digit(char c) {
+    return std::isdigit((unsigned char) c) != 0;
+}
+
+static std::variant<unsigned long long, std::string> parse_rate(const std::string &value) {
+    if (value.empty()) {
+        return std::string("Empty rate");
+    }
+    unsigned long long multiplier = 1;
+    auto digits = value;
+    switch (value.back()) {
+    case 'K':
+    case 'k':
+        multiplier = 1024ULL;
+        break;
+    case 'M':
+    case 'm':
+        multiplier = 1024ULL * 1024;
+        break;
+    case 'G':
+    case 'g':
+        multiplier = 1024ULL * 1024 * 1024;
+        break;
+    default:
+        break;
+    }
+    if (multiplier > 1) {
+        digits.pop_back();
+    }
+    if (digits.empty() || !std::all_of(digits.begin(), digits.end(), is_digit)) {
+        return std::string("Invalid rate \"") + value + std::string("\"");
+    }
+    try {
+        return std::stoull(digits) * multiplier;
+    } catch (const std::exception &) {
+        return std::string("Invalid rate \"") + value + std::string("\"");
+    }
+}
+
+static std::variant<unsigned int, std::string> parse_time_of_day(const std::string &value) {
+    const auto separator = value.find(':');
+    if (separator == std::string::npos) {
+        return std::string("Invalid time \"") + value + std::string("\", expected HH:MM");
+    }
+    const auto hours = value.substr(0, separator);
+    const auto minutes = value.substr(separator + 1);
+    if (hours.empty() || hours.size() > 2 || minutes.size() != 2 ||
+            !std::all_of(hours.begin(), hours.end(), is_digit) || !std::all_of(minutes.begin(), minutes.end(), is_digit)) {
+        return std::string("Invalid time \"") + value + std::string("\", expected HH:MM");
+    }
+    const auto hours_value = (unsigned int) std::stoul(hours);
+    const auto minutes_value = (unsigned int) std::stoul(minutes);
+    if (hours_value >= 24 || minutes_value >= 60) {
+        return std::string("Invalid time \"") + value + std::string("\", expected HH:MM");
+    }
+    return hours_value * 60 + minutes_value;
+}
+
+std::variant<BandwidthSchedule, std::string> parse_bandwidth_schedule(const std::string &value) {
+    BandwidthSchedule schedule;
+    if (value.find('=') == std::string::npos) {
+        const auto rate_ret = parse_rate(value);
+        if (std::holds_alternative<std::string>(rate_ret)) {
+            return std::get<std::string>(rate_ret);
+        }
+        schedule.push_back(BandwidthScheduleEntry { 0, std::get<unsigned long long>(rate_ret) });
+        return schedule;
+    }
+
+    std::stringstream stream(value);
+    std::string entry;
+    while (std::getline(stream, entry, ',')) {
+        const auto separator = entry.find('=');
+        if (separator == std::string::npos) {
+            return std::string("Invalid schedule entry \"") + entry + std::string("\", expected HH:MM=RATE");
+        }
+        const auto time_ret = parse_time_of_day(entry.substr(0, separator));
+        if (std::holds_alternative<std::string>(time_ret)) {
+            return std::get<std::string>(time_ret);
+        }
+        const auto rate_ret = parse_rate(entry.substr(separator + 1));
+        if (std::holds_alternative<std::string>(rate_ret)) {
+            return std::get<std::string>(rate_ret);
+        }
+        schedule.push_back(BandwidthScheduleEntry { std::get<unsigned int>(time_ret), std::get<unsigned long long>(rate_ret) });
+    }
+    if (schedule.empty()) {
+        return std::string("Empty schedule");
+    }
+    std::sort(schedule.begin(), schedule.end(), [](const BandwidthScheduleEntry &a, const BandwidthScheduleEntry &b) {
+        return a.start_minute < b.start_minute;
+    });
+    return schedule;
+}
+
+unsigned long long get_schedule_rate(const BandwidthSchedule &schedule, unsigned int minute_of_day) {
+    if (schedule.empty()) {
+        return 0;
+    }
+    // the last entry of the previous day is active before the first entry
+    auto rate = schedule.back().rate;
+    for (const auto &entry : schedule) {
+        if (entry.start_minute > minute_of_day) {
+            break;
+        }
+        rate = entry.rate;
+    }
+    return rate;
+}
+
+static unsigned int get_local_minute_of_day() {
+    const auto now = std::time(nullptr);
+    std::tm local_time {};
+#ifdef _WIN32
+    localtime_s(&local_time, &now);
+#else
+    localtime_r(&now, &local_time);
+#endif // _WIN32
+    return (unsigned int) (local_time.tm_hour * 60 + local_time.tm_min) % MINUTES_PER_DAY;
+}
+
+std::chrono::steady_clock::time_point BandwidthClock::now() {
+    return std::chrono::steady_clock::now();
+}
+
+void BandwidthClock::sleep_for(std::chrono::duration<double> duration) {
+    std::this_thread::sleep_for(duration);
+}
+
+BandwidthLimiter::BandwidthLimiter(const BandwidthSchedule &schedule_, double burst_seconds_, double reserved_share_, std::shared_ptr<BandwidthClock> clock_) :
+    schedule {schedule_},
+    burst_seconds {std::max(0.0, burst_seconds_)},
+    reserved_share {std::clamp(reserved_share_, 0.0, RESERVED_SHARE_MAX)},
+    clock {clock_ != nullptr ? clock_ : std::make_shared<BandwidthClock>()},
+    rate {get_schedule_rate(schedule, get_local_minute_of_day())},
+    transferred {0},
+    last_refill {clock->now()},
+    last_schedule_check {last_refill},
+    last_torrent_report {last_refill} {
+    // start with full bucket. When the torrent shares the limit, bandwidth is accumulated only when it is not used by both
+    tokens = reserved_share > 0 ? 0 : get_upload_rate() * burst_seconds;
+}
+
+double BandwidthLimiter::get_upload_rate() const {
+    return rate * (1.0 - reserved_share);
+}
+
+void BandwidthLimiter::refill(std::chrono::steady_clock::time_point now) {
+    if (now - last_schedule_check >= std::chrono::milliseconds(SCHEDULE_CHECK_INTERVAL_MS)) {
+        rate = get_schedule_rate(schedule, get_local_minute_of_day());
+        last_schedule_check = now;
+    }
+    const auto elapsed = std::chrono::duration<double>(now - last_refill).count();
+    last_refill = now;
+    tokens = std::min(tokens + elapsed * get_upload_rate(), get_upload_rate() * burst_seconds);
+}
+
+void BandwidthLimiter::acquire(unsigned long long bytes) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    while (true) {
+        refill(clock->now());
+        // acquire when there is no debt, even if bytes exceed the bucket size. Following calls wait until the debt is paid
+        if (rate == 0 || tokens >= 0) {
+            tokens -= rate == 0 ? 0 : bytes;
+            transferred += bytes;
+            return;
+        }
+        const auto wait = std::min(std::chrono::duration<double>(-tokens / get_upload_rate()), std::chrono::duration<double>(std::chrono::milliseconds(MAX_WAIT_MS)));
+        lock.unlock();
+        clock->sleep_for(wait);
+        lock.lock();
+    }
+}
+
+unsigned long long BandwidthLimiter::get_rate() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    refill(clock->now());
+    return rate;
+}
+
+unsigned long long BandwidthLimiter::get_transferred() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    return transferred;
+}
+
+unsigned long long BandwidthLimiter::get_torrent_rate(unsigned long long upload_rate) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    refill(clock->now());
+    if (rate == 0) {
+        return 0;
+    }
+    const auto reserved_rate = (unsigned long long) (rate * reserved_share);
+    return std::max(std::max(reserved_rate, rate - std::min(rate, upload_rate)), 1ULL);
+}
+
+void BandwidthLimiter::add_torrent_transferred(unsigned long long bytes) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    const auto now = clock->now();
+    refill(now);
+    const auto elapsed = std::chrono::duration<double>(now - last_torrent_report).count();
+    last_torrent_report = now;
+    // bandwidth the torrent took from the uploads share is not available for upload bursts.
+    // Debt is not increased, so that the torrent does not slow down uploads below their share
+    const auto excess = (double) bytes - elapsed * rate * reserved_share;
+    if (rate != 0 && excess > 0 && tokens > 0) {
+        tokens = std::max(tokens - excess, 0.0);
+    }
+}
+
+ThrottledStreamBuf::ThrottledStreamBuf(std::streambuf *source_, BandwidthLimiter &limiter_) :
+    source {source_},
+    limiter {limiter_},
+    buffer(THROTTLE_CHUNK_SIZE) {}
+
+ThrottledStreamBuf::int_type ThrottledStreamBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    const auto read_count = source->sgetn(buffer.data(), buffer.size());
+    if (read_count <= 0) {
+        return traits_type::eof();
+    }
+    limiter.acquire(read_count);
+    setg(buffer.data(), buffer.data(), buffer.data() + read_count);
+    return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize ThrottledStreamBuf::xsgetn(char_type *s, std::streamsize count) {
+    const auto buffered_count = std::min(count, (std::streamsize) (egptr() - gptr()));
+    if (buffered_count > 0) {
+        std::copy(gptr(), gptr() + buffered_count, s);
+        gbump((int) buffered_count);
+    }
+    std::streamsize total_count = buffered_count;
+    while (total_count < count) {
+        const auto chunk_size = std::min(count - total_count, (std::streamsize) THROTTLE_CHUNK_SIZE);
+        const auto read_count = source->sgetn(s + total_count, chunk_size);
+        if (read_count <= 0) {
+            break;
+        }
+        limiter.acquire(read_count);
+        total_count += read_count;
+        if (read_count < chunk_size) {
+            break;
+        }
+    }
+    return total_count;
+}
+
+ThrottledStreamBuf::pos_type ThrottledStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    // take buffered data into account
+    if (dir == std::ios_base::cur) {
+        off -= egptr() - gptr();
+    }
+    setg(buffer.data(), buffer.data(), buffer.data());
+    return source->pubseekoff(off, dir, which);
+}
+
+ThrottledStreamBuf::pos_type ThrottledStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    setg(buffer.data(), buffer.data(), buffer.data());
+    return source->pubseekpos(pos, which);
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <variant>
+#include <streambuf>
+
+struct BandwidthScheduleEntry {
+    // minutes since local midnight when the rate is applied
+    unsigned int start_minute;
+    // bytes per second. Not limited if set to 0
+    unsigned long long rate;
+};
+
+// entries are sorted by start_minute. The last entry is active until the first entry of the next day
+typedef std::vector<BandwidthScheduleEntry> BandwidthSchedule;
+
+// Parses either a single rate, i.e. "10M", or comma separated time of day rates, i.e. "0:00=10M,9:00=2M,18:00=10M".
+// Rate is in bytes per second with optional K, M or G suffix. Returns schedule or an error message
+std::variant<BandwidthSchedule, std::string> parse_bandwidth_schedule(const std::string &value);
+// returns rate of the schedule at minute_of_day
+unsigned long long get_schedule_rate(const BandwidthSchedule &schedule, unsigned int minute_of_day);
+
+// time source of the limiter, tests replace it so that they do not depend on the wall clock
+class BandwidthClock {
+public:
+    virtual ~BandwidthClock() = default;
+    virtual std::chrono::steady_clock::time_point now();
+    virtual void sleep_for(std::chrono::duration<double> duration);
+};
+
+// Token bucket shared by all S3 upload tasks. Tokens are added with the scheduled rate and up to
+// burst_seconds of unused bandwidth is accumulated for bursts.
+// The scheduled rate is a cap of the total bandwidth: reserved_share of it is kept for the torrent, uploads get
+// at most the rest, and the torrent gets what uploads do not use.
+class BandwidthLimiter {
+public:
+    // clock_ - steady clock is used if not set
+    BandwidthLimiter(const BandwidthSchedule &schedule_, double burst_seconds_, double reserved_share_ = 0.0, std::shared_ptr<BandwidthClock> clock_ = nullptr);
+
+    // blocks until bytes are allowed to be sent
+    void acquire(unsigned long long bytes);
+    // current scheduled rate, 0 if not limited
+    unsigned long long get_rate();
+    // total number of acquired bytes, allows to measure the upload rate
+    unsigned long long get_transferred();
+    // bandwidth left to the torrent download and upload to peers while uploads use upload_rate,
+    // not less than the reserved share. 0 if not limited
+    unsigned long long get_torrent_rate(unsigned long long upload_rate);
+    // reports bytes sent and received by the torrent. They are not throttled here, but bandwidth used by the
+    // torrent above its reserved share is not accumulated for upload bursts
+    void add_torrent_transferred(unsigned long long bytes);
+
+private:
+    void refill(std::chrono::steady_clock::time_point now);
+    // rate of tokens for uploads
+    double get_upload_rate() const;
+
+    std::mutex mutex;
+    const BandwidthSchedule schedule;
+    const double burst_seconds;
+    const double reserved_share;
+    const std::shared_ptr<BandwidthClock> clock;
+    // negative when more bytes were acquired than allowed, following acquire waits for the debt
+    double tokens;
+    unsigned long long rate;
+    unsigned long long transferred;
+    std::chrono::steady_clock::time_point last_refill;
+    // local time is checked at most once per second
+    std::chrono::steady_clock::time_point last_schedule_check;
+    std::chrono::steady_clock::time_point last_torrent_report;
+};
+
+// Input stream buffer which acquires read bytes from the bandwidth limiter
+class ThrottledStreamBuf : public std::streambuf {
+public:
+    ThrottledStreamBuf(std::streambuf *source_, BandwidthLimiter &limiter_);
+
+protected:
+    int_type underflow() override;
+    std::streamsize xsgetn(char_type *s, std::streamsize count) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+    std::streambuf *source;
+    BandwidthLimiter &limiter;
+    std::vector<char> buffer;
+};
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+#include "./checksum.hpp"
+
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+static std::string to_hex(const std::string &data) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(data.size() * 2);
+    for (const auto c: data) {
+        hex += digits[((unsigned char) c) >> 4];
+        hex += digits[((unsigned char) c) & 0x0f];
+    }
+    return hex;
+}
+
+Md5Hash::Md5Hash() : context {EVP_MD_CTX_new()} {
+    if (context == nullptr) {
+        throw std::runtime_error("Could not create MD5 context");
+    }
+    reset();
+}
+
+Md5Hash::~Md5Hash() {
+    EVP_MD_CTX_free(context);
+}
+
+void Md5Hash::reset() {
+    EVP_DigestInit_ex(context, EVP_md5(), nullptr);
+}
+
+void Md5Hash::update(const char *data, size_t size) {
+    EVP_DigestUpdate(context, data, size);
+}
+
+std::string Md5Hash::finish() {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    EVP_DigestFinal_ex(context, digest, &digest_size);
+    reset();
+    return std::string((const char *) digest, digest_size);
+}
+
+EtagHash::EtagHash(size_t part_size_) : part_size {part_size_}, part_bytes {0}, part_count {0} {}
+
+void EtagHash::reset() {
+    part_hash.reset();
+    part_digests.clear();
+    part_bytes = 0;
+    part_count = 0;
+}
+
+void EtagHash::update(const char *data, size_t size) {
+    while (size > 0) {
+        // part is finished only when more data arrives, so that data of exactly part size is a single part
+        if (part_bytes == part_size) {
+            part_digests += part_hash.finish();
+            part_count++;
+            part_bytes = 0;
+        }
+        const auto chunk_size = std::min(size, part_size - part_bytes);
+        part_hash.update(data, chunk_size);
+        part_bytes += chunk_size;
+        data += chunk_size;
+        size -= chunk_size;
+    }
+}
+
+std::string EtagHash::etag() {
+    const auto last_digest = part_hash.finish();
+    if (part_count == 0) {
+        return to_hex(last_digest);
+    }
+    Md5Hash multipart_hash;
+    multipart_hash.update(part_digests.data(), part_digests.size());
+    multipart_hash.update(last_digest.data(), last_digest.size());
+    return to_hex(multipart_hash.finish()) + "-" + std::to_string(part_count + 1);
+}
+
+EtagStreamBuf::EtagStreamBuf(std::streambuf *source_, size_t part_size) :
+    source {source_},
+    hash {part_size},
+    buffer(STREAM_BUFFER_SIZE),
+    position {0} {}
+
+std::string EtagStreamBuf::etag() {
+    return hash.etag();
+}
+
+EtagStreamBuf::int_type EtagStreamBuf::underflow() {
+    if (gptr() < egptr()) {
+        return traits_type::to_int_type(*gptr());
+    }
+    const auto read_count = source->sgetn(buffer.data(), buffer.size());
+    if (read_count <= 0) {
+        return traits_type::eof();
+    }
+    hash.update(buffer.data(), read_count);
+    position += read_count;
+    setg(buffer.data(), buffer.data(), buffer.data() + read_count);
+    return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize EtagStreamBuf::xsgetn(char_type *s, std::streamsize count) {
+    // drain buffered data first, then read large blocks directly without copying into the buffer
+    const auto buffered_count = std::min(count, (std::streamsize) (egptr() - gptr()));
+    if (buffered_count > 0) {
+        std::copy(gptr(), gptr() + buffered_count, s);
+        gbump((int) buffered_count);
+    }
+    if (buffered_count == count) {
+        return count;
+    }
+    const auto read_count = source->sgetn(s + buffered_count, count - buffered_count);
+    if (read_count <= 0) {
+        return buffered_count;
+    }
+    hash.update(s + buffered_count, read_count);
+    position += read_count;
+    return buffered_count + read_count;
+}
+
+EtagStreamBuf::pos_type EtagStreamBuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in)) {
+        return pos_type(off_type(-1));
+    }
+    // report current position
+    if (dir == std::ios_base::cur && off == 0) {
+        return pos_type(position - (egptr() - gptr()));
+    }
+    if (dir == std::ios_base::beg) {
+        return seekpos(pos_type(off), which);
+    }
+    return pos_type(off_type(-1));
+}
+
+EtagStreamBuf::pos_type EtagStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which) {
+    if (!(which & std::ios_base::in) || off_type(pos) != 0) {
+        return pos_type(off_type(-1));
+    }
+    if (source->pubseekpos(0, std::ios_base::in) != pos_type(0)) {
+        return pos_type(off_type(-1));
+    }
+    hash.reset();
+    position = 0;
+    setg(buffer.data(), buffer.data(), buffer.data());
+    return pos;
+}
+
+bool is_md5_etag(const std::string &etag) {
+    const auto separator = etag.find('-');
+    const auto digest = etag.substr(0, separator);
+    // ctype functions are undefined for negative char values
+    const auto is_hex_digit = [](char c) {
+        return std::isxdigit((unsigned char) c) != 0;
+    };
+    const auto is_digit = [](char c) {
+        return std::isdigit((unsigned char) c) != 0;
+    };
+    if (digest.size() != 32 || !std::all_of(digest.begin(), digest.end(), is_hex_digit)) {
+        return false;
+    }
+    if (separator == std::string::npos) {
+        return true;
+    }
+    const auto part_count = etag.substr(separator + 1);
+    return !part_count.empty() && std::all_of(part_count.begin(), part_count.end(), is_digit);
+}
+
+std::string normalize_etag(const std::string &etag) {
+    std::string normalized;
+    normalized.reserve(etag.size());
+    for (const auto c: etag) {
+        if (c == '"') {
+            continue;
+        }
+        normalized += (char) std::tolower((unsigned char) c);
+    }
+    return normalized;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <openssl/evp.h>
+
+// MD5 hash backed by OpenSSL which uses assembly implementation where available
+class Md5Hash {
+public:
+    Md5Hash();
+    ~Md5Hash();
+    Md5Hash(const Md5Hash&) = delete;
+    Md5Hash& operator=(const Md5Hash&) = delete;
+
+    void reset();
+    void update(const char *data, size_t size);
+    // returns raw digest bytes and resets the hash
+    std::string finish();
+
+private:
+    EVP_MD_CTX *context;
+};
+
+// Computes S3 ETag of the uploaded data. For data not larger than part size the ETag is MD5 of data.
+// Multipart upload ETag is MD5 of concatenated parts MD5 followed by "-" and the number of parts.
+class EtagHash {
+public:
+    explicit EtagHash(size_t part_size_);
+
+    void reset();
+    void update(const char *data, size_t size);
+    // lowercase hex ETag without quotes
+    std::string etag();
+
+private:
+    const size_t part_size;
+    Md5Hash part_hash;
+    // concatenated digests of completed parts
+    std::string part_digests;
+    size_t part_bytes;
+    unsigned long long part_count;
+};
+
+// Input stream buffer that computes ETag of the data while it is read from the source buffer,
+// so that uploaded data can be verified without reading it twice. Seeking is only supported to the beginning
+// of the stream, i.e. to restart the upload, and resets the hash.
+class EtagStreamBuf : public std::streambuf {
+public:
+    EtagStreamBuf(std::streambuf *source_, size_t part_size);
+
+    std::string etag();
+
+protected:
+    int_type underflow() override;
+    std::streamsize xsgetn(char_type *s, std::streamsize count) override;
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+    std::streambuf *source;
+    EtagHash hash;
+    std::vector<char> buffer;
+    // number of bytes read from the source
+    off_type position;
+};
+
+// returns true if ETag looks like MD5 based ETag, i.e. object is not encrypted with SSE-KMS or SSE-C
+bool is_md5_etag(const std::string &etag);
+// strip quotes and convert to lowercase
+std::string normalize_etag(const std::string &etag);
@@ -0,0 +1,132 @@
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "./compression_policy.hpp"
+#include "../trace/trace.hpp"
+
+// formats which are already compressed
+static const char *STORED_EXTENSIONS[] = {
+    "mp4", "mkv", "avi", "mov", "webm", "m4v", "wmv", "flv",
+    "mp3", "m4a", "aac", "ogg", "opus", "flac",
+    "jpg", "jpeg", "png", "gif", "webp", "heic",
+    "gz", "tgz", "bz2", "xz", "zst", "lz4", "cab", "iso"
+};
+
+static std::string to_lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) {
+        return (char) std::tolower(c);
+    });
+    return value;
+}
+
+static std::string get_extension(const std::filesystem::path &file_path) {
+    const auto extension = file_path.extension().string();
+    return to_lower(extension.empty() ? extension : extension.substr(1));
+}
+
+std::variant<compression_overrides_t, std::string> parse_compression_overrides(const std::string &overrides) {
+    compression_overrides_t ret;
+    std::stringstream stream(overrides);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty()) {
+            continue;
+        }
+        const auto separator = item.find('=');
+        if (separator == std::string::npos || separator == 0) {
+            return std::string("Invalid compression override \"") + item + "\"";
+        }
+        auto extension = to_lower(item.substr(0, separator));
+        if (extension[0] == '.') {
+            extension = extension.substr(1);
+        }
+        const auto value = to_lower(item.substr(separator + 1));
+        if (value == "store") {
+            ret[extension] = compression_choice_t { COMPRESSION_STORE, 0 };
+            continue;
+        }
+        if (value.size() != 1 || value[0] < '0' || value[0] > '9') {
+            return std::string("Invalid compression level in \"") + item + "\", expected \"store\" or 0-9";
+        }
+        const auto level = value[0] - '0';
+        ret[extension] = level == 0 ? compression_choice_t { COMPRESSION_STORE, 0 } : compression_choice_t { COMPRESSION_DEFLATE, level };
+    }
+    return ret;
+}
+
+CompressionPolicy::CompressionPolicy(int level_, double store_ratio_, unsigned long long sample_size_, const compression_overrides_t &overrides_) :
+    level {level_},
+    store_ratio {store_ratio_},
+    sample_size {sample_size_} {
+    for (const auto *extension : STORED_EXTENSIONS) {
+        overrides[extension] = compression_choice_t { COMPRESSION_STORE, 0 };
+    }
+    for (const auto &o : overrides_) {
+        overrides[o.first] = o.second;
+    }
+}
+
+// returns compressed size of the sample relative to its size
+static double sample_ratio(const std::filesystem::path &file_path, unsigned long long sample_size) {
+    std::error_code ec;
+    const auto file_size = std::filesystem::file_size(std::filesystem::u8path(file_path.string()), ec);
+    if (ec) {
+        return 0.0;
+    }
+    std::ifstream file(std::filesystem::u8path(file_path.string()), std::ios::binary);
+    std::vector<char> sample(std::min(sample_size, (unsigned long long) file_size));
+    file.read(sample.data(), sample.size());
+    const auto read_count = file.gcount();
+    if (read_count <= 0) {
+        return 0.0;
+    }
+    auto compressed_size = compressBound((uLong) read_count);
+    std::vector<char> compressed(compressed_size);
+    if (compress2((Bytef *) compressed.data(), &compressed_size, (const Bytef *) sample.data(), (uLong) read_count, Z_BEST_SPEED) != Z_OK) {
+        return 0.0;
+    }
+    return (double) compressed_size / read_count;
+}
+
+compression_choice_t CompressionPolicy::choose(const std::filesystem::path &file_path) {
+    const auto override_iter = overrides.find(get_extension(file_path));
+    if (override_iter != overrides.end()) {
+        return override_iter->second;
+    }
+    if (level == 0) {
+        return compression_choice_t { COMPRESSION_STORE, 0 };
+    }
+    const compression_choice_t deflate_choice { COMPRESSION_DEFLATE, level };
+    if (sample_size == 0) {
+        return deflate_choice;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const auto ratio = sample_ratio(file_path, sample_size);
+    const auto end = std::chrono::steady_clock::now();
+    trace_event("sample", "zip", start, end, file_path.string());
+    std::unique_lock<std::mutex> lock{ mutex };
+    stats.compression_time += end - start;
+    lock.unlock();
+    if (ratio > store_ratio) {
+        return compression_choice_t { COMPRESSION_STORE, 0 };
+    }
+    return deflate_choice;
+}
+
+void CompressionPolicy::add_stats(const compression_stats_t &archive_stats) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    stats.stored_files += archive_stats.stored_files;
+    stats.deflated_files += archive_stats.deflated_files;
+    stats.input_size += archive_stats.input_size;
+    stats.output_size += archive_stats.output_size;
+    stats.compression_time += archive_stats.compression_time;
+}
+
+compression_stats_t CompressionPolicy::get_stats() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    return stats;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <variant>
+#include <filesystem>
+#include <unordered_map>
+
+enum compression_method_t {
+    // file is stored in the archive without compression
+    COMPRESSION_STORE = 0,
+    COMPRESSION_DEFLATE = 1
+};
+
+struct compression_choice_t {
+    compression_method_t method = COMPRESSION_DEFLATE;
+    // zlib compression level, -1 for default
+    int level = -1;
+};
+
+struct compression_stats_t {
+    unsigned long long stored_files = 0;
+    unsigned long long deflated_files = 0;
+    // size of source files
+    unsigned long long input_size = 0;
+    // size of archives
+    unsigned long long output_size = 0;
+    // time spent on compression and sampling
+    std::chrono::nanoseconds compression_time {0};
+};
+
+// key - lowercase file extension without dot
+typedef std::unordered_map<std::string, compression_choice_t> compression_overrides_t;
+
+// parses comma separated overrides, i.e. "mp4=store,log=9". Level 0 is the same as store
+std::variant<compression_overrides_t, std::string> parse_compression_overrides(const std::string &overrides);
+
+// Chooses compression method for archived files. Beginning of a file is compressed with the fastest level and
+// the file is stored without compression if the sample does not compress well, i.e. video or encrypted data.
+// Thread safe, collects statistics of all archived files.
+class CompressionPolicy {
+public:
+    // level_ - zlib compression level for deflated files, -1 for default. All files are stored if set to 0
+    // store_ratio_ - file is stored if its sample is compressed to more than this fraction of the sample size
+    // sample_size_ - size of the sample in bytes. Sampling is disabled if set to 0
+    // overrides_ - per extension choices which skip sampling. Common media formats are stored by default
+    CompressionPolicy(int level_ = -1, double store_ratio_ = 0.95, unsigned long long sample_size_ = 4 * 1024 * 1024, const compression_overrides_t &overrides_ = {});
+
+    compression_choice_t choose(const std::filesystem::path &file_path);
+    // adds statistics of an uploaded archive
+    void add_stats(const compression_stats_t &archive_stats);
+    compression_stats_t get_stats();
+
+private:
+    int level;
+    double store_ratio;
+    unsigned long long sample_size;
+    compression_overrides_t overrides;
+    std::mutex mutex;
+    compression_stats_t stats;
+};
@@ -0,0 +1,70 @@
+#include <algorithm>
+
+#include "./concurrency_limiter.hpp"
+
+// multiplicative decrease factor
+#define DECREASE_FACTOR 0.5
+#define DECREASE_COOLDOWN_MS 1000
+
+ConcurrencyLimiter::ConcurrencyLimiter(unsigned int min_limit_, unsigned int max_limit_, unsigned int initial_limit, std::chrono::milliseconds target_latency_) :
+    min_limit {std::max(1u, min_limit_)},
+    max_limit {std::max(min_limit, max_limit_)},
+    target_latency {target_latency_},
+    limit {(double) std::clamp(initial_limit, min_limit, max_limit)},
+    running {0},
+    last_decrease {} {}
+
+void ConcurrencyLimiter::acquire() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    while (running >= (unsigned int) limit) {
+        condition.wait(lock);
+    }
+    running++;
+}
+
+void ConcurrencyLimiter::release() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    if (running > 0) {
+        running--;
+    }
+    lock.unlock();
+    condition.notify_one();
+}
+
+void ConcurrencyLimiter::on_success(std::chrono::milliseconds latency) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    if (target_latency.count() > 0 && latency > target_latency) {
+        decrease();
+        return;
+    }
+    const auto old_limit = (unsigned int) limit;
+    limit = std::min((double) max_limit, limit + 1.0 / limit);
+    lock.unlock();
+    if ((unsigned int) limit > old_limit) {
+        condition.notify_all();
+    }
+}
+
+void ConcurrencyLimiter::on_throttle() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    decrease();
+}
+
+void ConcurrencyLimiter::decrease() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_decrease < std::chrono::milliseconds(DECREASE_COOLDOWN_MS)) {
+        return;
+    }
+    last_decrease = now;
+    limit = std::max((double) min_limit, limit * DECREASE_FACTOR);
+}
+
+unsigned int ConcurrencyLimiter::get_limit() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    return (unsigned int) limit;
+}
+
+unsigned int ConcurrencyLimiter::get_running() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    return running;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+// Limits the number of simultaneous operations. The limit adapts with AIMD (additive increase,
+// multiplicative decrease): it grows by one per limit successful operations and halves on throttling
+// or when operation latency exceeds target latency.
+
+class ConcurrencyLimiter {
+public:
+    // target_latency_ - latency above which the limit is decreased. Latency is not checked if set to 0
+    ConcurrencyLimiter(unsigned int min_limit_, unsigned int max_limit_, unsigned int initial_limit, std::chrono::milliseconds target_latency_);
+
+    // blocks until the number of running operations is below the limit
+    void acquire();
+    void release();
+
+    // report completed operation
+    void on_success(std::chrono::milliseconds latency);
+    // report throttled (i.e. HTTP 429) or timed out operation
+    void on_throttle();
+
+    unsigned int get_limit();
+    unsigned int get_running();
+
+private:
+    void decrease();
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    const unsigned int min_limit;
+    const unsigned int max_limit;
+    const std::chrono::milliseconds target_latency;
+    // fractional limit allows additive increase of 1/limit per success
+    double limit;
+    unsigned int running;
+    // decrease at most once per cooldown so that a burst of failures of simultaneous operations
+    // does not collapse the limit to the minimum
+    std::chrono::steady_clock::time_point last_decrease;
+};
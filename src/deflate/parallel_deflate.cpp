@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "./parallel_deflate.hpp"
+#include "../trace/trace.hpp"
+
+// deflate window size, data further back could not be referenced
+#define DICTIONARY_SIZE (32 * 1024)
+// sync flush marker and block headers which are not accounted by deflateBound
+#define FLUSH_OVERHEAD 64
+
+static deflate_block_t deflate_block(const std::vector<char> &block, const std::vector<char> &dictionary, bool last, int level) {
+    const auto start = std::chrono::steady_clock::now();
+    deflate_block_t ret { {}, 0, block.size(), std::chrono::nanoseconds(0), std::nullopt };
+    ret.crc = (uint32_t) crc32(crc32(0L, Z_NULL, 0), (const Bytef *) block.data(), (uInt) block.size());
+
+    z_stream stream {};
+    // negative window bits for raw deflate without zlib header
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        ret.error = "Could not initialize deflate";
+        return ret;
+    }
+    if (!dictionary.empty()) {
+        const auto dictionary_size = std::min(dictionary.size(), (size_t) DICTIONARY_SIZE);
+        deflateSetDictionary(&stream, (const Bytef *) dictionary.data() + dictionary.size() - dictionary_size, (uInt) dictionary_size);
+    }
+    ret.data.resize(deflateBound(&stream, (uLong) block.size()) + FLUSH_OVERHEAD);
+    stream.next_in = (Bytef *) block.data();
+    stream.avail_in = (uInt) block.size();
+    stream.next_out = (Bytef *) ret.data.data();
+    stream.avail_out = (uInt) ret.data.size();
+    // sync flush ends the block at a byte boundary without finishing the stream
+    const auto result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    const auto is_complete = last ? result == Z_STREAM_END : (result == Z_OK && stream.avail_in == 0 && stream.avail_out > 0);
+    if (!is_complete) {
+        ret.error = stream.msg != nullptr ? std::string(stream.msg) : std::string("Deflate output buffer is too small");
+    }
+    ret.data.resize(ret.data.size() - stream.avail_out);
+    deflateEnd(&stream);
+    const auto end = std::chrono::steady_clock::now();
+    ret.duration = end - start;
+    trace_event("deflate block", "zip", start, end);
+    return ret;
+}
+
+DeflatePool::DeflatePool(unsigned int thread_count_) : workers(thread_count_, "Deflate worker") {}
+
+unsigned int DeflatePool::get_thread_count() const {
+    return workers.get_thread_count();
+}
+
+std::future<deflate_block_t> DeflatePool::compress(std::vector<char> block, std::vector<char> dictionary, bool last, int level) {
+    auto job = std::make_shared<deflate_job_t>();
+    job->block = std::move(block);
+    job->dictionary = std::move(dictionary);
+    job->last = last;
+    job->level = level;
+    auto result = job->result.get_future();
+    workers.submit([job]() {
+        job->result.set_value(deflate_block(job->block, job->dictionary, job->last, job->level));
+    });
+    return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <future>
+#include <string>
+#include <cstdint>
+#include <optional>
+
+#include "../worker_pool/worker_pool.hpp"
+
+// compressed block of a raw deflate stream
+struct deflate_block_t {
+    std::vector<char> data;
+    // CRC-32 of the uncompressed block
+    uint32_t crc;
+    // uncompressed block size
+    unsigned long long size;
+    // time spent on compression of the block
+    std::chrono::nanoseconds duration;
+    std::optional<std::string> error;
+};
+
+// Compresses independent blocks of raw deflate streams on a thread pool, similar to pigz.
+// Each block ends at a byte boundary, so compressed blocks of a stream can be concatenated in order.
+// Up to 32 KB of data preceding the block are used as a dictionary, so compression ratio is close to
+// single threaded deflate. The pool can be shared by several streams.
+class DeflatePool {
+public:
+    explicit DeflatePool(unsigned int thread_count_);
+    DeflatePool(const DeflatePool &) = delete;
+    DeflatePool &operator=(const DeflatePool &) = delete;
+
+    unsigned int get_thread_count() const;
+    // dictionary - data preceding the block, only last 32 KB are used
+    // last - block finishes the stream
+    // level - zlib compression level, -1 for default
+    std::future<deflate_block_t> compress(std::vector<char> block, std::vector<char> dictionary, bool last, int level = -1);
+
+private:
+    struct deflate_job_t {
+        std::vector<char> block;
+        std::vector<char> dictionary;
+        bool last;
+        int level;
+        std::promise<deflate_block_t> result;
+    };
+
+    WorkerPool workers;
+};
@@ -10,6 +10,11 @@ public:
         return deque.empty();
     }
 
+    size_t size() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        return deque.size();
+    }
+
     T pop_front_waiting() {
         // unique_lock can be unlocked, lock_guard can not
         std::unique_lock<std::mutex> lock{ mutex }; // locks
@@ -0,0 +1,63 @@
+#pragma once
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <utility>
+#include <condition_variable>
+
+// Items with lower priority value are popped first, items with the same priority are popped in FIFO order.
+// An item that waits longer than max_wait is popped before any other item, so that low priority items
+// are not starved by a steady flow of high priority ones.
+template<class T>
+class ThreadSafePriorityDeque {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit ThreadSafePriorityDeque(std::chrono::milliseconds max_wait_) : max_wait {max_wait_}, sequence {0} {}
+
+    bool empty() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        return items.empty();
+    }
+
+    size_t size() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        return items.size();
+    }
+
+    T pop_front_waiting() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        while (items.empty()) {
+            condition.wait(lock);
+        }
+        auto item = items.begin();
+        // oldest item is the first one in the arrival order
+        const auto oldest = arrivals.begin();
+        if (clock::now() - oldest->second.first >= max_wait) {
+            item = items.find(std::make_pair(oldest->second.second, oldest->first));
+        }
+        auto t = item->second;
+        arrivals.erase(item->first.second);
+        items.erase(item);
+        return t;
+    }
+
+    void push_back(const T t, long long priority = 0) {
+        std::unique_lock<std::mutex> lock{ mutex };
+        const auto index = sequence++;
+        items.emplace(std::make_pair(priority, index), t);
+        arrivals.emplace(index, std::make_pair(clock::now(), priority));
+        lock.unlock();
+        condition.notify_one(); // wakes up pop_front_waiting
+    }
+
+private:
+    std::chrono::milliseconds max_wait;
+    unsigned long long sequence;
+    // key - priority and arrival sequence number
+    std::map<std::pair<long long, unsigned long long>, T> items;
+    // key - arrival sequence number, value - arrival time and priority
+    std::map<unsigned long long, std::pair<clock::time_point, long long>> arrivals;
+    std::mutex mutex;
+    std::condition_variable condition;
+};
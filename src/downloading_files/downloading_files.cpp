@@ -1,75 +1,176 @@
+#include <limits>
+#include <algorithm>
+
 #include "./downloading_files.hpp"
 
-DownloadingFiles::DownloadingFiles(const lt::torrent_info& torrent_, std::vector<std::string> updated_files, unsigned long long size_limit_bytes) :
-    torrent {torrent_},
-    torrent_files {updated_files.begin(), updated_files.end()},
-    size_limit {size_limit_bytes}
-{}
+// size of removed files, larger than any free space
+#define SIZE_REMOVED std::numeric_limits<unsigned long long>::max()
 
-std::vector<std::string> DownloadingFiles::download_next_chunk() {
-    unsigned long long total_size = 0;
-    for (const auto &file_index: torrent.files().file_range()) {
-        const auto file_size = torrent.files().file_size(file_index);
-        const auto file_name = torrent.files().file_path(file_index);
+FileSizeTree::FileSizeTree(const std::vector<unsigned long long> &sizes) : count {sizes.size()}, leaves {1} {
+    while (leaves < count) {
+        leaves *= 2;
+    }
+    tree.resize(leaves * 2, SIZE_REMOVED);
+    for (size_t i = 0; i < count; i++) {
+        tree[leaves + i] = sizes[i];
+    }
+    for (size_t node = leaves - 1; node > 0; node--) {
+        tree[node] = std::min(tree[node * 2], tree[node * 2 + 1]);
+    }
+}
 
-        if (torrent_files.find(file_name) == torrent_files.end()) {
-            continue;
-        }
-        if (completed_files.find(file_name) != completed_files.end()) {
-            continue;
-        }
-        if (downloading_files.find(file_name) != downloading_files.end()) {
-            total_size += file_size;
-        }
+void FileSizeTree::remove(size_t position) {
+    auto node = leaves + position;
+    tree[node] = SIZE_REMOVED;
+    for (node /= 2; node > 0; node /= 2) {
+        tree[node] = std::min(tree[node * 2], tree[node * 2 + 1]);
     }
+}
 
-    std::vector<std::string> to_download_files;
-    int first_uncompleted_index = -1;
-    for (const auto &file_index: torrent.files().file_range()) {
-        const auto file_size = torrent.files().file_size(file_index);
-        const auto file_name = torrent.files().file_path(file_index);
+size_t FileSizeTree::find_first(size_t from, unsigned long long max_size) const {
+    if (from >= count) {
+        return count;
+    }
+    // removed files never fit
+    return std::min(find_first(1, 0, leaves, from, std::min(max_size, SIZE_REMOVED - 1)), count);
+}
 
-        if (torrent_files.find(file_name) == torrent_files.end()) {
-            continue;
-        }
-        if (completed_files.find(file_name) != completed_files.end()) {
-            continue;
-        }
-        if (downloading_files.find(file_name) != downloading_files.end()) {
-            continue;
+size_t FileSizeTree::find_first(size_t node, size_t node_begin, size_t node_end, size_t from, unsigned long long max_size) const {
+    if (node_end <= from || tree[node] > max_size) {
+        return count;
+    }
+    if (node_end - node_begin == 1) {
+        return node_begin;
+    }
+    const auto middle = (node_begin + node_end) / 2;
+    const auto left = find_first(node * 2, node_begin, middle, from, max_size);
+    if (left != count) {
+        return left;
+    }
+    return find_first(node * 2 + 1, middle, node_end, from, max_size);
+}
+
+size_t FileSizeTree::size() const {
+    return count;
+}
+
+DownloadingFiles::DownloadingFiles(std::shared_ptr<const TorrentMetadata> metadata_, const std::vector<std::string> &updated_files, unsigned long long size_limit_bytes) :
+    metadata {metadata_},
+    size_limit {size_limit_bytes},
+    download_tree {std::vector<unsigned long long>()},
+    prefetch_tree {std::vector<unsigned long long>()},
+    downloading_size {0},
+    prefetching_size {0},
+    completed_count {0}
+{
+    // files not in the torrent are skipped, the rest are kept in torrent order
+    std::vector<unsigned int> file_indexes;
+    file_indexes.reserve(updated_files.size());
+    for (const auto &file_name : updated_files) {
+        const auto file_index = metadata->find_file(file_name);
+        if (file_index.has_value()) {
+            file_indexes.push_back(file_index.value());
         }
-        if (first_uncompleted_index < 0) first_uncompleted_index = (int) file_index;
-        if (total_size + file_size > size_limit) {
-            continue;
+    }
+    std::sort(file_indexes.begin(), file_indexes.end());
+    file_indexes.erase(std::unique(file_indexes.begin(), file_indexes.end()), file_indexes.end());
+
+    std::vector<unsigned long long> sizes;
+    sizes.reserve(file_indexes.size());
+    files.reserve(file_indexes.size());
+    file_positions.reserve(file_indexes.size());
+    for (const auto file_index : file_indexes) {
+        const auto file_size = metadata->file_size(file_index);
+        file_positions[file_index] = files.size();
+        files.push_back(file_t { file_index, file_size, false, false, false });
+        sizes.push_back(file_size);
+    }
+    download_tree = FileSizeTree(sizes);
+    prefetch_tree = FileSizeTree(sizes);
+}
+
+void DownloadingFiles::start_download(size_t position, std::vector<std::string> &to_download_files) {
+    auto &file = files[position];
+    file.is_downloading = true;
+    download_tree.remove(position);
+    prefetch_tree.remove(position);
+    if (file.is_prefetching) {
+        file.is_prefetching = false;
+        prefetching_size -= file.size;
+    }
+    downloading_size += file.size;
+    to_download_files.push_back(metadata->file_path(file.file_index));
+}
+
+std::vector<std::string> DownloadingFiles::download_next_chunk() {
+    std::vector<std::string> to_download_files;
+    // files are selected in torrent order, skipping files which do not fit
+    const auto first_uncompleted = download_tree.find_first(0, SIZE_REMOVED);
+    unsigned long long total_size = downloading_size;
+    size_t position = 0;
+    while (total_size <= size_limit) {
+        position = download_tree.find_first(position, size_limit - total_size);
+        if (position == files.size()) {
+            break;
         }
-        to_download_files.push_back(file_name);
-        downloading_files.insert(file_name);
-        total_size += file_size;
+        total_size += files[position].size;
+        start_download(position, to_download_files);
+        position++;
     }
 
     // if no file fits a size limit, add first available file and download one by one
-    if (total_size == 0 && first_uncompleted_index >= 0) {
-        const auto file_name = torrent.files().file_path(lt::file_index_t{first_uncompleted_index});
-        to_download_files.push_back(file_name);
-        downloading_files.insert(file_name);
+    if (total_size == 0 && first_uncompleted < files.size() && !files[first_uncompleted].is_downloading) {
+        start_download(first_uncompleted, to_download_files);
     }
     return to_download_files;
 }
 
+std::vector<std::string> DownloadingFiles::prefetch_next_chunk(unsigned long long headroom_bytes) {
+    std::vector<std::string> to_prefetch_files;
+    size_t position = 0;
+    while (prefetching_size <= headroom_bytes) {
+        position = prefetch_tree.find_first(position, headroom_bytes - prefetching_size);
+        if (position == files.size()) {
+            break;
+        }
+        auto &file = files[position];
+        file.is_prefetching = true;
+        prefetch_tree.remove(position);
+        prefetching_size += file.size;
+        to_prefetch_files.push_back(metadata->file_path(file.file_index));
+        position++;
+    }
+    return to_prefetch_files;
+}
+
 void DownloadingFiles::complete_file(std::string file_name) {
-    const auto file_to_erase = downloading_files.find(file_name);
-    if (file_to_erase != downloading_files.end()) {
-        downloading_files.erase(file_to_erase);
+    const auto file_index = metadata->find_file(file_name);
+    if (!file_index.has_value()) {
+        return;
+    }
+    const auto position_it = file_positions.find(file_index.value());
+    if (position_it == file_positions.end()) {
+        return;
     }
-    completed_files.insert(file_name);
+    const auto position = position_it->second;
+    auto &file = files[position];
+    if (file.is_completed) {
+        return;
+    }
+    if (file.is_downloading) {
+        file.is_downloading = false;
+        downloading_size -= file.size;
+    }
+    if (file.is_prefetching) {
+        file.is_prefetching = false;
+        prefetching_size -= file.size;
+    }
+    file.is_completed = true;
+    download_tree.remove(position);
+    prefetch_tree.remove(position);
+    completed_count++;
 }
 
 bool DownloadingFiles::is_completed() const {
-    std::unordered_set<std::string> intersect;
-    for (const auto f : completed_files) {
-        if (torrent_files.count(f)) {
-            intersect.insert(f);
-        }
-    }
-    return intersect == torrent_files;
+    return completed_count == files.size();
 }
@@ -2,24 +2,65 @@
 
 #include <string>
 #include <vector>
-#include <unordered_set>
+#include <unordered_map>
 #include <optional>
 
-#include <libtorrent/torrent_info.hpp>
+#include "../torrent_metadata/torrent_metadata.hpp"
+
+// Segment tree of file sizes in torrent order, finds the first file which fits the free space in O(log n).
+// Removed files never fit.
+class FileSizeTree {
+public:
+    FileSizeTree(const std::vector<unsigned long long> &sizes);
+    void remove(size_t position);
+    // first position not before from with size not above max_size, size() if there is no such file
+    size_t find_first(size_t from, unsigned long long max_size) const;
+    size_t size() const;
+
+private:
+    size_t find_first(size_t node, size_t node_begin, size_t node_end, size_t from, unsigned long long max_size) const;
+
+    size_t count;
+    size_t leaves;
+    // minimal size in the subtree
+    std::vector<unsigned long long> tree;
+};
 
 class DownloadingFiles {
 public:
-    DownloadingFiles(const lt::torrent_info& torrent_, std::vector<std::string> updated_files, unsigned long long size_limit_bytes);
+    DownloadingFiles(std::shared_ptr<const TorrentMetadata> metadata_, const std::vector<std::string> &updated_files, unsigned long long size_limit_bytes);
     std::vector<std::string> download_next_chunk();
+    // select files that would be downloaded next, up to headroom_bytes in total, for a low priority download.
+    // Prefetched files are still returned by download_next_chunk() when they fit the size limit.
+    std::vector<std::string> prefetch_next_chunk(unsigned long long headroom_bytes);
     // mark as downloaded
     void complete_file(std::string file_name);
     bool is_completed() const;
 
 private:
-    const lt::torrent_info torrent;
+    struct file_t {
+        // index in the torrent, names are kept by metadata
+        unsigned int file_index;
+        unsigned long long size;
+        bool is_downloading;
+        bool is_prefetching;
+        bool is_completed;
+    };
+
+    void start_download(size_t position, std::vector<std::string> &to_download_files);
+
+    std::shared_ptr<const TorrentMetadata> metadata;
     unsigned long long size_limit;
-    // we might want to download not all files from the torrent, so we keep a separate set of downloadable files
-    std::unordered_set<std::string> torrent_files;
-    std::unordered_set<std::string> completed_files;
-    std::unordered_set<std::string> downloading_files;
+    // we might want to download not all files from the torrent, so we keep only downloadable files in torrent order
+    std::vector<file_t> files;
+    // key - index in the torrent
+    // value - position in files
+    std::unordered_map<unsigned int, size_t> file_positions;
+    // files which are neither downloading nor completed
+    FileSizeTree download_tree;
+    // files which are neither prefetching, downloading nor completed
+    FileSizeTree prefetch_tree;
+    unsigned long long downloading_size;
+    unsigned long long prefetching_size;
+    size_t completed_count;
 };
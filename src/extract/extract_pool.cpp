@@ -0,0 +1,25 @@
+#include "./extract_pool.hpp"
+
+ExtractPool::ExtractPool(unsigned int thread_count_) : workers(thread_count_, "Extract worker") {}
+
+unsigned int ExtractPool::get_thread_count() const {
+    return workers.get_thread_count();
+}
+
+void ExtractPool::extract(const std::string &file_name, std::filesystem::path archive_path, std::filesystem::path output_directory) {
+    auto job = std::make_shared<extract_job_t>();
+    job->file_name = file_name;
+    job->archive_path = archive_path;
+    job->output_directory = output_directory;
+    workers.submit([this, job]() {
+        fprintf(stdout, "Extracting %s\n", job->archive_path.string().c_str());
+        auto result = unpack_file(job->archive_path, job->output_directory, [&](const file_unpack_info_t &file) {
+            progress_queue.push_back(ExtractProgressFile { job->file_name, file });
+        });
+        progress_queue.push_back(ExtractProgressDone { job->file_name, std::move(result) });
+    });
+}
+
+ThreadSafeDeque<ExtractProgressEvent> &ExtractPool::get_progress_queue() {
+    return progress_queue;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <variant>
+#include <filesystem>
+
+#include "../deque/deque.hpp"
+#include "../worker_pool/worker_pool.hpp"
+#include "../archive/archive.hpp"
+
+// file is extracted from the archive and could be uploaded
+struct ExtractProgressFile {
+    // name of the archive relative to the download path
+    std::string file_name;
+    file_unpack_info_t file;
+};
+
+// extraction of the archive is finished
+struct ExtractProgressDone {
+    // name of the archive relative to the download path
+    std::string file_name;
+    // either all extracted files or an error message, same as unpack_file
+    std::variant<std::vector<file_unpack_info_t>, std::string> result;
+};
+
+typedef std::variant<ExtractProgressFile, ExtractProgressDone> ExtractProgressEvent;
+
+// Extracts archives on worker threads, so that extraction of a large archive does not block processing
+// of other downloaded and uploaded files. Each extracted file is reported to the progress queue as soon as
+// it is written, followed by ExtractProgressDone of its archive
+class ExtractPool {
+public:
+    explicit ExtractPool(unsigned int thread_count_);
+    ExtractPool(const ExtractPool &) = delete;
+    ExtractPool &operator=(const ExtractPool &) = delete;
+
+    unsigned int get_thread_count() const;
+    // file_name - reported back in the progress events
+    void extract(const std::string &file_name, std::filesystem::path archive_path, std::filesystem::path output_directory);
+    ThreadSafeDeque<ExtractProgressEvent> &get_progress_queue();
+
+private:
+    struct extract_job_t {
+        std::string file_name;
+        std::filesystem::path archive_path;
+        std::filesystem::path output_directory;
+    };
+
+    ThreadSafeDeque<ExtractProgressEvent> progress_queue;
+    // declared last, so that the workers are stopped before the progress queue is destroyed
+    WorkerPool workers;
+};
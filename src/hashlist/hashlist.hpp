@@ -3,7 +3,7 @@
 #include <unordered_map>
 #include <unordered_set>
 
-#include "../torrent/torrent_download.hpp"
+#include "../torrent_metadata/torrent_metadata.hpp"
 
 struct hashlist_t {
     // hash of each piece of a file - stored in .torrent file
@@ -17,8 +17,8 @@ struct hashlist_t {
 // value - hashes of file pieces and linked file names
 typedef std::unordered_map<std::string, hashlist_t> file_hashlist_t;
 
-file_hashlist_t create_hashlist(const lt::torrent_info &torrent, const std::unordered_map<std::string, std::vector<std::string>> &linked_files);
+file_hashlist_t create_hashlist(const TorrentMetadata &metadata, const std::unordered_map<std::string, std::vector<std::string>> &linked_files);
 
-std::unordered_set<std::string> get_updated_files(const lt::torrent_info &torrent, const file_hashlist_t& files);
+std::unordered_set<std::string> get_updated_files(const TorrentMetadata &metadata, const file_hashlist_t& files);
 
-std::unordered_set<std::string> get_removed_files(const lt::torrent_info &torrent, const file_hashlist_t& files);
+std::unordered_set<std::string> get_removed_files(const TorrentMetadata &metadata, const file_hashlist_t& files);
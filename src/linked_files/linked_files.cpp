@@ -1,60 +1,165 @@
+#include <limits>
+
 #include "./linked_files.hpp"
 
-void LinkedFiles::add_files(std::string parent, std::vector<std::string> files) {
-    linked_files[parent].insert(files.begin(), files.end());
-    for (const auto &f : files) {
-        parent_files[f] = parent;
+#define NO_NODE std::numeric_limits<unsigned int>::max()
+
+std::optional<unsigned int> LinkedFiles::find_node(const std::string &path) const {
+    const auto node_iter = node_ids.find(path);
+    if (node_iter == node_ids.end()) {
+        return {};
     }
+    return node_iter->second;
 }
 
-void LinkedFiles::remove_child(std::string child) {
-    const auto parent_iter = parent_files.find(child);
-    if (parent_iter == parent_files.end()) return;
-    const auto parent = parent_iter->second;
-    parent_files.erase(parent_iter);
-    const auto children_iter = linked_files.find(parent);
-    if (children_iter == linked_files.end()) {
+unsigned int LinkedFiles::intern(const std::string &path) {
+    const auto node_iter = node_ids.find(path);
+    if (node_iter != node_ids.end()) {
+        return node_iter->second;
+    }
+    unsigned int node;
+    if (!free_nodes.empty()) {
+        node = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[node] = node_t { path, NO_NODE, NO_NODE, NO_NODE, NO_NODE, 0, false };
+    } else {
+        node = (unsigned int) nodes.size();
+        nodes.push_back(node_t { path, NO_NODE, NO_NODE, NO_NODE, NO_NODE, 0, false });
+    }
+    node_ids.emplace(nodes[node].path, node);
+    return node;
+}
+
+void LinkedFiles::link(unsigned int parent, unsigned int child) {
+    auto &parent_node = nodes[parent];
+    auto &child_node = nodes[child];
+    parent_node.is_parent = true;
+    if (child_node.parent == parent) {
         return;
     }
-    auto &children_files_ref = children_iter->second;
-    const auto child_iter = children_files_ref.find(child);
-    if (child_iter == children_files_ref.end()) {
+    if (child_node.parent != NO_NODE) {
+        const auto previous_parent = child_node.parent;
+        unlink(child);
+        release(previous_parent);
+    }
+    child_node.parent = parent;
+    child_node.prev_sibling = NO_NODE;
+    child_node.next_sibling = parent_node.first_child;
+    if (parent_node.first_child != NO_NODE) {
+        nodes[parent_node.first_child].prev_sibling = child;
+    }
+    parent_node.first_child = child;
+    parent_node.child_count++;
+}
+
+void LinkedFiles::unlink(unsigned int child) {
+    auto &child_node = nodes[child];
+    auto &parent_node = nodes[child_node.parent];
+    if (child_node.prev_sibling != NO_NODE) {
+        nodes[child_node.prev_sibling].next_sibling = child_node.next_sibling;
+    } else {
+        parent_node.first_child = child_node.next_sibling;
+    }
+    if (child_node.next_sibling != NO_NODE) {
+        nodes[child_node.next_sibling].prev_sibling = child_node.prev_sibling;
+    }
+    child_node.parent = NO_NODE;
+    child_node.prev_sibling = NO_NODE;
+    child_node.next_sibling = NO_NODE;
+    parent_node.child_count--;
+    // parent without children is removed along with its last child
+    if (parent_node.child_count == 0) {
+        parent_node.is_parent = false;
+    }
+}
+
+void LinkedFiles::release(unsigned int node) {
+    auto &file_node = nodes[node];
+    if (file_node.parent != NO_NODE || file_node.is_parent || file_node.first_child != NO_NODE) {
         return;
     }
-    children_files_ref.erase(child_iter);
-    if (children_files_ref.size() > 0) {
+    node_ids.erase(file_node.path);
+    file_node.path = std::string();
+    free_nodes.push_back(node);
+}
+
+void LinkedFiles::add_files(const std::string &parent, const std::vector<std::string> &files) {
+    const auto parent_node = intern(parent);
+    nodes[parent_node].is_parent = true;
+    for (const auto &f : files) {
+        link(parent_node, intern(f));
+    }
+}
+
+bool LinkedFiles::add_child(const std::string &parent, const std::string &child) {
+    const auto child_node = intern(child);
+    if (nodes[child_node].parent != NO_NODE) {
+        return false;
+    }
+    link(intern(parent), child_node);
+    return true;
+}
+
+void LinkedFiles::remove_child(const std::string &child) {
+    const auto child_node = find_node(child);
+    if (!child_node.has_value() || nodes[child_node.value()].parent == NO_NODE) {
         return;
     }
-    linked_files.erase(children_iter);
+    const auto parent_node = nodes[child_node.value()].parent;
+    unlink(child_node.value());
+    release(child_node.value());
+    release(parent_node);
 }
 
-void LinkedFiles::remove_parent(std::string parent) {
-    const auto children_iter = linked_files.find(parent);
-    if (children_iter == linked_files.end()) return;
-    for (const auto child : children_iter->second) {
-        const auto parent_iter = parent_files.find(child);
-        if (parent_iter == parent_files.end()) continue;;
-        parent_files.erase(parent_iter);
+void LinkedFiles::remove_parent(const std::string &parent) {
+    const auto parent_node = find_node(parent);
+    if (!parent_node.has_value() || !nodes[parent_node.value()].is_parent) {
+        return;
     }
-    linked_files.erase(children_iter);
+    auto child = nodes[parent_node.value()].first_child;
+    while (child != NO_NODE) {
+        const auto next_child = nodes[child].next_sibling;
+        unlink(child);
+        release(child);
+        child = next_child;
+    }
+    nodes[parent_node.value()].is_parent = false;
+    release(parent_node.value());
 }
 
 std::unordered_map<std::string, std::vector<std::string>> LinkedFiles::get_files() const {
     std::unordered_map<std::string, std::vector<std::string>> linked_files_copy;
-    for (const auto kv : linked_files) {
-        std::vector<std::string> files;
-        for (const auto f : kv.second) {
-            files.push_back(f);
+    for (const auto &node : nodes) {
+        if (!node.is_parent) {
+            continue;
+        }
+        auto &files = linked_files_copy[node.path];
+        files.reserve(node.child_count);
+        for (auto child = node.first_child; child != NO_NODE; child = nodes[child].next_sibling) {
+            files.push_back(nodes[child].path);
         }
-        linked_files_copy[kv.first] = files;
     }
     return linked_files_copy;
 }
 
-std::optional<std::string> LinkedFiles::get_parent(std::string child) const {
-    const auto parent_iter = parent_files.find(child);
-    if (parent_iter == parent_files.end()) {
+std::optional<std::string> LinkedFiles::get_parent(const std::string &child) const {
+    const auto child_node = find_node(child);
+    if (!child_node.has_value() || nodes[child_node.value()].parent == NO_NODE) {
         return {};
     }
-    return parent_iter->second;
+    return nodes[nodes[child_node.value()].parent].path;
+}
+
+bool LinkedFiles::is_parent(const std::string &parent) const {
+    const auto parent_node = find_node(parent);
+    return parent_node.has_value() && nodes[parent_node.value()].is_parent;
+}
+
+size_t LinkedFiles::child_count(const std::string &parent) const {
+    const auto parent_node = find_node(parent);
+    return parent_node.has_value() ? nodes[parent_node.value()].child_count : 0;
+}
+
+bool LinkedFiles::has_children(const std::string &parent) const {
+    return child_count(parent) > 0;
 }
@@ -1,24 +1,53 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <deque>
 #include <unordered_map>
-#include <unordered_set>
 #include <optional>
 
+// Tree of parent and linked files, i.e. folders and their files or archives and extracted files.
+// Each path is interned once, nodes keep the parent, the number of children and a list of children,
+// so that lookups, child counts and removals do not copy paths or touch other parents.
 class LinkedFiles {
 public:
-    void add_files(std::string parent, std::vector<std::string> files);
-    void remove_child(std::string child);
-    void remove_parent(std::string parent);
+    // a file which is already linked to another parent is moved to this parent, it is no longer listed
+    // under the previous one, which is removed if it is left without children
+    void add_files(const std::string &parent, const std::vector<std::string> &files);
+    // links child to parent unless the child is linked already, returns whether it was linked
+    bool add_child(const std::string &parent, const std::string &child);
+    void remove_child(const std::string &child);
+    void remove_parent(const std::string &parent);
     std::unordered_map<std::string, std::vector<std::string>> get_files() const;
-    std::optional<std::string> get_parent(std::string child) const;
+    std::optional<std::string> get_parent(const std::string &child) const;
+    // parent added with add_files() which is not removed yet, it might have no children
+    bool is_parent(const std::string &parent) const;
+    size_t child_count(const std::string &parent) const;
+    // unlike get_files() does not copy all files
+    bool has_children(const std::string &parent) const;
 
 private:
-    // key - parent file
-    // value - linked files
-    std::unordered_map<std::string, std::unordered_set<std::string>> linked_files;
-    // key - linked file
-    // value - parent file
-    std::unordered_map<std::string, std::string> parent_files;
+    struct node_t {
+        std::string path;
+        unsigned int parent;
+        // children are a doubly linked list, so that a child is removed in O(1)
+        unsigned int first_child;
+        unsigned int prev_sibling;
+        unsigned int next_sibling;
+        unsigned int child_count;
+        bool is_parent;
+    };
+
+    std::optional<unsigned int> find_node(const std::string &path) const;
+    unsigned int intern(const std::string &path);
+    void link(unsigned int parent, unsigned int child);
+    void unlink(unsigned int child);
+    // frees the node if it is neither a parent nor a child
+    void release(unsigned int node);
+
+    // deque does not move nodes, so node_ids keys may point to their paths
+    std::deque<node_t> nodes;
+    std::unordered_map<std::string_view, unsigned int> node_ids;
+    std::vector<unsigned int> free_nodes;
 };
@@ -16,6 +16,13 @@
 #include "./db/sqlite.hpp"
 #include "./app_state/state.hpp"
 #include "./app_sync/sync.hpp"
+#include "./bandwidth/bandwidth_limiter.hpp"
+#include "./deflate/parallel_deflate.hpp"
+#include "./compression/compression_policy.hpp"
+#include "./extract/extract_pool.hpp"
+#include "./archive/archive.hpp"
+#include "./metrics/metrics.hpp"
+#include "./trace/trace.hpp"
 
 #define STRING(x) #x
 #define XSTRING(x) STRING(x)
@@ -24,6 +31,12 @@
 #define APP_VERSION XSTRING(CMAKE_PROJECT_VERSION)
 
 #define STATE_STORAGE_NAME "default.sqlite"
+#define BANDWIDTH_BURST_SECONDS_DEFAULT 1.0
+// share of the bandwidth limit kept for the torrent, so that S3 uploads do not starve the download
+#define BANDWIDTH_TORRENT_SHARE 0.1
+#define ARCHIVE_STORE_RATIO_DEFAULT 0.95
+// beginning of archived file which is compressed to choose compression method
+#define ARCHIVE_SAMPLE_SIZE (4 * 1024 * 1024)
 
 static void print_usage(const cxxopts::Options &options) {
     fprintf(stderr, "%s", options.help().c_str());
@@ -47,10 +60,31 @@ int main(int argc, char const* argv[]) {
            ("u,s3-upload-path", "S3 path to store uploaded files", cxxopts::value<std::string>())
            ("a,s3-access-key", "S3 access key", cxxopts::value<std::string>())
            ("k,s3-secret-key", "S3 secret key", cxxopts::value<std::string>())
+           ("s3-max-concurrency", "Maximum number of simultaneous S3 uploads. Default is 64", cxxopts::value<unsigned int>())
+           ("s3-min-concurrency", "Minimum number of simultaneous S3 uploads. Default is 1", cxxopts::value<unsigned int>())
+           ("s3-target-latency", "S3 upload latency in milliseconds per 16 MB above which number of simultaneous uploads is decreased", cxxopts::value<unsigned int>())
+           ("s3-upload-order", "Order of queued S3 uploads: \"fifo\", \"smallest\", \"largest\" or \"parent\". Default is \"fifo\"", cxxopts::value<std::string>())
+           ("s3-upload-max-wait", "Seconds after which a queued file is uploaded regardless of the upload order. Default is 60", cxxopts::value<unsigned int>())
+           ("bandwidth-limit", "Combined upload and download bandwidth limit in bytes per second with optional K, M or G suffix, i.e. \"10M\", or time of day schedule, i.e. \"0:00=10M,9:00=2M,18:00=10M\"", cxxopts::value<std::string>())
+           ("bandwidth-burst", "Seconds of unused upload bandwidth which can be used for bursts. Default is 1", cxxopts::value<double>())
            ("d,download-path", "Temporary directory for downloaded files", cxxopts::value<std::string>())
            ("l,limit-size", "Temporary directory maximum size in bytes", cxxopts::value<unsigned long long>())
            ("x,extract-files", "Extract downloaded archives before uploading")
+           ("extract-threads", "Number of archives extracted simultaneously. Default is 1", cxxopts::value<unsigned int>())
+           ("archive-block-size", "Size of reads from archives and from archived files in bytes. Default is 65536", cxxopts::value<size_t>())
+           ("extract-streaming", "Upload files of extracted archives directly from the archive without writing them to disk")
            ("z,archive-files", "Archive files before uploading")
+           ("archive-threads", "Number of threads to compress large archived files. Default is 1", cxxopts::value<unsigned int>())
+           ("archive-level", "Compression level (0-9) of archived files, 0 stores files without compression. Default is 6", cxxopts::value<int>())
+           ("archive-store-ratio", "Archived file is stored without compression if its first 4 MB compress to more than this fraction. Default is 0.95", cxxopts::value<double>())
+           ("archive-overrides", "Compression of archived files by extension, i.e. \"mp4=store,log=9\". Common media files are stored by default", cxxopts::value<std::string>())
+           ("c,s3-reconcile", "Skip files that are unknown to the application state but already uploaded to S3 with the same size")
+           ("bundle-threshold", "Files smaller than this size in bytes are uploaded in tar bundles. Bundling is disabled if not set", cxxopts::value<unsigned long long>())
+           ("bundle-size", "Bundle is uploaded when total size of its files reaches this size in bytes. Default is 64 MB", cxxopts::value<unsigned long long>())
+           ("p,prefetch-headroom", "Fraction of the temporary directory size limit to use for low priority prefetch of the next files. Prefetch is disabled if not set", cxxopts::value<double>())
+           ("metrics-file", "Path to a file with metrics in Prometheus text format, i.e. for the node_exporter textfile collector. Metrics are not written if not set", cxxopts::value<std::string>())
+           ("metrics-interval", "Seconds between updates of the metrics file. Default is 10", cxxopts::value<unsigned int>())
+           ("trace-file", "Path to a file with Chrome trace of pipeline stages, written on exit and on SIGUSR1. Tracing is disabled if not set", cxxopts::value<std::string>())
            ("q,state-file", std::string("Path to application state file. Default is <download-path>/") + std::string(STATE_STORAGE_NAME), cxxopts::value<std::string>())
            ("v,version", "Show version")
            ("h,help", "Show help");
@@ -160,8 +194,126 @@ int main(int argc, char const* argv[]) {
         s3_region = args["s3-region"].as<std::string>();
     }
 
+    unsigned int s3_max_concurrency = 0;
+    if (args.count("s3-max-concurrency")) {
+        s3_max_concurrency = args["s3-max-concurrency"].as<unsigned int>();
+    }
+    unsigned int s3_min_concurrency = 0;
+    if (args.count("s3-min-concurrency")) {
+        s3_min_concurrency = args["s3-min-concurrency"].as<unsigned int>();
+    }
+    unsigned int s3_target_latency_ms = 0;
+    if (args.count("s3-target-latency")) {
+        s3_target_latency_ms = args["s3-target-latency"].as<unsigned int>();
+    }
+    auto s3_upload_order = UPLOAD_ORDER_FIFO;
+    if (args.count("s3-upload-order")) {
+        const auto upload_order = parse_upload_order(args["s3-upload-order"].as<std::string>());
+        if (!upload_order.has_value()) {
+            fprintf(stderr, "Unknown upload order \"%s\".\n", args["s3-upload-order"].as<std::string>().c_str());
+            print_usage(options);
+            return EXIT_FAILURE;
+        }
+        s3_upload_order = upload_order.value();
+    }
+    unsigned int s3_upload_max_wait_ms = 0;
+    if (args.count("s3-upload-max-wait")) {
+        s3_upload_max_wait_ms = args["s3-upload-max-wait"].as<unsigned int>() * 1000;
+    }
+
+    std::shared_ptr<BandwidthLimiter> bandwidth_limiter;
+    if (args.count("bandwidth-limit")) {
+        const auto schedule_ret = parse_bandwidth_schedule(args["bandwidth-limit"].as<std::string>());
+        if (std::holds_alternative<std::string>(schedule_ret)) {
+            fprintf(stderr, "Invalid bandwidth limit: %s\n", std::get<std::string>(schedule_ret).c_str());
+            print_usage(options);
+            return EXIT_FAILURE;
+        }
+        double bandwidth_burst_seconds = BANDWIDTH_BURST_SECONDS_DEFAULT;
+        if (args.count("bandwidth-burst")) {
+            bandwidth_burst_seconds = args["bandwidth-burst"].as<double>();
+            if (bandwidth_burst_seconds < 0.0) {
+                fprintf(stderr, "Bandwidth burst should not be negative.\n");
+                print_usage(options);
+                return EXIT_FAILURE;
+            }
+        }
+        bandwidth_limiter = std::make_shared<BandwidthLimiter>(std::get<BandwidthSchedule>(schedule_ret), bandwidth_burst_seconds, BANDWIDTH_TORRENT_SHARE);
+    }
+
     const auto extract_files = args.count("extract-files") > 0;
+    const auto extract_streaming = args.count("extract-streaming") > 0;
+    // archives are extracted in background, so that other files are processed meanwhile
+    std::shared_ptr<ExtractPool> extract_pool;
+    if (extract_files) {
+        extract_pool = std::make_shared<ExtractPool>(args.count("extract-threads") ? args["extract-threads"].as<unsigned int>() : 1);
+    }
+    if (args.count("archive-block-size")) {
+        set_archive_block_size(args["archive-block-size"].as<size_t>());
+    }
     const auto archive_files = args.count("archive-files") > 0;
+    std::shared_ptr<DeflatePool> deflate_pool;
+    if (args.count("archive-threads") && args["archive-threads"].as<unsigned int>() > 1) {
+        deflate_pool = std::make_shared<DeflatePool>(args["archive-threads"].as<unsigned int>());
+    }
+    int archive_level = -1;
+    if (args.count("archive-level")) {
+        archive_level = args["archive-level"].as<int>();
+        if (archive_level < 0 || archive_level > 9) {
+            fprintf(stderr, "Compression level should be between 0 and 9.\n");
+            print_usage(options);
+            return EXIT_FAILURE;
+        }
+    }
+    double archive_store_ratio = ARCHIVE_STORE_RATIO_DEFAULT;
+    if (args.count("archive-store-ratio")) {
+        archive_store_ratio = args["archive-store-ratio"].as<double>();
+        if (!(archive_store_ratio > 0.0 && archive_store_ratio <= 1.0)) {
+            fprintf(stderr, "Archive store ratio should be greater than 0 and not greater than 1.\n");
+            print_usage(options);
+            return EXIT_FAILURE;
+        }
+    }
+    compression_overrides_t archive_overrides;
+    if (args.count("archive-overrides")) {
+        const auto overrides_ret = parse_compression_overrides(args["archive-overrides"].as<std::string>());
+        if (std::holds_alternative<std::string>(overrides_ret)) {
+            fprintf(stderr, "%s\n", std::get<std::string>(overrides_ret).c_str());
+            print_usage(options);
+            return EXIT_FAILURE;
+        }
+        archive_overrides = std::get<compression_overrides_t>(overrides_ret);
+    }
+    std::shared_ptr<CompressionPolicy> compression_policy;
+    if (archive_files) {
+        compression_policy = std::make_shared<CompressionPolicy>(archive_level, archive_store_ratio, ARCHIVE_SAMPLE_SIZE, archive_overrides);
+    }
+    const auto reconcile_uploaded = args.count("s3-reconcile") > 0;
+
+    double prefetch_headroom = 0.0;
+    if (args.count("prefetch-headroom")) {
+        prefetch_headroom = args["prefetch-headroom"].as<double>();
+        if (prefetch_headroom < 0.0) {
+            fprintf(stderr, "Prefetch headroom should not be negative.\n");
+            print_usage(options);
+            return EXIT_FAILURE;
+        }
+    }
+
+    unsigned long long bundle_threshold = 0;
+    if (args.count("bundle-threshold")) {
+        bundle_threshold = args["bundle-threshold"].as<unsigned long long>();
+    }
+    unsigned long long bundle_size = 0;
+    if (args.count("bundle-size")) {
+        bundle_size = args["bundle-size"].as<unsigned long long>();
+    }
+
+    std::shared_ptr<Metrics> metrics;
+    if (args.count("metrics-file")) {
+        const auto metrics_interval_seconds = args.count("metrics-interval") ? args["metrics-interval"].as<unsigned int>() : 0;
+        metrics = std::make_shared<Metrics>(args["metrics-file"].as<std::string>(), metrics_interval_seconds * 1000);
+    }
 
     fprintf(stdout, "Torrent-S3 starting\n");
 
@@ -211,9 +363,9 @@ int main(int argc, char const* argv[]) {
         torrent_params.ti = std::make_shared<lt::torrent_info>(std::get<lt::torrent_info>(torrent_content_ret));
     }
 
-    auto app_state = std::make_shared<AppState>(db, false);
-    auto s3_uploader = std::make_shared<S3Uploader>(0, s3_url, s3_access_key, s3_secret_key, s3_bucket, s3_region, download_path, upload_path);
-    auto torrent_downloader = std::make_shared<TorrentDownloader>(torrent_params);
+    auto app_state = std::make_shared<AppState>(db, false, metrics);
+    auto s3_uploader = std::make_shared<S3Uploader>(s3_max_concurrency, s3_url, s3_access_key, s3_secret_key, s3_bucket, s3_region, download_path, upload_path, s3_min_concurrency, s3_target_latency_ms, bandwidth_limiter, s3_upload_order, s3_upload_max_wait_ms, deflate_pool, compression_policy, metrics);
+    auto torrent_downloader = std::make_shared<TorrentDownloader>(torrent_params, 0, bandwidth_limiter, metrics);
     AppSync app_sync(
         app_state,
         s3_uploader,
@@ -221,15 +373,41 @@ int main(int argc, char const* argv[]) {
         limit_size_bytes,
         download_path,
         extract_files,
-        archive_files
+        archive_files,
+        prefetch_headroom,
+        reconcile_uploaded,
+        bundle_threshold,
+        bundle_size,
+        extract_streaming,
+        extract_pool,
+        metrics
     );
 
+    if (metrics != nullptr) {
+        metrics->start();
+    }
+    if (args.count("trace-file")) {
+        trace_start(args["trace-file"].as<std::string>());
+    }
     const auto sync_ret = app_sync.full_sync();
+    trace_stop();
+    if (metrics != nullptr) {
+        metrics->stop();
+    }
     if (std::holds_alternative<std::string>(sync_ret)) {
         fprintf(stderr, "Could not execute sync. Error:\n%s\n", std::get<std::string>(sync_ret).c_str());
         return EXIT_FAILURE;
     }
 
+    if (compression_policy != nullptr) {
+        const auto stats = compression_policy->get_stats();
+        const auto saved_size = (long long) stats.input_size - (long long) stats.output_size;
+        fprintf(stdout, "Archived %llu files (%llu stored without compression): %.3f MB to %.3f MB, saved %.3f MB in %.1f s of compression\n",
+                stats.deflated_files + stats.stored_files, stats.stored_files,
+                ((double) stats.input_size) / 1024 / 1024, ((double) stats.output_size) / 1024 / 1024, ((double) saved_size) / 1024 / 1024,
+                std::chrono::duration<double>(stats.compression_time).count());
+    }
+
     fprintf(stdout, "Torrent-S3 sync completed\n");
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <fstream>
+
+#include "./metrics.hpp"
+
+#define METRICS_INTERVAL_MS_DEFAULT 10000
+#define COUNTER_SUFFIX "_total"
+
+// upper bounds of latency histogram buckets in seconds, from fast local writes to slow multipart uploads
+static const std::vector<double> histogram_bounds { 0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120 };
+
+static std::string format_value(double value) {
+    char buff[64];
+    snprintf(buff, sizeof(buff), "%.15g", value);
+    return std::string(buff);
+}
+
+static bool ends_with(const std::string &value, const std::string &ending) {
+    return value.size() >= ending.size() && value.compare(value.size() - ending.size(), ending.size(), ending) == 0;
+}
+
+Metrics::Metrics(std::filesystem::path file_path_, unsigned int interval_ms_) :
+    file_path {file_path_},
+    interval {interval_ms_ ? interval_ms_ : METRICS_INTERVAL_MS_DEFAULT},
+    previous_time {std::chrono::steady_clock::now()},
+    running {false} {}
+
+Metrics::~Metrics() {
+    stop();
+}
+
+void Metrics::start() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    if (running || file_path.empty()) {
+        return;
+    }
+    running = true;
+    task = std::thread([this]() {
+        run();
+    });
+}
+
+void Metrics::stop() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    if (!running) {
+        return;
+    }
+    running = false;
+    lock.unlock();
+    condition.notify_one();
+    task.join();
+    sample();
+    const auto ret = write();
+    if (ret.has_value()) {
+        fprintf(stderr, "Could not write metrics: %s\n", ret.value().c_str());
+    }
+}
+
+void Metrics::add(const std::string &name, double value) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    counters[name] += value;
+}
+
+void Metrics::set(const std::string &name, double value) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    gauges[name] = value;
+}
+
+void Metrics::observe(const std::string &name, double value) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    auto &histogram = histograms[name];
+    if (histogram.buckets.empty()) {
+        histogram.buckets.resize(histogram_bounds.size() + 1, 0);
+    }
+    size_t bucket = 0;
+    while (bucket < histogram_bounds.size() && value > histogram_bounds[bucket]) {
+        bucket++;
+    }
+    histogram.buckets[bucket]++;
+    histogram.count++;
+    histogram.sum += value;
+}
+
+std::string Metrics::format() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration<double>(now - previous_time).count();
+    std::string out;
+    for (const auto &[name, value] : counters) {
+        out += "# TYPE " + name + " counter\n";
+        out += name + " " + format_value(value) + "\n";
+        if (!ends_with(name, COUNTER_SUFFIX)) {
+            continue;
+        }
+        const auto rate_name = name.substr(0, name.size() - std::string(COUNTER_SUFFIX).size()) + "_per_second";
+        const auto rate = elapsed > 0 ? (value - previous_counters[name]) / elapsed : 0.0;
+        out += "# TYPE " + rate_name + " gauge\n";
+        out += rate_name + " " + format_value(rate) + "\n";
+    }
+    for (const auto &[name, value] : gauges) {
+        out += "# TYPE " + name + " gauge\n";
+        out += name + " " + format_value(value) + "\n";
+    }
+    for (const auto &[name, histogram] : histograms) {
+        out += "# TYPE " + name + " histogram\n";
+        // Prometheus buckets are cumulative
+        unsigned long long count = 0;
+        for (size_t i = 0; i < histogram_bounds.size(); i++) {
+            count += histogram.buckets[i];
+            out += name + "_bucket{le=\"" + format_value(histogram_bounds[i]) + "\"} " + std::to_string(count) + "\n";
+        }
+        out += name + "_bucket{le=\"+Inf\"} " + std::to_string(histogram.count) + "\n";
+        out += name + "_sum " + format_value(histogram.sum) + "\n";
+        out += name + "_count " + std::to_string(histogram.count) + "\n";
+    }
+    previous_counters = counters;
+    previous_time = now;
+    return out;
+}
+
+std::optional<std::string> Metrics::write() {
+    if (file_path.empty()) {
+        return std::string("Metrics file is not set");
+    }
+    const auto content = format();
+    auto temporary_path = file_path;
+    temporary_path += ".tmp";
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return std::string("Could not open \"") + temporary_path.string() + "\"";
+    }
+    file << content;
+    file.close();
+    if (!file) {
+        return std::string("Could not write \"") + temporary_path.string() + "\"";
+    }
+    std::error_code ec;
+    std::filesystem::rename(temporary_path, file_path, ec);
+    if (ec) {
+        return std::string("Could not replace \"") + file_path.string() + "\": " + ec.message();
+    }
+    return std::nullopt;
+}
+
+void Metrics::add_sampler(std::function<void(Metrics &)> sampler) {
+    std::unique_lock<std::mutex> lock{ mutex };
+    samplers.push_back(std::move(sampler));
+}
+
+void Metrics::sample() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    const auto current_samplers = samplers;
+    lock.unlock();
+    for (const auto &sampler : current_samplers) {
+        sampler(*this);
+    }
+}
+
+void Metrics::run() {
+    std::unique_lock<std::mutex> lock{ mutex };
+    while (running) {
+        condition.wait_for(lock, interval);
+        if (!running) {
+            break;
+        }
+        // samplers and format() take the lock
+        lock.unlock();
+        sample();
+        const auto ret = write();
+        if (ret.has_value()) {
+            fprintf(stderr, "Could not write metrics: %s\n", ret.value().c_str());
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <filesystem>
+#include <condition_variable>
+
+// Thread safe counters, gauges and histograms in Prometheus text exposition format.
+// Metrics are written to a file, i.e. for the textfile collector of node_exporter. The file is replaced
+// atomically, so that it is never read partially written.
+class Metrics {
+public:
+    // file_path_ - file written by the background task every interval_ms_. Use default (10 s) if interval is set to 0
+    explicit Metrics(std::filesystem::path file_path_ = "", unsigned int interval_ms_ = 0);
+    ~Metrics();
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+    // start writing the file periodically
+    void start();
+    // stops writing and writes the final values
+    void stop();
+
+    // counter names should end with _total, their rate is reported as <name>_per_second gauge
+    void add(const std::string &name, double value = 1.0);
+    void set(const std::string &name, double value);
+    // adds a value in seconds to the latency histogram
+    void observe(const std::string &name, double value);
+    // sampler is called by the background task before each write, so that slow measurements
+    // such as disk usage do not block the threads which report metrics
+    void add_sampler(std::function<void(Metrics &)> sampler);
+
+    // rates are averaged since the previous call
+    std::string format();
+    std::optional<std::string> write();
+
+private:
+    struct histogram_t {
+        // not cumulative, one more than bucket bounds for +Inf
+        std::vector<unsigned long long> buckets;
+        unsigned long long count = 0;
+        double sum = 0.0;
+    };
+
+    void run();
+    void sample();
+
+    const std::filesystem::path file_path;
+    const std::chrono::milliseconds interval;
+    // std::map keeps the output sorted
+    std::map<std::string, double> counters;
+    std::map<std::string, double> gauges;
+    std::map<std::string, histogram_t> histograms;
+    std::map<std::string, double> previous_counters;
+    std::vector<std::function<void(Metrics &)>> samplers;
+    std::chrono::steady_clock::time_point previous_time;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool running;
+    std::thread task;
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include <map>
+#include <random>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <optional>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Exponential backoff with full jitter: rand(0, min(max_delay, initial_delay * 2^attempt)).
+// Server provided delay (i.e. Retry-After header) is used as a lower bound.
+inline std::chrono::milliseconds jittered_delay(
+    unsigned int attempt,
+    std::chrono::milliseconds initial_delay,
+    std::chrono::milliseconds max_delay,
+    std::optional<std::chrono::milliseconds> retry_after = std::nullopt
+) {
+    // only the random engine is kept per thread, the cap is computed on each call
+    thread_local std::mt19937_64 engine {std::random_device{}()};
+    const auto max_count = std::max(max_delay.count(), (std::chrono::milliseconds::rep) 0);
+    auto cap = std::max(initial_delay.count(), (std::chrono::milliseconds::rep) 0);
+    // doubling stops at max_delay, so that large attempts do not overflow
+    for (unsigned int i = 0; i < attempt && cap > 0 && cap < max_count; i++) {
+        cap = cap > max_count / 2 ? max_count : cap * 2;
+    }
+    cap = std::min(cap, max_count);
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> distribution(0, cap);
+    const auto delay = std::chrono::milliseconds(distribution(engine));
+    if (retry_after.has_value() && retry_after.value() > delay) {
+        return retry_after.value();
+    }
+    return delay;
+}
+
+// Keeps items until their not-before time and hands them over to on_ready callback from the timer thread.
+// Allows to retry failed operations without blocking worker threads.
+template<class T>
+class RetryScheduler {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    explicit RetryScheduler(std::function<void(const T &)> on_ready_) : on_ready {on_ready_}, running {false} {}
+
+    ~RetryScheduler() {
+        stop();
+    }
+
+    void start() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        if (running) {
+            return;
+        }
+        running = true;
+        task = std::thread([this]() {
+            run();
+        });
+    }
+
+    // stops timer thread. Items that are still waiting are handed over immediately
+    void stop() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        if (!running) {
+            return;
+        }
+        running = false;
+        lock.unlock();
+        condition.notify_one();
+        task.join();
+
+        lock.lock();
+        auto items = std::move(queue);
+        queue.clear();
+        lock.unlock();
+        for (const auto &i : items) {
+            on_ready(i.second);
+        }
+    }
+
+    void schedule(const T t, clock::time_point not_before) {
+        std::unique_lock<std::mutex> lock{ mutex };
+        queue.emplace(not_before, t);
+        lock.unlock();
+        condition.notify_one(); // wakes up timer thread to recalculate the next deadline
+    }
+
+    size_t size() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        return queue.size();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock{ mutex };
+        while (running) {
+            if (queue.empty()) {
+                condition.wait(lock);
+                continue;
+            }
+            const auto next_time = queue.begin()->first;
+            if (clock::now() < next_time) {
+                condition.wait_until(lock, next_time);
+                continue;
+            }
+            std::vector<T> ready;
+            const auto ready_end = queue.upper_bound(clock::now());
+            for (auto it = queue.begin(); it != ready_end; it++) {
+                ready.push_back(it->second);
+            }
+            queue.erase(queue.begin(), ready_end);
+            // do not hold the lock while the callback runs
+            lock.unlock();
+            for (const auto &r : ready) {
+                on_ready(r);
+            }
+            lock.lock();
+        }
+    }
+
+    std::function<void(const T &)> on_ready;
+    // multimap keeps scheduling order for items with the same not-before time
+    std::multimap<clock::time_point, T> queue;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool running;
+    std::thread task;
+};
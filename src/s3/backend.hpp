@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+#include <variant>
+#include <climits>
+#include <optional>
+#include <istream>
+#include <unordered_map>
+
+// content size of a stream which is read until the end
+#define CONTENT_SIZE_UNKNOWN ULLONG_MAX
+
+struct S3Error {
+    std::string message;
+    // throttling or connection error
+    bool retryable;
+    // delay requested by the server with Retry-After header
+    std::optional<std::chrono::milliseconds> retry_after;
+    // uploaded data does not match its checksum. It is retried, but it is not a sign of server overload
+    bool is_corrupted = false;
+};
+
+// Object store used by S3Uploader. Object names use '/' separators.
+// Implementations are called from multiple upload tasks simultaneously and must be thread safe.
+// Each call makes a single attempt, retries are made by the caller.
+class S3Backend {
+public:
+    virtual ~S3Backend() = default;
+
+    virtual const std::string &get_bucket() const = 0;
+    virtual std::variant<bool, S3Error> bucket_exists() = 0;
+    // uploads content_size bytes from stream, returns ETag of the uploaded object
+    // content_size - CONTENT_SIZE_UNKNOWN if stream should be read until the end
+    // part_size - size of multipart upload part, content not larger than part_size is uploaded with a single request
+    virtual std::variant<std::string, S3Error> put_object(const std::string &object, std::istream &stream, unsigned long long content_size, size_t part_size) = 0;
+    // removing nonexisting object is not an error
+    virtual std::optional<S3Error> remove_object(const std::string &object) = 0;
+    // returns false if object does not exist
+    virtual std::variant<bool, S3Error> object_exists(const std::string &object) = 0;
+    // returns sizes of objects which names start with prefix, key - full object name
+    virtual std::variant<std::unordered_map<std::string, unsigned long long>, S3Error> list_objects(const std::string &prefix) = 0;
+};
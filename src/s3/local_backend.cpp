@@ -0,0 +1,154 @@
+#include <thread>
+#include <fstream>
+#include <vector>
+
+#include "./local_backend.hpp"
+#include "../checksum/checksum.hpp"
+
+#define COPY_BUFFER_SIZE (64 * 1024)
+// uploads in progress are stored here and are not listed
+#define UPLOADS_DIRECTORY ".uploads"
+
+LocalBackend::LocalBackend(const std::filesystem::path &root_, const LocalBackendOptions &options_) :
+    root {root_},
+    bucket {root_.filename().string()},
+    options {options_},
+    random_engine {options_.seed},
+    throttled_count {0},
+    upload_counter {0} {}
+
+std::optional<S3Error> LocalBackend::begin_request() {
+    if (options.latency.count() > 0) {
+        std::this_thread::sleep_for(options.latency);
+    }
+    if (options.throttle_rate <= 0.0) {
+        return std::nullopt;
+    }
+    std::unique_lock<std::mutex> lock{ random_mutex };
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    if (distribution(random_engine) >= options.throttle_rate) {
+        return std::nullopt;
+    }
+    throttled_count++;
+    return S3Error { "SlowDown: Please reduce your request rate.", true, std::nullopt };
+}
+
+std::filesystem::path LocalBackend::object_path(const std::string &object) const {
+    return root / std::filesystem::u8path(object);
+}
+
+const std::string &LocalBackend::get_bucket() const {
+    return bucket;
+}
+
+unsigned long long LocalBackend::get_throttled_count() {
+    std::unique_lock<std::mutex> lock{ random_mutex };
+    return throttled_count;
+}
+
+std::variant<bool, S3Error> LocalBackend::bucket_exists() {
+    const auto error = begin_request();
+    if (error.has_value()) {
+        return error.value();
+    }
+    std::error_code ec;
+    return std::filesystem::is_directory(root, ec);
+}
+
+std::variant<std::string, S3Error> LocalBackend::put_object(const std::string &object, std::istream &stream, unsigned long long content_size, size_t part_size) {
+    const auto error = begin_request();
+    if (error.has_value()) {
+        return error.value();
+    }
+
+    const auto path = object_path(object);
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    if (ec) {
+        return S3Error { ec.message(), false, std::nullopt };
+    }
+    // write to temporary file, so that failed upload does not leave partial object
+    std::filesystem::create_directories(root / UPLOADS_DIRECTORY, ec);
+    const auto temporary_path = root / UPLOADS_DIRECTORY / std::to_string(upload_counter++);
+    std::ofstream file(temporary_path, std::ios::binary);
+    if (!file) {
+        return S3Error { std::string("Could not create object file ") + temporary_path.string(), false, std::nullopt };
+    }
+
+    EtagHash hash(part_size);
+    std::vector<char> buffer(COPY_BUFFER_SIZE);
+    const auto start = std::chrono::steady_clock::now();
+    unsigned long long written = 0;
+    while (written < content_size) {
+        const auto chunk_size = (std::streamsize) std::min((unsigned long long) buffer.size(), content_size - written);
+        stream.read(buffer.data(), chunk_size);
+        const auto read_count = stream.gcount();
+        if (read_count <= 0) {
+            break;
+        }
+        hash.update(buffer.data(), read_count);
+        file.write(buffer.data(), read_count);
+        written += read_count;
+        if (options.bandwidth > 0) {
+            // sleep until the time the data would be sent with the limited bandwidth
+            std::this_thread::sleep_until(start + std::chrono::microseconds(written * 1000000 / options.bandwidth));
+        }
+    }
+    file.close();
+    if ((content_size != CONTENT_SIZE_UNKNOWN && written < content_size) || !file) {
+        std::filesystem::remove(temporary_path, ec);
+        return S3Error { "IncompleteBody: You did not provide the number of bytes specified by the Content-Length HTTP header.", false, std::nullopt };
+    }
+    std::filesystem::rename(temporary_path, path, ec);
+    if (ec) {
+        std::filesystem::remove(temporary_path, ec);
+        return S3Error { ec.message(), false, std::nullopt };
+    }
+    return hash.etag();
+}
+
+std::optional<S3Error> LocalBackend::remove_object(const std::string &object) {
+    const auto error = begin_request();
+    if (error.has_value()) {
+        return error;
+    }
+    std::error_code ec;
+    std::filesystem::remove(object_path(object), ec);
+    return std::nullopt;
+}
+
+std::variant<bool, S3Error> LocalBackend::object_exists(const std::string &object) {
+    const auto error = begin_request();
+    if (error.has_value()) {
+        return error.value();
+    }
+    std::error_code ec;
+    return std::filesystem::is_regular_file(object_path(object), ec);
+}
+
+std::variant<std::unordered_map<std::string, unsigned long long>, S3Error> LocalBackend::list_objects(const std::string &prefix) {
+    const auto error = begin_request();
+    if (error.has_value()) {
+        return error.value();
+    }
+    std::unordered_map<std::string, unsigned long long> objects;
+    std::error_code ec;
+    for (auto iter = std::filesystem::recursive_directory_iterator(root, ec); !ec && iter != std::filesystem::recursive_directory_iterator(); iter.increment(ec)) {
+        if (iter.depth() == 0 && iter->path().filename() == UPLOADS_DIRECTORY) {
+            iter.disable_recursion_pending();
+            continue;
+        }
+        if (!iter->is_regular_file(ec)) {
+            continue;
+        }
+        const auto object = iter->path().lexically_relative(root).generic_u8string();
+        if (object.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        objects[object] = iter->file_size(ec);
+    }
+    if (ec) {
+        return S3Error { ec.message(), false, std::nullopt };
+    }
+    return objects;
+}
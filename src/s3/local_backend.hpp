@@ -0,0 +1,51 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <filesystem>
+
+#include "./backend.hpp"
+
+struct LocalBackendOptions {
+    // delay added to every request
+    std::chrono::milliseconds latency {0};
+    // upload bandwidth of a single request in bytes per second. Not limited if set to 0
+    unsigned long long bandwidth = 0;
+    // probability of a request to fail with 429 Too Many Requests error, from 0 to 1
+    double throttle_rate = 0.0;
+    // seed of the throttling random generator, so that failures could be reproduced
+    unsigned int seed = 0;
+};
+
+// In-process stand-in for S3 which stores objects as files in root_ directory.
+// Allows to run tests and benchmarks of the upload path offline.
+class LocalBackend : public S3Backend {
+public:
+    // root_ - bucket directory, it should exist for the bucket to exist
+    LocalBackend(const std::filesystem::path &root_, const LocalBackendOptions &options_ = LocalBackendOptions {});
+
+    const std::string &get_bucket() const override;
+    std::variant<bool, S3Error> bucket_exists() override;
+    std::variant<std::string, S3Error> put_object(const std::string &object, std::istream &stream, unsigned long long content_size, size_t part_size) override;
+    std::optional<S3Error> remove_object(const std::string &object) override;
+    std::variant<bool, S3Error> object_exists(const std::string &object) override;
+    std::variant<std::unordered_map<std::string, unsigned long long>, S3Error> list_objects(const std::string &prefix) override;
+
+    // number of requests failed with injected 429 error
+    unsigned long long get_throttled_count();
+
+private:
+    // waits for injected latency and returns injected error if any
+    std::optional<S3Error> begin_request();
+    std::filesystem::path object_path(const std::string &object) const;
+
+    const std::filesystem::path root;
+    const std::string bucket;
+    const LocalBackendOptions options;
+
+    std::mutex random_mutex;
+    std::mt19937 random_engine;
+    unsigned long long throttled_count;
+    std::atomic<unsigned long long> upload_counter;
+};
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cctype>
+
+#include "./minio_backend.hpp"
+
+MinioBackend::MinioBackend(const std::string &url_, const std::string &access_key_, const std::string &secret_key_, const std::string &bucket_, const std::string &region_) :
+    url {url_},
+    bucket {bucket_},
+    region {region_},
+    provider {access_key_, secret_key_} {}
+
+static std::optional<std::chrono::milliseconds> parse_retry_after(const minio::utils::Multimap &headers) {
+    // only delay-seconds form is supported, HTTP-date form falls back to the backoff delay
+    const auto retry_after = headers.GetFront("retry-after");
+    const auto is_digit = [](char c) {
+        // ctype functions are undefined for negative char values
+        return std::isdigit((unsigned char) c) != 0;
+    };
+    if (retry_after.empty() || !std::all_of(retry_after.begin(), retry_after.end(), is_digit)) {
+        return std::nullopt;
+    }
+    try {
+        return std::chrono::seconds(std::stoul(retry_after));
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+}
+
+template<class T>
+static std::optional<S3Error> response_error(const T &resp) {
+    if (resp) {
+        return std::nullopt;
+    }
+    // throttling (429 or 503 SlowDown) or connection error - make retry
+    if (resp.status_code == 429 || resp.status_code == 503 || resp.status_code == 0) {
+        return S3Error { resp.Error().String(), true, parse_retry_after(resp.headers) };
+    }
+    return S3Error { resp.Error().String(), false, std::nullopt };
+}
+
+std::unique_ptr<minio::s3::Client> MinioBackend::acquire_client() {
+    std::unique_lock<std::mutex> lock{ clients_mutex };
+    if (!free_clients.empty()) {
+        auto client = std::move(free_clients.back());
+        free_clients.pop_back();
+        return client;
+    }
+    lock.unlock();
+    minio::s3::BaseUrl base_url(url);
+    return std::make_unique<minio::s3::Client>(base_url, &provider);
+}
+
+void MinioBackend::release_client(std::unique_ptr<minio::s3::Client> client) {
+    std::unique_lock<std::mutex> lock{ clients_mutex };
+    free_clients.push_back(std::move(client));
+}
+
+const std::string &MinioBackend::get_bucket() const {
+    return bucket;
+}
+
+std::variant<bool, S3Error> MinioBackend::bucket_exists() {
+    minio::s3::BucketExistsArgs args;
+    args.bucket = bucket;
+    if (!region.empty()) {
+        args.region = region;
+    }
+
+    auto client = acquire_client();
+    const auto resp = client->BucketExists(args);
+    release_client(std::move(client));
+    const auto error = response_error(resp);
+    if (error.has_value()) {
+        return error.value();
+    }
+    return resp.exist;
+}
+
+std::variant<std::string, S3Error> MinioBackend::put_object(const std::string &object, std::istream &stream, unsigned long long content_size, size_t part_size) {
+    // minio-cpp reads stream until the end if size is -1
+    minio::s3::PutObjectArgs args(stream, content_size == CONTENT_SIZE_UNKNOWN ? -1L : (long) content_size, part_size);
+    args.bucket = bucket;
+    args.object = object;
+    if (!region.empty()) {
+        args.region = region;
+    }
+
+    auto client = acquire_client();
+    const auto resp = client->PutObject(args);
+    release_client(std::move(client));
+    const auto error = response_error(resp);
+    if (error.has_value()) {
+        return error.value();
+    }
+    return resp.etag;
+}
+
+std::optional<S3Error> MinioBackend::remove_object(const std::string &object) {
+    minio::s3::RemoveObjectArgs args;
+    args.bucket = bucket;
+    args.object = object;
+    if (!region.empty()) {
+        args.region = region;
+    }
+
+    auto client = acquire_client();
+    const auto resp = client->RemoveObject(args);
+    release_client(std::move(client));
+    return response_error(resp);
+}
+
+std::variant<bool, S3Error> MinioBackend::object_exists(const std::string &object) {
+    minio::s3::StatObjectArgs args;
+    args.bucket = bucket;
+    args.object = object;
+    if (!region.empty()) {
+        args.region = region;
+    }
+
+    auto client = acquire_client();
+    const auto resp = client->StatObject(args);
+    release_client(std::move(client));
+    const auto error = response_error(resp);
+    if (error.has_value()) {
+        if (error->message == "NoSuchKey: Object does not exist") {
+            return false;
+        }
+        if (error->message == "NoSuchBucket: Bucket does not exist") {
+            return false;
+        }
+        return error.value();
+    }
+    // delete marker is not processed properly by minio so we skip checking it
+    return resp.etag.size() > 0;
+}
+
+std::variant<std::unordered_map<std::string, unsigned long long>, S3Error> MinioBackend::list_objects(const std::string &prefix) {
+    minio::s3::ListObjectsArgs args;
+    args.bucket = bucket;
+    args.prefix = prefix;
+    args.recursive = true;
+    if (!region.empty()) {
+        args.region = region;
+    }
+
+    std::unordered_map<std::string, unsigned long long> objects;
+    auto client = acquire_client();
+    std::optional<S3Error> error;
+    // ListObjectsV2 is used by default, next pages are requested while iterating the result
+    auto result = client->ListObjects(args);
+    for (; result; result++) {
+        const auto item = *result;
+        if (!item) {
+            error = response_error(item);
+            break;
+        }
+        if (item.is_prefix) {
+            continue;
+        }
+        objects[item.name] = item.size;
+    }
+    release_client(std::move(client));
+    if (error.has_value()) {
+        return error.value();
+    }
+    return objects;
+}
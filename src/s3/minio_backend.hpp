@@ -0,0 +1,34 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+
+#include <miniocpp/client.h>
+
+#include "./backend.hpp"
+
+// S3 backend using minio-cpp. Keeps a pool of clients so that each simultaneous request uses its own client.
+class MinioBackend : public S3Backend {
+public:
+    MinioBackend(const std::string &url_, const std::string &access_key_, const std::string &secret_key_, const std::string &bucket_, const std::string &region_);
+
+    const std::string &get_bucket() const override;
+    std::variant<bool, S3Error> bucket_exists() override;
+    std::variant<std::string, S3Error> put_object(const std::string &object, std::istream &stream, unsigned long long content_size, size_t part_size) override;
+    std::optional<S3Error> remove_object(const std::string &object) override;
+    std::variant<bool, S3Error> object_exists(const std::string &object) override;
+    std::variant<std::unordered_map<std::string, unsigned long long>, S3Error> list_objects(const std::string &prefix) override;
+
+private:
+    std::unique_ptr<minio::s3::Client> acquire_client();
+    void release_client(std::unique_ptr<minio::s3::Client> client);
+
+    const std::string url;
+    const std::string bucket;
+    const std::string region;
+    minio::creds::StaticProvider provider;
+
+    std::mutex clients_mutex;
+    std::vector<std::unique_ptr<minio::s3::Client>> free_clients;
+};
@@ -1,21 +1,73 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
-
-#include "../backoffxx/backoffxx.h"
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <unordered_set>
 
 #include "./s3.hpp"
+#include "./minio_backend.hpp"
 #include "../archive/archive.hpp"
+#include "../checksum/checksum.hpp"
+#include "../trace/trace.hpp"
 
-// how many S3 upload tasks to run simultaneously
+// how many S3 upload tasks to run simultaneously at start
 #define TASKS_COUNT_DEFAULT 16
+// upper bound for the number of S3 upload tasks
+#define TASKS_COUNT_MAX_DEFAULT 64
+// upload latency is measured per this amount of bytes, so that large files are not considered slow
+#define LATENCY_SIZE_UNIT (16 * 1024 * 1024)
 
 #define RANDOM_FILE_NAME_LENGTH 16
 
+// same as minio-cpp default part size calculation
+#define MULTIPART_SIZE_MIN (5ULL * 1024 * 1024)
+#define MULTIPART_COUNT_MAX 10000ULL
+
+// queued file is uploaded out of order after waiting this long
+#define UPLOAD_MAX_WAIT_MS_DEFAULT 60000
+
+// upper bound of zip size is estimated as file size plus 1/ZIP_OVERHEAD_RATIO plus ZIP_OVERHEAD_MAX bytes of headers
+#define ZIP_OVERHEAD_RATIO 100
+#define ZIP_OVERHEAD_MAX (64 * 1024)
+
 #define RETRIES 5
 #define INITIAL_DELAY_SECONDS 5
 #define MAX_DELAY_SECONDS 60
 
+#define METRIC_UPLOADED_BYTES "torrent_s3_uploaded_bytes_total"
+#define METRIC_UPLOAD_DURATION "torrent_s3_upload_duration_seconds"
+
+std::optional<upload_order_t> parse_upload_order(const std::string &name) {
+    if (name == "fifo") {
+        return UPLOAD_ORDER_FIFO;
+    }
+    if (name == "smallest") {
+        return UPLOAD_ORDER_SMALLEST_FIRST;
+    }
+    if (name == "largest") {
+        return UPLOAD_ORDER_LARGEST_FIRST;
+    }
+    if (name == "parent") {
+        return UPLOAD_ORDER_PARENT_FIRST;
+    }
+    return std::nullopt;
+}
+
+static long long get_event_priority(const S3TaskEvent &event) {
+    if (std::holds_alternative<S3TaskEventNewFile>(event)) {
+        return std::get<S3TaskEventNewFile>(event).priority;
+    }
+    if (std::holds_alternative<S3TaskEventNewBundle>(event)) {
+        return std::get<S3TaskEventNewBundle>(event).priority;
+    }
+    if (std::holds_alternative<S3TaskEventNewArchive>(event)) {
+        return std::get<S3TaskEventNewArchive>(event).priority;
+    }
+    return 0;
+}
+
 S3Uploader::S3Uploader(
     unsigned int thread_count_,
     const std::string &url_,
@@ -24,23 +76,60 @@ S3Uploader::S3Uploader(
     const std::string &bucket_,
     const std::string &region_,
     const std::filesystem::path &path_from_,
-    const std::filesystem::path &path_to_
+    const std::filesystem::path &path_to_,
+    unsigned int min_thread_count_,
+    unsigned int target_latency_ms_,
+    std::shared_ptr<BandwidthLimiter> bandwidth_limiter_,
+    upload_order_t upload_order_,
+    unsigned int max_wait_ms_,
+    std::shared_ptr<DeflatePool> deflate_pool_,
+    std::shared_ptr<CompressionPolicy> compression_policy_,
+    std::shared_ptr<Metrics> metrics_
+) : S3Uploader(
+        thread_count_,
+        std::make_shared<MinioBackend>(url_, access_key_, secret_key_, bucket_, region_),
+        path_from_,
+        path_to_,
+        min_thread_count_,
+        target_latency_ms_,
+        bandwidth_limiter_,
+        upload_order_,
+        max_wait_ms_,
+        deflate_pool_,
+        compression_policy_,
+        metrics_
+    ) {}
+
+S3Uploader::S3Uploader(
+    unsigned int thread_count_,
+    std::shared_ptr<S3Backend> backend_,
+    const std::filesystem::path &path_from_,
+    const std::filesystem::path &path_to_,
+    unsigned int min_thread_count_,
+    unsigned int target_latency_ms_,
+    std::shared_ptr<BandwidthLimiter> bandwidth_limiter_,
+    upload_order_t upload_order_,
+    unsigned int max_wait_ms_,
+    std::shared_ptr<DeflatePool> deflate_pool_,
+    std::shared_ptr<CompressionPolicy> compression_policy_,
+    std::shared_ptr<Metrics> metrics_
 ) :
-    thread_count {thread_count_},
-    url {url_},
-    access_key {access_key_},
-    secret_key {secret_key_},
-    bucket {bucket_},
-    region {region_},
+    message_queue {std::chrono::milliseconds(max_wait_ms_ ? max_wait_ms_ : UPLOAD_MAX_WAIT_MS_DEFAULT)},
+    thread_count {thread_count_ ? thread_count_ : TASKS_COUNT_MAX_DEFAULT},
+    upload_order {upload_order_},
+    concurrency_limiter {min_thread_count_, thread_count, TASKS_COUNT_DEFAULT, std::chrono::milliseconds(target_latency_ms_)},
+    backend {backend_},
+    bandwidth_limiter {bandwidth_limiter_},
+    deflate_pool {deflate_pool_},
+    compression_policy {compression_policy_},
+    metrics {metrics_},
     path_from {path_from_},
-    path_to {path_to_} {
-    if (!thread_count) {
-        thread_count = TASKS_COUNT_DEFAULT;
-    }
-
-    minio::s3::BaseUrl base_url(url);
-    provider = std::make_unique<minio::creds::StaticProvider>(access_key, secret_key);
-    client = std::make_unique<minio::s3::Client>(base_url, provider.get());
+    path_to {path_to_},
+    retry_scheduler {[this](const S3TaskEvent &event) {
+        message_queue.push_back(event, get_event_priority(event));
+    }} {
+    pending_files.count = 0;
+    pending_files.next_parent_order = 0;
 }
 
 static std::string gen_random(const int len) {
@@ -66,212 +155,451 @@ static std::string replace(std::string subject, const std::string& search, const
     return subject;
 }
 
-static std::optional<std::string> write_stream_s3(std::istream &stream, unsigned long content_size, minio::s3::Client &client, const std::string &bucket, const std::string &region, const std::filesystem::path &path) {
-    minio::s3::PutObjectArgs args(stream, content_size, 0);
-    args.bucket = bucket;
-    args.object = replace(path.string(), "\\", "/");
-    if (!region.empty()) {
-        args.region = region;
-    }
+static std::string to_object_name(const std::filesystem::path &path) {
+    return replace(path.string(), "\\", "/");
+}
 
-    std::string error = "Retry limit reached";
-    const auto result = backoffxx::attempt(backoffxx::make_exponential(std::chrono::seconds(INITIAL_DELAY_SECONDS), RETRIES, std::chrono::seconds(MAX_DELAY_SECONDS)), [&] {
-        args.stream.clear();
-        args.stream.seekg(0);
-        const auto resp = client.PutObject(args);
-        if (!resp) {
-            // throttling - make retry
-            if (resp.status_code == 429 || resp.status_code == 0) {
-                return backoffxx::attempt_rc::failure;
-            }
-            error = resp.Error().String();
-            return backoffxx::attempt_rc::hard_error;
+static std::chrono::milliseconds retry_delay(unsigned int attempt, const S3Error &error) {
+    return jittered_delay(attempt, std::chrono::seconds(INITIAL_DELAY_SECONDS), std::chrono::seconds(MAX_DELAY_SECONDS), error.retry_after);
+}
+
+// runs S3 operation in the calling thread, sleeping between retries.
+// Only used outside of upload tasks, upload tasks reschedule failed uploads instead.
+static std::optional<std::string> retry_blocking(std::function<std::optional<S3Error>()> operation) {
+    for (unsigned int attempt = 0;; attempt++) {
+        const auto error = operation();
+        if (!error.has_value()) {
+            return std::nullopt;
         }
-        return backoffxx::attempt_rc::success;
-    });
+        if (!error->retryable) {
+            return error->message;
+        }
+        if (attempt >= RETRIES) {
+            return std::string("Retry limit reached");
+        }
+        std::this_thread::sleep_for(retry_delay(attempt, error.value()));
+    }
+}
+
+// part size is set explicitly so that ETag of multipart upload could be computed
+static size_t upload_part_size(unsigned long content_size) {
+    const auto part_size = (content_size + MULTIPART_COUNT_MAX - 1) / MULTIPART_COUNT_MAX;
+    const auto part_size_aligned = (part_size + MULTIPART_SIZE_MIN - 1) / MULTIPART_SIZE_MIN * MULTIPART_SIZE_MIN;
+    return (size_t) std::max(part_size_aligned, MULTIPART_SIZE_MIN);
+}
 
-    if (!result.ok()) {
-        return error;
+// makes a single upload attempt. Uploaded data is verified with ETag which is computed while the data is read
+// by the backend, so the data is not read twice
+// content_size - CONTENT_SIZE_UNKNOWN if stream is read until the end, part_size should fit all the data in this case
+static std::optional<S3Error> write_stream_s3(std::istream &stream, unsigned long long content_size, size_t part_size, S3Backend &backend, BandwidthLimiter *bandwidth_limiter, const std::filesystem::path &path) {
+    stream.clear();
+    stream.seekg(0);
+    std::optional<ThrottledStreamBuf> throttled_buffer;
+    if (bandwidth_limiter != nullptr) {
+        throttled_buffer.emplace(stream.rdbuf(), *bandwidth_limiter);
+    }
+    EtagStreamBuf etag_buffer(throttled_buffer.has_value() ? &throttled_buffer.value() : stream.rdbuf(), part_size);
+    std::istream etag_stream(&etag_buffer);
+
+    const auto ret = backend.put_object(to_object_name(path), etag_stream, content_size, part_size);
+    if (std::holds_alternative<S3Error>(ret)) {
+        return std::get<S3Error>(ret);
+    }
+    const auto etag = normalize_etag(std::get<std::string>(ret));
+    // ETag of objects encrypted with SSE-C or SSE-KMS is not MD5 of the data and could not be verified
+    if (!is_md5_etag(etag)) {
+        return std::nullopt;
+    }
+    const auto expected_etag = etag_buffer.etag();
+    if (etag != expected_etag) {
+        // data was corrupted on the way, upload again
+        return S3Error { "Checksum mismatch, expected ETag " + expected_etag + ", received " + etag, true, std::nullopt, true };
     }
     return std::nullopt;
 }
 
-static std::optional<std::string> write_content_to_file_s3(const std::string &content, minio::s3::Client &client, const std::string &bucket, const std::string &region, const std::filesystem::path &path) {
+static std::optional<std::string> write_content_to_file_s3(const std::string &content, S3Backend &backend, const std::filesystem::path &path) {
     const auto content_size = content.size();
     std::stringstream stream(content);
-    return write_stream_s3(stream, content_size, client, bucket, region, path);
+    return retry_blocking([&] {
+        return write_stream_s3(stream, content_size, upload_part_size(content_size), backend, nullptr, path);
+    });
 }
 
-static std::optional<std::string> write_file_s3(const std::filesystem::path &file_path, minio::s3::Client &client, const std::string &bucket, const std::string &region, const std::filesystem::path &path) {
+static std::optional<S3Error> write_file_s3(const std::filesystem::path &file_path, S3Backend &backend, BandwidthLimiter *bandwidth_limiter, const std::filesystem::path &path) {
     std::ifstream file_stream(std::filesystem::u8path(file_path.string()), std::ios::binary);
     unsigned long file_size;
     try {
         file_size = std::filesystem::file_size(std::filesystem::u8path(file_path.string()));
     } catch (const std::filesystem::filesystem_error& e) {
-        return e.what();
+        return S3Error { e.what(), false, std::nullopt };
     }
-    return write_stream_s3(file_stream, file_size, client, bucket, region, path);
+    return write_stream_s3(file_stream, file_size, upload_part_size(file_size), backend, bandwidth_limiter, path);
 }
 
-static std::optional<std::string> delete_file_s3(minio::s3::Client &client, const std::string &bucket, const std::string &region, const std::filesystem::path &path) {
-    minio::s3::RemoveObjectArgs args;
-    args.bucket = bucket;
-    args.object = replace(path.string(), "\\", "/");
-    if (!region.empty()) {
-        args.region = region;
+// zip is written directly to the upload stream, so that the archive is not stored on disk.
+// archive_error is set if the file could not be archived
+static std::optional<S3Error> write_zip_s3(
+    const std::filesystem::path &file_path,
+    S3Backend &backend,
+    BandwidthLimiter *bandwidth_limiter,
+    std::shared_ptr<DeflatePool> deflate_pool,
+    CompressionPolicy *compression_policy,
+    const std::filesystem::path &path,
+    std::optional<std::string> &archive_error
+) {
+    unsigned long long file_size;
+    try {
+        file_size = std::filesystem::file_size(std::filesystem::u8path(file_path.string()));
+    } catch (const std::filesystem::filesystem_error& e) {
+        return S3Error { e.what(), false, std::nullopt };
+    }
+    const auto compression = compression_policy != nullptr ? compression_policy->choose(file_path) : compression_choice_t {};
+    ZipStreamBuf zip_buffer(file_path, deflate_pool, compression);
+    archive_error = zip_buffer.error();
+    if (archive_error.has_value()) {
+        return S3Error { archive_error.value(), false, std::nullopt };
     }
+    std::istream zip_stream(&zip_buffer);
+    // archive size is not known in advance, but it is not much larger than the file even if data is not compressible
+    const auto ret = write_stream_s3(zip_stream, CONTENT_SIZE_UNKNOWN, upload_part_size(file_size + file_size / ZIP_OVERHEAD_RATIO + ZIP_OVERHEAD_MAX), backend, bandwidth_limiter, path);
+    archive_error = zip_buffer.error();
+    if (archive_error.has_value()) {
+        // truncated archive could be uploaded
+        backend.remove_object(to_object_name(path));
+        return S3Error { archive_error.value(), false, std::nullopt };
+    }
+    if (!ret.has_value() && compression_policy != nullptr) {
+        compression_policy->add_stats(zip_buffer.get_stats());
+    }
+    return ret;
+}
 
-    std::string error = "Retry limit reached";
-    const auto result = backoffxx::attempt(backoffxx::make_exponential(std::chrono::seconds(INITIAL_DELAY_SECONDS), RETRIES, std::chrono::seconds(MAX_DELAY_SECONDS)), [&] {
-        const auto resp = client.RemoveObject(args);
-        if (!resp) {
-            // throttling - make retry
-            if (resp.status_code == 429 || resp.status_code == 0) {
-                return backoffxx::attempt_rc::failure;
-            }
-            error = resp.Error().String();
-            return backoffxx::attempt_rc::hard_error;
+static std::optional<std::string> delete_file_s3(S3Backend &backend, const std::filesystem::path &path) {
+    return retry_blocking([&] {
+        return backend.remove_object(to_object_name(path));
+    });
+}
+
+static std::variant<bool, std::string> exists_bucket_s3(S3Backend &backend) {
+    bool exists = false;
+    const auto error = retry_blocking([&] {
+        const auto ret = backend.bucket_exists();
+        if (std::holds_alternative<S3Error>(ret)) {
+            return std::optional<S3Error>(std::get<S3Error>(ret));
         }
-        return backoffxx::attempt_rc::success;
+        exists = std::get<bool>(ret);
+        return std::optional<S3Error>();
     });
 
-    if (!result.ok()) {
-        return error;
+    if (error.has_value()) {
+        return error.value();
     }
-    return std::nullopt;
+
+    return exists;
 }
 
-static std::variant<bool, std::string> exists_bucket_s3(minio::s3::Client &client, const std::string &bucket, const std::string &region) {
-    minio::s3::BucketExistsArgs args;
-    args.bucket = bucket;
-    if (!region.empty()) {
-        args.region = region;
+// parent - file which becomes ready after the reported one is uploaded
+static void report_progress(ThreadSafeDeque<S3ProgressEvent> &progress_queue, S3PendingFiles &pending_files, const std::string &parent, const S3ProgressEvent event) {
+    progress_queue.push_back(event);
+    std::unique_lock<std::mutex> lock{ pending_files.mutex };
+    pending_files.count--;
+    const auto it = pending_files.parent_order.find(parent);
+    if (it != pending_files.parent_order.end() && --it->second.pending == 0) {
+        pending_files.parent_order.erase(it);
     }
+    lock.unlock();
+    pending_files.condition.notify_all();
+}
 
-    std::string error = "Retry limit reached";
-    bool exists;
-    const auto result = backoffxx::attempt(backoffxx::make_exponential(std::chrono::seconds(INITIAL_DELAY_SECONDS), RETRIES, std::chrono::seconds(MAX_DELAY_SECONDS)), [&] {
-        const auto resp = client.BucketExists(args);
-        if (!resp) {
-            // throttling - make retry
-            if (resp.status_code == 429 || resp.status_code == 0) {
-                return backoffxx::attempt_rc::failure;
-            }
-            error = resp.Error().String();
-            return backoffxx::attempt_rc::hard_error;
-        }
-        if (resp.exist) {
-            exists = true;
+static unsigned long long get_file_size(const std::filesystem::path &path) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(std::filesystem::u8path(path.string()), ec);
+    return ec ? 0 : size;
+}
+
+// runs upload and reports its latency to the concurrency limiter and metrics
+// upload_size - size of uploaded data, latency is measured relative to it
+static std::optional<S3Error> upload_measured(unsigned long long upload_size, ConcurrencyLimiter &concurrency_limiter, Metrics *metrics, std::function<std::optional<S3Error>()> upload) {
+    const auto upload_start = std::chrono::steady_clock::now();
+    const auto ret = upload();
+    const auto upload_duration = std::chrono::steady_clock::now() - upload_start;
+    const auto upload_latency = std::chrono::duration_cast<std::chrono::milliseconds>(upload_duration);
+    if (metrics != nullptr) {
+        metrics->observe(METRIC_UPLOAD_DURATION, std::chrono::duration<double>(upload_duration).count());
+        if (!ret.has_value()) {
+            metrics->add(METRIC_UPLOADED_BYTES, (double) upload_size);
         }
-        return backoffxx::attempt_rc::success;
+    }
+    if (!ret.has_value()) {
+        concurrency_limiter.on_success(upload_latency / (1 + upload_size / LATENCY_SIZE_UNIT));
+    } else if (ret->retryable && !ret->is_corrupted) {
+        concurrency_limiter.on_throttle();
+    }
+    return ret;
+}
+
+static std::optional<S3Error> write_file_measured(const std::filesystem::path &file_path, S3Backend &backend, BandwidthLimiter *bandwidth_limiter, ConcurrencyLimiter &concurrency_limiter, Metrics *metrics, const std::filesystem::path &path) {
+    return upload_measured(get_file_size(file_path), concurrency_limiter, metrics, [&]() {
+        return write_file_s3(file_path, backend, bandwidth_limiter, path);
     });
+}
 
-    if (!result.ok()) {
-        return error;
+// packs files into a temporary tar and uploads it. Releases concurrency limiter after upload
+static void upload_bundle(
+    const S3TaskEventNewBundle &bundle_event,
+    ThreadSafeDeque<S3ProgressEvent> &progress_queue,
+    S3PendingFiles &pending_files,
+    RetryScheduler<S3TaskEvent> &retry_scheduler,
+    ConcurrencyLimiter &concurrency_limiter,
+    S3Backend &backend,
+    BandwidthLimiter *bandwidth_limiter,
+    Metrics *metrics,
+    const std::filesystem::path &path_from,
+    const std::filesystem::path &path_to,
+    const std::string &temporary_name_prefix,
+    unsigned int task_index
+) {
+    const auto save_to_filename = (path_to / bundle_event.bundle_name).lexically_normal();
+    const auto save_from_filename = std::filesystem::absolute(path_from / (temporary_name_prefix + "_" + std::filesystem::path(bundle_event.bundle_name).filename().string())).lexically_normal();
+
+    fprintf(stdout, "[Task %u] Bundling %zu files into %s\n", task_index + 1, bundle_event.files.size(), save_from_filename.string().c_str());
+    const auto bundle_ret = bundle_files(bundle_event.files, path_from, save_from_filename);
+    std::optional<S3Error> ret;
+    if (std::holds_alternative<std::string>(bundle_ret)) {
+        ret = S3Error { std::get<std::string>(bundle_ret), false, std::nullopt };
+    } else {
+        fprintf(stdout, "[Task %u] Uploading %s\n", task_index + 1, save_from_filename.string().c_str());
+        TraceSpan span("upload bundle", "s3", bundle_event.bundle_name, (int) bundle_event.attempt);
+        ret = write_file_measured(save_from_filename, backend, bandwidth_limiter, concurrency_limiter, metrics, save_to_filename);
+    }
+    concurrency_limiter.release();
+    std::error_code ec;
+    std::filesystem::remove(std::filesystem::u8path(save_from_filename.string()), ec);
+
+    if (ret.has_value()) {
+        // reschedule instead of sleeping, so the task can upload other files meanwhile
+        if (ret->retryable && bundle_event.attempt < RETRIES) {
+            const auto delay = retry_delay(bundle_event.attempt, ret.value());
+            fprintf(stderr, "[Task %u] Could not upload bundle \"%s\". Retrying in %.1f s. Error %s\n", task_index + 1, bundle_event.bundle_name.c_str(), delay.count() / 1000.0, ret->message.c_str());
+            auto retry_event = bundle_event;
+            retry_event.attempt++;
+            retry_scheduler.schedule(retry_event, RetryScheduler<S3TaskEvent>::clock::now() + delay);
+            return;
+        }
+        const auto error = ret->retryable ? std::string("Retry limit reached") : ret->message;
+        fprintf(stderr, "[Task %u] Could not upload bundle \"%s\". Error %s\n", task_index + 1, bundle_event.bundle_name.c_str(), error.c_str());
+        for (const auto &f : bundle_event.files) {
+            report_progress(progress_queue, pending_files, bundle_event.bundle_name, S3ProgressUploadError { f, error });
+        }
+        return;
+    }
+    for (auto entry : std::get<std::vector<bundle_entry_t>>(bundle_ret)) {
+        entry.bundle_name = bundle_event.bundle_name;
+        report_progress(progress_queue, pending_files, bundle_event.bundle_name, S3ProgressUploadOk { entry.file_name, entry });
     }
-
-    return exists;
 }
 
-static std::filesystem::path filename_to_archived_path(std::filesystem::path file_name, std::string file_prefix) {
-    file_name = file_name.replace_filename(file_prefix + "_" + file_name.filename().string());
-    file_name = file_name.replace_extension(file_name.extension().string() + ".zip");
-    return std::filesystem::absolute(file_name).lexically_normal();
+// streams files from the archive one by one in the order they are stored. Releases concurrency limiter after upload.
+// Files which failed with a retryable error are rescheduled together, so the archive is read once per attempt
+static void upload_archive(
+    const S3TaskEventNewArchive &archive_event,
+    ThreadSafeDeque<S3ProgressEvent> &progress_queue,
+    S3PendingFiles &pending_files,
+    RetryScheduler<S3TaskEvent> &retry_scheduler,
+    ConcurrencyLimiter &concurrency_limiter,
+    S3Backend &backend,
+    BandwidthLimiter *bandwidth_limiter,
+    Metrics *metrics,
+    const std::filesystem::path &path_from,
+    const std::filesystem::path &path_to,
+    unsigned int task_index
+) {
+    const auto archive_path = (path_from / archive_event.archive_name).lexically_normal();
+    const auto output_folder = std::filesystem::path(archive_event.output_folder);
+    std::unordered_set<std::string> remaining_files(archive_event.files.begin(), archive_event.files.end());
+    std::vector<std::string> retry_files;
+    std::optional<S3Error> retry_error;
+    std::optional<std::string> archive_error;
+
+    fprintf(stdout, "[Task %u] Uploading %zu files from %s\n", task_index + 1, archive_event.files.size(), archive_path.string().c_str());
+    ArchiveEntryStreamBuf entry_buffer(archive_path);
+    std::istream entry_stream(&entry_buffer);
+    while (!remaining_files.empty()) {
+        const auto next = entry_buffer.next_entry();
+        if (std::holds_alternative<std::string>(next)) {
+            archive_error = std::get<std::string>(next);
+            break;
+        }
+        const auto entry = std::get<std::optional<archive_entry_info_t>>(next);
+        if (!entry.has_value()) {
+            break;
+        }
+        if (remaining_files.erase(entry->name) == 0) {
+            continue;
+        }
+        const auto file_name = (output_folder / std::filesystem::u8path(entry->name)).string();
+        const auto save_to_filename = (path_to / file_name).lexically_normal();
+        TraceSpan span("upload from archive", "s3", file_name, (int) archive_event.attempt);
+        auto ret = upload_measured(entry->size, concurrency_limiter, metrics, [&]() {
+            return write_stream_s3(entry_stream, entry->size, upload_part_size(entry->size), backend, bandwidth_limiter, save_to_filename);
+        });
+        if (!ret.has_value() && entry_buffer.error().has_value()) {
+            // archive is broken, truncated file could be uploaded
+            backend.remove_object(to_object_name(save_to_filename));
+            ret = S3Error { entry_buffer.error().value(), false, std::nullopt };
+        }
+        if (!ret.has_value()) {
+            report_progress(progress_queue, pending_files, archive_event.archive_name, S3ProgressUploadOk { file_name });
+            continue;
+        }
+        if (ret->retryable && archive_event.attempt < RETRIES) {
+            retry_files.push_back(entry->name);
+            retry_error = ret;
+            continue;
+        }
+        const auto error = ret->retryable ? std::string("Retry limit reached") : ret->message;
+        fprintf(stderr, "[Task %u] Could not upload file \"%s\" from archive. Error %s\n", task_index + 1, file_name.c_str(), error.c_str());
+        report_progress(progress_queue, pending_files, archive_event.archive_name, S3ProgressUploadError { file_name, error });
+    }
+    concurrency_limiter.release();
+
+    // files which were not reached are reported in the order of the event
+    for (const auto &f : archive_event.files) {
+        if (remaining_files.count(f) == 0) {
+            continue;
+        }
+        const auto file_name = (output_folder / std::filesystem::u8path(f)).string();
+        const auto error = archive_error.value_or(std::string("File is not found in archive"));
+        fprintf(stderr, "[Task %u] Could not upload file \"%s\" from archive. Error %s\n", task_index + 1, file_name.c_str(), error.c_str());
+        report_progress(progress_queue, pending_files, archive_event.archive_name, S3ProgressUploadError { file_name, error });
+    }
+    if (retry_files.empty()) {
+        return;
+    }
+    // reschedule instead of sleeping, so the task can upload other files meanwhile
+    const auto delay = retry_delay(archive_event.attempt, retry_error.value());
+    fprintf(stderr, "[Task %u] Could not upload %zu files from archive \"%s\". Retrying in %.1f s. Error %s\n", task_index + 1, retry_files.size(), archive_event.archive_name.c_str(), delay.count() / 1000.0, retry_error->message.c_str());
+    auto retry_event = archive_event;
+    retry_event.files = retry_files;
+    retry_event.attempt++;
+    retry_scheduler.schedule(retry_event, RetryScheduler<S3TaskEvent>::clock::now() + delay);
 }
 
 static void s3_upload_task(
     ThreadSafeDeque<S3ProgressEvent> &progress_queue,
-    const std::string &url,
-    const std::string &access_key,
-    const std::string &secret_key,
-    const std::string &bucket,
-    const std::string &region,
+    S3PendingFiles &pending_files,
+    RetryScheduler<S3TaskEvent> &retry_scheduler,
+    ConcurrencyLimiter &concurrency_limiter,
+    S3Backend &backend,
+    BandwidthLimiter *bandwidth_limiter,
+    std::shared_ptr<DeflatePool> deflate_pool,
+    CompressionPolicy *compression_policy,
+    Metrics *metrics,
     const std::filesystem::path &path_from,
     const std::filesystem::path &path_to,
-    ThreadSafeDeque<S3TaskEvent> &message_queue,
+    ThreadSafePriorityDeque<S3TaskEvent> &message_queue,
     unsigned int task_index
 ) {
     fprintf(stdout, "Starting S3 upload task #%u\n", task_index + 1);
+    trace_thread_name("S3 upload task #" + std::to_string(task_index + 1));
 
-    minio::s3::BaseUrl base_url(url);
-    minio::creds::StaticProvider provider(access_key, secret_key);
-    minio::s3::Client client(base_url, &provider);
-
-    const auto archived_name_random_part = gen_random(RANDOM_FILE_NAME_LENGTH);
+    const auto temporary_name_prefix = gen_random(RANDOM_FILE_NAME_LENGTH);
 
     while (true) {
+        // only tasks within concurrency limit take files from the queue
+        concurrency_limiter.acquire();
         const auto event = message_queue.pop_front_waiting();
         if (std::holds_alternative<S3TaskEventTerminate>(event)) {
+            concurrency_limiter.release();
             break;
         }
+        if (std::holds_alternative<S3TaskEventNewBundle>(event)) {
+            upload_bundle(std::get<S3TaskEventNewBundle>(event), progress_queue, pending_files, retry_scheduler, concurrency_limiter, backend, bandwidth_limiter, metrics, path_from, path_to, temporary_name_prefix, task_index);
+            continue;
+        }
+        if (std::holds_alternative<S3TaskEventNewArchive>(event)) {
+            upload_archive(std::get<S3TaskEventNewArchive>(event), progress_queue, pending_files, retry_scheduler, concurrency_limiter, backend, bandwidth_limiter, metrics, path_from, path_to, task_index);
+            continue;
+        }
         const auto file_event = std::get<S3TaskEventNewFile>(event);
-        auto save_to_filename = (path_to / file_event.file_name).lexically_normal();
-        auto save_from_filename = (path_from / file_event.file_name).lexically_normal();
-        auto is_temporary_file = false;
+        const auto save_to_filename = (path_to / file_event.file_name).lexically_normal();
+        const auto save_from_filename = (path_from / file_event.file_name).lexically_normal();
+        std::optional<S3Error> ret;
+        auto is_archived = false;
 
         if (file_event.should_archive && !is_packed(save_from_filename)) {
-            fprintf(stdout, "[Task %u] Archiving %s\n", task_index + 1, save_from_filename.string().c_str());
-            const auto temporary_file = filename_to_archived_path(save_from_filename, archived_name_random_part);
-            const auto zip_result = zip_file(save_from_filename, temporary_file);
-            if (zip_result.has_value()) {
-                fprintf(stderr, "[Task %u] Could not archive file \"%s\". Error: %s\n", task_index + 1, save_from_filename.string().c_str(), zip_result.value().c_str());
+            fprintf(stdout, "[Task %u] Archiving and uploading %s\n", task_index + 1, save_from_filename.string().c_str());
+            const auto archived_filename = save_to_filename.string() + ".zip";
+            std::optional<std::string> archive_error;
+            TraceSpan span("zip and upload", "s3", file_event.file_name, (int) file_event.attempt);
+            ret = upload_measured(get_file_size(save_from_filename), concurrency_limiter, metrics, [&]() {
+                return write_zip_s3(save_from_filename, backend, bandwidth_limiter, deflate_pool, compression_policy, archived_filename, archive_error);
+            });
+            if (archive_error.has_value()) {
+                fprintf(stderr, "[Task %u] Could not archive file \"%s\". Error: %s\n", task_index + 1, save_from_filename.string().c_str(), archive_error.value().c_str());
             } else {
-                save_to_filename = save_to_filename.replace_extension(save_to_filename.extension().string() + ".zip");
-                save_from_filename = temporary_file;
-                is_temporary_file = true;
+                is_archived = true;
             }
         }
 
-        fprintf(stdout, "[Task %u] Uploading %s\n", task_index + 1, save_from_filename.string().c_str());
+        if (!is_archived) {
+            fprintf(stdout, "[Task %u] Uploading %s\n", task_index + 1, save_from_filename.string().c_str());
+            TraceSpan span("upload", "s3", file_event.file_name, (int) file_event.attempt);
+            ret = write_file_measured(save_from_filename, backend, bandwidth_limiter, concurrency_limiter, metrics, save_to_filename);
+        }
+        concurrency_limiter.release();
 
-        const auto ret = write_file_s3(save_from_filename, client, bucket, region, save_to_filename);
         if (ret.has_value()) {
-            fprintf(stderr, "[Task %u] Could not upload file \"%s\". Error %s\n", task_index + 1, save_from_filename.string().c_str(), ret.value().c_str());
-            progress_queue.push_back(S3ProgressUploadError { file_event.file_name, ret.value() });
-            if (is_temporary_file) {
-                // erase archive after failed upload
-                std::filesystem::remove(std::filesystem::u8path(save_from_filename.string()));
+            // reschedule instead of sleeping, so the task can upload other files meanwhile
+            if (ret->retryable && file_event.attempt < RETRIES) {
+                const auto delay = retry_delay(file_event.attempt, ret.value());
+                fprintf(stderr, "[Task %u] Could not upload file \"%s\". Retrying in %.1f s. Error %s\n", task_index + 1, save_from_filename.string().c_str(), delay.count() / 1000.0, ret->message.c_str());
+                auto retry_event = file_event;
+                retry_event.attempt++;
+                retry_scheduler.schedule(retry_event, RetryScheduler<S3TaskEvent>::clock::now() + delay);
+                continue;
             }
+            const auto error = ret->retryable ? std::string("Retry limit reached") : ret->message;
+            fprintf(stderr, "[Task %u] Could not upload file \"%s\". Error %s\n", task_index + 1, save_from_filename.string().c_str(), error.c_str());
+            report_progress(progress_queue, pending_files, file_event.parent, S3ProgressUploadError { file_event.file_name, error });
             continue;
         }
-        progress_queue.push_back(S3ProgressUploadOk { file_event.file_name });
-        if (is_temporary_file) {
-            // erase archive after upload
-            std::filesystem::remove(std::filesystem::u8path(save_from_filename.string()));
-        }
+        report_progress(progress_queue, pending_files, file_event.parent, S3ProgressUploadOk { file_event.file_name });
     }
 
     fprintf(stdout, "S3 upload task #%u completed\n", task_index + 1);
 }
 
 std::optional<std::string> S3Uploader::start() {
-    const auto exists_variant = exists_bucket_s3(*client, bucket, region);
+    const auto exists_variant = exists_bucket_s3(*backend);
     if (std::holds_alternative<std::string>(exists_variant)) {
         return std::get<std::string>(exists_variant);
     }
     const auto exists = std::get<bool>(exists_variant);
     if (!exists) {
-        return std::string("Bucket \"") + bucket + std::string("\" does not exist");
+        return std::string("Bucket \"") + backend->get_bucket() + std::string("\" does not exist");
     }
 
     std::string empty_file;
     const auto file_name = gen_random(RANDOM_FILE_NAME_LENGTH);
     const auto save_to_filename = path_to / file_name;
-    const auto write_option = write_content_to_file_s3(empty_file, *client, bucket, region, save_to_filename);
+    const auto write_option = write_content_to_file_s3(empty_file, *backend, save_to_filename);
     if (write_option.has_value()) {
-        return std::string("Could not write to bucket \"") + bucket + std::string("\". Error: ") + write_option.value();
+        return std::string("Could not write to bucket \"") + backend->get_bucket() + std::string("\". Error: ") + write_option.value();
     }
 
-    const auto delete_option = delete_file_s3(*client, bucket, region, save_to_filename);
+    const auto delete_option = delete_file_s3(*backend, save_to_filename);
     if (delete_option.has_value()) {
-        return std::string("Could not delete from bucket \"") + bucket + std::string("\". Error: ") + delete_option.value();
+        return std::string("Could not delete from bucket \"") + backend->get_bucket() + std::string("\". Error: ") + delete_option.value();
     }
 
     tasks.clear();
+    retry_scheduler.start();
     for (unsigned int i = 0; i < thread_count; i++) {
         // use lambda to MSVC workaround
         std::thread task([&, i]() {
-            s3_upload_task(progress_queue, url, access_key, secret_key, bucket, region, path_from, path_to, message_queue, i);
+            s3_upload_task(progress_queue, pending_files, retry_scheduler, concurrency_limiter, *backend, bandwidth_limiter.get(), deflate_pool, compression_policy.get(), metrics.get(), path_from, path_to, message_queue, i);
         });
         tasks.push_back(std::move(task));
     }
@@ -279,6 +607,13 @@ std::optional<std::string> S3Uploader::start() {
 }
 
 void S3Uploader::stop() {
+    if (!tasks.empty()) {
+        // wait for queued files and scheduled retries before terminating tasks
+        std::unique_lock<std::mutex> lock{ pending_files.mutex };
+        while (pending_files.count > 0) {
+            pending_files.condition.wait(lock);
+        }
+    }
     for (auto i = 0; i < tasks.size(); i++) {
         message_queue.push_back(S3TaskEventTerminate {});
     }
@@ -286,53 +621,132 @@ void S3Uploader::stop() {
         t.join();
     }
     tasks.clear();
+    retry_scheduler.stop();
+    pending_files.parent_order.clear();
+    pending_files.next_parent_order = 0;
 }
 
 ThreadSafeDeque<S3ProgressEvent> &S3Uploader::get_progress_queue() {
     return progress_queue;
 }
 
-void S3Uploader::new_file(const std::string &file_name, bool should_archive) {
-    message_queue.push_back(S3TaskEventNewFile { file_name, should_archive });
+long long S3Uploader::get_priority(const std::string &parent, unsigned long long size, unsigned long file_count) {
+    switch (upload_order) {
+    case UPLOAD_ORDER_SMALLEST_FIRST:
+        return (long long) std::min(size, (unsigned long long) LLONG_MAX);
+    case UPLOAD_ORDER_LARGEST_FIRST:
+        return -(long long) std::min(size, (unsigned long long) LLONG_MAX);
+    case UPLOAD_ORDER_PARENT_FIRST: {
+        std::unique_lock<std::mutex> lock{ pending_files.mutex };
+        if (file_count == 0) {
+            // nothing is reported for the parent, so its entry would never be removed
+            return pending_files.next_parent_order;
+        }
+        const auto inserted = pending_files.parent_order.emplace(parent, parent_order_t { pending_files.next_parent_order, 0 });
+        if (inserted.second) {
+            pending_files.next_parent_order++;
+        }
+        inserted.first->second.pending += file_count;
+        return inserted.first->second.order;
+    }
+    default:
+        return 0;
+    }
+}
+
+void S3Uploader::new_file(const std::string &file_name, bool should_archive, const std::string &parent) {
+    std::unique_lock<std::mutex> lock{ pending_files.mutex };
+    pending_files.count++;
+    lock.unlock();
+    S3TaskEventNewFile event { file_name, should_archive };
+    event.parent = parent.empty() ? file_name : parent;
+    event.priority = get_priority(event.parent, get_file_size(path_from / file_name), 1);
+    message_queue.push_back(event, event.priority);
+}
+
+void S3Uploader::new_bundle(const std::string &bundle_name, const std::vector<std::string> &files) {
+    std::unique_lock<std::mutex> lock{ pending_files.mutex };
+    // progress is reported for each file
+    pending_files.count += files.size();
+    lock.unlock();
+    unsigned long long size = 0;
+    for (const auto &f : files) {
+        size += get_file_size(path_from / f);
+    }
+    S3TaskEventNewBundle event { bundle_name, files };
+    event.priority = get_priority(bundle_name, size, files.size());
+    message_queue.push_back(event, event.priority);
+}
+
+void S3Uploader::new_archive(const std::string &archive_name, const std::string &output_folder, const std::vector<std::string> &files) {
+    std::unique_lock<std::mutex> lock{ pending_files.mutex };
+    // progress is reported for each file
+    pending_files.count += files.size();
+    lock.unlock();
+    S3TaskEventNewArchive event { archive_name, output_folder, files };
+    event.priority = get_priority(archive_name, get_file_size(path_from / archive_name), files.size());
+    message_queue.push_back(event, event.priority);
 }
 
 std::optional<std::string> S3Uploader::delete_file(const std::string &file_name) {
-    return delete_file_s3(*client, bucket, region, path_to / file_name);
+    return delete_file_s3(*backend, path_to / file_name);
 }
 
-std::variant<bool, std::string> S3Uploader::is_file_existing(const std::string &file_name) {
-    const auto file_path = path_to / file_name;
-    minio::s3::StatObjectArgs args;
-    args.bucket = bucket;
-    args.object = replace(file_path.string(), "\\", "/");
-    if (!region.empty()) {
-        args.region = region;
-    }
-
-    std::string error = "Retry limit reached";
-    minio::s3::StatObjectResponse response;
-    const auto result = backoffxx::attempt(backoffxx::make_exponential(std::chrono::seconds(INITIAL_DELAY_SECONDS), RETRIES, std::chrono::seconds(MAX_DELAY_SECONDS)), [&] {
-        response = client->StatObject(args);
-        if (!response) {
-            // throttling - make retry
-            if (response.status_code == 429 || response.status_code == 0) {
-                return backoffxx::attempt_rc::failure;
-            }
-            error = response.Error().String();
-            return backoffxx::attempt_rc::hard_error;
+std::variant<std::unordered_map<std::string, unsigned long long>, std::string> S3Uploader::list_files() {
+    auto prefix = to_object_name((path_to / "").lexically_normal());
+    // "." and "./" are normalized to "." which is the bucket root
+    if (prefix == "." || prefix == "./") {
+        prefix = "";
+    }
+
+    std::unordered_map<std::string, unsigned long long> files;
+    const auto error = retry_blocking([&] {
+        const auto ret = backend->list_objects(prefix);
+        if (std::holds_alternative<S3Error>(ret)) {
+            return std::optional<S3Error>(std::get<S3Error>(ret));
         }
-        return backoffxx::attempt_rc::success;
+        files.clear();
+        for (const auto &[object, size]: std::get<std::unordered_map<std::string, unsigned long long>>(ret)) {
+            files[object.substr(prefix.size())] = size;
+        }
+        return std::optional<S3Error>();
     });
 
-    if (!result.ok()) {
-        if (error == "NoSuchKey: Object does not exist") {
-            return false;
-        }
-        if (error == "NoSuchBucket: Bucket does not exist") {
-            return false;
+    if (error.has_value()) {
+        return error.value();
+    }
+    return files;
+}
+
+unsigned int S3Uploader::get_concurrency() {
+    return concurrency_limiter.get_limit();
+}
+
+unsigned int S3Uploader::get_uploading_count() {
+    return concurrency_limiter.get_running();
+}
+
+size_t S3Uploader::get_queue_size() {
+    return message_queue.size();
+}
+
+size_t S3Uploader::get_retry_count() {
+    return retry_scheduler.size();
+}
+
+std::variant<bool, std::string> S3Uploader::is_file_existing(const std::string &file_name) {
+    bool exists = false;
+    const auto error = retry_blocking([&] {
+        const auto ret = backend->object_exists(to_object_name(path_to / file_name));
+        if (std::holds_alternative<S3Error>(ret)) {
+            return std::optional<S3Error>(std::get<S3Error>(ret));
         }
-        return error;
+        exists = std::get<bool>(ret);
+        return std::optional<S3Error>();
+    });
+
+    if (error.has_value()) {
+        return error.value();
     }
-    // delete marker is not processed properly by minio so we skip checking it
-    return response.etag.size() > 0;
+    return exists;
 }
@@ -1,26 +1,74 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 #include <thread>
 #include <variant>
 #include <optional>
 #include <filesystem>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 
-#include <miniocpp/client.h>
-
+#include "./backend.hpp"
 #include "../deque/deque.hpp"
+#include "../deque/priority_deque.hpp"
+#include "../retry/retry_scheduler.hpp"
+#include "../concurrency/concurrency_limiter.hpp"
+#include "../bandwidth/bandwidth_limiter.hpp"
+#include "../archive/archive.hpp"
+#include "../compression/compression_policy.hpp"
+#include "../metrics/metrics.hpp"
+
+// order in which queued files are uploaded
+enum upload_order_t {
+    // in order of arrival
+    UPLOAD_ORDER_FIFO = 0,
+    // smaller files first, so that space in the temporary directory is freed sooner
+    UPLOAD_ORDER_SMALLEST_FIRST = 1,
+    UPLOAD_ORDER_LARGEST_FIRST = 2,
+    // files of the earliest queued parent first, so that the parent becomes ready sooner
+    UPLOAD_ORDER_PARENT_FIRST = 3
+};
+
+// accepts "fifo", "smallest", "largest" and "parent"
+std::optional<upload_order_t> parse_upload_order(const std::string &name);
 
 struct S3TaskEventTerminate {};
 
 struct S3TaskEventNewFile {
     std::string file_name;
-    bool should_archive; // if true, file will be zipped before upload
+    bool should_archive; // if true, file will be zipped before upload, unless it is an archive already
+    unsigned int attempt = 0; // number of failed upload attempts
+    long long priority = 0; // files with lower value are uploaded first
+    std::string parent; // file which becomes ready after this one is uploaded
 };
 
-typedef std::variant<S3TaskEventTerminate, S3TaskEventNewFile> S3TaskEvent;
+// files are packed into a single tar object
+struct S3TaskEventNewBundle {
+    std::string bundle_name;
+    std::vector<std::string> files;
+    unsigned int attempt = 0; // number of failed upload attempts
+    long long priority = 0; // files with lower value are uploaded first
+};
+
+// files are read from the archive and uploaded without extraction to disk
+struct S3TaskEventNewArchive {
+    std::string archive_name;
+    // folder the files are uploaded to, relative to path_to_
+    std::string output_folder;
+    // names of files inside of the archive which are not uploaded yet
+    std::vector<std::string> files;
+    unsigned int attempt = 0; // number of failed upload attempts
+    long long priority = 0; // files with lower value are uploaded first
+};
+
+typedef std::variant<S3TaskEventTerminate, S3TaskEventNewFile, S3TaskEventNewBundle, S3TaskEventNewArchive> S3TaskEvent;
 
 struct S3ProgressUploadOk {
     std::string file_name;
+    // set if the file is uploaded as a part of a bundle
+    std::optional<bundle_entry_t> bundle_entry;
 };
 
 struct S3ProgressUploadError {
@@ -30,11 +78,36 @@ struct S3ProgressUploadError {
 
 typedef std::variant<S3ProgressUploadOk, S3ProgressUploadError> S3ProgressEvent;
 
+struct parent_order_t {
+    long long order; // order of the first queued file of the parent
+    unsigned long pending; // files of the parent which are not reported yet
+};
+
+// files that are queued, uploading or waiting for retry
+struct S3PendingFiles {
+    std::mutex mutex;
+    std::condition_variable condition;
+    unsigned long count;
+    // parents with pending files. Entry is removed once the last file of the parent is reported,
+    // a parent which is queued again after that gets a new order
+    std::unordered_map<std::string, parent_order_t> parent_order;
+    long long next_parent_order;
+};
+
 class S3Uploader {
 public:
-    // use default thread count (16) if thread_count is set to 0
+    // thread_count_ - maximum number of simultaneous uploads. Use default (64) if set to 0
     // path_from_ - where we store files
     // path_to_ - where to upload them
+    // min_thread_count_ - minimum number of simultaneous uploads. Use 1 if set to 0
+    // target_latency_ms_ - upload latency per 16 MB above which concurrency is decreased. Not checked if set to 0
+    // bandwidth_limiter_ - shared limit of upload bandwidth. Not limited if set to nullptr
+    // upload_order_ - order in which queued files are uploaded
+    // max_wait_ms_ - queued file is uploaded out of order after waiting this long. Use default (60 s) if set to 0
+    // deflate_pool_ - threads for compression of archived files. Single threaded if set to nullptr
+    // compression_policy_ - chooses compression of archived files and collects statistics. Always deflate if set to nullptr
+    // metrics_ - uploaded bytes and upload latency are reported if set
+    // Concurrency starts at 16 uploads and adapts within [min_thread_count_, thread_count_] bounds.
     S3Uploader(
         unsigned int thread_count_,
         const std::string &url_,
@@ -43,36 +116,84 @@ public:
         const std::string &bucket_,
         const std::string &region_,
         const std::filesystem::path &path_from_,
-        const std::filesystem::path &path_to_
+        const std::filesystem::path &path_to_,
+        unsigned int min_thread_count_ = 0,
+        unsigned int target_latency_ms_ = 0,
+        std::shared_ptr<BandwidthLimiter> bandwidth_limiter_ = nullptr,
+        upload_order_t upload_order_ = UPLOAD_ORDER_FIFO,
+        unsigned int max_wait_ms_ = 0,
+        std::shared_ptr<DeflatePool> deflate_pool_ = nullptr,
+        std::shared_ptr<CompressionPolicy> compression_policy_ = nullptr,
+        std::shared_ptr<Metrics> metrics_ = nullptr
+    );
+    // upload with custom backend, i.e. LocalBackend for offline tests
+    S3Uploader(
+        unsigned int thread_count_,
+        std::shared_ptr<S3Backend> backend_,
+        const std::filesystem::path &path_from_,
+        const std::filesystem::path &path_to_,
+        unsigned int min_thread_count_ = 0,
+        unsigned int target_latency_ms_ = 0,
+        std::shared_ptr<BandwidthLimiter> bandwidth_limiter_ = nullptr,
+        upload_order_t upload_order_ = UPLOAD_ORDER_FIFO,
+        unsigned int max_wait_ms_ = 0,
+        std::shared_ptr<DeflatePool> deflate_pool_ = nullptr,
+        std::shared_ptr<CompressionPolicy> compression_policy_ = nullptr,
+        std::shared_ptr<Metrics> metrics_ = nullptr
     );
 
     std::optional<std::string> start();
+    // waits for all queued files to be uploaded, including retries
     void stop();
     // progress_queue allows to receive notifications on upload progress
     ThreadSafeDeque<S3ProgressEvent> &get_progress_queue();
-    void new_file(const std::string &file_name, bool should_archive = false);
+    // parent - name of the file which becomes ready after all its files are uploaded. File itself if empty
+    void new_file(const std::string &file_name, bool should_archive = false, const std::string &parent = "");
+    // upload files as a single bundle_name tar object. Progress is reported for each file
+    void new_bundle(const std::string &bundle_name, const std::vector<std::string> &files);
+    // upload files of archive_name to output_folder without extraction. Progress is reported for each file
+    // as output_folder / file, the archive should not be changed until all files are reported
+    void new_archive(const std::string &archive_name, const std::string &output_folder, const std::vector<std::string> &files);
     // does not require S3 uploader to be started
     std::optional<std::string> delete_file(const std::string &file_name);
     // returns either file exists or an error message
     // does not require S3 uploader to be started
     // delete marker is not supported
     std::variant<bool, std::string> is_file_existing(const std::string &file_name);
+    // returns either uploaded objects sizes or an error message
+    // key - object name relative to path_to_ with '/' separators
+    // does not require S3 uploader to be started
+    std::variant<std::unordered_map<std::string, unsigned long long>, std::string> list_files();
+    // current limit of simultaneous uploads
+    unsigned int get_concurrency();
+    // number of files which are being uploaded right now
+    unsigned int get_uploading_count();
+    // number of upload events waiting for an upload task
+    size_t get_queue_size();
+    // number of failed upload events waiting for the next attempt
+    size_t get_retry_count();
 private:
-    ThreadSafeDeque<S3TaskEvent> message_queue;
+    // queue priority of a file of the given size and parent
+    // file_count - number of files of the parent which are reported on upload
+    long long get_priority(const std::string &parent, unsigned long long size, unsigned long file_count);
+
+    ThreadSafePriorityDeque<S3TaskEvent> message_queue;
     ThreadSafeDeque<S3ProgressEvent> progress_queue;
+    S3PendingFiles pending_files;
     unsigned int thread_count;
+    upload_order_t upload_order;
+    ConcurrencyLimiter concurrency_limiter;
 
-    // S3 credentials
-    const std::string url;
-    const std::string access_key;
-    const std::string secret_key;
-    const std::string bucket;
-    const std::string region;
+    std::shared_ptr<S3Backend> backend;
+    std::shared_ptr<BandwidthLimiter> bandwidth_limiter;
+    std::shared_ptr<DeflatePool> deflate_pool;
+    std::shared_ptr<CompressionPolicy> compression_policy;
+    std::shared_ptr<Metrics> metrics;
 
     const std::filesystem::path path_from;
     const std::filesystem::path path_to;
-    std::unique_ptr<minio::creds::Provider> provider;
-    std::unique_ptr<minio::s3::Client> client;
 
+    // failed uploads wait here for the next attempt, so that upload tasks stay free
+    RetryScheduler<S3TaskEvent> retry_scheduler;
     std::vector<std::thread> tasks;
 };
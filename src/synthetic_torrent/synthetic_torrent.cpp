@@ -0,0 +1,112 @@
+#include <cmath>
+#include <climits>
+#include <optional>
+#include <random>
+#include <iterator>
+#include <algorithm>
+
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/create_torrent.hpp>
+#include <libtorrent/file_storage.hpp>
+
+#include "./synthetic_torrent.hpp"
+
+#define PIECE_SIZE_MIN (16 * 1024)
+#define PIECE_HASH_SIZE 20
+
+static std::string get_file_path(const synthetic_torrent_options_t &options, unsigned long long file_index) {
+    // folder of each level is named by its index among all folders of the level, so names are unique
+    std::vector<unsigned long long> folder_indexes;
+    unsigned long long divisor = 1;
+    for (unsigned int level = 0; level < options.depth; level++) {
+        if (divisor <= options.file_count) {
+            divisor *= options.fanout;
+        }
+        folder_indexes.push_back(file_index / divisor);
+    }
+    std::string path = options.name;
+    for (auto it = folder_indexes.rbegin(); it != folder_indexes.rend(); it++) {
+        path += "/dir_" + std::to_string(*it);
+    }
+    return path + "/file_" + std::to_string(file_index) + ".bin";
+}
+
+static std::optional<std::string> validate_options(const synthetic_torrent_options_t &options) {
+    if (options.name.empty()) {
+        return std::string("Torrent name is empty");
+    }
+    if (options.file_count == 0) {
+        return std::string("Torrent should have at least one file");
+    }
+    if (options.fanout == 0) {
+        return std::string("Fanout should be positive");
+    }
+    if (options.max_file_size == 0 || options.min_file_size > options.max_file_size) {
+        return std::string("Invalid file size range");
+    }
+    if (options.size_distribution == FILE_SIZE_LOG_UNIFORM && options.min_file_size == 0) {
+        return std::string("Minimum file size of log-uniform distribution should be positive");
+    }
+    if (options.piece_size != 0 && (options.piece_size < PIECE_SIZE_MIN || (options.piece_size & (options.piece_size - 1)) != 0)) {
+        return std::string("Piece size should be a power of 2, at least 16 KB");
+    }
+    return std::nullopt;
+}
+
+std::variant<std::vector<char>, std::string> generate_synthetic_torrent(const synthetic_torrent_options_t &options) {
+    const auto error = validate_options(options);
+    if (error.has_value()) {
+        return error.value();
+    }
+    std::mt19937_64 rng(options.seed);
+    std::uniform_int_distribution<unsigned long long> uniform_dist(options.min_file_size, options.max_file_size);
+    std::uniform_real_distribution<double> log_dist(
+        std::log((double) std::max(options.min_file_size, 1ULL)),
+        std::log((double) options.max_file_size));
+
+    lt::file_storage fs;
+    for (unsigned long long i = 0; i < options.file_count; i++) {
+        auto size = options.max_file_size;
+        if (options.size_distribution == FILE_SIZE_UNIFORM) {
+            size = uniform_dist(rng);
+        } else if (options.size_distribution == FILE_SIZE_LOG_UNIFORM) {
+            size = std::clamp((unsigned long long) std::llround(std::exp(log_dist(rng))), options.min_file_size, options.max_file_size);
+        }
+        fs.add_file(get_file_path(options, i), (std::int64_t) size);
+    }
+
+    try {
+        lt::create_torrent torrent(fs, options.piece_size, lt::create_torrent::v1_only);
+        char hash[PIECE_HASH_SIZE];
+        std::uniform_int_distribution<int> byte_dist(0, 255);
+        for (const auto &piece_index : torrent.piece_range()) {
+            for (auto &c : hash) {
+                c = (char) byte_dist(rng);
+            }
+            torrent.set_hash(piece_index, lt::sha1_hash(hash));
+        }
+        std::vector<char> buffer;
+        lt::bencode(std::back_inserter(buffer), torrent.generate());
+        return buffer;
+    } catch (const std::exception &e) {
+        return std::string("Could not create torrent: ") + e.what();
+    }
+}
+
+std::variant<std::shared_ptr<lt::torrent_info>, std::string> create_synthetic_torrent(const synthetic_torrent_options_t &options) {
+    const auto generate_ret = generate_synthetic_torrent(options);
+    if (std::holds_alternative<std::string>(generate_ret)) {
+        return std::get<std::string>(generate_ret);
+    }
+    const auto &buffer = std::get<std::vector<char>>(generate_ret);
+    // default limits reject torrents above 10 MB, i.e. with more than 100k files
+    lt::load_torrent_limits limits;
+    limits.max_buffer_size = std::max(limits.max_buffer_size, (int) std::min(buffer.size(), (size_t) INT_MAX));
+    limits.max_pieces = INT_MAX;
+    limits.max_decode_tokens = INT_MAX;
+    try {
+        return std::make_shared<lt::torrent_info>(buffer, limits, lt::from_span);
+    } catch (const std::exception &e) {
+        return std::string("Could not load torrent: ") + e.what();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <variant>
+
+#include <libtorrent/torrent_info.hpp>
+
+enum file_size_distribution_t {
+    FILE_SIZE_FIXED = 0,
+    FILE_SIZE_UNIFORM = 1,
+    FILE_SIZE_LOG_UNIFORM = 2
+};
+
+struct synthetic_torrent_options_t {
+    std::string name = "synthetic";
+    unsigned long long file_count = 1000;
+    // number of folder levels between the torrent folder and files
+    unsigned int depth = 2;
+    // number of files in a folder and of subfolders in a folder, the top level might have more
+    unsigned int fanout = 32;
+    // max_file_size is used for fixed distribution
+    file_size_distribution_t size_distribution = FILE_SIZE_LOG_UNIFORM;
+    unsigned long long min_file_size = 1024;
+    unsigned long long max_file_size = 16 * 1024 * 1024;
+    // power of 2, at least 16 KB. Chosen by libtorrent if set to 0
+    int piece_size = 0;
+    // seed of file sizes and piece hashes, the same options produce the same torrent
+    unsigned int seed = 0;
+};
+
+// Torrents of any size for scaling tests and benchmarks, created without payload data:
+// piece hashes are random, so the torrent could not be downloaded.
+
+// returns bencoded .torrent file or an error
+std::variant<std::vector<char>, std::string> generate_synthetic_torrent(const synthetic_torrent_options_t &options);
+
+std::variant<std::shared_ptr<lt::torrent_info>, std::string> create_synthetic_torrent(const synthetic_torrent_options_t &options);
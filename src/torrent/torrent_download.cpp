@@ -1,5 +1,7 @@
 #include <iostream>
 #include <ctime>
+#include <algorithm>
+#include <climits>
 
 #include <libtorrent/session.hpp>
 #include <libtorrent/add_torrent_params.hpp>
@@ -9,11 +11,25 @@
 #include <libtorrent/alert_types.hpp>
 
 #include "./torrent_download.hpp"
+#include "../trace/trace.hpp"
 
 // Workaround for stale torrent metadata. Will retry if no new peers found in STALE_TIMEOUT_SECONDS period.
 #define STALE_TIMEOUT_SECONDS 120
 // Up to STALE_RETRIES for stale torrent metadata.
 #define STALE_RETRIES 5
+// How many requested files are downloaded with the top priority at once.
+#define FOCUS_WINDOW_DEFAULT 2
+// Deadline step between consecutive pieces of the focused files.
+#define PIECE_DEADLINE_STEP_MS 100
+// How often torrent rate limits are adjusted to the S3 upload rate.
+#define DOWNLOAD_RATE_UPDATE_MS 1000
+// Share of the torrent bandwidth given to uploads to peers, the rest is left to the download.
+#define PEER_UPLOAD_SHARE 0.1
+
+#define METRIC_DOWNLOADED_BYTES "torrent_s3_downloaded_bytes_total"
+#define METRIC_DOWNLOADED_FILES "torrent_s3_downloaded_files_total"
+#define METRIC_PEERS "torrent_s3_torrent_peers"
+#define METRIC_MESSAGE_QUEUE_SIZE "torrent_s3_torrent_message_queue_size"
 
 // return the name of a torrent status enum
 static char const* state(lt::torrent_status::state_t s) {
@@ -102,26 +118,83 @@ std::variant<lt::torrent_info, std::string> load_magnet_link_info(const std::str
     }
 }
 
-static std::unordered_map<std::string, unsigned int> get_file_indexes(const lt::torrent_info &torrent) {
-    std::unordered_map<std::string, unsigned int> file_indexes;
-    for (const auto &file_index: torrent.files().file_range()) {
-        const auto file_name = torrent.files().file_path(file_index);
-        file_indexes[file_name] = (int) file_index;
+// Give the top priority and piece deadlines to the first focus_window pending files, so they complete
+// one after another instead of progressing all together. Other pending files keep the default priority.
+static void update_focused_files(
+    lt::torrent_handle &torrent_handle,
+    const TorrentMetadata &metadata,
+    const std::vector<unsigned int> &pending_indexes,
+    std::set<unsigned int> &focused_indexes,
+    unsigned int focus_window
+) {
+    int deadline = 0;
+    for (const auto file_index : pending_indexes) {
+        if (focused_indexes.size() >= focus_window) {
+            break;
+        }
+        if (focused_indexes.count(file_index) > 0) {
+            continue;
+        }
+        focused_indexes.insert(file_index);
+        const auto index = lt::file_index_t {(int) file_index};
+        torrent_handle.file_priority(index, libtorrent::top_priority);
+        if (metadata.file_size(file_index) == 0) {
+            continue;
+        }
+        const auto range = metadata.piece_range(file_index);
+        for (lt::piece_index_t pi = std::get<0>(range); pi != std::get<1>(range); pi++) {
+            torrent_handle.set_piece_deadline(pi, deadline);
+            deadline += PIECE_DEADLINE_STEP_MS;
+        }
+    }
+}
+
+struct torrent_rate_limits_t {
+    int download;
+    int upload;
+};
+
+// Bandwidth not used by S3 uploads is split between the download and uploads to peers, so that the combined
+// rate stays within the limit. Returns libtorrent rate limits, 0 if not limited
+static torrent_rate_limits_t get_torrent_rate_limits(BandwidthLimiter &bandwidth_limiter, unsigned long long upload_rate) {
+    const auto torrent_rate = bandwidth_limiter.get_torrent_rate(upload_rate);
+    if (torrent_rate == 0) {
+        return { 0, 0 };
     }
-    return file_indexes;
+    const auto peer_upload_rate = std::max((unsigned long long) (torrent_rate * PEER_UPLOAD_SHARE), 1ULL);
+    const auto download_rate = torrent_rate - std::min(torrent_rate, peer_upload_rate);
+    return {
+        (int) std::clamp(download_rate, 1ULL, (unsigned long long) INT_MAX),
+        (int) std::clamp(peer_upload_rate, 1ULL, (unsigned long long) INT_MAX)
+    };
 }
 
 static void download_task(
     ThreadSafeDeque<TorrentProgressEvent> &progress_queue,
     ThreadSafeDeque<TorrentTaskEvent> &message_queue,
-    const lt::add_torrent_params& torrent_params
+    const lt::add_torrent_params& torrent_params,
+    const TorrentMetadata &metadata,
+    unsigned int focus_window,
+    BandwidthLimiter *bandwidth_limiter,
+    Metrics *metrics
 ) {
     fprintf(stdout, "Starting Torrent download upload task\n");
+    trace_thread_name("Torrent download");
 
     lt::session session;
     lt::settings_pack p;
     p.set_int(lt::settings_pack::alert_mask, lt::alert_category::error | lt::alert_category::status | lt::alert_category::file_progress);
+    torrent_rate_limits_t rate_limits { 0, 0 };
+    if (bandwidth_limiter != nullptr) {
+        rate_limits = get_torrent_rate_limits(*bandwidth_limiter, 0);
+        p.set_int(lt::settings_pack::download_rate_limit, rate_limits.download);
+        p.set_int(lt::settings_pack::upload_rate_limit, rate_limits.upload);
+    }
     session.apply_settings(p);
+    auto rate_update_time = std::chrono::steady_clock::now();
+    unsigned long long last_uploaded = bandwidth_limiter != nullptr ? bandwidth_limiter->get_transferred() : 0;
+    // all torrent traffic, including protocol overhead, at the previous state update
+    std::int64_t last_transferred = 0;
 
     lt::add_torrent_params params { torrent_params };
     params.file_priorities = std::vector<lt::download_priority_t>(params.ti->num_files(), libtorrent::dont_download);
@@ -131,8 +204,11 @@ static void download_task(
     bool stop_download = false;
     std::set<unsigned int> downloaded_indexes;
     std::set<unsigned int> requested_indexes;
-
-    const auto files = get_file_indexes(*torrent_handle.torrent_file());
+    // requested but not yet downloaded files in the order of request
+    std::vector<unsigned int> pending_indexes;
+    std::set<unsigned int> focused_indexes;
+    // payload downloaded by the session at the previous state update
+    std::int64_t last_downloaded = 0;
 
     while (true) {
         if (download_error) {
@@ -152,18 +228,36 @@ static void download_task(
                 stop_download = true;
                 break;
             }
+            if (std::holds_alternative<TorrentTaskEventPrefetchFile>(event)) {
+                const auto prefetch_event = std::get<TorrentTaskEventPrefetchFile>(event);
+                const auto maybe_file_index = metadata.find_file(prefetch_event.file_name);
+                if (!maybe_file_index.has_value()) {
+                    continue;
+                }
+                const auto file_index = maybe_file_index.value();
+                // requested files already have higher priority
+                if (requested_indexes.count(file_index) > 0 || downloaded_indexes.count(file_index) > 0) {
+                    continue;
+                }
+                torrent_handle.file_priority(lt::file_index_t {(int) file_index}, libtorrent::low_priority);
+                continue;
+            }
             const auto file_event = std::get<TorrentTaskEventNewFile>(event);
             const auto filename = file_event.file_name;
-            if (files.count(filename) == 0) {
+            const auto maybe_file_index = metadata.find_file(filename);
+            if (!maybe_file_index.has_value()) {
                 continue;
             }
-            const auto file_index = files.at(filename);
+            const auto file_index = maybe_file_index.value();
             requested_indexes.insert(file_index);
-            torrent_handle.file_priority(lt::file_index_t {(int) file_index}, libtorrent::default_priority);
             // check if it was already downloaded
             if (downloaded_indexes.count(file_index) > 0) {
                 progress_queue.push_back(TorrentProgressDownloadOk { filename, file_index });
+                continue;
             }
+            torrent_handle.file_priority(lt::file_index_t {(int) file_index}, libtorrent::default_priority);
+            pending_indexes.push_back(file_index);
+            update_focused_files(torrent_handle, metadata, pending_indexes, focused_indexes, focus_window);
             continue;
         }
 
@@ -182,10 +276,18 @@ static void download_task(
 
                 std::cout << "File #" << file_index + 1 << " downloaded" << std::endl;
                 downloaded_indexes.insert(file_index);
+                if (metrics != nullptr) {
+                    metrics->add(METRIC_DOWNLOADED_FILES);
+                }
+
+                // promote next pending file to the focus window
+                pending_indexes.erase(std::remove(pending_indexes.begin(), pending_indexes.end(), file_index), pending_indexes.end());
+                if (focused_indexes.erase(file_index) > 0) {
+                    update_focused_files(torrent_handle, metadata, pending_indexes, focused_indexes, focus_window);
+                }
 
                 if (requested_indexes.count(file_index) > 0) {
-                    const auto file_name = torrent_handle.torrent_file()->files().file_path(lt::file_index_t {(int) file_index});
-                    progress_queue.push_back(TorrentProgressDownloadOk { file_name, file_index });
+                    progress_queue.push_back(TorrentProgressDownloadOk { metadata.file_path(file_index), file_index });
                 }
                 continue;
             }
@@ -198,6 +300,17 @@ static void download_task(
                           << (s.download_payload_rate / 1000) << " kB/s "
                           << s.num_peers << " peers)\x1b[K" << std::endl;
                 std::cout.flush();
+
+                if (metrics != nullptr) {
+                    metrics->add(METRIC_DOWNLOADED_BYTES, (double) std::max(s.total_payload_download - last_downloaded, (std::int64_t) 0));
+                    metrics->set(METRIC_PEERS, s.num_peers);
+                    metrics->set(METRIC_MESSAGE_QUEUE_SIZE, message_queue.size());
+                }
+                last_downloaded = s.total_payload_download;
+                if (bandwidth_limiter != nullptr) {
+                    bandwidth_limiter->add_torrent_transferred((unsigned long long) std::max(s.total_download + s.total_upload - last_transferred, (std::int64_t) 0));
+                }
+                last_transferred = s.total_download + s.total_upload;
             }
         }
         std::this_thread::sleep_for(std::chrono::milliseconds(200));
@@ -205,20 +318,43 @@ static void download_task(
         // ask the session to post a state_update_alert, to update our
         // state output for the torrent
         session.post_torrent_updates();
+
+        const auto now = std::chrono::steady_clock::now();
+        if (bandwidth_limiter != nullptr && now - rate_update_time >= std::chrono::milliseconds(DOWNLOAD_RATE_UPDATE_MS)) {
+            const auto uploaded = bandwidth_limiter->get_transferred();
+            const auto upload_rate = (unsigned long long) ((uploaded - last_uploaded) / std::chrono::duration<double>(now - rate_update_time).count());
+            last_uploaded = uploaded;
+            rate_update_time = now;
+            const auto new_rate_limits = get_torrent_rate_limits(*bandwidth_limiter, upload_rate);
+            if (new_rate_limits.download != rate_limits.download || new_rate_limits.upload != rate_limits.upload) {
+                rate_limits = new_rate_limits;
+                lt::settings_pack rate_pack;
+                rate_pack.set_int(lt::settings_pack::download_rate_limit, rate_limits.download);
+                rate_pack.set_int(lt::settings_pack::upload_rate_limit, rate_limits.upload);
+                session.apply_settings(rate_pack);
+            }
+        }
     }
 
     fprintf(stdout, "Torrent dowload task completed\n");
 }
 
-TorrentDownloader::TorrentDownloader(const lt::add_torrent_params& params) :
-    torrent_params {params} {
+TorrentDownloader::TorrentDownloader(const lt::add_torrent_params& params, unsigned int focus_window_, std::shared_ptr<BandwidthLimiter> bandwidth_limiter_, std::shared_ptr<Metrics> metrics_) :
+    torrent_params {params},
+    focus_window {focus_window_},
+    bandwidth_limiter {bandwidth_limiter_},
+    metrics {metrics_} {
+    if (!focus_window) {
+        focus_window = FOCUS_WINDOW_DEFAULT;
+    }
+    metadata = std::make_shared<const TorrentMetadata>(torrent_params.ti);
     const int file_count = torrent_params.ti->num_files();
     torrent_params.file_priorities = std::vector<lt::download_priority_t>(file_count, libtorrent::dont_download);
 }
 
 void TorrentDownloader::start() {
     task = std::thread([&]() {
-        download_task(progress_queue, message_queue, torrent_params);
+        download_task(progress_queue, message_queue, torrent_params, *metadata, focus_window, bandwidth_limiter.get(), metrics.get());
     });
 }
 
@@ -239,31 +375,12 @@ void TorrentDownloader::download_files(const std::vector<std::string> &files) {
     }
 }
 
-lt::torrent_info TorrentDownloader::get_torrent_info() const {
-    return *torrent_params.ti;
-}
-
-static std::tuple<lt::piece_index_t, lt::piece_index_t> file_piece_range(lt::file_storage const& fs, lt::file_index_t const file) {
-    auto const range = fs.map_file(file, 0, 1);
-    std::int64_t const file_size = fs.file_size(file);
-    std::int64_t const piece_size = fs.piece_length();
-    auto const end_piece = lt::piece_index_t(int((static_cast<int>(range.piece)
-                           * piece_size + range.start + file_size - 1) / piece_size + 1));
-    return std::make_tuple(range.piece, end_piece);
+void TorrentDownloader::prefetch_files(const std::vector<std::string> &files) {
+    for (const auto &f: files) {
+        message_queue.push_back(TorrentTaskEventPrefetchFile { f });
+    }
 }
 
-std::vector<std::string> get_file_hashes(const lt::torrent_info &torrent, std::string file_name) {
-    const auto file_indexes = get_file_indexes(torrent);
-    const auto file_index_it = file_indexes.find(file_name);
-    if (file_index_it == file_indexes.end()) {
-        return {};
-    }
-    std::vector<std::string> file_hashes;
-    const auto range = file_piece_range(torrent.files(), lt::file_index_t(file_index_it->second));
-    for (lt::piece_index_t pi = std::get<0>(range); pi != std::get<1>(range); pi++) {
-        const auto piece_hash = torrent.hash_for_piece(pi);
-        const auto hash_vector = std::string(piece_hash.data(), piece_hash.size());
-        file_hashes.push_back(hash_vector);
-    }
-    return file_hashes;
+std::shared_ptr<const TorrentMetadata> TorrentDownloader::get_metadata() const {
+    return metadata;
 }
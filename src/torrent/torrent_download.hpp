@@ -1,10 +1,14 @@
 #pragma once
 
 #include <thread>
+#include <memory>
 #include <variant>
 #include <libtorrent/add_torrent_params.hpp>
 #include <libtorrent/torrent_info.hpp>
 #include "../deque/deque.hpp"
+#include "../bandwidth/bandwidth_limiter.hpp"
+#include "../metrics/metrics.hpp"
+#include "../torrent_metadata/torrent_metadata.hpp"
 
 std::variant<lt::torrent_info, std::string> load_magnet_link_info(const std::string magnet_link);
 
@@ -14,7 +18,12 @@ struct TorrentTaskEventNewFile {
     std::string file_name;
 };
 
-typedef std::variant<TorrentTaskEventTerminate, TorrentTaskEventNewFile> TorrentTaskEvent;
+// download file pieces with low priority until the file is requested with TorrentTaskEventNewFile
+struct TorrentTaskEventPrefetchFile {
+    std::string file_name;
+};
+
+typedef std::variant<TorrentTaskEventTerminate, TorrentTaskEventNewFile, TorrentTaskEventPrefetchFile> TorrentTaskEvent;
 
 struct TorrentProgressDownloadOk {
     std::string file_name;
@@ -29,7 +38,12 @@ typedef std::variant<TorrentProgressDownloadOk, TorrentProgressDownloadError> To
 
 class TorrentDownloader {
 public:
-    TorrentDownloader(const lt::add_torrent_params& params);
+    // files are downloaded with the top priority focus_window at a time, so that they complete one
+    // after another rather than all together at the end of a chunk
+    // use default window (2) if focus_window is set to 0
+    // bandwidth_limiter_ - limit shared with S3 uploads, download gets the bandwidth not used by uploads
+    // metrics_ - downloaded bytes, peers and queue size are reported if set
+    TorrentDownloader(const lt::add_torrent_params& params, unsigned int focus_window_ = 0, std::shared_ptr<BandwidthLimiter> bandwidth_limiter_ = nullptr, std::shared_ptr<Metrics> metrics_ = nullptr);
 
     void start();
     void stop();
@@ -37,13 +51,19 @@ public:
     // progress_queue allows to receive notifications on download progress
     ThreadSafeDeque<TorrentProgressEvent> &get_progress_queue();
     void download_files(const std::vector<std::string> &files);
-    lt::torrent_info get_torrent_info() const;
+    // speculatively download files with low priority. Prefetched files are not reported to the progress_queue
+    // until they are requested with download_files()
+    void prefetch_files(const std::vector<std::string> &files);
+    // file table of the torrent, shared instead of copying torrent_info
+    std::shared_ptr<const TorrentMetadata> get_metadata() const;
 private:
     std::thread task;
     lt::add_torrent_params torrent_params;
+    std::shared_ptr<const TorrentMetadata> metadata;
+    unsigned int focus_window;
+    std::shared_ptr<BandwidthLimiter> bandwidth_limiter;
+    std::shared_ptr<Metrics> metrics;
 
     ThreadSafeDeque<TorrentTaskEvent> message_queue;
     ThreadSafeDeque<TorrentProgressEvent> progress_queue;
 };
-
-std::vector<std::string> get_file_hashes(const lt::torrent_info &torrent, std::string file_name);
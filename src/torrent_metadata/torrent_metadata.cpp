@@ -0,0 +1,73 @@
+#include "./torrent_metadata.hpp"
+
+TorrentMetadata::TorrentMetadata(std::shared_ptr<const lt::torrent_info> torrent_) : torrent {torrent_}, size {0} {
+    const auto &fs = torrent->files();
+    const std::int64_t piece_size = fs.piece_length();
+    const auto file_count = (unsigned int) torrent->num_files();
+    paths.reserve(file_count);
+    files.reserve(file_count);
+    for (const auto &file_index: fs.file_range()) {
+        const std::int64_t file_offset = fs.file_offset(file_index);
+        const std::int64_t file_size = fs.file_size(file_index);
+        // piece of the last byte, the same range is used for hashes stored in the hashlist
+        const auto end_piece = (int) ((file_offset + file_size - 1) / piece_size + 1);
+        paths.push_back(fs.file_path(file_index));
+        files.push_back(file_t { (unsigned long long) file_size, (unsigned long long) file_offset, (int) (file_offset / piece_size), end_piece });
+        size += (unsigned long long) file_size;
+    }
+    // paths are not moved anymore, so views into them stay valid
+    file_indexes.reserve(file_count);
+    for (unsigned int i = 0; i < file_count; i++) {
+        file_indexes.emplace(paths[i], i);
+    }
+}
+
+unsigned int TorrentMetadata::num_files() const {
+    return (unsigned int) files.size();
+}
+
+unsigned long long TorrentMetadata::total_size() const {
+    return size;
+}
+
+const std::string &TorrentMetadata::file_path(unsigned int file_index) const {
+    return paths[file_index];
+}
+
+unsigned long long TorrentMetadata::file_size(unsigned int file_index) const {
+    return files[file_index].size;
+}
+
+unsigned long long TorrentMetadata::file_offset(unsigned int file_index) const {
+    return files[file_index].offset;
+}
+
+std::pair<lt::piece_index_t, lt::piece_index_t> TorrentMetadata::piece_range(unsigned int file_index) const {
+    const auto &file = files[file_index];
+    return {lt::piece_index_t(file.first_piece), lt::piece_index_t(file.end_piece)};
+}
+
+std::optional<unsigned int> TorrentMetadata::find_file(const std::string &file_path) const {
+    const auto file_index_it = file_indexes.find(file_path);
+    if (file_index_it == file_indexes.end()) {
+        return std::nullopt;
+    }
+    return file_index_it->second;
+}
+
+std::vector<std::string> TorrentMetadata::get_file_hashes(unsigned int file_index) const {
+    std::vector<std::string> file_hashes;
+    const auto &file = files[file_index];
+    if (file.end_piece > file.first_piece) {
+        file_hashes.reserve(file.end_piece - file.first_piece);
+    }
+    for (auto pi = lt::piece_index_t(file.first_piece); pi != lt::piece_index_t(file.end_piece); pi++) {
+        const auto piece_hash = torrent->hash_for_piece(pi);
+        file_hashes.emplace_back(piece_hash.data(), piece_hash.size());
+    }
+    return file_hashes;
+}
+
+std::shared_ptr<const lt::torrent_info> TorrentMetadata::get_torrent_info() const {
+    return torrent;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+
+#include <libtorrent/torrent_info.hpp>
+
+// Immutable file table of a torrent, created once and shared by all subsystems instead of torrent_info copies.
+// File paths, sizes, offsets and piece ranges are computed at construction, so lookups do not allocate.
+// File indexes are the same as in the torrent.
+class TorrentMetadata {
+public:
+    TorrentMetadata(std::shared_ptr<const lt::torrent_info> torrent_);
+
+    unsigned int num_files() const;
+    unsigned long long total_size() const;
+    const std::string &file_path(unsigned int file_index) const;
+    unsigned long long file_size(unsigned int file_index) const;
+    // offset of the file in the torrent payload
+    unsigned long long file_offset(unsigned int file_index) const;
+    // pieces [first, end) with data of the file
+    std::pair<lt::piece_index_t, lt::piece_index_t> piece_range(unsigned int file_index) const;
+    std::optional<unsigned int> find_file(const std::string &file_path) const;
+    // hash of each piece of a file
+    std::vector<std::string> get_file_hashes(unsigned int file_index) const;
+    std::shared_ptr<const lt::torrent_info> get_torrent_info() const;
+
+private:
+    struct file_t {
+        unsigned long long size;
+        unsigned long long offset;
+        int first_piece;
+        int end_piece;
+    };
+
+    std::shared_ptr<const lt::torrent_info> torrent;
+    std::vector<std::string> paths;
+    std::vector<file_t> files;
+    // keys point to the strings in paths
+    std::unordered_map<std::string_view, unsigned int> file_indexes;
+    unsigned long long size;
+};
@@ -0,0 +1,270 @@
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <condition_variable>
+
+#include "./trace.hpp"
+
+// events above this number are dropped, so that a long sync does not exhaust memory
+#define TRACE_EVENTS_PER_THREAD_MAX 1000000
+// how often the dump task checks for the signal
+#define TRACE_SIGNAL_CHECK_MS 200
+
+struct trace_record_t {
+    const char *name;
+    const char *category;
+    std::string file;
+    int attempt;
+    long long start_us;
+    long long duration_us;
+};
+
+struct thread_buffer_t {
+    std::mutex mutex;
+    unsigned int tid;
+    std::string name;
+    std::vector<trace_record_t> records;
+    unsigned long long dropped = 0;
+};
+
+static std::atomic<bool> tracing {false};
+static std::chrono::steady_clock::time_point trace_origin;
+static std::filesystem::path trace_path;
+// buffers of finished threads are kept until the next trace starts, so that their records are written
+// and counted in the totals. They are removed when tracing is off
+static std::mutex buffers_mutex;
+static std::vector<std::shared_ptr<thread_buffer_t>> buffers;
+static unsigned int last_tid = 0;
+
+static std::mutex dump_mutex;
+static std::condition_variable dump_condition;
+static bool dump_running = false;
+static std::thread dump_task;
+static volatile std::sig_atomic_t dump_requested = 0;
+
+static void on_dump_signal(int) {
+    dump_requested = 1;
+}
+
+// buffers_mutex should be locked
+static void remove_finished_buffers() {
+    // buffer of a finished thread is referenced only by the list
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](const std::shared_ptr<thread_buffer_t> &buffer) {
+        return buffer.use_count() == 1;
+    }), buffers.end());
+}
+
+static thread_buffer_t &get_thread_buffer() {
+    thread_local std::shared_ptr<thread_buffer_t> buffer;
+    if (buffer == nullptr) {
+        buffer = std::make_shared<thread_buffer_t>();
+        std::unique_lock<std::mutex> lock{ buffers_mutex };
+        // threads are named when tracing is off as well, so that buffers do not pile up
+        if (!tracing) {
+            remove_finished_buffers();
+        }
+        buffer->tid = ++last_tid;
+        buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+static std::string escape_json(const std::string &value) {
+    std::string ret;
+    ret.reserve(value.size());
+    for (const auto c : value) {
+        if (c == '"' || c == '\\') {
+            ret += '\\';
+            ret += c;
+        } else if ((unsigned char) c < 0x20) {
+            char buff[8];
+            snprintf(buff, sizeof(buff), "\\u%04x", (unsigned int) (unsigned char) c);
+            ret += buff;
+        } else {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+void trace_start(const std::filesystem::path &file_path) {
+    std::unique_lock<std::mutex> lock{ dump_mutex };
+    if (dump_running) {
+        return;
+    }
+    // records of the previous trace are written already
+    std::unique_lock<std::mutex> buffers_lock{ buffers_mutex };
+    remove_finished_buffers();
+    for (const auto &buffer : buffers) {
+        std::unique_lock<std::mutex> buffer_lock{ buffer->mutex };
+        buffer->records.clear();
+        buffer->dropped = 0;
+    }
+    buffers_lock.unlock();
+    trace_path = file_path;
+    trace_origin = std::chrono::steady_clock::now();
+    tracing = true;
+    dump_running = true;
+#ifdef SIGUSR1
+    std::signal(SIGUSR1, on_dump_signal);
+#endif
+    dump_task = std::thread([]() {
+        std::unique_lock<std::mutex> lock{ dump_mutex };
+        while (dump_running) {
+            dump_condition.wait_for(lock, std::chrono::milliseconds(TRACE_SIGNAL_CHECK_MS));
+            if (!dump_requested) {
+                continue;
+            }
+            dump_requested = 0;
+            const auto ret = trace_write(trace_path);
+            if (ret.has_value()) {
+                fprintf(stderr, "Could not write trace: %s\n", ret.value().c_str());
+            } else {
+                fprintf(stdout, "Trace written to %s\n", trace_path.string().c_str());
+            }
+        }
+    });
+}
+
+void trace_stop() {
+    std::unique_lock<std::mutex> lock{ dump_mutex };
+    if (!dump_running) {
+        return;
+    }
+    dump_running = false;
+    lock.unlock();
+    dump_condition.notify_one();
+    dump_task.join();
+    tracing = false;
+    const auto ret = trace_write(trace_path);
+    if (ret.has_value()) {
+        fprintf(stderr, "Could not write trace: %s\n", ret.value().c_str());
+        return;
+    }
+    fprintf(stdout, "Trace written to %s\n", trace_path.string().c_str());
+}
+
+bool is_tracing() {
+    return tracing;
+}
+
+void trace_thread_name(const std::string &name) {
+    // name is kept even if tracing is not started yet, thread pools are created before the trace starts
+    auto &buffer = get_thread_buffer();
+    std::unique_lock<std::mutex> lock{ buffer.mutex };
+    buffer.name = name;
+}
+
+void trace_event(
+    const char *name,
+    const char *category,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    const std::string &file,
+    int attempt) {
+    if (!tracing) {
+        return;
+    }
+    const auto start_us = (long long) std::chrono::duration_cast<std::chrono::microseconds>(start - trace_origin).count();
+    const auto duration_us = (long long) std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    auto &buffer = get_thread_buffer();
+    std::unique_lock<std::mutex> lock{ buffer.mutex };
+    if (buffer.records.size() >= TRACE_EVENTS_PER_THREAD_MAX) {
+        buffer.dropped++;
+        return;
+    }
+    buffer.records.push_back(trace_record_t { name, category, file, attempt, std::max(start_us, 0LL), std::max(duration_us, 0LL) });
+}
+
+std::optional<std::string> trace_write(const std::filesystem::path &file_path) {
+    auto temporary_path = file_path;
+    temporary_path += ".tmp";
+    std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return std::string("Could not open \"") + temporary_path.string() + "\"";
+    }
+    std::unique_lock<std::mutex> lock{ buffers_mutex };
+    const auto thread_buffers = buffers;
+    lock.unlock();
+
+    unsigned long long dropped = 0;
+    auto is_first = true;
+    file << "{\"traceEvents\":[";
+    for (const auto &buffer : thread_buffers) {
+        std::unique_lock<std::mutex> buffer_lock{ buffer->mutex };
+        dropped += buffer->dropped;
+        if (!buffer->name.empty()) {
+            file << (is_first ? "\n" : ",\n");
+            is_first = false;
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                 << ",\"args\":{\"name\":\"" << escape_json(buffer->name) << "\"}}";
+        }
+        for (const auto &r : buffer->records) {
+            file << (is_first ? "\n" : ",\n");
+            is_first = false;
+            file << "{\"name\":\"" << r.name << "\",\"cat\":\"" << r.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                 << ",\"ts\":" << r.start_us << ",\"dur\":" << r.duration_us << ",\"args\":{";
+            if (!r.file.empty()) {
+                file << "\"file\":\"" << escape_json(r.file) << "\"";
+            }
+            if (r.attempt >= 0) {
+                file << (r.file.empty() ? "" : ",") << "\"attempt\":" << r.attempt;
+            }
+            file << "}}";
+        }
+    }
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    file.close();
+    if (!file) {
+        return std::string("Could not write \"") + temporary_path.string() + "\"";
+    }
+    std::error_code ec;
+    std::filesystem::rename(temporary_path, file_path, ec);
+    if (ec) {
+        return std::string("Could not replace \"") + file_path.string() + "\": " + ec.message();
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "Trace is incomplete, %llu events were dropped\n", dropped);
+    }
+    return std::nullopt;
+}
+
+std::map<std::string, trace_total_t> get_trace_totals() {
+    std::unique_lock<std::mutex> lock{ buffers_mutex };
+    const auto thread_buffers = buffers;
+    lock.unlock();
+
+    std::map<std::string, trace_total_t> totals;
+    for (const auto &buffer : thread_buffers) {
+        std::unique_lock<std::mutex> buffer_lock{ buffer->mutex };
+        for (const auto &r : buffer->records) {
+            auto &total = totals[r.name];
+            total.count++;
+            total.seconds += (double) r.duration_us / 1000000;
+        }
+    }
+    return totals;
+}
+
+TraceSpan::TraceSpan(const char *name_, const char *category_, const std::string &file_, int attempt_) :
+    name {name_},
+    category {category_},
+    attempt {attempt_},
+    is_enabled {tracing} {
+    if (is_enabled) {
+        file = file_;
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if (is_enabled) {
+        trace_event(name, category, start, std::chrono::steady_clock::now(), file, attempt);
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <map>
+#include <chrono>
+#include <string>
+#include <optional>
+#include <filesystem>
+
+// Spans of pipeline stages recorded to per-thread buffers and written in Chrome Trace Event format,
+// which could be opened with Perfetto or chrome://tracing. Nothing is recorded until trace_start is called.
+
+// starts recording. Trace is written to file_path on trace_stop and on SIGUSR1 where it is supported
+void trace_start(const std::filesystem::path &file_path);
+// stops recording and writes the trace
+void trace_stop();
+bool is_tracing();
+
+// writes events recorded so far, recording continues
+std::optional<std::string> trace_write(const std::filesystem::path &file_path);
+
+struct trace_total_t {
+    unsigned long long count = 0;
+    double seconds = 0;
+};
+
+// number and total duration of spans recorded so far, by span name
+std::map<std::string, trace_total_t> get_trace_totals();
+
+// name of the current thread in the trace, could be set before trace_start
+void trace_thread_name(const std::string &name);
+
+// records a span which started and ended at the given time, possibly on different threads
+// name and category should be string literals
+// file - processed file, not shown if empty
+// attempt - upload attempt, not shown if negative
+void trace_event(
+    const char *name,
+    const char *category,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end,
+    const std::string &file = "",
+    int attempt = -1);
+
+// records a span from construction to destruction
+class TraceSpan {
+public:
+    TraceSpan(const char *name_, const char *category_, const std::string &file_ = "", int attempt_ = -1);
+    ~TraceSpan();
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    // empty if tracing is disabled
+    std::string file;
+    int attempt;
+    bool is_enabled;
+    std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,37 @@
+#include <algorithm>
+
+#include "./worker_pool.hpp"
+#include "../trace/trace.hpp"
+
+WorkerPool::WorkerPool(unsigned int thread_count_, const std::string &name) {
+    const auto thread_count = std::max(thread_count_, 1U);
+    for (unsigned int i = 0; i < thread_count; i++) {
+        threads.emplace_back([this, name, i]() {
+            trace_thread_name(name + " #" + std::to_string(i + 1));
+            while (true) {
+                const auto job = jobs.pop_front_waiting();
+                if (!job) {
+                    break;
+                }
+                job();
+            }
+        });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    for (size_t i = 0; i < threads.size(); i++) {
+        jobs.push_back(nullptr);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+unsigned int WorkerPool::get_thread_count() const {
+    return (unsigned int) threads.size();
+}
+
+void WorkerPool::submit(std::function<void()> job) {
+    jobs.push_back(std::move(job));
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+
+#include "../deque/deque.hpp"
+
+// Fixed number of threads which run submitted jobs in order of submission.
+// Jobs which are already submitted are finished before the destructor returns
+class WorkerPool {
+public:
+    // name - thread name in the trace, followed by the worker number
+    WorkerPool(unsigned int thread_count_, const std::string &name);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    unsigned int get_thread_count() const;
+    void submit(std::function<void()> job);
+
+private:
+    // empty job terminates a worker thread
+    ThreadSafeDeque<std::function<void()>> jobs;
+    std::vector<std::thread> threads;
+};
@@ -39,6 +39,45 @@ TEST(app_state_test, add_child) {
     EXPECT_EQ(state.get_uploading_parent("child"), "parent");
 }
 
+TEST(app_state_test, add_child_incrementally) {
+    const auto maybe_db = db_open(":memory:");
+    const auto db = std::get<std::shared_ptr<sqlite3>>(maybe_db);
+    AppState state(db, true);
+    state.add_uploading_files("parent", {"child1"});
+    state.add_uploading_file("parent", "child2");
+    state.file_complete("child1");
+    const auto new_files = state.get_uploading_files();
+    EXPECT_EQ(new_files.size(), 1);
+    EXPECT_EQ(new_files.at("parent").size(), 1);
+    EXPECT_EQ(new_files.at("parent")[0], "child2");
+    EXPECT_EQ(state.get_uploading_parent("child2"), "parent");
+    // child uploaded before is uploaded again
+    state.add_uploading_file("parent", "child1");
+    EXPECT_EQ(state.get_file_status("child1"), file_status_t::FILE_STATUS_UPLOADING);
+    EXPECT_EQ(state.get_uploading_files().at("parent").size(), 2);
+}
+
+TEST(app_state_test, bundle_files) {
+    const auto maybe_db = db_open(":memory:");
+    const auto db = std::get<std::shared_ptr<sqlite3>>(maybe_db);
+    AppState state(db, true);
+    EXPECT_FALSE(state.get_bundle_file("file").has_value());
+    state.add_bundle_file(bundle_entry_t { "file", "bundle1.tar", 512, 10 });
+    auto entry = state.get_bundle_file("file");
+    EXPECT_TRUE(entry.has_value());
+    EXPECT_EQ(entry->file_name, "file");
+    EXPECT_EQ(entry->bundle_name, "bundle1.tar");
+    EXPECT_EQ(entry->offset, 512);
+    EXPECT_EQ(entry->size, 10);
+    // file is moved to another bundle after update
+    state.add_bundle_file(bundle_entry_t { "file", "bundle2.tar", 1024, 20 });
+    entry = state.get_bundle_file("file");
+    EXPECT_EQ(entry->bundle_name, "bundle2.tar");
+    EXPECT_EQ(entry->offset, 1024);
+    state.remove_bundle_file("file");
+    EXPECT_FALSE(state.get_bundle_file("file").has_value());
+}
+
 TEST(app_state_test, mark_complete) {
     const auto maybe_db = db_open(":memory:");
     const auto db = std::get<std::shared_ptr<sqlite3>>(maybe_db);
@@ -98,12 +137,13 @@ TEST(app_state_test, torrent_save_load) {
         const auto f = torrent_params.ti->files().file_path(i);
         state.file_complete(f);
     }
-    auto new_hashlist = create_hashlist(*torrent_params.ti, state.get_completed_files());
+    const TorrentMetadata metadata(torrent_params.ti);
+    auto new_hashlist = create_hashlist(metadata, state.get_completed_files());
     state.save_hashlist(new_hashlist);
 
     auto hashlist = state.get_hashlist();
     EXPECT_TRUE(hashlist.size() > 0);
 
-    const auto new_files_set = get_updated_files(*torrent_params.ti, hashlist);
+    const auto new_files_set = get_updated_files(metadata, hashlist);
     EXPECT_EQ(new_files_set.size(), 0);
 }
@@ -1,9 +1,200 @@
+#include <thread>
+#include <fstream>
+#include <filesystem>
 #include <gtest/gtest.h>
 
+#include <libtorrent/session.hpp>
+#include <libtorrent/settings_pack.hpp>
+#include <libtorrent/create_torrent.hpp>
+#include <libtorrent/torrent_flags.hpp>
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/address.hpp>
+
 #include "../src/db/sqlite.hpp"
 #include "../src/app_sync/sync.hpp"
+#include "../src/s3/local_backend.hpp"
 #include "test_utils.hpp"
 
+#define SEEDER_LISTEN_WAIT_MS 5000
+
+// torrent of the archives folder seeded by an in-process session, so that AppSync runs offline
+struct local_torrent_t {
+    std::shared_ptr<lt::session> seeder;
+    lt::add_torrent_params params;
+};
+
+static local_torrent_t seed_local_torrent(const std::filesystem::path &seed_path, const std::vector<std::string> &assets, const std::string &download_path) {
+    std::filesystem::create_directories(seed_path / "archives");
+    for (const auto &asset : assets) {
+        std::filesystem::copy_file(get_asset(asset), seed_path / "archives" / asset);
+    }
+    lt::file_storage fs;
+    lt::add_files(fs, (seed_path / "archives").string());
+    lt::create_torrent torrent(fs, 0, lt::create_torrent::v1_only);
+    lt::error_code ec;
+    lt::set_piece_hashes(torrent, seed_path.string(), ec);
+    EXPECT_FALSE(ec);
+    std::vector<char> buffer;
+    lt::bencode(std::back_inserter(buffer), torrent.generate());
+    const auto torrent_info = std::make_shared<lt::torrent_info>(buffer, lt::from_span);
+
+    lt::settings_pack p;
+    p.set_str(lt::settings_pack::listen_interfaces, "127.0.0.1:0");
+    p.set_bool(lt::settings_pack::enable_dht, false);
+    p.set_bool(lt::settings_pack::enable_lsd, false);
+    p.set_bool(lt::settings_pack::enable_upnp, false);
+    p.set_bool(lt::settings_pack::enable_natpmp, false);
+    auto seeder = std::make_shared<lt::session>(p);
+    lt::add_torrent_params seed_params;
+    seed_params.ti = torrent_info;
+    seed_params.save_path = seed_path.string();
+    seed_params.flags |= lt::torrent_flags::seed_mode;
+    seeder->add_torrent(seed_params);
+    const auto wait_start = std::chrono::steady_clock::now();
+    while (seeder->listen_port() == 0 && std::chrono::steady_clock::now() - wait_start < std::chrono::milliseconds(SEEDER_LISTEN_WAIT_MS)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_NE(seeder->listen_port(), 0);
+
+    lt::add_torrent_params params;
+    params.save_path = download_path;
+    params.ti = std::make_shared<lt::torrent_info>(*torrent_info);
+    params.peers.push_back(lt::tcp::endpoint(lt::make_address("127.0.0.1"), seeder->listen_port()));
+    return local_torrent_t { seeder, params };
+}
+
+static std::string read_file(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static size_t count_regular_files(const std::filesystem::path &path) {
+    size_t count = 0;
+    std::error_code ec;
+    for (std::filesystem::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+        if (it->is_regular_file(ec)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// syncs archives with extraction and checks uploaded objects and cleanup of the download folder.
+// 4.zip is broken, so it could be neither streamed nor extracted and is uploaded as is
+static void expect_extracted_sync(bool extract_streaming, std::shared_ptr<ExtractPool> extract_pool) {
+    const auto tmp_dir = std::filesystem::path(get_tmp_dir());
+    std::filesystem::remove_all(tmp_dir);
+    const auto download_path = (tmp_dir / "download").string();
+    const auto bucket_path = tmp_dir / "bucket";
+    std::filesystem::create_directories(download_path);
+    std::filesystem::create_directories(bucket_path);
+    auto torrent = seed_local_torrent(tmp_dir / "seed", { "1.zip", "3.zip", "4.zip", "2.txt" }, download_path);
+
+    auto app_state = std::make_shared<AppState>(std::get<std::shared_ptr<sqlite3>>(db_open(":memory:")), true);
+    auto s3_uploader = std::make_shared<S3Uploader>(0, std::make_shared<LocalBackend>(bucket_path), download_path, "upload");
+    auto torrent_downloader = std::make_shared<TorrentDownloader>(torrent.params);
+    AppSync app_sync(
+        app_state,
+        s3_uploader,
+        torrent_downloader,
+        LLONG_MAX,
+        download_path,
+        true,
+        false,
+        0.0,
+        false,
+        0,
+        0,
+        extract_streaming,
+        extract_pool
+    );
+    const auto sync_ret = app_sync.full_sync();
+    EXPECT_TRUE(std::holds_alternative<std::vector<file_upload_error_t>>(sync_ret));
+    EXPECT_EQ(std::get<std::vector<file_upload_error_t>>(sync_ret).size(), 0);
+
+    for (const auto &f : { "archives/1_zip/1.txt", "archives/3_zip/1.txt", "archives/3_zip/2.txt", "archives/4.zip", "archives/2.txt" }) {
+        EXPECT_TRUE(std::get<bool>(s3_uploader->is_file_existing(f))) << f;
+    }
+    // extracted archives are not uploaded
+    EXPECT_FALSE(std::get<bool>(s3_uploader->is_file_existing("archives/1.zip")));
+    EXPECT_FALSE(std::get<bool>(s3_uploader->is_file_existing("archives/3.zip")));
+    EXPECT_EQ(read_file(bucket_path / "upload" / "archives" / "3_zip" / "1.txt"), read_file(get_asset("1.txt")));
+    EXPECT_EQ(read_file(bucket_path / "upload" / "archives" / "3_zip" / "2.txt"), read_file(get_asset("2.txt")));
+
+    // downloaded archives, extracted files and their folders are deleted after upload
+    EXPECT_EQ(count_regular_files(download_path), 0);
+    EXPECT_FALSE(std::filesystem::exists(std::filesystem::path(download_path) / "archives" / "1_zip"));
+    EXPECT_FALSE(std::filesystem::exists(std::filesystem::path(download_path) / "archives" / "3_zip"));
+    EXPECT_TRUE(app_state->get_uploading_files().empty());
+    std::filesystem::remove_all(tmp_dir);
+}
+
+// files are uploaded as soon as they are extracted, archives are completed on ExtractProgressDone
+TEST(app_sync_test, extract_pipelined) {
+    expect_extracted_sync(false, std::make_shared<ExtractPool>(2));
+}
+
+// all extracted files are uploaded before ExtractProgressDone is processed, the kept folder is deleted on done
+TEST(app_sync_test, extract_done_after_uploads) {
+    const auto tmp_dir = std::filesystem::path(get_tmp_dir());
+    std::filesystem::remove_all(tmp_dir);
+    const auto download_path = (tmp_dir / "download").string();
+    const auto bucket_path = tmp_dir / "bucket";
+    std::filesystem::create_directories(std::filesystem::path(download_path) / "archives");
+    std::filesystem::create_directories(bucket_path);
+    auto torrent = seed_local_torrent(tmp_dir / "seed", { "3.zip" }, download_path);
+    // the archive is placed into the download folder by the test, nothing is downloaded
+    torrent.seeder.reset();
+    torrent.params.peers.clear();
+    std::filesystem::copy_file(get_asset("3.zip"), std::filesystem::path(download_path) / "archives" / "3.zip");
+
+    auto app_state = std::make_shared<AppState>(std::get<std::shared_ptr<sqlite3>>(db_open(":memory:")), true);
+    auto s3_uploader = std::make_shared<S3Uploader>(0, std::make_shared<LocalBackend>(bucket_path), download_path, "upload");
+    auto torrent_downloader = std::make_shared<TorrentDownloader>(torrent.params);
+    const auto extract_pool = std::make_shared<ExtractPool>(1);
+    AppSync app_sync(app_state, s3_uploader, torrent_downloader, LLONG_MAX, download_path, true, false, 0.0, false, 0, 0, false, extract_pool);
+    EXPECT_EQ(app_sync.start(), std::nullopt);
+    app_sync.process_torrent_file("archives/3.zip");
+
+    std::optional<ExtractProgressDone> extract_done;
+    size_t extracted_count = 0;
+    while (!extract_done.has_value()) {
+        const auto event = extract_pool->get_progress_queue().pop_front_waiting();
+        if (std::holds_alternative<ExtractProgressFile>(event)) {
+            const auto &extracted_file = std::get<ExtractProgressFile>(event);
+            app_sync.process_extracted_file(extracted_file.file_name, extracted_file.file);
+            extracted_count++;
+            continue;
+        }
+        extract_done = std::get<ExtractProgressDone>(event);
+    }
+    EXPECT_EQ(extracted_count, 2);
+    for (size_t i = 0; i < extracted_count; i++) {
+        const auto s3_event = s3_uploader->get_progress_queue().pop_front_waiting();
+        EXPECT_TRUE(std::holds_alternative<S3ProgressUploadOk>(s3_event));
+        app_sync.process_s3_file(std::get<S3ProgressUploadOk>(s3_event).file_name);
+    }
+    // kept while extracting
+    EXPECT_TRUE(std::filesystem::exists(std::filesystem::path(download_path) / "archives" / "3_zip"));
+    app_sync.process_extraction_done(extract_done->file_name, extract_done->result);
+
+    EXPECT_FALSE(std::filesystem::exists(std::filesystem::path(download_path) / "archives"));
+    EXPECT_TRUE(app_state->get_uploading_files().empty());
+    EXPECT_EQ(app_sync.stop().size(), 0);
+    EXPECT_TRUE(std::get<bool>(s3_uploader->is_file_existing("archives/3_zip/1.txt")));
+    EXPECT_TRUE(std::get<bool>(s3_uploader->is_file_existing("archives/3_zip/2.txt")));
+    std::filesystem::remove_all(tmp_dir);
+}
+
+TEST(app_sync_test, extract_streaming) {
+    expect_extracted_sync(true, nullptr);
+}
+
+// archive which could not be streamed is extracted by the pool
+TEST(app_sync_test, extract_streaming_fallback) {
+    expect_extracted_sync(true, std::make_shared<ExtractPool>(1));
+}
+
 TEST(app_sync_test, basic_check) {
     const auto maybe_db = db_open(":memory:");
     const auto db = std::get<std::shared_ptr<sqlite3>>(maybe_db);
@@ -15,7 +206,6 @@ TEST(app_sync_test, basic_check) {
     const auto path = std::filesystem::canonical(get_asset("starwars.torrent"));
     torrent_params.ti = std::make_shared<lt::torrent_info>(path.string());
     auto torrent_downloader = std::make_shared<TorrentDownloader>(torrent_params);
-    const auto ti = torrent_downloader->get_torrent_info();
     const auto test_file_name = torrent_params.ti->files().file_path(lt::file_index_t(276));
     for (const auto &i : torrent_params.ti->files().file_range()) {
         const auto f = torrent_params.ti->files().file_path(i);
@@ -54,7 +244,6 @@ TEST(app_sync_test, restore_state) {
     const auto path = std::filesystem::canonical(get_asset("starwars.torrent"));
     torrent_params.ti = std::make_shared<lt::torrent_info>(path.string());
     auto torrent_downloader = std::make_shared<TorrentDownloader>(torrent_params);
-    const auto ti = torrent_downloader->get_torrent_info();
     const auto file1 = torrent_params.ti->files().file_path(lt::file_index_t(276));
     const auto file2 = torrent_params.ti->files().file_path(lt::file_index_t(277));
     const auto test_file_names = std::unordered_set<std::string>({file1, file2});
@@ -1,3 +1,4 @@
+#include <fstream>
 #include <filesystem>
 #include <gtest/gtest.h>
 
@@ -18,6 +19,22 @@ TEST(archive_test, is_packed) {
     EXPECT_FALSE(is_packed(get_asset("4.zip")));
 }
 
+TEST(archive_test, is_packed_cache) {
+    const auto archive_path = std::filesystem::path(get_tmp_dir()) / "cached.zip";
+    std::filesystem::create_directories(archive_path.parent_path());
+    std::filesystem::copy_file(get_asset("1.zip"), archive_path);
+    EXPECT_TRUE(is_packed(archive_path));
+    EXPECT_TRUE(is_packed(archive_path));
+
+    // replaced file is detected again
+    std::filesystem::remove(archive_path);
+    std::filesystem::copy_file(get_asset("4.zip"), archive_path);
+    EXPECT_FALSE(is_packed(archive_path));
+    std::filesystem::remove(archive_path);
+    EXPECT_FALSE(is_packed(archive_path));
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
 TEST(archive_test, unpack_no_file) {
     const auto ret = unpack_file(get_asset("0.txt"), get_tmp_dir());
     EXPECT_TRUE(std::holds_alternative<std::string>(ret));
@@ -114,3 +131,197 @@ TEST(archive_test, zip_file) {
     std::filesystem::remove_all(get_tmp_dir());
 }
 
+
+static std::string read_range(const std::filesystem::path &file_name, unsigned long long offset, unsigned long long size) {
+    std::ifstream file(file_name, std::ios::binary);
+    file.seekg(offset);
+    std::string content(size, '\0');
+    file.read(content.data(), size);
+    return content;
+}
+
+TEST(archive_test, bundle_files) {
+    const auto bundle_path = std::filesystem::path(get_tmp_dir()) / "bundle.tar";
+    const auto assets_path = std::filesystem::path(SOURCE_DIR) / "test" / "assets";
+    const auto ret = bundle_files({ "1.txt", "2.txt" }, assets_path, bundle_path);
+    EXPECT_TRUE(std::holds_alternative<std::vector<bundle_entry_t>>(ret));
+    const auto entries = std::get<std::vector<bundle_entry_t>>(ret);
+    EXPECT_EQ(entries.size(), 2);
+    for (const auto &entry : entries) {
+        const auto asset_size = std::filesystem::file_size(assets_path / entry.file_name);
+        EXPECT_EQ(entry.size, asset_size);
+        EXPECT_EQ(read_range(bundle_path, entry.offset, entry.size), read_range(assets_path / entry.file_name, 0, asset_size));
+    }
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(archive_test, bundle_no_file) {
+    const auto bundle_path = std::filesystem::path(get_tmp_dir()) / "bundle.tar";
+    const auto ret = bundle_files({ "1.txt", "0.txt" }, std::filesystem::path(SOURCE_DIR) / "test" / "assets", bundle_path);
+    EXPECT_TRUE(std::holds_alternative<std::string>(ret));
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(archive_test, zip_stream) {
+    const auto filename = std::filesystem::path(SOURCE_DIR) / "test/assets/1.txt";
+    ZipStreamBuf zip_buffer(filename);
+    EXPECT_FALSE(zip_buffer.error().has_value());
+    std::istream zip_stream(&zip_buffer);
+    const std::string content((std::istreambuf_iterator<char>(zip_stream)), std::istreambuf_iterator<char>());
+    EXPECT_FALSE(zip_buffer.error().has_value());
+    EXPECT_FALSE(content.empty());
+
+    // seeking to the beginning produces the same archive again
+    zip_stream.clear();
+    zip_stream.seekg(0);
+    const std::string content_again((std::istreambuf_iterator<char>(zip_stream)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(content, content_again);
+
+    const auto zip_file_path = std::filesystem::path(get_tmp_dir()) / "stream.zip";
+    std::filesystem::create_directories(zip_file_path.parent_path());
+    std::ofstream zip_file_stream(zip_file_path, std::ios::binary);
+    zip_file_stream << content;
+    zip_file_stream.close();
+    const auto ret = unpack_file(zip_file_path, std::filesystem::path(get_tmp_dir()) / "unpacked");
+    EXPECT_TRUE(std::holds_alternative<std::vector<file_unpack_info_t>>(ret));
+    const auto unpacked_path = std::filesystem::path(get_tmp_dir()) / "unpacked" / filename.filename();
+    EXPECT_EQ(read_range(unpacked_path, 0, std::filesystem::file_size(filename)), read_range(filename, 0, std::filesystem::file_size(filename)));
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(archive_test, zip_stream_unicode_name) {
+    ZipStreamBuf zip_buffer(std::filesystem::path(SOURCE_DIR) / "test/assets/Документ Microsoft Word (2).htm");
+    std::istream zip_stream(&zip_buffer);
+    const std::string content((std::istreambuf_iterator<char>(zip_stream)), std::istreambuf_iterator<char>());
+    EXPECT_FALSE(zip_buffer.error().has_value());
+    EXPECT_FALSE(content.empty());
+}
+
+TEST(archive_test, zip_stream_no_file) {
+    ZipStreamBuf zip_buffer(std::filesystem::path(SOURCE_DIR) / "test/assets/0.txt");
+    EXPECT_TRUE(zip_buffer.error().has_value());
+    std::istream zip_stream(&zip_buffer);
+    EXPECT_EQ(zip_stream.get(), std::char_traits<char>::eof());
+}
+
+TEST(archive_test, zip_file_parallel) {
+    const auto source_path = std::filesystem::path(get_tmp_dir()) / "parallel.txt";
+    std::filesystem::create_directories(source_path.parent_path());
+    std::string content;
+    for (int i = 0; content.size() < 3 * 1024 * 1024; i++) {
+        content += "line " + std::to_string(i * 7919 % 100003) + "\n";
+    }
+    std::ofstream source_stream(source_path, std::ios::binary);
+    source_stream << content;
+    source_stream.close();
+
+    const auto deflate_pool = std::make_shared<DeflatePool>(4);
+    const auto zip_file_path = std::filesystem::path(get_tmp_dir()) / "parallel.txt.zip";
+    const auto ret = zip_file(source_path, zip_file_path, deflate_pool);
+    EXPECT_FALSE(ret.has_value());
+    EXPECT_LT(std::filesystem::file_size(zip_file_path), content.size() / 2);
+
+    const auto unpack_ret = unpack_file(zip_file_path, std::filesystem::path(get_tmp_dir()) / "unpacked");
+    EXPECT_TRUE(std::holds_alternative<std::vector<file_unpack_info_t>>(unpack_ret));
+    const auto unpacked_path = std::filesystem::path(get_tmp_dir()) / "unpacked" / "parallel.txt";
+    EXPECT_EQ(std::filesystem::file_size(unpacked_path), content.size());
+    EXPECT_TRUE(read_range(unpacked_path, 0, content.size()) == content);
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(archive_test, zip_file_store) {
+    // ascii copy of the document, so that unpacking does not depend on the locale
+    const auto filename = std::filesystem::path(get_tmp_dir()) / "document.htm";
+    std::filesystem::create_directories(filename.parent_path());
+    std::filesystem::copy_file(std::filesystem::path(SOURCE_DIR) / "test/assets/Документ Microsoft Word (2).htm", filename);
+    const auto stored_path = std::filesystem::path(get_tmp_dir()) / "stored.zip";
+    const auto deflated_path = std::filesystem::path(get_tmp_dir()) / "deflated.zip";
+    EXPECT_FALSE(zip_file(filename, stored_path, nullptr, compression_choice_t { COMPRESSION_STORE, 0 }).has_value());
+    EXPECT_FALSE(zip_file(filename, deflated_path, nullptr, compression_choice_t { COMPRESSION_DEFLATE, 9 }).has_value());
+    EXPECT_GT(std::filesystem::file_size(stored_path), std::filesystem::file_size(filename));
+    EXPECT_LT(std::filesystem::file_size(deflated_path), std::filesystem::file_size(filename));
+
+    // stored entry is written with a data descriptor, content should be unchanged
+    const auto content = read_range(filename, 0, std::filesystem::file_size(filename));
+    for (const auto &zip_path : { stored_path, deflated_path }) {
+        const auto output_directory = std::filesystem::path(get_tmp_dir()) / (zip_path.stem().string() + "_unpacked");
+        const auto unpack_ret = unpack_file(zip_path, output_directory);
+        EXPECT_TRUE(std::holds_alternative<std::vector<file_unpack_info_t>>(unpack_ret));
+        const auto unpacked_path = output_directory / filename.filename();
+        EXPECT_EQ(std::filesystem::file_size(unpacked_path), content.size());
+        EXPECT_TRUE(read_range(unpacked_path, 0, content.size()) == content);
+    }
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(archive_test, list_archive_entries) {
+    const auto ret = list_archive_entries(get_asset("3.zip"));
+    EXPECT_TRUE(std::holds_alternative<std::vector<archive_entry_info_t>>(ret));
+    EXPECT_EQ(std::get<std::vector<archive_entry_info_t>>(ret).size(), 2);
+
+    const auto rar_ret = list_archive_entries(get_asset("2.rar"));
+    EXPECT_TRUE(std::holds_alternative<std::vector<archive_entry_info_t>>(rar_ret));
+    EXPECT_EQ(std::get<std::vector<archive_entry_info_t>>(rar_ret).size(), 1);
+}
+
+TEST(archive_test, list_archive_entries_fail) {
+    EXPECT_TRUE(std::holds_alternative<std::string>(list_archive_entries(get_asset("0.zip"))));
+    EXPECT_TRUE(std::holds_alternative<std::string>(list_archive_entries(get_asset("1.txt"))));
+}
+
+TEST(archive_test, archive_entry_stream) {
+    const auto unpack_ret = unpack_file(get_asset("3.zip"), get_tmp_dir());
+    EXPECT_TRUE(std::holds_alternative<std::vector<file_unpack_info_t>>(unpack_ret));
+
+    ArchiveEntryStreamBuf entry_buffer(get_asset("3.zip"));
+    std::istream entry_stream(&entry_buffer);
+    auto entries_count = 0;
+    while (true) {
+        const auto ret = entry_buffer.next_entry();
+        EXPECT_TRUE(std::holds_alternative<std::optional<archive_entry_info_t>>(ret));
+        const auto entry = std::get<std::optional<archive_entry_info_t>>(ret);
+        if (!entry.has_value()) {
+            break;
+        }
+        entries_count++;
+        // seeking to the beginning is accepted until the data is read
+        entry_stream.clear();
+        entry_stream.seekg(0);
+        EXPECT_TRUE(entry_stream.good());
+        const std::string content((std::istreambuf_iterator<char>(entry_stream)), std::istreambuf_iterator<char>());
+        EXPECT_FALSE(entry_buffer.error().has_value());
+        EXPECT_EQ(content.size(), entry->size);
+        const auto unpacked_path = std::filesystem::path(get_tmp_dir()) / std::filesystem::u8path(entry->name);
+        EXPECT_TRUE(content == read_range(unpacked_path, 0, entry->size));
+    }
+    EXPECT_EQ(entries_count, 2);
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(archive_test, archive_block_size) {
+    const auto default_block_size = get_archive_block_size();
+    set_archive_block_size(1);
+    EXPECT_EQ(get_archive_block_size(), 512);
+
+    // blocks smaller than files give the same results
+    const auto ret = unpack_file(get_asset("3.zip"), get_tmp_dir());
+    EXPECT_TRUE(std::holds_alternative<std::vector<file_unpack_info_t>>(ret));
+    EXPECT_EQ(std::get<std::vector<file_unpack_info_t>>(ret).size(), 2);
+    const auto source_path = std::filesystem::path(get_tmp_dir()) / "small_blocks.txt";
+    std::string content;
+    for (int i = 0; content.size() < 64 * 1024; i++) {
+        content += "line " + std::to_string(i) + "\n";
+    }
+    std::ofstream source_stream(source_path, std::ios::binary);
+    source_stream << content;
+    source_stream.close();
+    const auto zip_file_path = std::filesystem::path(get_tmp_dir()) / "small_blocks.zip";
+    EXPECT_FALSE(zip_file(source_path, zip_file_path).has_value());
+    const auto unpack_ret = unpack_file(zip_file_path, std::filesystem::path(get_tmp_dir()) / "unpacked");
+    EXPECT_TRUE(std::holds_alternative<std::vector<file_unpack_info_t>>(unpack_ret));
+    const auto unpacked_path = std::filesystem::path(get_tmp_dir()) / "unpacked" / "small_blocks.txt";
+    EXPECT_TRUE(read_range(unpacked_path, 0, content.size()) == content);
+
+    set_archive_block_size(default_block_size);
+    std::filesystem::remove_all(get_tmp_dir());
+}
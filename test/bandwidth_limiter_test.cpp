@@ -0,0 +1,147 @@
+#include <memory>
+#include <sstream>
+#include <gtest/gtest.h>
+
+#include "../src/bandwidth/bandwidth_limiter.hpp"
+
+// time passes only when the limiter waits
+class ManualClock : public BandwidthClock {
+public:
+    std::chrono::steady_clock::time_point now() override {
+        return start + elapsed;
+    }
+
+    void sleep_for(std::chrono::duration<double> duration) override {
+        elapsed += std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration);
+    }
+
+    std::chrono::steady_clock::duration get_elapsed() const {
+        return elapsed;
+    }
+
+private:
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration elapsed {0};
+};
+
+TEST(bandwidth_limiter_test, parse_rate) {
+    const auto schedule = std::get<BandwidthSchedule>(parse_bandwidth_schedule("10M"));
+    EXPECT_EQ(schedule.size(), 1);
+    EXPECT_EQ(schedule[0].start_minute, 0);
+    EXPECT_EQ(schedule[0].rate, 10 * 1024 * 1024);
+    EXPECT_EQ(std::get<BandwidthSchedule>(parse_bandwidth_schedule("512"))[0].rate, 512);
+    EXPECT_EQ(std::get<BandwidthSchedule>(parse_bandwidth_schedule("2k"))[0].rate, 2048);
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_bandwidth_schedule("")));
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_bandwidth_schedule("M")));
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_bandwidth_schedule("10X")));
+}
+
+TEST(bandwidth_limiter_test, parse_schedule) {
+    const auto schedule = std::get<BandwidthSchedule>(parse_bandwidth_schedule("18:00=10M,9:30=2M"));
+    EXPECT_EQ(schedule.size(), 2);
+    EXPECT_EQ(schedule[0].start_minute, 9 * 60 + 30);
+    EXPECT_EQ(schedule[0].rate, 2 * 1024 * 1024);
+    EXPECT_EQ(schedule[1].start_minute, 18 * 60);
+    // the last entry wraps around midnight
+    EXPECT_EQ(get_schedule_rate(schedule, 0), 10 * 1024 * 1024);
+    EXPECT_EQ(get_schedule_rate(schedule, 9 * 60 + 29), 10 * 1024 * 1024);
+    EXPECT_EQ(get_schedule_rate(schedule, 9 * 60 + 30), 2 * 1024 * 1024);
+    EXPECT_EQ(get_schedule_rate(schedule, 18 * 60), 10 * 1024 * 1024);
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_bandwidth_schedule("24:00=1M")));
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_bandwidth_schedule("9:5=1M")));
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_bandwidth_schedule("9:00=1M,10:00")));
+}
+
+TEST(bandwidth_limiter_test, unlimited) {
+    const auto clock = std::make_shared<ManualClock>();
+    BandwidthLimiter limiter({ BandwidthScheduleEntry { 0, 0 } }, 1.0, 0.0, clock);
+    limiter.acquire(1ULL << 40);
+    EXPECT_EQ(clock->get_elapsed(), std::chrono::steady_clock::duration::zero());
+    EXPECT_EQ(limiter.get_rate(), 0);
+    EXPECT_EQ(limiter.get_transferred(), 1ULL << 40);
+}
+
+TEST(bandwidth_limiter_test, rate_limit) {
+    // 1 MB/s with 100 ms burst
+    const auto clock = std::make_shared<ManualClock>();
+    BandwidthLimiter limiter({ BandwidthScheduleEntry { 0, 1000000 } }, 0.1, 0.0, clock);
+    // burst is available at once
+    limiter.acquire(100000);
+    EXPECT_EQ(clock->get_elapsed(), std::chrono::steady_clock::duration::zero());
+    for (int i = 0; i < 4; i++) {
+        limiter.acquire(50000);
+    }
+    // 200 KB above the burst requires 200 ms, the last acquire is allowed before its bytes are paid
+    EXPECT_GE(clock->get_elapsed(), std::chrono::milliseconds(149));
+    EXPECT_LT(clock->get_elapsed(), std::chrono::milliseconds(160));
+    EXPECT_EQ(limiter.get_transferred(), 300000);
+}
+
+TEST(bandwidth_limiter_test, torrent_rate) {
+    BandwidthLimiter unlimited({ BandwidthScheduleEntry { 0, 0 } }, 1.0, 0.1);
+    EXPECT_EQ(unlimited.get_torrent_rate(1000), 0);
+    BandwidthLimiter limiter({ BandwidthScheduleEntry { 0, 1000000 } }, 1.0, 0.1);
+    EXPECT_EQ(limiter.get_torrent_rate(0), 1000000);
+    EXPECT_EQ(limiter.get_torrent_rate(400000), 600000);
+    // reserved share is kept for the torrent
+    EXPECT_EQ(limiter.get_torrent_rate(2000000), 100000);
+}
+
+// uploads acquire as much as they can while a simulated torrent takes the rest of the limit, as the torrent task does
+TEST(bandwidth_limiter_test, combined_rate) {
+    const unsigned long long rate = 1000000;
+    const auto clock = std::make_shared<ManualClock>();
+    BandwidthLimiter limiter({ BandwidthScheduleEntry { 0, rate } }, 0.5, 0.2, clock);
+
+    auto last_update = clock->now();
+    auto last_rate_update = last_update;
+    unsigned long long last_uploaded = 0;
+    unsigned long long torrent_rate = limiter.get_torrent_rate(0);
+    double torrent_transferred = 0;
+    while (clock->get_elapsed() < std::chrono::milliseconds(2000)) {
+        // torrent alone for 0.5 s, so that unused upload bandwidth could be accumulated for a burst.
+        // Time passes while the upload waits for the limiter
+        if (clock->get_elapsed() >= std::chrono::milliseconds(500)) {
+            limiter.acquire(10000);
+        } else {
+            clock->sleep_for(std::chrono::milliseconds(20));
+        }
+        const auto now = clock->now();
+        const auto elapsed = std::chrono::duration<double>(now - last_update).count();
+        last_update = now;
+        const auto bytes = torrent_rate * elapsed;
+        torrent_transferred += bytes;
+        limiter.add_torrent_transferred((unsigned long long) bytes);
+        // limits are updated every 100 ms
+        if (now - last_rate_update >= std::chrono::milliseconds(100)) {
+            const auto uploaded = limiter.get_transferred();
+            torrent_rate = limiter.get_torrent_rate((unsigned long long) ((uploaded - last_uploaded) / std::chrono::duration<double>(now - last_rate_update).count()));
+            last_uploaded = uploaded;
+            last_rate_update = now;
+        }
+    }
+    const auto seconds = std::chrono::duration<double>(clock->get_elapsed()).count();
+
+    const auto uploaded = (double) limiter.get_transferred();
+    // uploads get at most their share, the last acquire is allowed before it is paid
+    EXPECT_LE(uploaded, rate * 0.8 * (seconds - 0.5) + 10000);
+    EXPECT_GT(uploaded, rate * 0.8 * (seconds - 0.5) - 10000);
+    // the torrent reacts to uploads with a delay of one update
+    EXPECT_LT(uploaded + torrent_transferred, rate * seconds * 1.1);
+    EXPECT_GT(torrent_transferred, rate * 0.2 * seconds);
+}
+
+TEST(bandwidth_limiter_test, throttled_stream) {
+    BandwidthLimiter limiter({ BandwidthScheduleEntry { 0, 0 } }, 1.0);
+    std::stringstream source("abcdefghij");
+    ThrottledStreamBuf buffer(source.rdbuf(), limiter);
+    std::istream stream(&buffer);
+    char data[4];
+    stream.read(data, 4);
+    EXPECT_EQ(std::string(data, 4), "abcd");
+    EXPECT_EQ(stream.get(), 'e');
+    stream.seekg(0);
+    stream.read(data, 4);
+    EXPECT_EQ(std::string(data, 4), "abcd");
+    EXPECT_EQ(limiter.get_transferred(), 14);
+}
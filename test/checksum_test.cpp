@@ -0,0 +1,59 @@
+#include <sstream>
+#include <gtest/gtest.h>
+
+#include "../src/checksum/checksum.hpp"
+
+TEST(checksum_test, single_part) {
+    EtagHash hash(4);
+    EXPECT_EQ(hash.etag(), "d41d8cd98f00b204e9800998ecf8427e");
+    hash.update("abc", 3);
+    EXPECT_EQ(hash.etag(), "900150983cd24fb0d6963f7d28e17f72");
+    // data of exactly part size is a single part
+    hash.reset();
+    hash.update("ab", 2);
+    hash.update("c", 1);
+    EXPECT_EQ(hash.etag(), "900150983cd24fb0d6963f7d28e17f72");
+}
+
+TEST(checksum_test, multipart) {
+    EtagHash hash(2);
+    hash.update("abc", 3);
+    EXPECT_EQ(hash.etag(), "d833159094d1d7ad96ffcc78414e3682-2");
+    EtagHash other_hash(4);
+    other_hash.update("abcde", 5);
+    other_hash.update("fghij", 5);
+    EXPECT_EQ(other_hash.etag(), "446feba4c1b5cc7ad93bf4d44a0e36ac-3");
+}
+
+TEST(checksum_test, stream_buffer) {
+    std::stringstream source("abcdefghij");
+    EtagStreamBuf buffer(source.rdbuf(), 4);
+    std::istream stream(&buffer);
+    char data[6];
+    stream.read(data, 6);
+    EXPECT_EQ(stream.gcount(), 6);
+    EXPECT_EQ(stream.get(), 'g');
+    stream.read(data, 6);
+    EXPECT_EQ(stream.gcount(), 3);
+    EXPECT_EQ(buffer.etag(), "446feba4c1b5cc7ad93bf4d44a0e36ac-3");
+
+    // seeking to the beginning restarts the hash
+    stream.clear();
+    stream.seekg(0);
+    EXPECT_TRUE(stream.good());
+    stream.read(data, 6);
+    stream.read(data, 6);
+    EXPECT_EQ(buffer.etag(), "446feba4c1b5cc7ad93bf4d44a0e36ac-3");
+    stream.clear();
+    stream.seekg(3);
+    EXPECT_TRUE(stream.fail());
+}
+
+TEST(checksum_test, etag_format) {
+    EXPECT_EQ(normalize_etag("\"900150983CD24FB0D6963F7D28E17F72\""), "900150983cd24fb0d6963f7d28e17f72");
+    EXPECT_TRUE(is_md5_etag("900150983cd24fb0d6963f7d28e17f72"));
+    EXPECT_TRUE(is_md5_etag("d833159094d1d7ad96ffcc78414e3682-2"));
+    EXPECT_FALSE(is_md5_etag("d833159094d1d7ad96ffcc78414e3682-"));
+    EXPECT_FALSE(is_md5_etag("not-an-md5"));
+    EXPECT_FALSE(is_md5_etag(""));
+}
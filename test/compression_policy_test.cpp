@@ -0,0 +1,79 @@
+#include <random>
+#include <fstream>
+#include <filesystem>
+#include <gtest/gtest.h>
+
+#include "./test_utils.hpp"
+
+#include "../src/compression/compression_policy.hpp"
+
+static std::filesystem::path write_file(const std::string &name, const std::string &content) {
+    const auto path = std::filesystem::path(get_tmp_dir()) / name;
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream file(path, std::ios::binary);
+    file << content;
+    return path;
+}
+
+static std::string random_content(size_t size) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::string content(size, '\0');
+    for (auto &c : content) {
+        c = (char) dist(rng);
+    }
+    return content;
+}
+
+TEST(compression_policy_test, parse_overrides) {
+    const auto ret = parse_compression_overrides("MP4=store,.log=9,txt=0");
+    const auto &overrides = std::get<compression_overrides_t>(ret);
+    EXPECT_EQ(overrides.size(), 3);
+    EXPECT_EQ(overrides.at("mp4").method, COMPRESSION_STORE);
+    EXPECT_EQ(overrides.at("log").method, COMPRESSION_DEFLATE);
+    EXPECT_EQ(overrides.at("log").level, 9);
+    EXPECT_EQ(overrides.at("txt").method, COMPRESSION_STORE);
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_compression_overrides("log")));
+    EXPECT_TRUE(std::holds_alternative<std::string>(parse_compression_overrides("log=fast")));
+}
+
+TEST(compression_policy_test, sample) {
+    CompressionPolicy policy(5, 0.95, 64 * 1024);
+    const auto random_path = write_file("random.bin", random_content(256 * 1024));
+    EXPECT_EQ(policy.choose(random_path).method, COMPRESSION_STORE);
+
+    std::string text;
+    while (text.size() < 256 * 1024) {
+        text += "compressible text line\n";
+    }
+    const auto text_path = write_file("text.bin", text);
+    const auto text_choice = policy.choose(text_path);
+    EXPECT_EQ(text_choice.method, COMPRESSION_DEFLATE);
+    EXPECT_EQ(text_choice.level, 5);
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(compression_policy_test, overrides) {
+    CompressionPolicy policy(-1, 0.95, 64 * 1024, { { "bin", compression_choice_t { COMPRESSION_DEFLATE, 9 } } });
+    // extension override skips sampling
+    const auto random_path = write_file("random.bin", random_content(1024));
+    EXPECT_EQ(policy.choose(random_path).level, 9);
+    // media files are stored by default
+    EXPECT_EQ(policy.choose(std::filesystem::path(get_tmp_dir()) / "movie.MKV").method, COMPRESSION_STORE);
+    // all files are stored with level 0
+    CompressionPolicy store_policy(0);
+    EXPECT_EQ(store_policy.choose(std::filesystem::path(get_tmp_dir()) / "text.txt").method, COMPRESSION_STORE);
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(compression_policy_test, stats) {
+    CompressionPolicy policy;
+    policy.add_stats(compression_stats_t { 1, 0, 100, 110, std::chrono::milliseconds(1) });
+    policy.add_stats(compression_stats_t { 0, 1, 100, 20, std::chrono::milliseconds(2) });
+    const auto stats = policy.get_stats();
+    EXPECT_EQ(stats.stored_files, 1);
+    EXPECT_EQ(stats.deflated_files, 1);
+    EXPECT_EQ(stats.input_size, 200);
+    EXPECT_EQ(stats.output_size, 130);
+    EXPECT_EQ(stats.compression_time, std::chrono::milliseconds(3));
+}
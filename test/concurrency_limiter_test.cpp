@@ -0,0 +1,66 @@
+#include <atomic>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "../src/concurrency/concurrency_limiter.hpp"
+
+TEST(concurrency_limiter_test, bounds) {
+    ConcurrencyLimiter limiter(2, 8, 100, std::chrono::milliseconds(0));
+    EXPECT_EQ(limiter.get_limit(), 8);
+    ConcurrencyLimiter limiter_low(2, 8, 0, std::chrono::milliseconds(0));
+    EXPECT_EQ(limiter_low.get_limit(), 2);
+    // max is never lower than min
+    ConcurrencyLimiter limiter_fixed(4, 1, 4, std::chrono::milliseconds(0));
+    EXPECT_EQ(limiter_fixed.get_limit(), 4);
+}
+
+TEST(concurrency_limiter_test, additive_increase) {
+    ConcurrencyLimiter limiter(1, 4, 1, std::chrono::milliseconds(0));
+    EXPECT_EQ(limiter.get_limit(), 1);
+    limiter.on_success(std::chrono::milliseconds(10));
+    EXPECT_EQ(limiter.get_limit(), 2);
+    // limit grows by about one per limit successes
+    limiter.on_success(std::chrono::milliseconds(10));
+    EXPECT_EQ(limiter.get_limit(), 2);
+    limiter.on_success(std::chrono::milliseconds(10));
+    limiter.on_success(std::chrono::milliseconds(10));
+    EXPECT_EQ(limiter.get_limit(), 3);
+    for (int i = 0; i < 100; i++) {
+        limiter.on_success(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(limiter.get_limit(), 4);
+}
+
+TEST(concurrency_limiter_test, multiplicative_decrease) {
+    ConcurrencyLimiter limiter(1, 16, 16, std::chrono::milliseconds(100));
+    limiter.on_throttle();
+    EXPECT_EQ(limiter.get_limit(), 8);
+    // burst of failures within cooldown decreases only once
+    limiter.on_throttle();
+    limiter.on_success(std::chrono::milliseconds(1000));
+    EXPECT_EQ(limiter.get_limit(), 8);
+}
+
+TEST(concurrency_limiter_test, latency_decrease) {
+    ConcurrencyLimiter limiter(2, 16, 16, std::chrono::milliseconds(100));
+    limiter.on_success(std::chrono::milliseconds(1000));
+    EXPECT_EQ(limiter.get_limit(), 8);
+}
+
+TEST(concurrency_limiter_test, acquire_release) {
+    ConcurrencyLimiter limiter(1, 1, 1, std::chrono::milliseconds(0));
+    limiter.acquire();
+    EXPECT_EQ(limiter.get_running(), 1);
+    std::atomic<bool> acquired = false;
+    std::thread task([&]() {
+        limiter.acquire();
+        acquired = true;
+        limiter.release();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_FALSE(acquired);
+    limiter.release();
+    task.join();
+    EXPECT_TRUE(acquired);
+    EXPECT_EQ(limiter.get_running(), 0);
+}
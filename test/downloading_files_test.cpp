@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <gtest/gtest.h>
 
 #include "./test_utils.hpp"
@@ -6,14 +7,14 @@
 
 TEST(downloading_files_test, unlimited_size) {
     const auto torrent_file = get_asset("test.torrent");
-    lt::torrent_info ti(torrent_file);
+    const auto metadata = std::make_shared<const TorrentMetadata>(std::make_shared<const lt::torrent_info>(torrent_file));
     std::vector<std::string> new_files;
-    for (const auto &file_index: ti.files().file_range()) {
-        const auto file_name = ti.files().file_path(file_index);
+    for (unsigned int file_index = 0; file_index < metadata->num_files(); file_index++) {
+        const auto file_name = metadata->file_path(file_index);
         new_files.push_back(file_name);
     }
     EXPECT_EQ(new_files.size(), 3);
-    DownloadingFiles downloading_files(ti, new_files, LLONG_MAX);
+    DownloadingFiles downloading_files(metadata, new_files, LLONG_MAX);
     EXPECT_FALSE(downloading_files.is_completed());
     auto files_to_download = downloading_files.download_next_chunk();
     EXPECT_EQ(files_to_download.size(), 3);
@@ -34,15 +35,15 @@ TEST(downloading_files_test, unlimited_size) {
 
 TEST(downloading_files_test, one_file_size) {
     const auto torrent_file = get_asset("test.torrent");
-    lt::torrent_info ti(torrent_file);
+    const auto metadata = std::make_shared<const TorrentMetadata>(std::make_shared<const lt::torrent_info>(torrent_file));
     std::vector<std::string> new_files;
-    for (const auto &file_index: ti.files().file_range()) {
-        const auto file_name = ti.files().file_path(file_index);
+    for (unsigned int file_index = 0; file_index < metadata->num_files(); file_index++) {
+        const auto file_name = metadata->file_path(file_index);
         new_files.push_back(file_name);
     }
     EXPECT_EQ(new_files.size(), 3);
     // limit to 100 bytes - should result to one file in downloads at a time
-    DownloadingFiles downloading_files(ti, new_files, 100);
+    DownloadingFiles downloading_files(metadata, new_files, 100);
     EXPECT_FALSE(downloading_files.is_completed());
     auto files_to_download = downloading_files.download_next_chunk();
     EXPECT_EQ(files_to_download.size(), 1);
@@ -62,20 +63,20 @@ TEST(downloading_files_test, one_file_size) {
 
 TEST(downloading_files_test, two_file_size) {
     const auto torrent_file = get_asset("test.torrent");
-    lt::torrent_info ti(torrent_file);
+    const auto metadata = std::make_shared<const TorrentMetadata>(std::make_shared<const lt::torrent_info>(torrent_file));
     std::vector<std::string> new_files;
     unsigned long max_size = 0;
-    for (const auto &file_index: ti.files().file_range()) {
-        const auto file_name = ti.files().file_path(file_index);
+    for (unsigned int file_index = 0; file_index < metadata->num_files(); file_index++) {
+        const auto file_name = metadata->file_path(file_index);
         new_files.push_back(file_name);
-        const auto file_size = ti.files().file_size(file_index);
+        const auto file_size = metadata->file_size(file_index);
         if (file_size > max_size) {
             max_size = file_size;
         }
     }
     EXPECT_EQ(new_files.size(), 3);
     // limit to largest file bytes - should result to largest file downloaded first
-    DownloadingFiles downloading_files(ti, new_files, max_size + 1);
+    DownloadingFiles downloading_files(metadata, new_files, max_size + 1);
     EXPECT_FALSE(downloading_files.is_completed());
     auto files_to_download = downloading_files.download_next_chunk();
     EXPECT_EQ(files_to_download.size(), 1);
@@ -91,3 +92,56 @@ TEST(downloading_files_test, two_file_size) {
     files_to_download = downloading_files.download_next_chunk();
     EXPECT_EQ(files_to_download.size(), 0);
 }
+
+TEST(downloading_files_test, prefetch) {
+    const auto torrent_file = get_asset("test.torrent");
+    const auto metadata = std::make_shared<const TorrentMetadata>(std::make_shared<const lt::torrent_info>(torrent_file));
+    std::vector<std::string> new_files;
+    for (unsigned int file_index = 0; file_index < metadata->num_files(); file_index++) {
+        const auto file_name = metadata->file_path(file_index);
+        new_files.push_back(file_name);
+    }
+    EXPECT_EQ(new_files.size(), 3);
+    // limit to 100 bytes - should result to one file in downloads at a time
+    DownloadingFiles downloading_files(metadata, new_files, 100);
+    auto files_to_download = downloading_files.download_next_chunk();
+    EXPECT_EQ(files_to_download.size(), 1);
+    // no headroom - nothing to prefetch
+    auto files_to_prefetch = downloading_files.prefetch_next_chunk(0);
+    EXPECT_EQ(files_to_prefetch.size(), 0);
+    // unlimited headroom - prefetch all files that are not downloading yet
+    files_to_prefetch = downloading_files.prefetch_next_chunk(LLONG_MAX);
+    EXPECT_EQ(files_to_prefetch.size(), 2);
+    EXPECT_EQ(std::count(files_to_prefetch.begin(), files_to_prefetch.end(), files_to_download[0]), 0);
+    // already prefetching
+    EXPECT_EQ(downloading_files.prefetch_next_chunk(LLONG_MAX).size(), 0);
+    // prefetched files are still selected for download
+    downloading_files.complete_file(files_to_download[0]);
+    files_to_download = downloading_files.download_next_chunk();
+    EXPECT_EQ(files_to_download.size(), 1);
+    EXPECT_EQ(std::count(files_to_prefetch.begin(), files_to_prefetch.end(), files_to_download[0]), 1);
+    downloading_files.complete_file(files_to_download[0]);
+    files_to_download = downloading_files.download_next_chunk();
+    EXPECT_EQ(files_to_download.size(), 1);
+    EXPECT_EQ(std::count(files_to_prefetch.begin(), files_to_prefetch.end(), files_to_download[0]), 1);
+    downloading_files.complete_file(files_to_download[0]);
+    EXPECT_TRUE(downloading_files.is_completed());
+}
+
+TEST(downloading_files_test, file_size_tree) {
+    FileSizeTree tree({ 50, 10, 30, 0, 20 });
+    EXPECT_EQ(tree.size(), 5);
+    EXPECT_EQ(tree.find_first(0, 100), 0);
+    EXPECT_EQ(tree.find_first(0, 25), 1);
+    EXPECT_EQ(tree.find_first(2, 25), 3);
+    EXPECT_EQ(tree.find_first(4, 15), 5);
+    tree.remove(1);
+    tree.remove(3);
+    EXPECT_EQ(tree.find_first(0, 25), 4);
+    EXPECT_EQ(tree.find_first(0, 5), 5);
+    tree.remove(0);
+    tree.remove(2);
+    tree.remove(4);
+    // removed files never fit
+    EXPECT_EQ(tree.find_first(0, ULLONG_MAX), 5);
+}
@@ -0,0 +1,46 @@
+#include <map>
+#include <set>
+#include <filesystem>
+#include <gtest/gtest.h>
+
+#include "./test_utils.hpp"
+
+#include "../src/extract/extract_pool.hpp"
+
+TEST(extract_pool_test, extract) {
+    ExtractPool pool(2);
+    EXPECT_EQ(pool.get_thread_count(), 2);
+    const auto output_directory = std::filesystem::path(get_tmp_dir());
+    pool.extract("1.zip", get_asset("1.zip"), output_directory / "1_zip");
+    pool.extract("3.zip", get_asset("3.zip"), output_directory / "3_zip");
+    pool.extract("0.zip", get_asset("0.zip"), output_directory / "0_zip");
+
+    // key - archive name, value - number of reported files
+    std::map<std::string, size_t> extracted_files;
+    std::set<std::string> completed;
+    while (completed.size() < 3) {
+        const auto event = pool.get_progress_queue().pop_front_waiting();
+        if (std::holds_alternative<ExtractProgressFile>(event)) {
+            const auto &extracted = std::get<ExtractProgressFile>(event);
+            // file is reported before its archive is done
+            EXPECT_EQ(completed.count(extracted.file_name), 0);
+            EXPECT_FALSE(extracted.file.error_message.has_value());
+            EXPECT_TRUE(std::filesystem::exists(extracted.file.name));
+            extracted_files[extracted.file_name]++;
+            continue;
+        }
+        const auto &done = std::get<ExtractProgressDone>(event);
+        completed.insert(done.file_name);
+        if (done.file_name == "0.zip") {
+            EXPECT_TRUE(std::holds_alternative<std::string>(done.result));
+            continue;
+        }
+        EXPECT_TRUE(std::holds_alternative<std::vector<file_unpack_info_t>>(done.result));
+        EXPECT_EQ(std::get<std::vector<file_unpack_info_t>>(done.result).size(), extracted_files[done.file_name]);
+    }
+    EXPECT_EQ(extracted_files["1.zip"], 1);
+    EXPECT_EQ(extracted_files["3.zip"], 2);
+    EXPECT_EQ(extracted_files.count("0.zip"), 0);
+    EXPECT_TRUE(pool.get_progress_queue().empty());
+    std::filesystem::remove_all(get_tmp_dir());
+}
@@ -57,3 +57,54 @@ TEST(linked_files_test, remove_children) {
     EXPECT_EQ(files.get_parent("child1"), std::nullopt);
     EXPECT_EQ(files.get_parent("child2"), std::nullopt);
 }
+
+TEST(linked_files_test, link_child) {
+    LinkedFiles files;
+    EXPECT_TRUE(files.add_child("folder", "folder/file1"));
+    EXPECT_TRUE(files.add_child("folder", "folder/file2"));
+    // already linked
+    EXPECT_FALSE(files.add_child("folder", "folder/file1"));
+    EXPECT_FALSE(files.add_child("other", "folder/file1"));
+    EXPECT_EQ(files.get_parent("folder/file1"), "folder");
+    EXPECT_EQ(files.child_count("folder"), 2);
+    EXPECT_EQ(files.child_count("other"), 0);
+    EXPECT_FALSE(files.is_parent("other"));
+    files.remove_child("folder/file1");
+    EXPECT_EQ(files.child_count("folder"), 1);
+    EXPECT_TRUE(files.is_parent("folder"));
+    files.remove_child("folder/file2");
+    EXPECT_FALSE(files.is_parent("folder"));
+    EXPECT_FALSE(files.has_children("folder"));
+    EXPECT_EQ(files.get_files().size(), 0);
+}
+
+TEST(linked_files_test, nested_folders) {
+    LinkedFiles files;
+    files.add_child("a/b", "a/b/file");
+    files.add_child("a", "a/b");
+    files.add_child("a", "a/file");
+    EXPECT_EQ(files.get_parent("a/b"), "a");
+    EXPECT_EQ(files.child_count("a"), 2);
+    EXPECT_EQ(files.get_files().size(), 2);
+    // folder stays linked to its parent when its children are removed
+    files.remove_child("a/b/file");
+    EXPECT_FALSE(files.is_parent("a/b"));
+    EXPECT_EQ(files.get_parent("a/b"), "a");
+    files.remove_parent("a");
+    EXPECT_EQ(files.get_parent("a/b"), std::nullopt);
+    EXPECT_EQ(files.get_parent("a/file"), std::nullopt);
+    EXPECT_EQ(files.get_files().size(), 0);
+    // removed paths are added again
+    files.add_files("a", {"a/b"});
+    EXPECT_EQ(files.get_parent("a/b"), "a");
+    EXPECT_EQ(files.get_files().at("a").size(), 1);
+}
+
+TEST(linked_files_test, move_child) {
+    LinkedFiles files;
+    files.add_files("parent1", {"child"});
+    files.add_files("parent2", {"child"});
+    EXPECT_EQ(files.get_parent("child"), "parent2");
+    EXPECT_FALSE(files.is_parent("parent1"));
+    EXPECT_EQ(files.child_count("parent2"), 1);
+}
@@ -0,0 +1,102 @@
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <gtest/gtest.h>
+
+#include "./test_utils.hpp"
+
+#include "../src/metrics/metrics.hpp"
+
+static bool has_line(const std::string &text, const std::string &line) {
+    std::istringstream stream(text);
+    std::string l;
+    while (std::getline(stream, l)) {
+        if (l == line) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(metrics_test, format) {
+    Metrics metrics;
+    metrics.add("test_bytes_total", 100);
+    metrics.add("test_bytes_total", 50);
+    metrics.set("test_queue_size", 3);
+    metrics.set("test_queue_size", 2);
+    metrics.observe("test_duration_seconds", 0.003);
+    metrics.observe("test_duration_seconds", 0.2);
+    metrics.observe("test_duration_seconds", 1000);
+
+    const auto text = metrics.format();
+    EXPECT_TRUE(has_line(text, "# TYPE test_bytes_total counter"));
+    EXPECT_TRUE(has_line(text, "test_bytes_total 150"));
+    EXPECT_TRUE(has_line(text, "# TYPE test_bytes_per_second gauge"));
+    EXPECT_TRUE(has_line(text, "test_queue_size 2"));
+    EXPECT_TRUE(has_line(text, "# TYPE test_duration_seconds histogram"));
+    // buckets are cumulative
+    EXPECT_TRUE(has_line(text, "test_duration_seconds_bucket{le=\"0.001\"} 0"));
+    EXPECT_TRUE(has_line(text, "test_duration_seconds_bucket{le=\"0.005\"} 1"));
+    EXPECT_TRUE(has_line(text, "test_duration_seconds_bucket{le=\"0.25\"} 2"));
+    EXPECT_TRUE(has_line(text, "test_duration_seconds_bucket{le=\"120\"} 2"));
+    EXPECT_TRUE(has_line(text, "test_duration_seconds_bucket{le=\"+Inf\"} 3"));
+    EXPECT_TRUE(has_line(text, "test_duration_seconds_count 3"));
+
+    // rate is measured since the previous call
+    const auto next_text = metrics.format();
+    EXPECT_TRUE(has_line(next_text, "test_bytes_total 150"));
+    EXPECT_TRUE(has_line(next_text, "test_bytes_per_second 0"));
+}
+
+TEST(metrics_test, write) {
+    const auto file_path = std::filesystem::path(get_tmp_dir()) / "metrics.prom";
+    std::filesystem::create_directories(file_path.parent_path());
+    Metrics metrics(file_path, 50);
+    metrics.add("test_files_total");
+    metrics.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    EXPECT_TRUE(std::filesystem::exists(file_path));
+    metrics.add("test_files_total");
+    // final values are written on stop
+    metrics.stop();
+    std::ifstream file(file_path);
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(has_line(text, "test_files_total 2"));
+    EXPECT_FALSE(std::filesystem::exists(file_path.string() + ".tmp"));
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(metrics_test, sampler) {
+    const auto file_path = std::filesystem::path(get_tmp_dir()) / "metrics.prom";
+    std::filesystem::create_directories(file_path.parent_path());
+    Metrics metrics(file_path, 50);
+    const auto thread_id = std::this_thread::get_id();
+    std::atomic<int> samples = 0;
+    std::atomic<int> background_samples = 0;
+    metrics.add_sampler([&](Metrics &m) {
+        if (std::this_thread::get_id() != thread_id) {
+            background_samples++;
+        }
+        m.set("test_sample", ++samples);
+    });
+    // not sampled until written by the background task
+    EXPECT_FALSE(has_line(metrics.format(), "test_sample 1"));
+    metrics.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // final values are sampled on stop
+    metrics.stop();
+    EXPECT_GT(background_samples, 0);
+    EXPECT_EQ(samples, background_samples + 1);
+    std::ifstream file(file_path);
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(has_line(text, "test_sample " + std::to_string(samples)));
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(metrics_test, write_fail) {
+    Metrics metrics;
+    EXPECT_TRUE(metrics.write().has_value());
+    Metrics missing_folder_metrics(std::filesystem::path(get_tmp_dir()) / "missing" / "metrics.prom");
+    EXPECT_TRUE(missing_folder_metrics.write().has_value());
+}
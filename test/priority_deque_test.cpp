@@ -0,0 +1,41 @@
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "../src/deque/priority_deque.hpp"
+
+TEST(priority_deque_test, priority_order) {
+    ThreadSafePriorityDeque<int> deque(std::chrono::milliseconds(60000));
+    deque.push_back(1, 10);
+    deque.push_back(2, -5);
+    deque.push_back(3, 10);
+    deque.push_back(4, 0);
+    EXPECT_EQ(deque.size(), 4);
+    EXPECT_EQ(deque.pop_front_waiting(), 2);
+    EXPECT_EQ(deque.pop_front_waiting(), 4);
+    // same priority keeps arrival order
+    EXPECT_EQ(deque.pop_front_waiting(), 1);
+    EXPECT_EQ(deque.pop_front_waiting(), 3);
+    EXPECT_TRUE(deque.empty());
+}
+
+TEST(priority_deque_test, starvation) {
+    ThreadSafePriorityDeque<int> deque(std::chrono::milliseconds(50));
+    deque.push_back(1, 100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    deque.push_back(2, 0);
+    deque.push_back(3, 0);
+    // low priority item waited too long
+    EXPECT_EQ(deque.pop_front_waiting(), 1);
+    EXPECT_EQ(deque.pop_front_waiting(), 2);
+    EXPECT_EQ(deque.pop_front_waiting(), 3);
+}
+
+TEST(priority_deque_test, waiting) {
+    ThreadSafePriorityDeque<int> deque(std::chrono::milliseconds(60000));
+    std::thread producer([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        deque.push_back(7);
+    });
+    EXPECT_EQ(deque.pop_front_waiting(), 7);
+    producer.join();
+}
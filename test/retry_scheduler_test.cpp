@@ -0,0 +1,60 @@
+#include <climits>
+#include <gtest/gtest.h>
+
+#include "../src/deque/deque.hpp"
+#include "../src/retry/retry_scheduler.hpp"
+
+TEST(retry_scheduler_test, jittered_delay) {
+    for (unsigned int attempt = 0; attempt < 10; attempt++) {
+        const auto delay = jittered_delay(attempt, std::chrono::milliseconds(100), std::chrono::milliseconds(1000));
+        EXPECT_TRUE(delay.count() >= 0);
+        EXPECT_TRUE(delay.count() <= 1000);
+    }
+    // server provided delay is a lower bound
+    const auto delay = jittered_delay(0, std::chrono::milliseconds(100), std::chrono::milliseconds(1000), std::chrono::milliseconds(5000));
+    EXPECT_EQ(delay.count(), 5000);
+}
+
+TEST(retry_scheduler_test, jittered_delay_cap) {
+    // the cap of each call is used, not the one of the first call on the thread
+    for (int i = 0; i < 100; i++) {
+        EXPECT_LE(jittered_delay(10, std::chrono::milliseconds(100), std::chrono::milliseconds(1000)).count(), 1000);
+        EXPECT_LE(jittered_delay(10, std::chrono::milliseconds(100), std::chrono::milliseconds(10)).count(), 10);
+    }
+    // zero initial delay stays zero, large attempts do not overflow
+    EXPECT_EQ(jittered_delay(UINT_MAX, std::chrono::milliseconds(0), std::chrono::milliseconds(1000)).count(), 0);
+    EXPECT_LE(jittered_delay(UINT_MAX, std::chrono::milliseconds(100), std::chrono::milliseconds(1000)).count(), 1000);
+}
+
+TEST(retry_scheduler_test, not_before) {
+    ThreadSafeDeque<int> ready_queue;
+    RetryScheduler<int> scheduler([&](const int &i) {
+        ready_queue.push_back(i);
+    });
+    scheduler.start();
+    const auto now = RetryScheduler<int>::clock::now();
+    scheduler.schedule(2, now + std::chrono::milliseconds(200));
+    scheduler.schedule(1, now + std::chrono::milliseconds(100));
+    scheduler.schedule(0, now);
+    EXPECT_EQ(ready_queue.pop_front_waiting(), 0);
+    EXPECT_EQ(ready_queue.pop_front_waiting(), 1);
+    EXPECT_TRUE(RetryScheduler<int>::clock::now() >= now + std::chrono::milliseconds(100));
+    EXPECT_EQ(ready_queue.pop_front_waiting(), 2);
+    EXPECT_TRUE(RetryScheduler<int>::clock::now() >= now + std::chrono::milliseconds(200));
+    EXPECT_EQ(scheduler.size(), 0);
+    scheduler.stop();
+}
+
+TEST(retry_scheduler_test, stop_releases_items) {
+    ThreadSafeDeque<int> ready_queue;
+    RetryScheduler<int> scheduler([&](const int &i) {
+        ready_queue.push_back(i);
+    });
+    scheduler.start();
+    scheduler.schedule(1, RetryScheduler<int>::clock::now() + std::chrono::hours(1));
+    EXPECT_EQ(scheduler.size(), 1);
+    scheduler.stop();
+    EXPECT_EQ(scheduler.size(), 0);
+    EXPECT_FALSE(ready_queue.empty());
+    EXPECT_EQ(ready_queue.pop_front_waiting(), 1);
+}
@@ -1,3 +1,5 @@
+#include <atomic>
+#include <sstream>
 #include <filesystem>
 #include <gtest/gtest.h>
 #ifdef _WIN32
@@ -7,6 +9,7 @@
 #include "./test_utils.hpp"
 
 #include "../src/s3/s3.hpp"
+#include "../src/s3/local_backend.hpp"
 
 TEST(s3_test, start_stop) {
     S3Uploader uploader(1, "http://play.min.io", "Q3AM3UQ867SPQQA43P2F", "zuf+tfteSlswRu7BJ86wekitnifILbZam1KYY3TG", "test", "", "./", "");
@@ -90,3 +93,228 @@ TEST(s3_test, unicode_name) {
     const auto &download_ok = std::get<S3ProgressUploadOk>(s3_event);
     EXPECT_EQ(download_ok.file_name, unicode_file);
 }
+
+TEST(s3_test, list_files) {
+    const auto path_from = std::filesystem::path(SOURCE_DIR) / std::filesystem::path("test/assets");
+    const auto filename = "1.txt";
+    S3Uploader uploader(1, "http://play.min.io", "Q3AM3UQ867SPQQA43P2F", "zuf+tfteSlswRu7BJ86wekitnifILbZam1KYY3TG", "test", "", path_from, "list");
+    auto &progress_queue = uploader.get_progress_queue();
+    const auto ret = uploader.start();
+    EXPECT_FALSE(ret.has_value());
+    uploader.new_file(filename);
+    uploader.stop();
+    const auto s3_event = progress_queue.pop_front_waiting();
+    EXPECT_TRUE(std::holds_alternative<S3ProgressUploadOk>(s3_event));
+
+    const auto list_ret = uploader.list_files();
+    EXPECT_FALSE(std::holds_alternative<std::string>(list_ret));
+    const auto &files = std::get<std::unordered_map<std::string, unsigned long long>>(list_ret);
+    const auto file_iter = files.find(filename);
+    EXPECT_NE(file_iter, files.end());
+    EXPECT_EQ(file_iter->second, std::filesystem::file_size(path_from / filename));
+}
+
+static std::shared_ptr<LocalBackend> make_local_backend(const std::string &bucket, const LocalBackendOptions &options = LocalBackendOptions {}) {
+    const auto root = std::filesystem::path(get_tmp_dir()) / "s3" / bucket;
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    return std::make_shared<LocalBackend>(root, options);
+}
+
+// copies assets to a temporary folder, so that tests which write next to uploaded files do not touch the source tree
+static std::filesystem::path copy_assets(const std::string &folder, const std::vector<std::string> &assets) {
+    const auto path = std::filesystem::path(get_tmp_dir()) / "s3_assets" / folder;
+    std::filesystem::remove_all(path);
+    std::filesystem::create_directories(path);
+    for (const auto &asset : assets) {
+        std::filesystem::copy_file(get_asset(asset), path / asset);
+    }
+    return path;
+}
+
+TEST(s3_test, local_backend_upload) {
+    const auto path_from = std::filesystem::path(SOURCE_DIR) / std::filesystem::path("test/assets");
+    const auto backend = make_local_backend("upload");
+    S3Uploader uploader(4, backend, path_from, "upload");
+    auto &progress_queue = uploader.get_progress_queue();
+    const auto ret = uploader.start();
+    EXPECT_FALSE(ret.has_value());
+    uploader.new_file("1.txt");
+    uploader.new_file("2.txt");
+    uploader.stop();
+    for (int i = 0; i < 2; i++) {
+        const auto s3_event = progress_queue.pop_front_waiting();
+        EXPECT_TRUE(std::holds_alternative<S3ProgressUploadOk>(s3_event));
+    }
+    EXPECT_TRUE(std::get<bool>(uploader.is_file_existing("1.txt")));
+    EXPECT_TRUE(std::get<bool>(uploader.is_file_existing("2.txt")));
+    EXPECT_FALSE(std::get<bool>(uploader.is_file_existing("3.txt")));
+
+    const auto list_ret = uploader.list_files();
+    const auto &files = std::get<std::unordered_map<std::string, unsigned long long>>(list_ret);
+    EXPECT_EQ(files.size(), 2);
+    EXPECT_EQ(files.at("1.txt"), std::filesystem::file_size(path_from / "1.txt"));
+
+    EXPECT_EQ(uploader.delete_file("1.txt"), std::nullopt);
+    EXPECT_FALSE(std::get<bool>(uploader.is_file_existing("1.txt")));
+}
+
+TEST(s3_test, local_backend_list_root) {
+    const auto path_from = std::filesystem::path(SOURCE_DIR) / std::filesystem::path("test/assets");
+    const auto backend = make_local_backend("list_root");
+    for (const auto &path_to : { ".", "./" }) {
+        S3Uploader uploader(1, backend, path_from, path_to);
+        auto &progress_queue = uploader.get_progress_queue();
+        EXPECT_FALSE(uploader.start().has_value());
+        uploader.new_file("1.txt");
+        uploader.stop();
+        EXPECT_TRUE(std::holds_alternative<S3ProgressUploadOk>(progress_queue.pop_front_waiting()));
+
+        // objects in the bucket root are listed with their names
+        const auto list_ret = uploader.list_files();
+        ASSERT_TRUE((std::holds_alternative<std::unordered_map<std::string, unsigned long long>>(list_ret)));
+        const auto &files = std::get<std::unordered_map<std::string, unsigned long long>>(list_ret);
+        EXPECT_EQ(files.size(), 1);
+        EXPECT_EQ(files.count("1.txt"), 1);
+    }
+}
+
+TEST(s3_test, local_backend_missing_bucket) {
+    const auto backend = std::make_shared<LocalBackend>(std::filesystem::path(get_tmp_dir()) / "s3" / "nonexisting");
+    S3Uploader uploader(1, backend, "./", "");
+    const auto ret = uploader.start();
+    EXPECT_TRUE(ret.has_value());
+}
+
+TEST(s3_test, local_backend_throttling) {
+    LocalBackendOptions options;
+    options.throttle_rate = 1.0;
+    const auto backend = make_local_backend("throttling", options);
+    std::stringstream stream("content");
+    const auto ret = backend->put_object("file.txt", stream, 7, 1024);
+    const auto &error = std::get<S3Error>(ret);
+    EXPECT_TRUE(error.retryable);
+    EXPECT_EQ(backend->get_throttled_count(), 1);
+
+    options.throttle_rate = 0.0;
+    options.bandwidth = 70;
+    const auto slow_backend = make_local_backend("bandwidth", options);
+    const auto start = std::chrono::steady_clock::now();
+    stream.clear();
+    stream.seekg(0);
+    const auto slow_ret = slow_backend->put_object("file.txt", stream, 7, 1024);
+    EXPECT_EQ(std::get<std::string>(slow_ret), "9a0364b9e99bb480dd25e1f0284c8555");
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+}
+
+// returns a wrong ETag for the next uploads, as if the data was corrupted on the way
+class CorruptingBackend : public LocalBackend {
+public:
+    explicit CorruptingBackend(const std::filesystem::path &root_) : LocalBackend(root_), corrupted_count {0} {}
+
+    std::variant<std::string, S3Error> put_object(const std::string &object, std::istream &stream, unsigned long long content_size, size_t part_size) override {
+        const auto ret = LocalBackend::put_object(object, stream, content_size, part_size);
+        if (std::holds_alternative<std::string>(ret) && corrupted_count > 0) {
+            corrupted_count--;
+            return std::string("00000000000000000000000000000000");
+        }
+        return ret;
+    }
+
+    void corrupt_next(unsigned int count) {
+        corrupted_count = count;
+    }
+
+private:
+    std::atomic<unsigned int> corrupted_count;
+};
+
+TEST(s3_test, local_backend_checksum_mismatch) {
+    const auto path_from = std::filesystem::path(SOURCE_DIR) / std::filesystem::path("test/assets");
+    const auto root = std::filesystem::path(get_tmp_dir()) / "s3" / "checksum_mismatch";
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    const auto backend = std::make_shared<CorruptingBackend>(root);
+    S3Uploader uploader(8, backend, path_from, "upload", 1);
+    const auto initial_concurrency = uploader.get_concurrency();
+    auto &progress_queue = uploader.get_progress_queue();
+    EXPECT_FALSE(uploader.start().has_value());
+    backend->corrupt_next(1);
+    uploader.new_file("1.txt");
+    uploader.stop();
+    // corrupted upload is retried
+    EXPECT_TRUE(std::holds_alternative<S3ProgressUploadOk>(progress_queue.pop_front_waiting()));
+    EXPECT_TRUE(std::get<bool>(uploader.is_file_existing("1.txt")));
+    // checksum mismatch is not throttling, concurrency is not decreased
+    EXPECT_GE(uploader.get_concurrency(), initial_concurrency);
+    std::filesystem::remove_all(root);
+}
+
+TEST(s3_test, local_backend_bundle) {
+    const auto path_from = copy_assets("bundle", {"1.txt", "2.txt"});
+    const auto backend = make_local_backend("bundle");
+    S3Uploader uploader(4, backend, path_from, "upload");
+    auto &progress_queue = uploader.get_progress_queue();
+    const auto ret = uploader.start();
+    EXPECT_FALSE(ret.has_value());
+    uploader.new_bundle("bundles/1.tar", {"1.txt", "2.txt"});
+    uploader.stop();
+    for (int i = 0; i < 2; i++) {
+        const auto s3_event = progress_queue.pop_front_waiting();
+        const auto &uploaded = std::get<S3ProgressUploadOk>(s3_event);
+        EXPECT_TRUE(uploaded.bundle_entry.has_value());
+        EXPECT_EQ(uploaded.bundle_entry->bundle_name, "bundles/1.tar");
+        EXPECT_EQ(uploaded.bundle_entry->size, std::filesystem::file_size(path_from / uploaded.file_name));
+    }
+    EXPECT_TRUE(std::get<bool>(uploader.is_file_existing("bundles/1.tar")));
+    EXPECT_FALSE(std::get<bool>(uploader.is_file_existing("1.txt")));
+    // temporary bundle is removed after upload
+    for (const auto &entry: std::filesystem::directory_iterator(path_from)) {
+        EXPECT_NE(entry.path().extension(), ".tar");
+    }
+    std::filesystem::remove_all(path_from);
+}
+
+TEST(s3_test, local_backend_archive) {
+    const auto path_from = copy_assets("archive", {"1.txt"});
+    const auto backend = make_local_backend("archive");
+    S3Uploader uploader(1, backend, path_from, "upload");
+    auto &progress_queue = uploader.get_progress_queue();
+    const auto ret = uploader.start();
+    EXPECT_FALSE(ret.has_value());
+    uploader.new_file("1.txt", true);
+    uploader.stop();
+    const auto s3_event = progress_queue.pop_front_waiting();
+    EXPECT_TRUE(std::holds_alternative<S3ProgressUploadOk>(s3_event));
+    EXPECT_TRUE(std::get<bool>(uploader.is_file_existing("1.txt.zip")));
+    EXPECT_FALSE(std::get<bool>(uploader.is_file_existing("1.txt")));
+    // archive is streamed without a temporary file
+    for (const auto &entry: std::filesystem::directory_iterator(path_from)) {
+        EXPECT_EQ(entry.path().filename().string().find("1.txt.zip"), std::string::npos);
+    }
+    std::filesystem::remove_all(path_from);
+}
+
+TEST(s3_test, local_backend_extract_streaming) {
+    const auto path_from = copy_assets("extract_streaming", {"3.zip"});
+    const auto backend = make_local_backend("extract_streaming");
+    S3Uploader uploader(1, backend, path_from, "upload");
+    auto &progress_queue = uploader.get_progress_queue();
+    const auto ret = uploader.start();
+    EXPECT_FALSE(ret.has_value());
+    uploader.new_archive("3.zip", "3_zip", {"1.txt", "2.txt", "0.txt"});
+    uploader.stop();
+    for (const auto &name : {"1.txt", "2.txt"}) {
+        const auto s3_event = progress_queue.pop_front_waiting();
+        EXPECT_EQ(std::get<S3ProgressUploadOk>(s3_event).file_name, (std::filesystem::path("3_zip") / name).string());
+    }
+    // file which is not in the archive is reported as an error
+    const auto s3_event = progress_queue.pop_front_waiting();
+    EXPECT_EQ(std::get<S3ProgressUploadError>(s3_event).file_name, (std::filesystem::path("3_zip") / "0.txt").string());
+    EXPECT_TRUE(progress_queue.empty());
+    EXPECT_TRUE(std::get<bool>(uploader.is_file_existing("3_zip/1.txt")));
+    EXPECT_TRUE(std::get<bool>(uploader.is_file_existing("3_zip/2.txt")));
+    // files are not extracted to disk
+    EXPECT_FALSE(std::filesystem::exists(path_from / "3_zip"));
+    std::filesystem::remove_all(path_from);
+}
@@ -0,0 +1,123 @@
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <gtest/gtest.h>
+
+#include "../src/synthetic_torrent/synthetic_torrent.hpp"
+#include "../src/hashlist/hashlist.hpp"
+#include "../src/downloading_files/downloading_files.hpp"
+#include "../src/linked_files/linked_files.hpp"
+#include "../src/app_state/state.hpp"
+#include "../src/db/sqlite.hpp"
+
+// operations on SCALING_FACTOR times more files should take about SCALING_FACTOR times longer.
+// Quadratic paths take SCALING_FACTOR^2 times longer, so the limit leaves room for noise and N log N
+#define SCALING_FILES 5000
+#define SCALING_FACTOR 8
+#define SCALING_RATIO_MAX (SCALING_FACTOR * 3)
+// shorter runs are compared as if they took this long, so that timer noise does not fail the test
+#define SCALING_TIME_MIN_SECONDS 0.002
+#define SCALING_RUNS 3
+
+static std::shared_ptr<const TorrentMetadata> make_torrent(unsigned long long file_count) {
+    synthetic_torrent_options_t options;
+    options.file_count = file_count;
+    options.depth = 2;
+    options.fanout = 32;
+    options.max_file_size = 1024 * 1024;
+    options.piece_size = 64 * 1024;
+    return std::make_shared<const TorrentMetadata>(std::get<std::shared_ptr<lt::torrent_info>>(create_synthetic_torrent(options)));
+}
+
+static std::vector<std::string> get_file_names(const TorrentMetadata &torrent) {
+    std::vector<std::string> file_names;
+    for (unsigned int file_index = 0; file_index < torrent.num_files(); file_index++) {
+        file_names.push_back(torrent.file_path(file_index));
+    }
+    return file_names;
+}
+
+// best of several runs
+static double measure(const std::function<void()> &fn) {
+    auto best = std::numeric_limits<double>::max();
+    for (int i = 0; i < SCALING_RUNS; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return std::max(best, SCALING_TIME_MIN_SECONDS);
+}
+
+// runs fn on a small and a large torrent and checks that time grows near-linearly
+static void expect_linear(const std::function<void(const std::shared_ptr<const TorrentMetadata> &)> &fn) {
+    const auto small_torrent = make_torrent(SCALING_FILES);
+    const auto large_torrent = make_torrent(SCALING_FILES * SCALING_FACTOR);
+    const auto small_time = measure([&]() {
+        fn(small_torrent);
+    });
+    const auto large_time = measure([&]() {
+        fn(large_torrent);
+    });
+    EXPECT_LT(large_time / small_time, SCALING_RATIO_MAX) << small_time << " s for " << SCALING_FILES << " files, "
+            << large_time << " s for " << SCALING_FILES * SCALING_FACTOR << " files";
+}
+
+TEST(scaling_test, hashlist) {
+    expect_linear([](const std::shared_ptr<const TorrentMetadata> &torrent) {
+        const auto hashlist = create_hashlist(*torrent, {});
+        EXPECT_EQ(get_updated_files(*torrent, hashlist).size(), 0);
+    });
+}
+
+// files are completed one by one and the next chunk is requested after each of them, as AppSync does
+TEST(scaling_test, downloading_files) {
+    expect_linear([](const std::shared_ptr<const TorrentMetadata> &torrent) {
+        DownloadingFiles downloading_files(torrent, get_file_names(*torrent), torrent->total_size() / 16);
+        std::deque<std::string> downloading;
+        auto chunk = downloading_files.download_next_chunk();
+        downloading.insert(downloading.end(), chunk.begin(), chunk.end());
+        downloading_files.prefetch_next_chunk(torrent->total_size() / 16);
+        while (!downloading.empty()) {
+            downloading_files.complete_file(downloading.front());
+            downloading.pop_front();
+            chunk = downloading_files.download_next_chunk();
+            downloading.insert(downloading.end(), chunk.begin(), chunk.end());
+            downloading_files.prefetch_next_chunk(torrent->total_size() / 16);
+            EXPECT_EQ(downloading_files.is_completed(), downloading.empty());
+        }
+    });
+}
+
+TEST(scaling_test, linked_files) {
+    expect_linear([](const std::shared_ptr<const TorrentMetadata> &torrent) {
+        LinkedFiles folders;
+        const auto file_names = get_file_names(*torrent);
+        for (const auto &f : file_names) {
+            const auto child = std::filesystem::path(f);
+            folders.add_files(child.parent_path().string(), {child.string()});
+        }
+        for (const auto &f : file_names) {
+            const auto parent = folders.get_parent(f).value();
+            folders.remove_child(f);
+            if (!folders.has_children(parent)) {
+                folders.remove_parent(parent);
+            }
+        }
+        EXPECT_TRUE(folders.get_files().empty());
+    });
+}
+
+TEST(scaling_test, app_state) {
+    expect_linear([](const std::shared_ptr<const TorrentMetadata> &torrent) {
+        const auto db = std::get<std::shared_ptr<sqlite3>>(db_open(":memory:"));
+        AppState state(db, true);
+        for (const auto &f : get_file_names(*torrent)) {
+            state.add_uploading_files(f, {});
+            EXPECT_EQ(state.get_uploading_files().size(), 1);
+            state.file_complete(f);
+        }
+        state.save_hashlist(create_hashlist(*torrent, state.get_completed_files()));
+        EXPECT_EQ(state.get_hashlist().size(), torrent->num_files());
+    });
+}
@@ -0,0 +1,71 @@
+#include <climits>
+#include <filesystem>
+#include <gtest/gtest.h>
+
+#include "../src/synthetic_torrent/synthetic_torrent.hpp"
+#include "../src/hashlist/hashlist.hpp"
+
+TEST(synthetic_torrent_test, layout) {
+    synthetic_torrent_options_t options;
+    options.file_count = 100;
+    options.depth = 2;
+    options.fanout = 4;
+    options.size_distribution = FILE_SIZE_FIXED;
+    options.max_file_size = 1000;
+    options.piece_size = 16 * 1024;
+    const auto maybe_torrent = create_synthetic_torrent(options);
+    ASSERT_TRUE(std::holds_alternative<std::shared_ptr<lt::torrent_info>>(maybe_torrent));
+    const auto torrent = std::get<std::shared_ptr<lt::torrent_info>>(maybe_torrent);
+    EXPECT_EQ(torrent->num_files(), 100);
+    EXPECT_EQ(torrent->total_size(), 100000);
+    EXPECT_EQ(torrent->piece_length(), 16 * 1024);
+    const auto &files = torrent->files();
+    EXPECT_EQ(std::filesystem::path(files.file_path(lt::file_index_t(0))), std::filesystem::path("synthetic/dir_0/dir_0/file_0.bin"));
+    // 4 files in a folder, 4 folders in a parent folder
+    EXPECT_EQ(std::filesystem::path(files.file_path(lt::file_index_t(99))), std::filesystem::path("synthetic/dir_6/dir_24/file_99.bin"));
+    EXPECT_EQ(TorrentMetadata(torrent).get_file_hashes(99).size(), 1);
+}
+
+TEST(synthetic_torrent_test, size_distribution) {
+    synthetic_torrent_options_t options;
+    options.file_count = 1000;
+    options.min_file_size = 100;
+    options.max_file_size = 1000000;
+    for (const auto distribution : { FILE_SIZE_UNIFORM, FILE_SIZE_LOG_UNIFORM }) {
+        options.size_distribution = distribution;
+        const auto torrent = std::get<std::shared_ptr<lt::torrent_info>>(create_synthetic_torrent(options));
+        std::int64_t min_size = LLONG_MAX;
+        std::int64_t max_size = 0;
+        for (const auto &file_index : torrent->files().file_range()) {
+            min_size = std::min(min_size, torrent->files().file_size(file_index));
+            max_size = std::max(max_size, torrent->files().file_size(file_index));
+        }
+        EXPECT_GE(min_size, 100);
+        EXPECT_LE(max_size, 1000000);
+        EXPECT_LT(min_size, max_size);
+    }
+}
+
+TEST(synthetic_torrent_test, seed) {
+    synthetic_torrent_options_t options;
+    options.file_count = 10;
+    const auto torrent1 = std::get<std::vector<char>>(generate_synthetic_torrent(options));
+    const auto torrent2 = std::get<std::vector<char>>(generate_synthetic_torrent(options));
+    EXPECT_EQ(torrent1, torrent2);
+    options.seed = 1;
+    const auto torrent3 = std::get<std::vector<char>>(generate_synthetic_torrent(options));
+    EXPECT_NE(torrent1, torrent3);
+}
+
+TEST(synthetic_torrent_test, invalid_options) {
+    synthetic_torrent_options_t options;
+    options.file_count = 0;
+    EXPECT_TRUE(std::holds_alternative<std::string>(create_synthetic_torrent(options)));
+    options = synthetic_torrent_options_t();
+    options.min_file_size = 2000;
+    options.max_file_size = 1000;
+    EXPECT_TRUE(std::holds_alternative<std::string>(create_synthetic_torrent(options)));
+    options = synthetic_torrent_options_t();
+    options.piece_size = 20000;
+    EXPECT_TRUE(std::holds_alternative<std::string>(create_synthetic_torrent(options)));
+}
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include "./test_utils.hpp"
+
+#include "../src/torrent_metadata/torrent_metadata.hpp"
+#include "../src/torrent/torrent_download.hpp"
+
+TEST(torrent_metadata_test, file_table) {
+    const auto torrent = std::make_shared<const lt::torrent_info>(get_asset("starwars.torrent"));
+    const TorrentMetadata metadata(torrent);
+    const auto &fs = torrent->files();
+    EXPECT_EQ(metadata.num_files(), torrent->num_files());
+    EXPECT_EQ(metadata.total_size(), torrent->total_size());
+    EXPECT_EQ(metadata.get_torrent_info(), torrent);
+    for (const auto &file_index : fs.file_range()) {
+        const auto i = (unsigned int) (int) file_index;
+        EXPECT_EQ(metadata.file_path(i), fs.file_path(file_index));
+        EXPECT_EQ(metadata.file_size(i), fs.file_size(file_index));
+        EXPECT_EQ(metadata.file_offset(i), fs.file_offset(file_index));
+        EXPECT_EQ(metadata.find_file(fs.file_path(file_index)), i);
+        const auto range = metadata.piece_range(i);
+        const auto hashes = metadata.get_file_hashes(i);
+        EXPECT_EQ(hashes.size(), (int) range.second - (int) range.first);
+        if (fs.file_size(file_index) == 0) {
+            continue;
+        }
+        // first and last byte of the file are in the range
+        EXPECT_EQ(range.first, fs.map_file(file_index, 0, 1).piece);
+        EXPECT_EQ(range.second, lt::piece_index_t((int) fs.map_file(file_index, fs.file_size(file_index) - 1, 1).piece + 1));
+        const auto first_hash = torrent->hash_for_piece(range.first);
+        EXPECT_EQ(hashes[0], std::string(first_hash.data(), first_hash.size()));
+    }
+}
+
+TEST(torrent_metadata_test, find_file) {
+    const TorrentMetadata metadata(std::make_shared<const lt::torrent_info>(get_asset("test.torrent")));
+    EXPECT_EQ(metadata.find_file(metadata.file_path(2)), 2);
+    EXPECT_FALSE(metadata.find_file("doesnotexist").has_value());
+    EXPECT_FALSE(metadata.find_file("").has_value());
+}
+
+TEST(torrent_metadata_test, shared_by_downloader) {
+    lt::add_torrent_params torrent_params;
+    torrent_params.save_path = get_tmp_dir();
+    torrent_params.ti = std::make_shared<lt::torrent_info>(get_asset("test.torrent"));
+    TorrentDownloader downloader(torrent_params);
+    // the same object is returned each time, torrent_info is not copied
+    EXPECT_EQ(downloader.get_metadata(), downloader.get_metadata());
+    EXPECT_EQ(downloader.get_metadata()->get_torrent_info(), torrent_params.ti);
+}
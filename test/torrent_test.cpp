@@ -1,4 +1,5 @@
 #include <filesystem>
+#include <unordered_set>
 #include <gtest/gtest.h>
 
 #include "./test_utils.hpp"
@@ -152,3 +153,30 @@ TEST(torrent_test, unicode_files) {
     EXPECT_TRUE(std::filesystem::exists(std::filesystem::u8path(filename.string())));
     std::filesystem::remove_all(get_tmp_dir());
 }
+
+// Files are downloaded one at a time with the top priority. Make sure all requested files are still delivered.
+TEST(torrent_test, download_files_focus_window) {
+    const auto torrent_file = get_asset("test.torrent");
+    lt::add_torrent_params torrent_params;
+    torrent_params.save_path = get_tmp_dir();
+    torrent_params.ti = std::make_shared<lt::torrent_info>(torrent_file);
+    EXPECT_EQ(torrent_params.ti->num_files(), 3);
+    const auto to_download_first = torrent_params.ti->files().file_path(lt::file_index_t {1});
+    const auto to_download_second = torrent_params.ti->files().file_path(lt::file_index_t {2});
+    TorrentDownloader downloader(torrent_params, 1);
+    auto &progress_queue = downloader.get_progress_queue();
+    EXPECT_TRUE(progress_queue.empty());
+    downloader.start();
+    downloader.download_files({to_download_first, to_download_second});
+    downloader.stop();
+    std::unordered_set<std::string> downloaded_files;
+    while (!progress_queue.empty()) {
+        const auto torrent_event = progress_queue.pop_front_waiting();
+        const auto &download_ok = std::get<TorrentProgressDownloadOk>(torrent_event);
+        downloaded_files.insert(download_ok.file_name);
+    }
+    EXPECT_EQ(downloaded_files.size(), 2);
+    EXPECT_EQ(downloaded_files.count(to_download_first), 1);
+    EXPECT_EQ(downloaded_files.count(to_download_second), 1);
+    std::filesystem::remove_all(get_tmp_dir());
+}
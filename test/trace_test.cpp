@@ -0,0 +1,105 @@
+#include <thread>
+#include <future>
+#include <fstream>
+#include <filesystem>
+#include <gtest/gtest.h>
+
+#include "./test_utils.hpp"
+
+#include "../src/trace/trace.hpp"
+
+static std::string read_file(const std::filesystem::path &path) {
+    std::ifstream file(path);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+TEST(trace_test, spans) {
+    const auto trace_path = std::filesystem::path(get_tmp_dir()) / "trace.json";
+    std::filesystem::create_directories(trace_path.parent_path());
+    {
+        // not recorded before start
+        TraceSpan span("disabled span", "test");
+    }
+    EXPECT_FALSE(is_tracing());
+    trace_start(trace_path);
+    EXPECT_TRUE(is_tracing());
+    std::thread worker([]() {
+        trace_thread_name("Test worker");
+        TraceSpan span("worker span", "test", "dir/\"quoted\".txt", 2);
+    });
+    worker.join();
+    const auto start = std::chrono::steady_clock::now();
+    trace_event("cross thread event", "test", start, start + std::chrono::milliseconds(5), "file.txt");
+    trace_stop();
+    EXPECT_FALSE(is_tracing());
+    {
+        TraceSpan span("stopped span", "test");
+    }
+
+    const auto trace = read_file(trace_path);
+    EXPECT_EQ(trace.find("{\"traceEvents\":["), 0);
+    EXPECT_NE(trace.find("\"args\":{\"name\":\"Test worker\"}"), std::string::npos);
+    // events of finished threads are kept
+    EXPECT_NE(trace.find("\"name\":\"worker span\",\"cat\":\"test\",\"ph\":\"X\""), std::string::npos);
+    EXPECT_NE(trace.find("\"args\":{\"file\":\"dir/\\\"quoted\\\".txt\",\"attempt\":2}"), std::string::npos);
+    EXPECT_NE(trace.find("\"dur\":5000,\"args\":{\"file\":\"file.txt\"}"), std::string::npos);
+    EXPECT_EQ(trace.find("disabled span"), std::string::npos);
+    EXPECT_EQ(trace.find("stopped span"), std::string::npos);
+
+    const auto totals = get_trace_totals();
+    EXPECT_EQ(totals.at("worker span").count, 1);
+    EXPECT_EQ(totals.at("cross thread event").count, 1);
+    EXPECT_NEAR(totals.at("cross thread event").seconds, 0.005, 0.0001);
+    EXPECT_EQ(totals.count("stopped span"), 0);
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(trace_test, thread_name_before_start) {
+    const auto trace_path = std::filesystem::path(get_tmp_dir()) / "trace.json";
+    std::filesystem::create_directories(trace_path.parent_path());
+    // pool workers are created before the trace starts and keep running
+    std::promise<void> is_named;
+    std::promise<void> is_started;
+    std::thread worker([&]() {
+        trace_thread_name("Early worker");
+        is_named.set_value();
+        is_started.get_future().wait();
+    });
+    is_named.get_future().wait();
+    trace_start(trace_path);
+    is_started.set_value();
+    worker.join();
+    trace_stop();
+
+    const auto trace = read_file(trace_path);
+    EXPECT_NE(trace.find("\"args\":{\"name\":\"Early worker\"}"), std::string::npos);
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(trace_test, restart) {
+    const auto trace_path = std::filesystem::path(get_tmp_dir()) / "trace.json";
+    std::filesystem::create_directories(trace_path.parent_path());
+    trace_start(trace_path);
+    std::thread worker([]() {
+        TraceSpan span("first trace span", "test");
+    });
+    worker.join();
+    trace_stop();
+    EXPECT_EQ(get_trace_totals().at("first trace span").count, 1);
+
+    // records of the previous trace, including ones of finished threads, are not written again
+    trace_start(trace_path);
+    {
+        TraceSpan span("second trace span", "test");
+    }
+    trace_stop();
+    const auto trace = read_file(trace_path);
+    EXPECT_EQ(trace.find("first trace span"), std::string::npos);
+    EXPECT_NE(trace.find("second trace span"), std::string::npos);
+    EXPECT_EQ(get_trace_totals().count("first trace span"), 0);
+    std::filesystem::remove_all(get_tmp_dir());
+}
+
+TEST(trace_test, write_fail) {
+    EXPECT_TRUE(trace_write(std::filesystem::path(get_tmp_dir()) / "missing" / "trace.json").has_value());
+}
@@ -0,0 +1,35 @@
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "../src/worker_pool/worker_pool.hpp"
+
+TEST(worker_pool_test, thread_count) {
+    WorkerPool pool(0, "Test worker");
+    EXPECT_EQ(pool.get_thread_count(), 1);
+}
+
+TEST(worker_pool_test, finishes_submitted_jobs) {
+    std::atomic<int> done = 0;
+    std::mutex mutex;
+    std::set<std::thread::id> thread_ids;
+    {
+        WorkerPool pool(4, "Test worker");
+        EXPECT_EQ(pool.get_thread_count(), 4);
+        for (auto i = 0; i < 100; i++) {
+            pool.submit([&]() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    thread_ids.insert(std::this_thread::get_id());
+                }
+                done++;
+            });
+        }
+    }
+    // destructor waits for all submitted jobs
+    EXPECT_EQ(done, 100);
+    EXPECT_LE(thread_ids.size(), 4);
+    EXPECT_EQ(thread_ids.count(std::this_thread::get_id()), 0);
+}